@@ -1,9 +1,11 @@
 #include "agency.h"
 
+#include "base/base.h"
 #include "base/util.h"
 
 #include <boost/algorithm/string.hpp>
 
+#include <cstring>
 #include <fstream>
 namespace tgnews {
 
@@ -25,6 +27,37 @@ void TAgencyRating::Load(const std::string& filePath, bool setMinAsUnk) {
     }
 }
 
+std::string TAgencyRating::Serialize() const {
+    // Unknown rating, then rating, host size and host of every record.
+    std::string data(reinterpret_cast<const char*>(&UnkRating), sizeof(UnkRating));
+    for (const auto& [host, rating] : Records) {
+        const uint32_t size = host.size();
+        data.append(reinterpret_cast<const char*>(&rating), sizeof(rating));
+        data.append(reinterpret_cast<const char*>(&size), sizeof(size));
+        data += host;
+    }
+    return data;
+}
+
+void TAgencyRating::Deserialize(std::string_view data) {
+    auto read = [&data](void* value, size_t size) {
+        VERIFY(data.size() >= size, "truncated agency ratings");
+        std::memcpy(value, data.data(), size);
+        data.remove_prefix(size);
+    };
+    Records.clear();
+    read(&UnkRating, sizeof(UnkRating));
+    while (!data.empty()) {
+        double rating;
+        uint32_t size;
+        read(&rating, sizeof(rating));
+        read(&size, sizeof(size));
+        VERIFY(data.size() >= size, "truncated agency ratings");
+        Records.emplace(data.substr(0, size), rating);
+        data.remove_prefix(size);
+    }
+}
+
 double TAgencyRating::ScoreUrl(const std::string& url) const {
     const auto iter = Records.find(GetHost(url));
     return (iter != Records.end()) ? iter->second : UnkRating;
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <unordered_map>
 namespace tgnews {
 
@@ -12,6 +13,10 @@ public:
     }
 
     void Load(const std::string& fileName, bool setMinAsUnk = false);
+    // Ratings as binary records for the model bundle, read back without
+    // parsing numbers.
+    std::string Serialize() const;
+    void Deserialize(std::string_view data);
     double ScoreUrl(const std::string& url) const;
 
 private:
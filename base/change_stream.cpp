@@ -0,0 +1,84 @@
+#include "base/change_stream.h"
+
+#include <algorithm>
+
+#include "base/base.h"
+
+namespace tgnews {
+
+ChangeStream::ChangeStream(size_t capacity) : capacity_(capacity) {
+  VERIFY(capacity_ > 0, "change stream capacity must be positive");
+}
+
+uint64_t ChangeStream::Append(ParsedDoc::EState state,
+                              std::string filename) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  uint64_t sequence = first_sequence_ + events_.size();
+  events_.push_back({state, std::move(filename), sequence});
+  if (events_.size() > capacity_) {
+    events_.pop_front();
+    first_sequence_++;
+  }
+  return sequence;
+}
+
+uint64_t ChangeStream::NextSequence() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return first_sequence_ + events_.size();
+}
+
+ChangeStream::Batch ChangeStream::ReadFrom(uint64_t from,
+                                           size_t max_count) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return ReadLocked(from, max_count);
+}
+
+ChangeStream::CursorId ChangeStream::OpenCursor(std::string name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  cursors_.push_back({std::move(name), first_sequence_});
+  return cursors_.size() - 1;
+}
+
+ChangeStream::Batch ChangeStream::Read(CursorId cursor,
+                                       size_t max_count) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  VERIFY(cursor < cursors_.size(), "unknown change stream cursor");
+  return ReadLocked(cursors_[cursor].position, max_count);
+}
+
+void ChangeStream::Commit(CursorId cursor, uint64_t position) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  VERIFY(cursor < cursors_.size(), "unknown change stream cursor");
+  VERIFY(position <= first_sequence_ + events_.size(),
+         "commit past the end of the change stream");
+  cursors_[cursor].position = position;
+}
+
+std::vector<ChangeStream::CursorInfo> ChangeStream::GetCursors() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto end = first_sequence_ + events_.size();
+  auto cursors = cursors_;
+  for (auto& cursor : cursors) {
+    cursor.lag = end - std::min(cursor.position, end);
+  }
+  return cursors;
+}
+
+ChangeStream::Batch ChangeStream::ReadLocked(uint64_t from,
+                                             size_t max_count) const {
+  Batch batch;
+  auto end = first_sequence_ + events_.size();
+  if (from < first_sequence_) {
+    batch.lost = true;
+    batch.next = end;
+    return batch;
+  }
+  from = std::min(from, end);
+  auto count = std::min<uint64_t>(end - from, max_count);
+  auto begin = events_.begin() + (from - first_sequence_);
+  batch.changes.assign(begin, begin + count);
+  batch.next = from + count;
+  return batch;
+}
+
+}  // namespace tgnews
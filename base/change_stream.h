@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "base/parsed_document.h"
+
+namespace tgnews {
+
+// A document was added, changed or removed.
+struct ChangeEvent {
+  ParsedDoc::EState State = ParsedDoc::EState::Added;
+  std::string FileName;
+  uint64_t Sequence = 0;
+};
+
+// Ordered stream of document changes read by any number of consumers.
+//
+// Every change gets the next sequence number, starting from 1. Events keep
+// the document name only, so the stream never holds on to removed or
+// replaced documents: readers look up what the names point to now with
+// FileManager::GetChanges. Only the last `capacity` events are kept: a reader
+// asking for older ones is told it lost them and has to start over from a
+// snapshot of the documents taken after NextSequence().
+//
+// Reading never consumes anything. A consumer keeps its position in a
+// cursor and commits it once the batch is processed, so a batch which failed
+// is read again. Thread safe.
+class ChangeStream {
+ public:
+  static constexpr size_t kDefaultCapacity = 1 << 16;
+
+  using CursorId = size_t;
+
+  struct Batch {
+    std::vector<ChangeEvent> changes;
+    // Position to commit once the changes are processed. For a lost batch
+    // it is where to go on after a snapshot taken since the read.
+    uint64_t next = 0;
+    // Changes from the requested position were dropped already.
+    bool lost = false;
+  };
+
+  struct CursorInfo {
+    std::string name;
+    uint64_t position = 0;
+    // Events between the position and the end of the stream.
+    uint64_t lag = 0;
+  };
+
+  explicit ChangeStream(size_t capacity = kDefaultCapacity);
+
+  // Returns the sequence number of the change.
+  uint64_t Append(ParsedDoc::EState state, std::string filename);
+
+  // Number of events kept.
+  size_t Capacity() const { return capacity_; }
+
+  // Sequence number the next change will get.
+  uint64_t NextSequence() const;
+
+  // Changes starting from sequence `from`, at most `max_count` of them.
+  Batch ReadFrom(uint64_t from,
+                 size_t max_count = std::numeric_limits<size_t>::max()) const;
+
+  // A new cursor sees every change kept in the stream.
+  CursorId OpenCursor(std::string name);
+
+  Batch Read(CursorId cursor,
+             size_t max_count = std::numeric_limits<size_t>::max()) const;
+
+  // Moves the cursor to `position`, normally Batch::next.
+  void Commit(CursorId cursor, uint64_t position);
+
+  std::vector<CursorInfo> GetCursors() const;
+
+ private:
+  Batch ReadLocked(uint64_t from, size_t max_count) const;
+
+ private:
+  const size_t capacity_;
+  mutable std::mutex mutex_;
+  // Sequence number of events_.front().
+  uint64_t first_sequence_ = 1;
+  std::deque<ChangeEvent> events_;
+  std::vector<CursorInfo> cursors_;
+};
+
+}  // namespace tgnews
@@ -1,9 +1,23 @@
 #include "base/context.h"
+#include "base/base.h"
+#include "base/embedding_cache.h"
+#include "base/fasttext_classifier.h"
+#include "base/lang_detector.h"
+#include "base/model_bundle.h"
+#include "base/parsed_document.h"
+#include "base/word_vectors.h"
 
+#include "fmt/format.h"
 #include "glog/logging.h"
 
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <chrono>
+#include <istream>
+#include <streambuf>
 
 namespace {
 
@@ -51,37 +65,229 @@ void LoadBiasFromFile(Eigen::VectorXf& vec, std::string file) {
 
 namespace tgnews {
 
+namespace {
+
+constexpr const char* LangModelFile = "lang_detect.ftz";
+constexpr const char* RuCatModelFile = "ru_cat_v2.ftz";
+constexpr const char* EnCatModelFile = "en_cat_v2.ftz";
+constexpr const char* RatingsFile = "pagerank_rating.txt";
+const std::vector<std::string> EmbedderDirs = {"ru_sentence_embedder", "en_sentence_embedder"};
+constexpr int EmbedderColumns = 50;
+
+// fastText models saved by the version we build with, which reads them from
+// any stream. Older ones need the checks of loadModel(path).
+constexpr int32_t FastTextMagic = 793712314;
+constexpr int32_t FastTextVersion = 12;
+
+// Reads a bundle section in place.
+class SectionBuf : public std::streambuf {
+ public:
+  explicit SectionBuf(std::string_view data) {
+    char* begin = const_cast<char*>(data.data());
+    setg(begin, begin, begin + data.size());
+  }
+};
+
+bool IsSupportedFastText(std::string_view data) {
+  int32_t header[2] = {0, 0};
+  std::memcpy(header, data.data(), std::min(sizeof(header), data.size()));
+  return header[0] == FastTextMagic && header[1] == FastTextVersion;
+}
+
+std::unique_ptr<fasttext::FastText> LoadFastText(std::string_view data) {
+  VERIFY(IsSupportedFastText(data),
+         "bundled model is not a fastText model of the supported version");
+  // loadModel(std::istream&) starts after the header.
+  SectionBuf buffer(data.substr(2 * sizeof(int32_t)));
+  std::istream in(&buffer);
+  auto model = std::make_unique<fasttext::FastText>();
+  model->loadModel(in);
+  return model;
+}
+
+std::unique_ptr<QuantizedClassifier> LoadHead(std::string_view data) {
+  SectionBuf buffer(data);
+  std::istream in(&buffer);
+  return QuantizedClassifier::Load(in);
+}
+
+std::string ReadFile(const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  VERIFY(in.is_open(), "unable to read " + path);
+  return std::string(std::istreambuf_iterator<char>(in), {});
+}
+
+constexpr const char* SourcesSection = "sources";
+
+// Size and mtime of every file the bundle is packed from, a line each.
+// Compared for equality: a copy that keeps the mtimes (cp -p, rsync -t)
+// of other models changes them as well.
+std::string DescribeSources(const std::string& modelPath) {
+  std::vector<std::string> sources = {LangModelFile, RuCatModelFile, EnCatModelFile, RatingsFile};
+  for (const auto& dir : EmbedderDirs) {
+    sources.push_back(dir + "/matrix.txt");
+    sources.push_back(dir + "/bias.txt");
+  }
+  std::string description;
+  for (const auto& source : sources) {
+    boost::filesystem::path path(modelPath + "/" + source);
+    if (boost::filesystem::exists(path)) {
+      description += fmt::format("{} {} {}\n", source, boost::filesystem::file_size(path),
+                                 boost::filesystem::last_write_time(path));
+    } else {
+      description += fmt::format("{} missing\n", source);
+    }
+  }
+  return description;
+}
+
+// The bundle is only used while the models it was packed from are the ones
+// it recorded. Null otherwise.
+std::unique_ptr<ModelBundle> OpenFreshBundle(const std::string& modelPath) {
+  boost::filesystem::path path(modelPath + "/" + Context::BundleFileName);
+  if (!boost::filesystem::exists(path)) {
+    return nullptr;
+  }
+  LOG(INFO) << "mapping model bundle " << path.string();
+  auto bundle = std::make_unique<ModelBundle>(path.string());
+  if (!bundle->Has(SourcesSection) || bundle->Get(SourcesSection) != DescribeSources(modelPath)) {
+    LOG(WARNING) << "model bundle was packed from other models, reading the models";
+    return nullptr;
+  }
+  return bundle;
+}
+
+}
+
 Context::Context(const std::string modelPath, std::unique_ptr<FileCache> fileCache)
   : fileCache(std::move(fileCache))
   , Tokenizer(onmt::Tokenizer::Mode::Conservative, onmt::Tokenizer::Flags::CaseFeature)
-  , Ratings(modelPath + "/pagerank_rating.txt")
+  , Embeddings(std::make_unique<EmbeddingCache>())
 {
   LOG(INFO) << "Context loading";
   std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+  if (auto bundle = OpenFreshBundle(modelPath)) {
+    LoadBundle(std::move(bundle));
+  } else {
+    LoadFiles(modelPath);
+  }
+  LangDetector = std::make_unique<CascadeLangDetector>(LangClassifier.get());
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+  LOG(INFO) << "Time difference loading models = " << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count() << "[milli]";
+}
+
+Context::~Context() = default;
+
+void Context::LoadFiles(const std::string& modelPath) {
   LangDetect = std::make_unique<fasttext::FastText>();
-  LangDetect->loadModel(modelPath + "/lang_detect.ftz");
-  RuCatModel = std::make_unique<fasttext::FastText>();
-  RuCatModel->loadModel(modelPath + "/ru_cat_v2.ftz");
-  EnCatModel = std::make_unique<fasttext::FastText>();
-  EnCatModel->loadModel(modelPath + "/en_cat_v2.ftz");
-  RuVecModel = std::make_unique<fasttext::FastText>();
-  RuVecModel->loadModel(modelPath + "/ru_vectors_v2.bin");
-  EnVecModel = std::make_unique<fasttext::FastText>();
-  EnVecModel->loadModel(modelPath + "/en_vectors_v2.bin");
-
-  RuMatrix = Eigen::MatrixXf(RuVecModel->getDimension() * 3, 50); 
+  LangDetect->loadModel(modelPath + "/" + LangModelFile);
+  // The categorization models are read once for fastText and for the int8
+  // head. The head parses the bytes again, skipping the dictionary, which
+  // takes a few milliseconds per model.
+  auto loadCatModel = [&modelPath](const char* file, std::unique_ptr<QuantizedClassifier>& head) {
+    const std::string path = modelPath + "/" + file;
+    const std::string data = ReadFile(path);
+    head = LoadHead(data);
+    if (IsSupportedFastText(data)) {
+      return LoadFastText(data);
+    }
+    auto model = std::make_unique<fasttext::FastText>();
+    model->loadModel(path);
+    return model;
+  };
+  std::unique_ptr<QuantizedClassifier> ruHead;
+  std::unique_ptr<QuantizedClassifier> enHead;
+  RuCatModel = loadCatModel(RuCatModelFile, ruHead);
+  EnCatModel = loadCatModel(EnCatModelFile, enHead);
+  MakeClassifiers(std::move(ruHead), std::move(enHead));
+  RuWords = std::make_unique<WordVectors>(RuCatModel.get());
+  EnWords = std::make_unique<WordVectors>(EnCatModel.get());
+
+  // The embedder pools word vectors of the categorization models.
+  RuMatrix = Eigen::MatrixXf(RuWords->GetDimension() * 3, EmbedderColumns);
   LoadMatrixFromFile(RuMatrix, modelPath + "/ru_sentence_embedder/matrix.txt");
 
-  EnMatrix = Eigen::MatrixXf(EnVecModel->getDimension() * 3, 50);
+  EnMatrix = Eigen::MatrixXf(EnWords->GetDimension() * 3, EmbedderColumns);
   LoadMatrixFromFile(EnMatrix, modelPath + "/en_sentence_embedder/matrix.txt");
   
-  RuBias = Eigen::VectorXf(50);
+  RuBias = Eigen::VectorXf(EmbedderColumns);
   LoadBiasFromFile(RuBias, modelPath + "/ru_sentence_embedder/bias.txt");
 
-  EnBias = Eigen::VectorXf(50);
+  EnBias = Eigen::VectorXf(EmbedderColumns);
   LoadBiasFromFile(EnBias, modelPath + "/en_sentence_embedder/bias.txt");
-  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
-  LOG(INFO) << "Time difference loading models = " << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count() << "[milli]";
+
+  Ratings.Load(modelPath + "/" + RatingsFile);
+}
+
+void Context::LoadBundle(std::unique_ptr<ModelBundle> bundle) {
+  Bundle = std::move(bundle);
+  LangDetect = LoadFastText(Bundle->Get(LangModelFile));
+  RuCatModel = LoadFastText(Bundle->Get(RuCatModelFile));
+  EnCatModel = LoadFastText(Bundle->Get(EnCatModelFile));
+  // The heads parse the same mapped sections a second time.
+  MakeClassifiers(LoadHead(Bundle->Get(RuCatModelFile)),
+                  LoadHead(Bundle->Get(EnCatModelFile)));
+
+  auto loadWords = [this](const fasttext::FastText* model, const std::string& name) {
+    size_t values = 0;
+    size_t rows = 0;
+    const float* table = Bundle->GetArray<float>(name + ".table", values);
+    const uint8_t* known = Bundle->GetArray<uint8_t>(name + ".known", rows);
+    VERIFY(values == rows * model->getDimension(), "bundled word vectors do not match the model");
+    return std::make_unique<WordVectors>(model, table, known, rows);
+  };
+  RuWords = loadWords(RuCatModel.get(), "ru_words");
+  EnWords = loadWords(EnCatModel.get(), "en_words");
+
+  auto loadMatrix = [this](const std::string& name, Eigen::Index rows, Eigen::Index cols) {
+    size_t count = 0;
+    const float* values = Bundle->GetArray<float>(name, count);
+    VERIFY(count == static_cast<size_t>(rows * cols), "bundled " + name + " has another shape");
+    return Eigen::Map<const Eigen::MatrixXf>(values, rows, cols);
+  };
+  RuMatrix = loadMatrix("ru_sentence_embedder/matrix", RuWords->GetDimension() * 3, EmbedderColumns);
+  EnMatrix = loadMatrix("en_sentence_embedder/matrix", EnWords->GetDimension() * 3, EmbedderColumns);
+  RuBias = loadMatrix("ru_sentence_embedder/bias", EmbedderColumns, 1);
+  EnBias = loadMatrix("en_sentence_embedder/bias", EmbedderColumns, 1);
+
+  Ratings.Deserialize(Bundle->Get(RatingsFile));
+}
+
+void Context::MakeClassifiers(std::unique_ptr<QuantizedClassifier> ruHead,
+                              std::unique_ptr<QuantizedClassifier> enHead) {
+  LangClassifier = std::make_unique<FastTextClassifier>(
+      LangDetect.get(), [](std::string_view code) { return LangFromCode(code); });
+  // Categorization runs on every document, it gets the int8 head.
+  RuCategoryClassifier = std::make_unique<FastTextClassifier>(
+      RuCatModel.get(), [](std::string_view name) { return CategoryFromName(name); },
+      std::move(ruHead));
+  EnCategoryClassifier = std::make_unique<FastTextClassifier>(
+      EnCatModel.get(), [](std::string_view name) { return CategoryFromName(name); },
+      std::move(enHead));
+}
+
+void Context::SaveBundle(const std::string& modelPath, const std::string& path) const {
+  ModelBundle::Writer writer;
+  for (const char* file : {LangModelFile, RuCatModelFile, EnCatModelFile}) {
+    std::string model = ReadFile(modelPath + "/" + file);
+    VERIFY(IsSupportedFastText(model),
+           fmt::format("{} is not a fastText model of the supported version", file));
+    writer.Add(file, std::move(model));
+  }
+  for (const auto& [name, words] : {std::make_pair("ru_words", RuWords.get()),
+                                     std::make_pair("en_words", EnWords.get())}) {
+    writer.AddArray(std::string(name) + ".table", words->GetTable(),
+                    words->GetTableRows() * words->GetDimension());
+    writer.AddArray(std::string(name) + ".known", words->GetKnown(), words->GetTableRows());
+  }
+  writer.AddArray("ru_sentence_embedder/matrix", RuMatrix.data(), RuMatrix.size());
+  writer.AddArray("en_sentence_embedder/matrix", EnMatrix.data(), EnMatrix.size());
+  writer.AddArray("ru_sentence_embedder/bias", RuBias.data(), RuBias.size());
+  writer.AddArray("en_sentence_embedder/bias", EnBias.data(), EnBias.size());
+  writer.Add(RatingsFile, Ratings.Serialize());
+  writer.Add(SourcesSection, DescribeSources(modelPath));
+  writer.Write(path);
+  LOG(INFO) << "model bundle written to " << path;
 }
 
 }
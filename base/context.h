@@ -11,21 +11,60 @@
 
 namespace tgnews {
 
+class CascadeLangDetector;
+class EmbeddingCache;
+class FastTextClassifier;
+class ModelBundle;
+class QuantizedClassifier;
+class WordVectors;
+
 class Context {
  public:
+  // Packed by SaveBundle and mapped instead of reading the models one by
+  // one when it is in the models directory and its sources still have the
+  // sizes and mtimes it recorded.
+  static constexpr const char* BundleFileName = "models.bundle";
+
   Context(const std::string modelPath, std::unique_ptr<FileCache> fileCache);
+  ~Context();
+
+  // Everything loaded from the models directory in one file: the models as
+  // they are, the embedder matrices and ratings as plain values and the word
+  // vector tables precomputed.
+  void SaveBundle(const std::string& modelPath, const std::string& path) const;
+
   std::unique_ptr<FileCache> fileCache;
+  // Set by ModelRegistry, documents keep the version they were scored with.
+  uint32_t Version = 0;
+  // Sections the word vectors read in place, null without a bundle.
+  std::unique_ptr<ModelBundle> Bundle;
   std::unique_ptr<fasttext::FastText> LangDetect;
   std::unique_ptr<fasttext::FastText> RuCatModel;
   std::unique_ptr<fasttext::FastText> EnCatModel;
-  std::unique_ptr<fasttext::FastText> RuVecModel;
-  std::unique_ptr<fasttext::FastText> EnVecModel;
+  // Top labels of the language detection and categorization models.
+  std::unique_ptr<FastTextClassifier> LangClassifier;
+  std::unique_ptr<FastTextClassifier> RuCategoryClassifier;
+  std::unique_ptr<FastTextClassifier> EnCategoryClassifier;
+  // Letters first, LangClassifier for what they leave open.
+  std::unique_ptr<CascadeLangDetector> LangDetector;
+  // Word vectors of the categorization models the embedders read.
+  std::unique_ptr<WordVectors> RuWords;
+  std::unique_ptr<WordVectors> EnWords;
   Eigen::MatrixXf RuMatrix;
   Eigen::VectorXf RuBias;
   Eigen::MatrixXf EnMatrix;
   Eigen::VectorXf EnBias;
   onmt::Tokenizer Tokenizer;
   TAgencyRating Ratings;
+  // Shared by the annotating threads, may be null.
+  std::unique_ptr<EmbeddingCache> Embeddings;
+
+ private:
+  void LoadFiles(const std::string& modelPath);
+  // A bundle OpenFreshBundle mapped and checked already.
+  void LoadBundle(std::unique_ptr<ModelBundle> bundle);
+  void MakeClassifiers(std::unique_ptr<QuantizedClassifier> ruHead,
+                       std::unique_ptr<QuantizedClassifier> enHead);
 };
 
 }
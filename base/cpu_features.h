@@ -0,0 +1,40 @@
+#pragma once
+
+// Hand-written x86 kernels are compiled under TGNEWS_X86_KERNELS with
+// per-function target attributes and picked at run time, so one binary
+// still runs on CPUs without them.
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define TGNEWS_X86_KERNELS
+#endif
+
+namespace tgnews {
+
+enum class CpuFeature {
+  Avx2,
+  Fma,
+  Avx512F,
+  Avx512Vl,
+  Avx512Vnni,
+};
+
+// Whether the CPU running us has the feature. Always false off x86.
+inline bool HasCpuFeature(CpuFeature feature) {
+#ifdef TGNEWS_X86_KERNELS
+  switch (feature) {
+    case CpuFeature::Avx2:
+      return __builtin_cpu_supports("avx2");
+    case CpuFeature::Fma:
+      return __builtin_cpu_supports("fma");
+    case CpuFeature::Avx512F:
+      return __builtin_cpu_supports("avx512f");
+    case CpuFeature::Avx512Vl:
+      return __builtin_cpu_supports("avx512vl");
+    case CpuFeature::Avx512Vnni:
+      return __builtin_cpu_supports("avx512vnni");
+  }
+#endif
+  return false;
+}
+
+}  // namespace tgnews
@@ -0,0 +1,166 @@
+#include "base/document_record.h"
+
+#include <cstring>
+
+#include "base/base.h"
+#include "fmt/format.h"
+
+namespace tgnews {
+
+namespace {
+
+constexpr uint16_t kNotExtractedFlag = 1;
+
+constexpr size_t kHeaderSize = 2 * sizeof(uint32_t) + 2 * sizeof(uint16_t);
+constexpr size_t kFixedSize = kHeaderSize + 3 * sizeof(uint64_t) +
+                              sizeof(float) + 2 * sizeof(uint8_t) +
+                              sizeof(uint16_t) + EmbeddingSize * sizeof(float);
+
+template <typename T>
+void Write(std::string& out, T value) {
+  out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void WriteString(std::string& out, std::string_view value) {
+  Write(out, static_cast<uint32_t>(value.size()));
+  out.append(value);
+}
+
+class Reader {
+ public:
+  explicit Reader(std::string_view data) : data_(data) {}
+
+  template <typename T>
+  T Read() {
+    T value;
+    std::memcpy(&value, Skip(sizeof(T)), sizeof(T));
+    return value;
+  }
+
+  std::string_view ReadString() {
+    auto size = Read<uint32_t>();
+    return std::string_view(Skip(size), size);
+  }
+
+  const char* Skip(size_t size) {
+    VERIFY(data_.size() - offset_ >= size, "document record is truncated");
+    const char* result = data_.data() + offset_;
+    offset_ += size;
+    return result;
+  }
+
+ private:
+  std::string_view data_;
+  size_t offset_ = 0;
+};
+
+}  // namespace
+
+std::string SerializeDocumentRecord(const ParsedDoc& document) {
+  VERIFY(document.HasColdFields,
+         fmt::format("cold fields of {} are dropped", document.FileName));
+  std::string out;
+  out.reserve(kFixedSize + 10 * sizeof(uint32_t) + 2 * sizeof(uint64_t) + document.FileName.size() +
+              document.Title.size() + document.Url.size() +
+              document.Description.size() + document.Text.size() +
+              document.Author.size() + document.GoodTitle.size() +
+              document.GoodText.size() + document.GetSiteName().size() +
+              document.GetHostName().size());
+
+  Write(out, kDocumentRecordMagic);
+  Write(out, kDocumentRecordVersion);
+  Write(out, document.Extracted ? uint16_t(0) : kNotExtractedFlag);
+  Write(out, uint32_t(0));  // size, patched below
+  Write(out, document.FetchTime);
+  Write(out, document.MaxAge);
+  Write(out, document.PubTime);
+  Write(out, document.Weight);
+  Write(out, static_cast<uint8_t>(document.Lang));
+  Write(out, static_cast<int8_t>(document.Category));
+  Write(out, uint16_t(0));
+  out.append(reinterpret_cast<const char*>(document.Vector.data()),
+             EmbeddingSize * sizeof(float));
+
+  WriteString(out, document.FileName);
+  WriteString(out, document.Title);
+  WriteString(out, document.Url);
+  WriteString(out, document.Description);
+  WriteString(out, document.Text);
+  WriteString(out, document.Author);
+  WriteString(out, document.GoodTitle);
+  WriteString(out, document.GoodText);
+  WriteString(out, document.GetSiteName());
+  WriteString(out, document.GetHostName());
+  Write(out, document.ContentHash);
+  Write(out, document.Fingerprint);
+
+  auto size = static_cast<uint32_t>(out.size());
+  std::memcpy(out.data() + sizeof(uint32_t) + 2 * sizeof(uint16_t), &size,
+              sizeof(size));
+  return out;
+}
+
+bool DocumentRecordView::IsDocumentRecord(std::string_view data) {
+  uint32_t magic = 0;
+  if (data.size() < sizeof(magic)) {
+    return false;
+  }
+  std::memcpy(&magic, data.data(), sizeof(magic));
+  return magic == kDocumentRecordMagic;
+}
+
+DocumentRecordView::DocumentRecordView(std::string_view data) {
+  VERIFY(IsDocumentRecord(data), "not a document record");
+  Reader reader(data);
+  reader.Read<uint32_t>();
+  auto version = reader.Read<uint16_t>();
+  VERIFY(version >= 1 && version <= kDocumentRecordVersion,
+         fmt::format("unknown document record version: {}", version));
+  Extracted = !(reader.Read<uint16_t>() & kNotExtractedFlag);
+  Size = reader.Read<uint32_t>();
+  VERIFY(Size >= kFixedSize && Size <= data.size(),
+         "document record is truncated");
+  reader = Reader(data.substr(0, Size));
+  reader.Skip(kHeaderSize);
+
+  FetchTime = reader.Read<uint64_t>();
+  MaxAge = reader.Read<uint64_t>();
+  PubTime = reader.Read<uint64_t>();
+  Weight = reader.Read<float>();
+  // Both index per language and per category arrays later on.
+  auto lang = reader.Read<uint8_t>();
+  VERIFY(lang < LangCount || (lang >= LangTg && lang <= LangUndefined),
+         fmt::format("document record has an unknown language: {}", lang));
+  Lang = static_cast<ELang>(lang);
+  auto category = reader.Read<int8_t>();
+  VERIFY(category >= NC_NOT_NEWS && category < NC_COUNT,
+         fmt::format("document record has an unknown category: {}", category));
+  Category = static_cast<ENewsCategory>(category);
+  reader.Read<uint16_t>();
+  vector_ = reader.Skip(EmbeddingSize * sizeof(float));
+
+  FileName = reader.ReadString();
+  Title = reader.ReadString();
+  Url = reader.ReadString();
+  Description = reader.ReadString();
+  Text = reader.ReadString();
+  Author = reader.ReadString();
+  GoodTitle = reader.ReadString();
+  GoodText = reader.ReadString();
+  SiteName = reader.ReadString();
+  HostName = reader.ReadString();
+  if (version >= 2) {
+    ContentHash = reader.Read<uint64_t>();
+  }
+  if (version >= 3) {
+    Fingerprint = reader.Read<uint64_t>();
+  }
+}
+
+Embedding DocumentRecordView::GetVector() const {
+  Embedding vector;
+  std::memcpy(vector.data(), vector_, sizeof(vector));
+  return vector;
+}
+
+}  // namespace tgnews
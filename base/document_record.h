@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "base/parsed_document.h"
+
+namespace tgnews {
+
+// Binary record holding every ParsedDoc field, derived ones included, so a
+// restored document needs neither json parsing nor annotation.
+//
+// Little endian, no padding:
+//   u32 magic, u16 version, u16 flags, u32 size of the whole record,
+//   u64 FetchTime, u64 MaxAge, u64 PubTime, f32 Weight, u8 Lang,
+//   i8 Category, u16 reserved (0), f32 Vector[EmbeddingSize],
+//   then u32 size + bytes for FileName, Title, Url, Description, Text,
+//   Author, GoodTitle, GoodText, site name and host name.
+// Version 2 appends u64 ContentHash, version 3 u64 Fingerprint. Flag bit 0
+// marks documents which are not ParsedDoc::Extracted.
+//
+// The size prefix lets records be laid out back to back. Records of a version
+// the reader doesn't know are rejected.
+constexpr uint32_t kDocumentRecordMagic = 0x52444754;  // "TGDR"
+constexpr uint16_t kDocumentRecordVersion = 3;
+
+std::string SerializeDocumentRecord(const ParsedDoc& document);
+
+// Points into the serialized record, nothing is copied, so it may be read
+// straight from a mapped file. The data has to outlive the view.
+struct DocumentRecordView {
+  // Throws on a truncated record or an unknown version.
+  explicit DocumentRecordView(std::string_view data);
+
+  // Tells records apart from json dumps of older builds.
+  static bool IsDocumentRecord(std::string_view data);
+
+  // The embedding is not aligned inside the record.
+  Embedding GetVector() const;
+
+  // Same as ParsedDoc::ColdBytes of the decoded document.
+  size_t ColdBytes() const {
+    return Url.size() + Description.size() + Text.size() + Author.size() +
+           GoodTitle.size() + GoodText.size();
+  }
+
+  uint32_t Size = 0;
+  uint64_t FetchTime = 0;
+  uint64_t MaxAge = 0;
+  uint64_t PubTime = 0;
+  float Weight = -1.f;
+  ELang Lang = LangUndefined;
+  ENewsCategory Category = NC_UNDEFINED;
+  bool Extracted = true;
+  // 0 for version 1 records.
+  uint64_t ContentHash = 0;
+  // 0 for records before version 3.
+  uint64_t Fingerprint = 0;
+  std::string_view FileName;
+  std::string_view Title;
+  std::string_view Url;
+  std::string_view Description;
+  std::string_view Text;
+  std::string_view Author;
+  std::string_view GoodTitle;
+  std::string_view GoodText;
+  std::string_view SiteName;
+  std::string_view HostName;
+
+ private:
+  const char* vector_ = nullptr;
+};
+
+}  // namespace tgnews
@@ -0,0 +1,74 @@
+#include "base/embedder.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace tgnews {
+  Embedding Embedder::GetEmbedding(const std::vector<std::string_view>& tokens) const {
+    Eigen::VectorXf features(3 * Words.GetDimension());
+    Pool(tokens, features);
+    Eigen::VectorXf result = Matrix.transpose() * features + Bias;
+    Embedding resultVector;
+    for (size_t i = 0; i < EmbeddingSize; i++) {
+        resultVector[i] = result[i];
+    }
+    return resultVector;
+  }
+
+  void Embedder::SetEmbeddings(const std::vector<tgnews::ParsedDoc*>& documents) const {
+    if (documents.empty()) {
+        return;
+    }
+    Eigen::MatrixXf features(3 * Words.GetDimension(), std::min(BatchSize, documents.size()));
+    Eigen::MatrixXf result;
+    std::vector<std::string_view> tokens;
+    for (size_t begin = 0; begin < documents.size(); begin += BatchSize) {
+        const size_t count = std::min(BatchSize, documents.size() - begin);
+        for (size_t i = 0; i < count; i++) {
+            documents[begin + i]->GetTokens(tokens);
+            Pool(tokens, features.col(i));
+        }
+        result.noalias() = Matrix.transpose() * features.leftCols(count);
+        result.colwise() += Bias;
+        for (size_t i = 0; i < count; i++) {
+            Embedding& vector = documents[begin + i]->Vector;
+            for (size_t j = 0; j < EmbeddingSize; j++) {
+                vector[j] = result(j, i);
+            }
+        }
+    }
+  }
+
+  void Embedder::Pool(const std::vector<std::string_view>& tokens, Eigen::Ref<Eigen::VectorXf> features) const {
+    const Eigen::Index N = Words.GetDimension();
+    auto avgVector = features.segment(0, N);
+    auto maxVector = features.segment(N, N);
+    auto minVector = features.segment(2 * N, N);
+    avgVector.setZero();
+    maxVector.setConstant(-std::numeric_limits<float>::infinity());
+    minVector.setConstant(std::numeric_limits<float>::infinity());
+    fasttext::Vector wordVector(N);
+    Eigen::Map<const Eigen::VectorXf> word(wordVector.data(), N);
+    // Dictionary lookups take strings, the buffer is reused.
+    std::string token;
+    size_t count = 0;
+    for (std::string_view view : tokens) {
+        if (count > 100) {
+            break;
+        }
+        token.assign(view);
+        if (!Words.GetVector(token, wordVector)) {
+            continue;
+        }
+        avgVector += word;
+        maxVector = maxVector.cwiseMax(word);
+        minVector = minVector.cwiseMin(word);
+        count += 1;
+    }
+    if (count == 0) {
+        features.setZero();
+        return;
+    }
+    avgVector *= 1.0f / static_cast<float>(count);
+  }
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "base/parsed_document.h"
+#include "base/word_vectors.h"
+
+#include <string_view>
+#include <vector>
+
+#include "third_party/fastText/src/fasttext.h"
+#include "third_party/eigen/Eigen/Core"
+
+namespace tgnews {
+  class Embedder {
+  public:
+    // Documents projected by one matrix product.
+    static constexpr size_t BatchSize = 1024;
+
+    Embedder(const WordVectors& words, const Eigen::MatrixXf& matrix, const Eigen::VectorXf& bias)
+      : Words(words)
+      , Matrix(matrix)
+      , Bias(bias)
+    {}
+
+    // Embedding of a document with the tokens from ParsedDoc::GetTokens.
+    Embedding GetEmbedding(const std::vector<std::string_view>& tokens) const;
+    // Same as GetEmbedding for each document, written to their Vector.
+    void SetEmbeddings(const std::vector<tgnews::ParsedDoc*>& documents) const;
+  private:
+    // Average, maximum and minimum of the word vectors, one after another.
+    void Pool(const std::vector<std::string_view>& tokens, Eigen::Ref<Eigen::VectorXf> features) const;
+
+    const WordVectors& Words;
+    const Eigen::MatrixXf& Matrix;
+    const Eigen::VectorXf& Bias;
+  };
+}
@@ -0,0 +1,30 @@
+#include "base/embedding_cache.h"
+
+#include "base/hash.h"
+
+namespace tgnews {
+
+EmbeddingCache::EmbeddingCache(size_t capacity) : cache_(capacity) {}
+
+uint64_t EmbeddingCache::GetKey(ELang lang, std::string_view good_title,
+                                std::string_view good_text) {
+  return HashBytes(good_text, HashBytes(good_title, lang));
+}
+
+std::optional<Embedding> EmbeddingCache::Find(uint64_t key) {
+  return cache_.Find(key);
+}
+
+void EmbeddingCache::Insert(uint64_t key, const Embedding& embedding) {
+  cache_.Insert(key, embedding);
+}
+
+EmbeddingCache::Stats EmbeddingCache::GetStats() const {
+  Stats stats;
+  stats.hits = cache_.Hits();
+  stats.misses = cache_.Misses();
+  stats.size = cache_.Size();
+  return stats;
+}
+
+}  // namespace tgnews
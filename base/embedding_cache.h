@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+#include "base/lru_cache.h"
+#include "base/parsed_document.h"
+
+namespace tgnews {
+
+// Embeddings of recently embedded texts, so a document is not embedded again
+// when only its markup changed or when it is a verbatim copy of another one.
+class EmbeddingCache {
+ public:
+  static constexpr size_t kDefaultCapacity = 1 << 16;
+
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    size_t size = 0;
+  };
+
+  explicit EmbeddingCache(size_t capacity = kDefaultCapacity);
+
+  // Everything the embedding depends on: the model picked by the language
+  // and the tokens.
+  static uint64_t GetKey(ELang lang, std::string_view good_title,
+                         std::string_view good_text);
+
+  std::optional<Embedding> Find(uint64_t key);
+
+  void Insert(uint64_t key, const Embedding& embedding);
+
+  Stats GetStats() const;
+
+ private:
+  // Keys are hashes already.
+  struct KeyHash {
+    size_t operator()(uint64_t key) const { return key; }
+  };
+
+  ShardedLruCache<uint64_t, Embedding, KeyHash> cache_;
+};
+
+}  // namespace tgnews
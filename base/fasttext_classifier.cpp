@@ -0,0 +1,109 @@
+#include "base/fasttext_classifier.h"
+
+#include <cmath>
+#include <istream>
+#include <string>
+
+#include "base/base.h"
+#include "base/text_stream.h"
+
+namespace tgnews {
+
+namespace {
+
+constexpr std::string_view kLabelPrefix = "__label__";
+
+}  // namespace
+
+FastTextClassifier::FastTextClassifier(
+    const fasttext::FastText* model,
+    const std::function<int(std::string_view)>& label_id,
+    std::unique_ptr<QuantizedClassifier> head)
+    : model_(model),
+      dictionary_(model->getDictionary()),
+      head_(std::move(head)) {
+  VERIFY(!head_ || head_->GetLabelCount() == dictionary_->nlabels(),
+         "quantized head has other labels than the model");
+  for (int32_t i = 0; i < dictionary_->nlabels(); i++) {
+    const std::string label = dictionary_->getLabel(i);
+    std::string_view name = label;
+    if (name.substr(0, kLabelPrefix.size()) == kLabelPrefix) {
+      name.remove_prefix(kLabelPrefix.size());
+    }
+    label_ids_.push_back(label_id(name));
+  }
+}
+
+std::optional<FastTextClassifier::Prediction> FastTextClassifier::Predict(
+    const std::vector<std::string_view>& pieces, float threshold) const {
+  struct Scratch {
+    std::vector<int32_t> words;
+    fasttext::Predictions predictions;
+  };
+  thread_local Scratch scratch;
+
+  ReadWords(pieces, scratch.words);
+  if (scratch.words.empty()) {
+    return std::nullopt;
+  }
+  if (head_) {
+    auto prediction = head_->Predict(scratch.words, threshold);
+    if (!prediction) {
+      return std::nullopt;
+    }
+    return Prediction{label_ids_[prediction->label], prediction->probability};
+  }
+  scratch.predictions.clear();
+  model_->predict(1, scratch.words, scratch.predictions, threshold);
+  if (scratch.predictions.empty()) {
+    return std::nullopt;
+  }
+  // Predictions come as log probabilities.
+  const auto& [log_probability, index] = scratch.predictions.front();
+  return Prediction{label_ids_[index], std::exp(log_probability)};
+}
+
+void FastTextClassifier::Predict(
+    const std::vector<std::vector<std::string_view>>& texts, float threshold,
+    std::vector<std::optional<Prediction>>& predictions) const {
+  struct Scratch {
+    std::vector<std::vector<int32_t>> words;
+    std::vector<std::optional<QuantizedClassifier::Prediction>> predictions;
+  };
+  thread_local Scratch scratch;
+
+  predictions.assign(texts.size(), std::nullopt);
+  if (!head_) {
+    for (size_t i = 0; i < texts.size(); i++) {
+      predictions[i] = Predict(texts[i], threshold);
+    }
+    return;
+  }
+  // Batches are mostly of the same size, the word lists keep their
+  // capacity from one to the next.
+  scratch.words.resize(texts.size());
+  for (size_t i = 0; i < texts.size(); i++) {
+    ReadWords(texts[i], scratch.words[i]);
+  }
+  head_->Predict(scratch.words, threshold, scratch.predictions);
+  for (size_t i = 0; i < texts.size(); i++) {
+    if (const auto& prediction = scratch.predictions[i]) {
+      predictions[i] =
+          Prediction{label_ids_[prediction->label], prediction->probability};
+    }
+  }
+}
+
+void FastTextClassifier::ReadWords(const std::vector<std::string_view>& pieces,
+                                   std::vector<int32_t>& words) const {
+  thread_local std::vector<int32_t> labels;
+  words.clear();
+  JoinedTextBuf buffer(pieces);
+  std::istream stream(&buffer);
+  if (stream.peek() == std::istream::traits_type::eof()) {
+    return;
+  }
+  dictionary_->getLine(stream, words, labels);
+}
+
+}  // namespace tgnews
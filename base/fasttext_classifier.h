@@ -0,0 +1,54 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include "base/quantized_classifier.h"
+
+#include "third_party/fastText/src/fasttext.h"
+
+namespace tgnews {
+
+// Top label of a supervised fastText model. Label names are mapped to the
+// caller's ids once, so predictions do not go through "__label__" strings,
+// and every thread reuses its own buffers for words and predictions.
+class FastTextClassifier {
+ public:
+  struct Prediction {
+    int label;
+    float probability;
+  };
+
+  // `label_id` gets label names without the "__label__" prefix. The head,
+  // if any, is the same model loaded for int8 inference and replaces
+  // fastText's own after the words are read.
+  FastTextClassifier(const fasttext::FastText* model,
+                     const std::function<int(std::string_view)>& label_id,
+                     std::unique_ptr<QuantizedClassifier> head = nullptr);
+
+  // Top label of the pieces of text joined by spaces. Nothing for a text
+  // without words or when no label reaches the threshold.
+  std::optional<Prediction> Predict(const std::vector<std::string_view>& pieces,
+                                    float threshold) const;
+
+  // The same for many texts, each given as its pieces. With a head the
+  // output layer is scored for all of them at once.
+  void Predict(const std::vector<std::vector<std::string_view>>& texts,
+               float threshold,
+               std::vector<std::optional<Prediction>>& predictions) const;
+
+ private:
+  // Word ids of the pieces, empty for a text without words.
+  void ReadWords(const std::vector<std::string_view>& pieces,
+                 std::vector<int32_t>& words) const;
+
+  const fasttext::FastText* model_;
+  std::shared_ptr<const fasttext::Dictionary> dictionary_;
+  std::vector<int> label_ids_;
+  std::unique_ptr<QuantizedClassifier> head_;
+};
+
+}  // namespace tgnews
@@ -7,7 +7,7 @@ namespace tgnews {
 FileCache::FileCache(FileManager* file_manager) : file_manager_(file_manager) {
 }
 
-std::vector<ParsedDoc> FileCache::GetDocuments() {
+std::vector<ParsedDocPtr> FileCache::GetDocuments() {
   return file_manager_->GetDocuments().apply(cti::transforms::wait());
 }
 
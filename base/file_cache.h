@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -12,7 +13,7 @@ class FileCache {
  public:
   explicit FileCache(FileManager* file_manager);
 
-  std::vector<ParsedDoc> GetDocuments();
+  std::vector<std::shared_ptr<const ParsedDoc>> GetDocuments();
 
  private:
   FileManager* const file_manager_;
@@ -1,71 +1,262 @@
 #include "base/file_manager.h"
 
+#include "base/document_record.h"
+#include "base/embedder.h"
+#include "base/hash.h"
+#include "base/parallel_for.h"
+
+#include <algorithm>
+#include <functional>
+#include <string_view>
+
 namespace tgnews {
 
-FileManager::FileManager(std::experimental::thread_pool& pool, Context* context,
-                         std::string content_dir)
-    : content_dir_(std::move(content_dir)),
-      context_(context),
-      documents_strand_(pool.get_executor()),
+namespace {
+
+constexpr std::string_view kLogDirectory = "log";
+
+}  // namespace
+
+FileManager::FileManager(std::experimental::thread_pool& pool,
+                         ModelRegistry* models, std::string content_dir,
+                         size_t shard_count, SegmentLog::Options log_options,
+                         uint64_t cold_fields_budget,
+                         size_t change_stream_capacity)
+    : models_(models),
+      content_dir_(std::move(content_dir)),
+      change_stream_(change_stream_capacity),
+      cold_fields_budget_(cold_fields_budget),
+      restore_start_(std::chrono::steady_clock::now()),
       pool_(pool) {
+  VERIFY(shard_count > 0, "file manager needs at least one shard");
   boost::filesystem::path content_path = content_dir_;
   if (!boost::filesystem::exists(content_path)) {
-    LOG(INFO) << fmt::format("content path does not exist: {}", content_dir);
+    LOG(INFO) << fmt::format("content path does not exist: {}", content_dir_);
     VERIFY(boost::filesystem::create_directory(content_path),
            fmt::format("unable to create directory for index storage: {}",
-                       content_dir));
+                       content_dir_));
   }
 
-  std::experimental::post(documents_strand_, [this] {
-    RestoreFiles();
-    finished_restoring_from_disk_ = true;
-  });
+  log_ = std::make_unique<SegmentLog>(
+      (content_path / std::string(kLogDirectory)).string(), log_options);
+
+  shards_.reserve(shard_count);
+  for (size_t i = 0; i < shard_count; i++) {
+    shards_.push_back(std::make_unique<Shard>(pool_));
+  }
+
+  std::experimental::post(pool_, [this] { RestoreFiles(); });
 }
 
 FileManager::~FileManager() {
   pool_.stop();
   pool_.join();
+  // Flushes whatever is still queued.
+  log_.reset();
+}
+
+size_t FileManager::GetShardIndex(const std::string& filename) const {
+  return std::hash<std::string>{}(filename) % shards_.size();
+}
+
+FileManager::Shard& FileManager::GetShard(const std::string& filename) {
+  return *shards_[GetShardIndex(filename)];
+}
+
+template <typename Promise, typename Value>
+SegmentLog::Callback FileManager::AnswerWhenWritten(
+    std::shared_ptr<Promise> promise, Value value) {
+  return [this, promise, value](std::exception_ptr error) {
+    // Not on the writer thread, continuations may take a while.
+    std::experimental::post(pool_, [promise, value, error] {
+      if (error) {
+        promise->set_exception(error);
+      } else {
+        promise->set_value(value);
+      }
+    });
+  };
+}
+
+template <typename Handler, typename Done>
+void FileManager::ForEachShard(Handler handler, Done done) {
+  auto pending = std::make_shared<std::atomic<size_t>>(shards_.size());
+  auto shared_done = std::make_shared<Done>(std::move(done));
+  for (size_t i = 0; i < shards_.size(); i++) {
+    auto& shard = *shards_[i];
+    std::experimental::post(
+        shard.strand, [i, &shard, handler, pending, shared_done]() mutable {
+          handler(i, shard);
+          if (pending->fetch_sub(1) == 1) {
+            (*shared_done)();
+          }
+        });
+  }
+}
+
+template <typename T, typename Collect>
+cti::continuable<std::vector<T>> FileManager::CollectFromShards(
+    Collect collect) {
+  return cti::make_continuable<std::vector<T>>(
+      [this, collect = std::move(collect)](
+          cti::promise<std::vector<T>> promise) mutable {
+        // Every shard writes its own slot, the last one to finish merges.
+        auto parts =
+            std::make_shared<std::vector<std::vector<T>>>(shards_.size());
+        ForEachShard(
+            [parts, collect](size_t index, Shard& shard) mutable {
+              (*parts)[index] = collect(shard);
+            },
+            [parts, p = std::move(promise)]() mutable {
+              std::vector<T> result;
+              for (auto& part : *parts) {
+                result.insert(result.end(),
+                              std::make_move_iterator(part.begin()),
+                              std::make_move_iterator(part.end()));
+              }
+              p.set_value(std::move(result));
+            });
+      });
 }
 
 cti::continuable<bool> FileManager::StoreOrUpdateFile(std::string filename,
                                                       std::string content,
                                                       uint64_t max_age) {
-  return UpdateContentOrCreateDocument(filename, std::move(content), max_age)
-      .then([this, f = std::move(filename)](bool result) mutable {
-        LOG(INFO) << "after content creation";
-        return cti::make_continuable<bool>(
-            [this, f = std::move(f), result](auto promise) mutable {
-              std::experimental::post(
-                  documents_strand_, [this, p = std::move(promise),
-                                      f = std::move(f), result]() mutable {
-                    auto it = document_by_name_.find(f);
-                    VERIFY(it != document_by_name_.end(),
-                           fmt::format("no document with name {} found", f));
-                    std::experimental::post(
-                        pool_, [this, p = std::move(p), f = std::move(f), it,
-                                result]() mutable {
-                          DumpOnDisk(fmt::format("{0}/{1}", content_dir_, f),
-                                     *it->second);
-                          p.set_value(result);
-                        });
-                  });
-            });
-      });
+  auto content_hash = HashBytes(content);
+  return cti::make_continuable<bool>([this, filename = std::move(filename),
+                                      content = std::move(content), max_age,
+                                      content_hash](
+                                         cti::promise<bool> promise) mutable {
+    auto& shard = GetShard(filename);
+    std::experimental::post(
+        shard.strand,
+        [this, &shard, p = std::move(promise), filename = std::move(filename),
+         content = std::move(content), max_age, content_hash]() mutable {
+          if (RefreshIfUnchanged(shard, filename, content_hash, max_age, p)) {
+            return;
+          }
+
+          auto& pending = shard.pending_puts[filename];
+          if (pending.last && pending.last->content_hash == content_hash &&
+              pending.last->max_age == max_age) {
+            dedup_hits_++;
+            pending.last->waiters.push_back(std::move(p));
+            return;
+          }
+          auto put = std::make_shared<PendingPut>();
+          put->sequence = ++shard.next_sequence;
+          put->content_hash = content_hash;
+          put->max_age = max_age;
+          put->waiters.push_back(std::move(p));
+          // Different content of the same name is parsed alongside, the
+          // sequence keeps the last accepted one in the map.
+          pending.last = put;
+          pending.count++;
+
+          CreateDocument(filename, std::move(content), max_age, content_hash)
+              .then([this, put](std::shared_ptr<ParsedDoc> document) {
+                LOG(INFO) << "after content creation";
+                return EmplaceDocument(std::move(document), put->sequence);
+              })
+              .then([this, &shard, filename, put](bool updated) {
+                FinishPendingPut(shard, filename, put,
+                                 [updated](cti::promise<bool>& waiter,
+                                           bool first) {
+                                   // Later waiters find the document stored.
+                                   waiter.set_value(first ? updated : true);
+                                 });
+              })
+              .fail([this, &shard, filename, put](std::exception_ptr error) {
+                FinishPendingPut(
+                    shard, filename, put,
+                    [error](cti::promise<bool>& waiter, bool) {
+                      waiter.set_exception(error);
+                    });
+              });
+        });
+  });
+}
+
+bool FileManager::RefreshIfUnchanged(Shard& shard, const std::string& filename,
+                                     uint64_t content_hash, uint64_t max_age,
+                                     cti::promise<bool>& promise) {
+  auto pending = shard.pending_puts.find(filename);
+  if (pending != shard.pending_puts.end() && pending->second.last &&
+      (pending->second.last->content_hash != content_hash ||
+       pending->second.last->max_age != max_age)) {
+    // Another PUT lands after the stored document, this one has to land
+    // after it.
+    return false;
+  }
+  auto it = shard.document_by_name.find(filename);
+  if (it == shard.document_by_name.end() || content_hash == 0 ||
+      it->second.document->ContentHash != content_hash) {
+    return false;
+  }
+  dedup_hits_++;
+  if (it->second.document->MaxAge == max_age) {
+    promise.set_value(true);
+    return true;
+  }
+
+  // Only the expiration moves: a touch record instead of the whole
+  // document. The solver prunes documents by expiration too, so it still
+  // has to see the new handle.
+  auto document = std::make_shared<ParsedDoc>(*it->second.document);
+  document->MaxAge = max_age;
+  shard.expiration_wheel.Cancel(it->second.expiration);
+  it->second.expiration = shard.expiration_wheel.Insert(
+      document->ExpirationTime(), document.get());
+  it->second.document = document;
+  change_stream_.Append(ParsedDoc::EState::Changed, filename);
+
+  auto shared = std::make_shared<cti::promise<bool>>(std::move(promise));
+  log_->Touch(filename, document->ExpirationTime(),
+              AnswerWhenWritten(std::move(shared), true));
+  return true;
+}
+
+template <typename Answer>
+void FileManager::FinishPendingPut(Shard& shard, const std::string& filename,
+                                   std::shared_ptr<PendingPut> put,
+                                   Answer answer) {
+  std::experimental::post(shard.strand, [&shard, filename, put, answer] {
+    auto it = shard.pending_puts.find(filename);
+    if (it != shard.pending_puts.end()) {
+      if (it->second.last == put) {
+        it->second.last.reset();
+      }
+      if (--it->second.count == 0) {
+        shard.pending_puts.erase(it);
+      }
+    }
+    for (size_t i = 0; i < put->waiters.size(); i++) {
+      answer(put->waiters[i], i == 0);
+    }
+  });
 }
 
 cti::continuable<bool> FileManager::RemoveFile(std::string filename) {
   // bool is unnecessary here but it doesn't compile with void.
   return cti::make_continuable<bool>(
       [this, f = std::move(filename)](auto promise) mutable {
+        auto& shard = GetShard(f);
         std::experimental::post(
-            pool_, [this, p = std::move(promise), f = std::move(f)]() mutable {
-              RemoveFileFromDisk(f);
-
-              std::experimental::post(
-                  documents_strand_,
-                  [this, p = std::move(p), f = std::move(f)]() mutable {
-                    p.set_value(RemoveFileFromMap(std::move(f)));
-                  });
+            shard.strand,
+            [this, &shard, p = std::move(promise), f = std::move(f)]() mutable {
+              bool removed = RemoveFileFromMap(shard, f);
+              auto pending = shard.pending_puts.find(f);
+              if (pending != shard.pending_puts.end()) {
+                // PUTs of the name still being parsed were sent before, they
+                // are removed as well once done.
+                pending->second.removed = ++shard.next_sequence;
+                pending->second.last.reset();
+                removed = true;
+              }
+              // The tombstone goes out even for unknown names: the document
+              // may still be on its way from the log while restoring.
+              auto shared = std::make_shared<decltype(p)>(std::move(p));
+              log_->Delete(f, AnswerWhenWritten(std::move(shared), removed));
             });
       });
 }
@@ -74,215 +265,661 @@ cti::continuable<bool> FileManager::RemoveOutdatedFiles() {
   if (!finished_restoring_from_disk_) {
     return cti::make_ready_continuable<bool>(true);
   }
-  return cti::make_continuable<bool>([this](auto promise) {
-    std::experimental::post(
-        documents_strand_, [this, p = std::move(promise)]() mutable {
-          auto now = last_fetch_time_.load();
-
-          std::vector<std::string> remove_from_disk;
-          for (auto it = documents_with_deadline_.begin();
-               it != documents_with_deadline_.end(); ++it) {
-            if (it->first > now) {
-              break;
-            }
-            LOG(INFO) << fmt::format(
-                "now: {} remove outdated file: {} with deadline: {}", now,
-                it->second->FileName, it->first);
-            remove_from_disk.push_back(it->second->FileName);
-            RemoveFileFromMap(it->second->FileName);
-          }
+  auto now = last_fetch_time_.load();
+  return CollectFromShards<std::string>([this, now](Shard& shard) {
+           std::vector<std::string> outdated;
+           shard.expiration_wheel.Advance(now, [&](const ParsedDoc* document) {
+             LOG(INFO) << fmt::format(
+                 "now: {} remove outdated file: {} with deadline: {}", now,
+                 document->FileName, document->ExpirationTime());
+             outdated.push_back(document->FileName);
+           });
+           for (const auto& filename : outdated) {
+             auto it = shard.document_by_name.find(filename);
+             it->second.expiration = ExpirationWheel::kInvalidHandle;
+             EraseDocument(shard, it);
+             log_->Delete(filename);
+           }
+           return outdated;
+         })
+      .then([this, now](std::vector<std::string>) {
+        if (log_->NeedsCompaction()) {
+          std::experimental::post(pool_, [this, now] { CompactLog(now); });
+        }
+        return true;
+      });
+}
 
-          std::experimental::post(
-              pool_, [this, p = std::move(p),
-                      remove = std::move(remove_from_disk)]() mutable {
-                for (auto&& filename : remove) {
-                  RemoveFileFromDisk(filename);
-                }
-                p.set_value(true);
-              });
-        });
+cti::continuable<std::vector<ParsedDocPtr>> FileManager::GetDocuments() {
+  return CollectFromShards<ParsedDocPtr>([](Shard& shard) {
+    std::vector<ParsedDocPtr> documents;
+    documents.reserve(shard.document_by_name.size());
+    for (auto& [name, entry] : shard.document_by_name) {
+      documents.push_back(entry.document);
+    }
+    return documents;
   });
 }
 
-cti::continuable<std::vector<ParsedDoc>> FileManager::GetDocuments() {
-  return cti::make_continuable<std::vector<ParsedDoc>>([this](auto promise) {
-    std::experimental::post(
-        documents_strand_, [this, p = std::move(promise)]() mutable {
-          std::vector<ParsedDoc> documents;
-          documents.reserve(document_by_name_.size());
-          for (auto& [name, document_ptr] : document_by_name_) {
-            documents.push_back(*document_ptr);
-          }
+cti::continuable<std::vector<DocumentChange>> FileManager::GetChanges(
+    std::vector<ChangeEvent> events) {
+  auto shared = std::make_shared<std::vector<ChangeEvent>>(std::move(events));
+  return CollectFromShards<DocumentChange>([this, shared](Shard& shard) {
+           // The last event of every name in this shard.
+           std::unordered_map<std::string_view, const ChangeEvent*> last;
+           for (const auto& event : *shared) {
+             if (&GetShard(event.FileName) == &shard) {
+               last[event.FileName] = &event;
+             }
+           }
+           std::vector<DocumentChange> changes;
+           changes.reserve(last.size());
+           for (auto [name, event] : last) {
+             auto it = shard.document_by_name.find(event->FileName);
+             if (it == shard.document_by_name.end()) {
+               changes.push_back({ParsedDoc::EState::Removed, event->FileName,
+                                  nullptr, event->Sequence});
+             } else {
+               changes.push_back({event->State == ParsedDoc::EState::Removed
+                                      ? ParsedDoc::EState::Added
+                                      : event->State,
+                                  event->FileName, it->second.document,
+                                  event->Sequence});
+             }
+           }
+           return changes;
+         })
+      .then([](std::vector<DocumentChange> changes) {
+        std::sort(changes.begin(), changes.end(),
+                  [](const auto& l, const auto& r) {
+                    return l.Sequence < r.Sequence;
+                  });
+        return changes;
+      });
+}
 
-          p.set_value(std::move(documents));
-        });
-  });
+cti::continuable<ParsedDocPtr> FileManager::LoadDocument(
+    std::string filename) {
+  return cti::make_continuable<ParsedDocPtr>(
+      [this, f = std::move(filename)](auto promise) mutable {
+        LoadDocument(std::move(f),
+                     std::make_shared<decltype(promise)>(std::move(promise)),
+                     nullptr);
+      });
 }
 
-cti::continuable<std::vector<ParsedDoc>> FileManager::FetchChangeLog() {
-  if (!finished_restoring_from_disk_) {
-    return cti::make_ready_continuable<std::vector<ParsedDoc>>({});
-  }
-  return cti::make_continuable<std::vector<ParsedDoc>>([this](auto promise) {
-    std::experimental::post(documents_strand_,
-                            [this, p = std::move(promise)]() mutable {
-                              std::vector<ParsedDoc> documents;
-                              change_log_.swap(documents);
-                              p.set_value(std::move(documents));
-                            });
+void FileManager::LoadDocument(std::string filename,
+                               std::shared_ptr<cti::promise<ParsedDocPtr>> p,
+                               ParsedDocPtr previous) {
+  auto& shard = GetShard(filename);
+  std::experimental::post(shard.strand, [this, &shard, p = std::move(p),
+                                         f = std::move(filename),
+                                         previous = std::move(
+                                             previous)]() mutable {
+    auto it = shard.document_by_name.find(f);
+    if (it == shard.document_by_name.end()) {
+      p->set_value(nullptr);
+      return;
+    }
+    auto document = it->second.document;
+    if (document->HasColdFields) {
+      p->set_value(std::move(document));
+      return;
+    }
+    if (document == previous) {
+      // The handle did not change, yet the log has another record: its put
+      // failed to be written.
+      p->set_exception(std::make_exception_ptr(std::runtime_error(
+          fmt::format("no record of the stored document {}", f))));
+      return;
+    }
+    // The strand only hands out the handle, the read runs on the pool.
+    std::experimental::post(pool_, [this, p = std::move(p), f = std::move(f),
+                                    document = std::move(
+                                        document)]() mutable {
+      std::shared_ptr<ParsedDoc> loaded;
+      try {
+        auto value = log_->Get(f);
+        if (value) {
+          loaded = std::make_shared<ParsedDoc>(DocumentRecordView(*value));
+        }
+      } catch (...) {
+        p->set_exception(std::current_exception());
+        return;
+      }
+      if (!loaded || loaded->ContentHash != document->ContentHash ||
+          loaded->FetchTime != document->FetchTime) {
+        // A PUT or DELETE of the name got in after the handle was taken, the
+        // record belongs to it. Start over with the handle it left.
+        LoadDocument(std::move(f), std::move(p), std::move(document));
+        return;
+      }
+      // Touches may have moved the expiration since.
+      loaded->MaxAge = document->MaxAge;
+      p->set_value(std::move(loaded));
+    });
   });
 }
 
 cti::continuable<bool> FileManager::EmplaceDocument(
-    std::unique_ptr<ParsedDoc> document) {
+    std::shared_ptr<ParsedDoc> document, uint64_t sequence) {
   LOG(INFO) << fmt::format("start emplacing document: {}", document->FileName);
-  return cti::make_continuable<bool>(
-      [this, d = std::move(document)](auto promise) mutable {
-        LOG(INFO) << "in future";
-        LOG(INFO) << fmt::format("start emplacing document in future: {}",
-                                 d->FileName);
-        std::experimental::post(
-            documents_strand_,
-            [this, p = std::move(promise), document = std::move(d)]() mutable {
-              EmplaceDocumentSync(std::move(document));
-
-              p.set_value(true);
-            });
-      });
+  // Serialized here so that the strand only queues the record.
+  auto record = SerializeDocumentRecord(*document);
+  if (!ReserveColdBytes(document->ColdBytes())) {
+    document->DropColdFields();
+  }
+  return cti::make_continuable<bool>([this, d = std::move(document),
+                                      record = std::move(record),
+                                      sequence](auto promise) mutable {
+    auto& shard = GetShard(d->FileName);
+    std::experimental::post(
+        shard.strand, [this, &shard, p = std::move(promise),
+                       document = std::move(d), record = std::move(record),
+                       sequence]() mutable {
+          auto it = shard.document_by_name.find(document->FileName);
+          auto pending = shard.pending_puts.find(document->FileName);
+          if ((it != shard.document_by_name.end() &&
+               it->second.sequence > sequence) ||
+              (pending != shard.pending_puts.end() &&
+               pending->second.removed > sequence)) {
+            // A later PUT or DELETE of the name was applied already, this
+            // one is as good as overwritten.
+            cold_bytes_ -= document->ColdBytes();
+            p.set_value(true);
+            return;
+          }
+          bool updated = EmplaceDocumentSync(shard, document, sequence);
+
+          // Answer once the record is written and synced as configured. A
+          // failed write answers with the error, the document stays in
+          // memory until the PUT is repeated or the server restarts.
+          auto shared = std::make_shared<decltype(p)>(std::move(p));
+          log_->Put(document->FileName, document->ExpirationTime(), record,
+                    AnswerWhenWritten(std::move(shared), updated));
+        });
+  });
 }
 
-void FileManager::EmplaceDocumentSync(std::unique_ptr<ParsedDoc> document) {
+bool FileManager::EmplaceDocumentSync(Shard& shard, ParsedDocPtr document,
+                                      uint64_t sequence) {
   LOG(INFO) << fmt::format("create document: {} fetch time: {}",
                            document->FileName, document->FetchTime);
 
-  last_fetch_time_ = std::max(last_fetch_time_.load(), document->FetchTime);
+  UpdateLastFetchTime(document->FetchTime);
 
-  change_log_.push_back(*document);
+  auto [it, inserted] = shard.document_by_name.try_emplace(document->FileName);
+  if (!inserted) {
+    shard.expiration_wheel.Cancel(it->second.expiration);
+    AccountDocument(*it->second.document, false);
+  }
+  AccountDocument(*document, true);
+  it->second.document = document;
+  it->second.sequence = sequence;
+  it->second.expiration = shard.expiration_wheel.Insert(
+      document->ExpirationTime(), document.get());
+  change_stream_.Append(
+      inserted ? ParsedDoc::EState::Added : ParsedDoc::EState::Changed,
+      document->FileName);
+
+  return !inserted;
+}
 
-  documents_with_deadline_.emplace(document->ExpirationTime(), document.get());
-  document_by_name_.emplace(document->FileName, std::move(document));
+void FileManager::RestoreFiles() {
+  RestoredDocuments restored(shards_.size());
+  // One set of models for the whole restore.
+  auto context = models_ ? models_->Get() : nullptr;
+
+  // Json records are left by older builds, they get annotated and rewritten
+  // in the binary format once.
+  std::vector<std::shared_ptr<ParsedDoc>> converted;
+  std::mutex converted_mutex;
+  log_->Replay(
+      [&](std::string_view name, uint64_t expiration_time,
+          std::string_view value) {
+        std::shared_ptr<ParsedDoc> document;
+        bool is_record = DocumentRecordView::IsDocumentRecord(value);
+        try {
+          if (is_record) {
+            DocumentRecordView record(value);
+            document = std::make_shared<ParsedDoc>(
+                record, ReserveColdBytes(record.ColdBytes()));
+          } else {
+            document =
+                std::make_shared<ParsedDoc>(nlohmann::json::parse(value));
+          }
+        } catch (...) {
+          LOG(ERROR) << "log contains an invalid document: " << name;
+          return;
+        }
+        // Touches after the put only moved the expiration.
+        if (expiration_time >= document->FetchTime) {
+          document->MaxAge = expiration_time - document->FetchTime;
+        }
+        if (!is_record) {
+          if (context) {
+            document->Annotate(*context, /*batched=*/true);
+          }
+          std::lock_guard<std::mutex> lock(converted_mutex);
+          converted.push_back(document);
+        }
+        AddRestoredDocument(restored, std::move(document), value.size());
+      },
+      &pool_);
+  std::vector<ParsedDoc*> unannotated;
+  for (const auto& document : converted) {
+    unannotated.push_back(document.get());
+  }
+  if (context) {
+    AnnotateInBatches(*context, unannotated);
+  }
+  ParallelFor(&pool_, converted.size(), [&](size_t index) {
+    auto& document = *converted[index];
+    log_->Put(document.FileName, document.ExpirationTime(),
+              SerializeDocumentRecord(document));
+    if (!ReserveColdBytes(document.ColdBytes())) {
+      document.DropColdFields();
+    }
+  });
+  if (!converted.empty()) {
+    LOG(INFO) << "converted json records: " << converted.size();
+  }
+  MigrateLegacyFiles(restored);
+
+  auto documents = std::make_shared<std::vector<std::vector<ParsedDocPtr>>>(
+      std::move(restored.documents));
+  ForEachShard(
+      [this, documents](size_t index, Shard& shard) {
+        for (auto& document : (*documents)[index]) {
+          EmplaceDocumentSync(shard, std::move(document));
+        }
+      },
+      [this] {
+        auto progress = GetRestoreProgress();
+        LOG(INFO) << fmt::format(
+            "restored {} documents, {} bytes in {:.1f}s", progress.documents,
+            progress.bytes, progress.seconds);
+        restore_duration_ = std::chrono::steady_clock::now() - restore_start_;
+        finished_restoring_from_disk_ = true;
+        ScheduleExpiry();
+      });
 }
 
-void FileManager::DumpOnDisk(std::string_view filepath,
-                             const ParsedDoc& document) {
-  LOG(INFO) << "write json to file: " << filepath;
+void FileManager::AddRestoredDocument(RestoredDocuments& restored,
+                                      ParsedDocPtr document, size_t bytes) {
+  auto index = GetShardIndex(document->FileName);
+  {
+    std::lock_guard<std::mutex> lock(restored.locks[index]);
+    restored.documents[index].push_back(std::move(document));
+  }
+  restored_documents_++;
+  restored_bytes_ += bytes;
+}
 
-  boost::filesystem::ofstream file(filepath.data());
-  file << document.Serialize();
-  file.close();
+bool FileManager::ReserveColdBytes(uint64_t bytes) {
+  auto used = cold_bytes_.load();
+  do {
+    if (used + bytes > cold_fields_budget_) {
+      return false;
+    }
+  } while (!cold_bytes_.compare_exchange_weak(used, used + bytes));
+  return true;
+}
 
-  boost::filesystem::path path = filepath.data();
-  VERIFY(boost::filesystem::exists(path),
-         "file has to be on disk after it's written");
+void FileManager::AccountDocument(const ParsedDoc& document, bool stored) {
+  if (stored) {
+    document_count_++;
+    resident_bytes_ += document.ResidentBytes();
+    return;
+  }
+  document_count_--;
+  resident_bytes_ -= document.ResidentBytes();
+  cold_bytes_ -= document.ColdBytes();
+}
 
-  LOG(INFO) << "written on disk: " << filepath;
+FileManager::MemoryUsage FileManager::GetMemoryUsage() const {
+  MemoryUsage usage;
+  usage.documents = document_count_.load();
+  usage.resident_bytes = resident_bytes_.load();
+  usage.cold_bytes = cold_bytes_.load();
+  usage.cold_fields_budget = cold_fields_budget_;
+  return usage;
 }
 
-void FileManager::RestoreFiles() {
-  boost::filesystem::path path = content_dir_;
+FileManager::RestoreProgress FileManager::GetRestoreProgress() const {
+  RestoreProgress progress;
+  progress.finished = finished_restoring_from_disk_.load();
+  progress.documents = restored_documents_.load();
+  progress.bytes = restored_bytes_.load();
+  auto duration = progress.finished
+                      ? restore_duration_.load()
+                      : std::chrono::steady_clock::now() - restore_start_;
+  progress.seconds = std::chrono::duration<double>(duration).count();
+  return progress;
+}
+
+void FileManager::MigrateLegacyFiles(RestoredDocuments& restored) {
+  auto context = models_ ? models_->Get() : nullptr;
+  std::vector<boost::filesystem::path> paths;
   for (const auto& entry : boost::make_iterator_range(
-           boost::filesystem::directory_iterator(path), {})) {
-    boost::filesystem::ifstream file(entry.path());
+           boost::filesystem::directory_iterator(content_dir_), {})) {
+    if (boost::filesystem::is_regular_file(entry.path())) {
+      paths.push_back(entry.path());
+    }
+  }
+
+  std::vector<std::shared_ptr<ParsedDoc>> documents(paths.size());
+  ParallelFor(&pool_, paths.size(), [&](size_t index) {
+    const auto& path = paths[index];
+    boost::filesystem::ifstream file(path);
     nlohmann::json value;
-    std::unique_ptr<ParsedDoc> document;
     try {
       file >> value;
-      document = std::make_unique<ParsedDoc>(std::move(value));
+      documents[index] = std::make_shared<ParsedDoc>(std::move(value));
     } catch (...) {
-      LOG(INFO) << "file contains invalid json: " << entry.path();
-      RemoveFileFromDisk(entry.path());
-      continue;
+      LOG(INFO) << "file contains invalid json: " << path;
+      boost::filesystem::remove(path);
+      return;
+    }
+    if (context) {
+      documents[index]->Annotate(*context, /*batched=*/true);
+    }
+  });
+  std::vector<ParsedDoc*> valid;
+  for (const auto& document : documents) {
+    if (document) {
+      valid.push_back(document.get());
     }
+  }
+  if (context) {
+    AnnotateInBatches(*context, valid);
+  }
 
-    EmplaceDocumentSync(std::move(document));
+  ParallelFor(&pool_, paths.size(), [&](size_t index) {
+    auto& document = documents[index];
+    if (!document) {
+      return;
+    }
+    // The file goes away only once its record is durable.
+    const auto& path = paths[index];
+    auto bytes = boost::filesystem::file_size(path);
+    log_->Put(document->FileName, document->ExpirationTime(),
+              SerializeDocumentRecord(*document),
+              [path](std::exception_ptr error) {
+                if (!error) {
+                  boost::filesystem::remove(path);
+                }
+              });
+    if (!ReserveColdBytes(document->ColdBytes())) {
+      document->DropColdFields();
+    }
+    AddRestoredDocument(restored, std::move(document), bytes);
+  });
+  if (!paths.empty()) {
+    LOG(INFO) << "migrated legacy files into the log: " << paths.size();
   }
+}
 
-  LOG(INFO) << "restored file count: " << document_by_name_.size();
+void FileManager::AnnotateInBatches(const Context& context,
+                                    const std::vector<ParsedDoc*>& documents) {
+  const size_t batches =
+      (documents.size() + Embedder::BatchSize - 1) / Embedder::BatchSize;
+  ParallelFor(&pool_, batches, [&](size_t index) {
+    auto begin = documents.begin() + index * Embedder::BatchSize;
+    auto end = documents.begin() +
+               std::min(documents.size(), (index + 1) * Embedder::BatchSize);
+    std::vector<ParsedDoc*> batch(begin, end);
+    ParsedDoc::DetectCategories(context, batch);
+    ParsedDoc::CalcEmbeddings(context, batch);
+  });
 }
 
-// Make sure to call it from strand.
-bool FileManager::RemoveFileFromMap(std::string filename) {
-  auto it = document_by_name_.find(filename);
-  if (it == document_by_name_.end()) {
+// Make sure to call it from the shard strand.
+bool FileManager::RemoveFileFromMap(Shard& shard,
+                                    const std::string& filename) {
+  auto it = shard.document_by_name.find(filename);
+  if (it == shard.document_by_name.end()) {
     return false;
   }
 
-  it->second->State = ParsedDoc::EState::Removed;
-
-  auto expiration_time = it->second->ExpirationTime();
-  auto* address = it->second.get();
-
-  auto document = std::move(*it->second);
-
-  documents_with_deadline_.erase({expiration_time, address});
-  document_by_name_.erase(it);
-
-  change_log_.emplace_back(std::move(document));
-
+  shard.expiration_wheel.Cancel(it->second.expiration);
+  EraseDocument(shard, it);
   return true;
 }
 
-cti::continuable<bool> FileManager::UpdateContentOrCreateDocument(
-    std::string filename, std::string content, uint64_t max_age) {
-  return cti::make_continuable<bool>([this, f = std::move(filename),
-                                      c = std::move(content), a = max_age](
-                                         cti::promise<bool> promise) mutable {
-    std::experimental::post(documents_strand_, [this, p = std::move(promise),
-                                                f = std::move(f),
-                                                c = std::move(c),
-                                                a = a]() mutable {
-      auto it = document_by_name_.find(f);
-      if (it != document_by_name_.end()) {
-        auto* document = it->second.get();
-
-        auto new_document =
-            ParsedDoc(context_, document->FileName, std::move(c), a,
-                      ParsedDoc::EState::Changed);
+void FileManager::EraseDocument(
+    Shard& shard, std::unordered_map<std::string, Entry>::iterator it) {
+  AccountDocument(*it->second.document, false);
+  change_stream_.Append(ParsedDoc::EState::Removed, it->first);
+  shard.document_by_name.erase(it);
+}
 
-        documents_with_deadline_.erase({document->ExpirationTime(), document});
+void FileManager::ScheduleExpiry() {
+  std::experimental::dispatch_after(
+      kExpiryTickPeriod, pool_.get_executor(), [this] {
+        RemoveOutdatedFiles()
+            .then([this](bool) { ScheduleExpiry(); })
+            .fail([this](std::exception_ptr ptr) {
+              try {
+                std::rethrow_exception(ptr);
+              } catch (std::exception& e) {
+                LOG(ERROR) << "expiry tick failed: " << e.what();
+              }
+              ScheduleExpiry();
+            });
+      });
+}
 
-        *document = std::move(new_document);
+cti::continuable<std::shared_ptr<ParsedDoc>> FileManager::CreateDocument(
+    std::string filename, std::string content, uint64_t max_age,
+    uint64_t content_hash) {
+  return cti::make_continuable<std::shared_ptr<ParsedDoc>>(
+      [this, filename = std::move(filename), content = std::move(content),
+       max_age = max_age, content_hash](auto promise) mutable {
+        std::experimental::post(
+            pool_, [this, p = std::move(promise), filename = std::move(filename),
+                    content = std::move(content), max_age = max_age,
+                    content_hash]() mutable {
+              std::shared_ptr<ParsedDoc> document;
+              try {
+                VERIFY(models_, "no models to parse documents with");
+                // A reload meanwhile does not change the models under it.
+                auto context = models_->Get();
+                document = std::make_shared<ParsedDoc>(
+                    context.get(), std::move(filename), content, max_age);
+                document->ContentHash = content_hash;
+              } catch (...) {
+                p.set_exception(std::current_exception());
+                return;
+              }
+              p.set_value(std::move(document));
+            });
+      });
+}
 
-        last_fetch_time_ =
-            std::max(last_fetch_time_.load(), document->FetchTime);
+bool FileManager::ReloadModels() {
+  if (!models_ || !finished_restoring_from_disk_) {
+    return false;
+  }
+  // The pool outlives this, the task posted to it does not run once it is
+  // stopped.
+  auto& pool = pool_;
+  return models_->Reload(
+      [this, &pool](std::shared_ptr<const Context> context) {
+        if (context) {
+          std::experimental::post(pool, [this, context] {
+            RescoreDocuments(std::move(context));
+          });
+        }
+      });
+}
 
-        change_log_.push_back(*document);
+FileManager::RescoreProgress FileManager::GetRescoreProgress() const {
+  RescoreProgress progress;
+  progress.version = rescore_version_.load();
+  progress.documents = rescored_documents_.load();
+  return progress;
+}
 
-        documents_with_deadline_.emplace(document->ExpirationTime(), document);
+void FileManager::RescoreDocuments(std::shared_ptr<const Context> context) {
+  LOG(INFO) << "re-scoring documents with models version "
+            << context->Version;
+  rescore_version_ = context->Version;
+  auto pass = std::make_shared<RescorePass>();
+  pass->context = std::move(context);
+  ScanShardForRescore(std::move(pass));
+}
 
-        p.set_value(true);
-        return;
+void FileManager::ScanShardForRescore(std::shared_ptr<RescorePass> pass) {
+  const uint32_t version = pass->context->Version;
+  if (models_->GetVersion() != version) {
+    // A newer reload runs its own pass.
+    return;
+  }
+  if (pass->shard == shards_.size()) {
+    if (pass->rescored > 0 || pass->skipped > 0) {
+      // Documents parsed with the older models while the pass went on may
+      // have been stored behind it, skipped ones are tried again.
+      RescoreDocuments(std::move(pass->context));
+      return;
+    }
+    LOG(INFO) << "documents re-scored with models version " << version;
+    uint32_t expected = version;
+    rescore_version_.compare_exchange_strong(expected, 0);
+    return;
+  }
+  auto& shard = *shards_[pass->shard];
+  std::experimental::post(shard.strand, [this, &shard, pass, version] {
+    pass->stale.clear();
+    pass->next = 0;
+    for (const auto& [name, entry] : shard.document_by_name) {
+      if (entry.document->Extracted &&
+          entry.document->ModelVersion != version) {
+        pass->stale.push_back(entry.document);
       }
-      auto new_document = ParsedDoc(context_, std::move(f), std::move(c), a,
-                                    ParsedDoc::EState::Added);
-      auto document_ptr = std::make_unique<ParsedDoc>(std::move(new_document));
-      EmplaceDocumentSync(std::move(document_ptr));
-      p.set_value(false);
-    });
+    }
+    std::experimental::post(pool_, [this, pass] { RescoreBatch(pass); });
   });
 }
 
-cti::continuable<ParsedDoc> FileManager::CreateDocument(
-    std::string filename, std::string content, uint64_t max_age,
-    ParsedDoc::EState state) {
-  return cti::make_continuable<ParsedDoc>(
-      [this, filename = std::move(filename), content = std::move(content),
-       max_age = max_age, state = state](auto promise) mutable {
-        std::experimental::post(
-            pool_,
-            [this, p = std::move(promise), filename = std::move(filename),
-             content = std::move(content), max_age = max_age,
-             state = state]() mutable {
-              p.set_value(ParsedDoc(context_, std::move(filename),
-                                    std::move(content), max_age, state));
-            });
+void FileManager::RescoreBatch(std::shared_ptr<RescorePass> pass) {
+  const Context& context = *pass->context;
+  if (models_->GetVersion() != context.Version) {
+    return;
+  }
+  if (pass->next == pass->stale.size()) {
+    pass->shard++;
+    pass->stale.clear();
+    ScanShardForRescore(std::move(pass));
+    return;
+  }
+
+  const size_t room = std::min(GetRescoreRoom(), kRescoreBatchSize);
+  if (room == 0) {
+    std::experimental::dispatch_after(
+        kRescoreThrottlePeriod, pool_.get_executor(),
+        [this, pass = std::move(pass)]() mutable {
+          RescoreBatch(std::move(pass));
+        });
+    return;
+  }
+  const size_t end = std::min(pass->stale.size(), pass->next + room);
+  std::vector<std::pair<ParsedDocPtr, std::shared_ptr<ParsedDoc>>> batch;
+  std::vector<ParsedDoc*> documents;
+  for (size_t i = pass->next; i < end; i++) {
+    const auto& stale = pass->stale[i];
+    std::shared_ptr<ParsedDoc> document;
+    try {
+      if (stale->HasColdFields) {
+        document = std::make_shared<ParsedDoc>(*stale);
+      } else if (auto value = log_->Get(stale->FileName)) {
+        document = std::make_shared<ParsedDoc>(DocumentRecordView(*value));
+        if (document->ContentHash != stale->ContentHash ||
+            document->FetchTime != stale->FetchTime) {
+          // The record of a later PUT, the handle is replaced on the strand
+          // soon. A later pass picks up whatever it replaces it with.
+          pass->skipped++;
+          continue;
+        }
+        // Touches may have moved the expiration since.
+        document->MaxAge = stale->MaxAge;
+      } else {
+        continue;
+      }
+      document->ResetAnnotation();
+      document->Annotate(context, /*batched=*/true);
+    } catch (std::exception& e) {
+      LOG(ERROR) << "unable to re-score " << stale->FileName << ": "
+                 << e.what();
+      continue;
+    }
+    documents.push_back(document.get());
+    batch.emplace_back(stale, std::move(document));
+  }
+  ParsedDoc::DetectCategories(context, documents);
+  ParsedDoc::CalcEmbeddings(context, documents);
+  pass->next = end;
+
+  // Serialized here so that the strand only swaps and queues the records.
+  std::vector<std::string> records;
+  for (auto& [stale, document] : batch) {
+    records.push_back(SerializeDocumentRecord(*document));
+    if (!stale->HasColdFields) {
+      document->DropColdFields();
+    }
+  }
+  auto& shard = *shards_[pass->shard];
+  std::experimental::post(
+      shard.strand, [this, &shard, pass, batch = std::move(batch),
+                     records = std::move(records)]() mutable {
+        for (size_t i = 0; i < batch.size(); i++) {
+          auto& [stale, document] = batch[i];
+          auto it = shard.document_by_name.find(stale->FileName);
+          if (it == shard.document_by_name.end()) {
+            // Removed meanwhile.
+            continue;
+          }
+          if (it->second.document != stale) {
+            // Updated meanwhile, maybe with a document of older models.
+            pass->skipped++;
+            continue;
+          }
+          // Cold fields are kept by the documents that had them, their
+          // bytes move over.
+          EmplaceDocumentSync(shard, document, it->second.sequence);
+          cold_bytes_ += document->ColdBytes();
+          log_->Put(document->FileName, document->ExpirationTime(),
+                    records[i]);
+          pass->rescored++;
+          rescored_documents_++;
+        }
+        // Requests queued meanwhile go first.
+        std::experimental::post(pool_, [this, pass] { RescoreBatch(pass); });
       });
 }
 
-void FileManager::RemoveFileFromDisk(boost::filesystem::path filepath) {
-  LOG(INFO) << fmt::format("removing file from disk {0}: {1}",
-                           filepath.string(),
-                           boost::filesystem::remove(filepath));
+size_t FileManager::GetRescoreRoom() const {
+  const uint64_t limit = std::max<uint64_t>(change_stream_.Capacity() / 2, 1);
+  uint64_t lag = 0;
+  for (const auto& cursor : change_stream_.GetCursors()) {
+    lag = std::max(lag, cursor.lag);
+  }
+  return lag < limit ? limit - lag : 0;
+}
+
+void FileManager::CompactLog(uint64_t now) {
+  try {
+    log_->Compact(now);
+  } catch (std::exception& e) {
+    LOG(ERROR) << "log compaction failed: " << e.what();
+  }
+}
+
+void FileManager::UpdateLastFetchTime(uint64_t fetch_time) {
+  auto current = last_fetch_time_.load();
+  while (current < fetch_time &&
+         !last_fetch_time_.compare_exchange_weak(current, fetch_time)) {
+  }
 }
 
 }  // namespace tgnews
@@ -7,19 +7,24 @@
 #include <experimental/future>
 #include <experimental/strand>
 #include <experimental/thread_pool>
+#include <experimental/timer>
 #include <limits>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
-#include <set>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
 #include "base/base.h"
+#include "base/change_stream.h"
 #include "base/context.h"
+#include "base/model_registry.h"
 #include "base/parsed_document.h"
+#include "base/segment_log.h"
 #include "base/time_helpers.h"
+#include "base/timing_wheel.h"
 #include "fmt/format.h"
 #include "glog/logging.h"
 #include "third_party/nlohmann_json/single_include/nlohmann/json.hpp"
@@ -28,8 +33,29 @@ namespace tgnews {
 
 class FileManager {
  public:
-  explicit FileManager(std::experimental::thread_pool& pool, Context* context,
-                       std::string content_dir = "content");
+  static constexpr size_t kDefaultShardCount = 16;
+  static constexpr std::chrono::seconds kExpiryTickPeriod{1};
+  static constexpr uint64_t kDefaultColdFieldsBudget = 256 << 20;
+  // Documents re-scored by one pool task after a model reload.
+  static constexpr size_t kRescoreBatchSize = 256;
+  // How often a re-scoring pass held back by a change stream reader checks
+  // whether the reader caught up.
+  static constexpr std::chrono::milliseconds kRescoreThrottlePeriod{100};
+
+  // Cold fields of stored documents stay in memory while their total size
+  // is within cold_fields_budget bytes, later documents keep the hot fields
+  // only.
+  // Documents are annotated with the current models at the time, null
+  // models leave them as they are. The change stream keeps the last
+  // change_stream_capacity changes.
+  explicit FileManager(std::experimental::thread_pool& pool,
+                       ModelRegistry* models,
+                       std::string content_dir = "content",
+                       size_t shard_count = kDefaultShardCount,
+                       SegmentLog::Options log_options = {},
+                       uint64_t cold_fields_budget = kDefaultColdFieldsBudget,
+                       size_t change_stream_capacity =
+                           ChangeStream::kDefaultCapacity);
 
   ~FileManager();
 
@@ -39,49 +65,261 @@ class FileManager {
 
   cti::continuable<bool> RemoveFile(std::string filename);
 
+  // Drops documents whose fetch time plus max age is not later than the
+  // latest fetch time seen. Runs every kExpiryTickPeriod once restored.
   cti::continuable<bool> RemoveOutdatedFiles();
 
-  cti::continuable<std::vector<ParsedDoc>> GetDocuments();
+  cti::continuable<std::vector<ParsedDocPtr>> GetDocuments();
+
+  // The stored document with every field, read from the log if the cold
+  // ones were dropped. Null if there is no such document.
+  cti::continuable<ParsedDocPtr> LoadDocument(std::string filename);
+
+  // Every change of the stored documents, restored ones included, in the
+  // order they were applied.
+  ChangeStream& GetChangeStream() { return change_stream_; }
 
-  cti::continuable<std::vector<ParsedDoc>> FetchChangeLog();
+  // The documents the events name as they are now, one change per name in
+  // the order of their last events. A name no longer stored is removed.
+  cti::continuable<std::vector<DocumentChange>> GetChanges(
+      std::vector<ChangeEvent> events);
 
   bool FinishedRestoringFromDisk() const {
     return finished_restoring_from_disk_.load();
   }
 
+  // PUTs answered without parsing: same content as the stored document or
+  // as a PUT of the same name in flight.
+  uint64_t DedupHits() const { return dedup_hits_.load(); }
+
+  // Null without models.
+  const ModelRegistry* GetModels() const { return models_; }
+
+  // Loads the next version of the models in the background. Once it is
+  // current, stored documents scored with older ones are annotated again,
+  // a batch per pool task, and replace them like an update would. False
+  // while restoring, without models or with a reload running already.
+  bool ReloadModels();
+
+  struct RescoreProgress {
+    // Version the documents are re-scored with, 0 if none are.
+    uint32_t version = 0;
+    uint64_t documents = 0;
+  };
+
+  RescoreProgress GetRescoreProgress() const;
+
+  struct RestoreProgress {
+    bool finished = false;
+    uint64_t documents = 0;
+    uint64_t bytes = 0;
+    // Since start, or the whole restore once finished.
+    double seconds = 0;
+  };
+
+  RestoreProgress GetRestoreProgress() const;
+
+  struct MemoryUsage {
+    uint64_t documents = 0;
+    // ParsedDoc::ResidentBytes of the stored documents.
+    uint64_t resident_bytes = 0;
+    uint64_t cold_bytes = 0;
+    uint64_t cold_fields_budget = 0;
+  };
+
+  MemoryUsage GetMemoryUsage() const;
+
  private:
-  cti::continuable<bool> EmplaceDocument(std::unique_ptr<ParsedDoc> document);
+  // Documents are spread over shards by filename hash. Everything inside a
+  // shard is touched from its strand only, parsing happens outside of it.
+  using ExpirationWheel = TimingWheel<const ParsedDoc*>;
+
+  struct Entry {
+    ParsedDocPtr document;
+    ExpirationWheel::Handle expiration = ExpirationWheel::kInvalidHandle;
+    // Of the PUT that stored the document, 0 if it was restored.
+    uint64_t sequence = 0;
+  };
+
+  // Identical PUTs of a name waiting for one parse.
+  struct PendingPut {
+    // Order of the PUT among the changes accepted by its shard.
+    uint64_t sequence = 0;
+    uint64_t content_hash = 0;
+    uint64_t max_age = 0;
+    std::vector<cti::promise<bool>> waiters;
+  };
+
+  // PUTs of a name being parsed. Parses finish in any order, so a result is
+  // only stored if no PUT or DELETE accepted after it got there first.
+  struct PendingPuts {
+    // The last accepted one, identical PUTs after it wait for it.
+    std::shared_ptr<PendingPut> last;
+    size_t count = 0;
+    // Sequence of the last DELETE of the name accepted meanwhile.
+    uint64_t removed = 0;
+  };
+
+  struct Shard {
+    explicit Shard(std::experimental::thread_pool& pool)
+        : strand(pool.get_executor()) {}
+
+    std::experimental::strand<std::experimental::thread_pool::executor_type>
+        strand;
+    std::unordered_map<std::string, Entry> document_by_name;
+    ExpirationWheel expiration_wheel;
+    std::unordered_map<std::string, PendingPuts> pending_puts;
+    uint64_t next_sequence = 0;
+  };
+
+  size_t GetShardIndex(const std::string& filename) const;
+
+  Shard& GetShard(const std::string& filename);
+
+  // Sets the value on the pool once the log record is written, a failed
+  // write is passed on as the exception.
+  template <typename Promise, typename Value>
+  SegmentLog::Callback AnswerWhenWritten(std::shared_ptr<Promise> promise,
+                                         Value value);
 
-  void EmplaceDocumentSync(std::unique_ptr<ParsedDoc> document);
+  // Runs handler(shard_index, shard) on every shard strand and calls done()
+  // after the last one finished.
+  template <typename Handler, typename Done>
+  void ForEachShard(Handler handler, Done done);
 
-  void DumpOnDisk(std::string_view filepath, const ParsedDoc& document);
+  // Concatenates collect(shard) results of all shards.
+  template <typename T, typename Collect>
+  cti::continuable<std::vector<T>> CollectFromShards(Collect collect);
 
+  // Make sure to call it from the shard strand. If the stored document has
+  // the same content and no other PUT of the name is pending, refreshes its
+  // expiration, answers and returns true.
+  bool RefreshIfUnchanged(Shard& shard, const std::string& filename,
+                          uint64_t content_hash, uint64_t max_age,
+                          cti::promise<bool>& promise);
+
+  // Calls answer(waiter, is_first) for every waiter from the shard strand.
+  template <typename Answer>
+  void FinishPendingPut(Shard& shard, const std::string& filename,
+                        std::shared_ptr<PendingPut> put, Answer answer);
+
+  // Serializes the document and drops its cold fields unless they fit into
+  // the budget. The document of the PUT with `sequence` is dropped if a
+  // later change of the name was applied already.
+  cti::continuable<bool> EmplaceDocument(std::shared_ptr<ParsedDoc> document,
+                                         uint64_t sequence);
+
+  // Make sure to call it from the shard strand. Returns true if a document
+  // with the same name was replaced.
+  bool EmplaceDocumentSync(Shard& shard, ParsedDocPtr document,
+                           uint64_t sequence = 0);
+
+  // Documents decoded by restore workers, merged into the shards at the end.
+  struct RestoredDocuments {
+    explicit RestoredDocuments(size_t shard_count)
+        : documents(shard_count), locks(shard_count) {}
+
+    std::vector<std::vector<ParsedDocPtr>> documents;
+    std::vector<std::mutex> locks;
+  };
+
+  // Reads and decodes on the whole pool, then fills every shard from its
+  // strand.
   void RestoreFiles();
 
-  // Make sure to call it from strand.
-  bool RemoveFileFromMap(std::string filename);
+  void AddRestoredDocument(RestoredDocuments& restored, ParsedDocPtr document,
+                           size_t bytes);
+
+  // Takes `bytes` out of the cold fields budget if they fit.
+  bool ReserveColdBytes(uint64_t bytes);
+
+  // Make sure to call it from the shard strand whenever a document enters or
+  // leaves the map.
+  void AccountDocument(const ParsedDoc& document, bool stored);
+
+  // Moves documents stored one json file each by older builds into the log.
+  void MigrateLegacyFiles(RestoredDocuments& restored);
+
+  // Categorizes and embeds documents annotated with batched = true, batches
+  // of them at once on the whole pool.
+  void AnnotateInBatches(const Context& context,
+                         const std::vector<ParsedDoc*>& documents);
+
+  // A pass over the shards re-scoring documents of older models, one shard
+  // after another.
+  struct RescorePass {
+    std::shared_ptr<const Context> context;
+    size_t shard = 0;
+    // Stale documents of the shard, the ones before `next` are done.
+    std::vector<ParsedDocPtr> stale;
+    size_t next = 0;
+    uint64_t rescored = 0;
+    // Documents replaced by a PUT while they were re-scored.
+    uint64_t skipped = 0;
+  };
+
+  void RescoreDocuments(std::shared_ptr<const Context> context);
+
+  // Collects the stale documents of the pass's shard on its strand.
+  void ScanShardForRescore(std::shared_ptr<RescorePass> pass);
+
+  // Re-scores the next batch of the shard on the calling pool thread and
+  // swaps the results in on the strand, then posts the batch after it.
+  void RescoreBatch(std::shared_ptr<RescorePass> pass);
+
+  // Documents a re-scoring batch may replace now. Every one is a change, and
+  // a stream reader left behind by more than the stream keeps loses them
+  // and starts over from all the documents. The pass keeps the slowest
+  // reader within half of the stream, the other half is for the PUTs.
+  size_t GetRescoreRoom() const;
+
+  // Reads the record of the handle the strand has for filename. Starts over
+  // when the record does not match the handle, unless the handle is still
+  // previous: then the record is lost and the promise fails.
+  void LoadDocument(std::string filename,
+                    std::shared_ptr<cti::promise<ParsedDocPtr>> promise,
+                    ParsedDocPtr previous);
+
+  // Make sure to call it from the shard strand.
+  bool RemoveFileFromMap(Shard& shard, const std::string& filename);
+
+  // Make sure to call it from the shard strand. The expiration timer has to
+  // be cancelled or fired already.
+  void EraseDocument(Shard& shard,
+                     std::unordered_map<std::string, Entry>::iterator it);
+
+  void ScheduleExpiry();
 
-  cti::continuable<bool> UpdateContentOrCreateDocument(std::string filename,
-                                                       std::string content,
-                                                       uint64_t max_age);
+  cti::continuable<std::shared_ptr<ParsedDoc>> CreateDocument(
+      std::string filename, std::string content, uint64_t max_age,
+      uint64_t content_hash);
 
-  cti::continuable<ParsedDoc> CreateDocument(std::string filename,
-                                             std::string content,
-                                             uint64_t max_age,
-                                             ParsedDoc::EState state);
+  void CompactLog(uint64_t now);
 
-  void RemoveFileFromDisk(boost::filesystem::path filepath);
+  void UpdateLastFetchTime(uint64_t fetch_time);
 
  private:
-  Context* context_;
+  ModelRegistry* models_;
   std::string content_dir_;
+  // Put and delete records of a name are appended from its shard strand, so
+  // the log keeps the same order as the map.
+  std::unique_ptr<SegmentLog> log_;
+  // Appended from the shard strands right after the map changes.
+  ChangeStream change_stream_;
   std::atomic<uint64_t> last_fetch_time_ = 0;
-  std::vector<ParsedDoc> change_log_;
-  std::unordered_map<std::string, std::unique_ptr<ParsedDoc>> document_by_name_;
-  std::set<std::pair<uint64_t, ParsedDoc*>> documents_with_deadline_;
-  std::experimental::strand<std::experimental::thread_pool::executor_type>
-      documents_strand_;
+  std::vector<std::unique_ptr<Shard>> shards_;
   std::atomic<bool> finished_restoring_from_disk_ = false;
+  std::atomic<uint64_t> dedup_hits_ = 0;
+  const uint64_t cold_fields_budget_;
+  std::atomic<uint64_t> cold_bytes_ = 0;
+  std::atomic<uint64_t> resident_bytes_ = 0;
+  std::atomic<uint64_t> document_count_ = 0;
+  std::atomic<uint64_t> restored_documents_ = 0;
+  std::atomic<uint64_t> restored_bytes_ = 0;
+  std::atomic<uint32_t> rescore_version_ = 0;
+  std::atomic<uint64_t> rescored_documents_ = 0;
+  const std::chrono::steady_clock::time_point restore_start_;
+  std::atomic<std::chrono::steady_clock::duration> restore_duration_{};
   std::experimental::thread_pool& pool_;
 };
 
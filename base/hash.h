@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+namespace tgnews {
+
+namespace details {
+
+inline uint64_t Mix(uint64_t lhs, uint64_t rhs) {
+  __uint128_t product = static_cast<__uint128_t>(lhs) * rhs;
+  return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+}
+
+inline uint64_t Load(const char* data) {
+  uint64_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+}  // namespace details
+
+// Fast non-cryptographic 64-bit hash, 16 bytes per multiplication. The
+// value is persisted, so it must not change between builds.
+inline uint64_t HashBytes(std::string_view data, uint64_t seed = 0) {
+  constexpr uint64_t kPrime0 = 0xa0761d6478bd642full;
+  constexpr uint64_t kPrime1 = 0xe7037ed1a0b428dbull;
+  constexpr uint64_t kPrime2 = 0x8ebc6af09c88c6e3ull;
+
+  const char* p = data.data();
+  size_t size = data.size();
+  uint64_t hash = seed ^ kPrime0;
+  for (; size >= 16; p += 16, size -= 16) {
+    hash = details::Mix(details::Load(p) ^ kPrime1,
+                        details::Load(p + 8) ^ hash);
+  }
+  if (size >= 8) {
+    hash = details::Mix(details::Load(p) ^ kPrime1, hash ^ kPrime2);
+    p += 8;
+    size -= 8;
+  }
+  uint64_t tail = 0;
+  std::memcpy(&tail, p, size);
+  hash = details::Mix(tail ^ kPrime2, hash ^ kPrime1);
+  return details::Mix(hash ^ kPrime0, data.size() ^ kPrime1);
+}
+
+}  // namespace tgnews
@@ -0,0 +1,635 @@
+#include "base/html_extractor.h"
+
+#include <third_party/tinyxml2/tinyxml2.h>
+
+#include <cctype>
+#include <cstring>
+#include <ctime>
+#include <sstream>
+#include <stdexcept>
+
+#include "base/parsed_document.h"
+
+namespace {
+
+// Same nesting limit as TINYXML2_MAX_ELEMENT_DEPTH.
+constexpr size_t kMaxElementDepth = 100;
+
+uint64_t DateToTimestamp(const std::string& date) {
+  std::stringstream ss(date);
+  char sep;
+  std::tm t = {};
+  ss >> t.tm_year;
+  t.tm_year -= 1900;
+  ss >> sep;
+  if (sep != '-') {
+    throw std::runtime_error("wrong date format");
+  }
+  ss >> t.tm_mon;
+  t.tm_mon -= 1;
+  ss >> sep;
+  if (sep != '-') {
+    throw std::runtime_error("wrong date format");
+  }
+  ss >> t.tm_mday;
+  ss >> sep;
+  if (sep != 'T') {
+    throw std::runtime_error("wrong date format");
+  }
+  ss >> t.tm_hour;
+  ss >> sep;
+  if (sep != ':') {
+    throw std::runtime_error("wrong date format");
+  }
+  ss >> t.tm_min;
+  ss >> sep;
+  if (sep != ':') {
+    throw std::runtime_error("wrong date format");
+  }
+  ss >> t.tm_sec;
+  char p;
+  ss >> p;
+  if (p != '+' && p != '-') {
+    throw std::runtime_error("wrong date format");
+  }
+  int h_z, h_m;
+  ss >> h_z >> sep >> h_m;
+  time_t timestamp = timegm(&t);
+  uint64_t zone_ts = h_z * 60 * 60 + h_m * 60;
+  if (p == '+') {
+    timestamp = timestamp - zone_ts;
+  } else if (p == '-') {
+    timestamp = timestamp + zone_ts;
+  }
+  return timestamp > 0 ? timestamp : 0;
+}
+
+// tinyxml2 drops the whole tree on any syntax error.
+[[noreturn]] void Fail() {
+  throw std::runtime_error("Parser error: no html tag");
+}
+
+bool IsWhiteSpace(char ch) {
+  return !(ch & 0x80) && std::isspace(static_cast<unsigned char>(ch));
+}
+
+bool IsNameStartChar(unsigned char ch) {
+  return ch >= 128 || std::isalpha(ch) || ch == ':' || ch == '_';
+}
+
+bool IsNameChar(unsigned char ch) {
+  return IsNameStartChar(ch) || std::isdigit(ch) || ch == '.' || ch == '-';
+}
+
+const char* SkipWhiteSpace(const char* p, const char* end) {
+  while (p != end && IsWhiteSpace(*p)) {
+    ++p;
+  }
+  return p;
+}
+
+bool StartsWith(const char* p, const char* end, std::string_view prefix) {
+  return static_cast<size_t>(end - p) >= prefix.size() &&
+         std::memcmp(p, prefix.data(), prefix.size()) == 0;
+}
+
+// Returns the position right after `terminator` or nullptr.
+const char* SkipPast(const char* p, const char* end,
+                     std::string_view terminator) {
+  std::string_view rest(p, end - p);
+  size_t pos = rest.find(terminator);
+  if (pos == std::string_view::npos) {
+    return nullptr;
+  }
+  return p + pos + terminator.size();
+}
+
+std::string_view ParseName(const char*& p, const char* end) {
+  if (p == end || !IsNameStartChar(*p)) {
+    return {};
+  }
+  const char* start = p++;
+  while (p != end && IsNameChar(*p)) {
+    ++p;
+  }
+  return std::string_view(start, p - start);
+}
+
+void AppendUtf8(unsigned long ucs, std::string& out) {
+  if (ucs < 0x80) {
+    out.push_back(static_cast<char>(ucs));
+  } else if (ucs < 0x800) {
+    out.push_back(static_cast<char>(0xC0 | (ucs >> 6)));
+    out.push_back(static_cast<char>(0x80 | (ucs & 0x3F)));
+  } else if (ucs < 0x10000) {
+    out.push_back(static_cast<char>(0xE0 | (ucs >> 12)));
+    out.push_back(static_cast<char>(0x80 | ((ucs >> 6) & 0x3F)));
+    out.push_back(static_cast<char>(0x80 | (ucs & 0x3F)));
+  } else if (ucs < 0x200000) {
+    out.push_back(static_cast<char>(0xF0 | (ucs >> 18)));
+    out.push_back(static_cast<char>(0x80 | ((ucs >> 12) & 0x3F)));
+    out.push_back(static_cast<char>(0x80 | ((ucs >> 6) & 0x3F)));
+    out.push_back(static_cast<char>(0x80 | (ucs & 0x3F)));
+  }
+}
+
+enum class ECharRef { Invalid, Skip, Decoded };
+
+// Mirrors XMLUtil::GetCharacterRef: `raw[pos]` is '&' followed by '#'.
+ECharRef ReadCharacterRef(std::string_view raw, size_t pos, size_t& next,
+                          unsigned long& ucs) {
+  if (pos + 2 >= raw.size()) {
+    next = pos + 1;
+    return ECharRef::Skip;
+  }
+  ucs = 0;
+  unsigned long mult = 1;
+  bool hex = raw[pos + 2] == 'x';
+  size_t digits_begin = pos + (hex ? 3 : 2);
+  if (hex && digits_begin >= raw.size()) {
+    return ECharRef::Invalid;
+  }
+  size_t semicolon = raw.find(';', digits_begin);
+  if (semicolon == std::string_view::npos) {
+    return ECharRef::Invalid;
+  }
+  for (size_t i = semicolon; i > digits_begin; --i) {
+    char ch = raw[i - 1];
+    unsigned digit = 0;
+    if (ch >= '0' && ch <= '9') {
+      digit = ch - '0';
+    } else if (hex && ch >= 'a' && ch <= 'f') {
+      digit = ch - 'a' + 10;
+    } else if (hex && ch >= 'A' && ch <= 'F') {
+      digit = ch - 'A' + 10;
+    } else {
+      return ECharRef::Invalid;
+    }
+    ucs += mult * digit;
+    mult *= hex ? 16 : 10;
+  }
+  next = semicolon + 1;
+  return ECharRef::Decoded;
+}
+
+// Appends the value of a tinyxml2 string (text or attribute) to `out`,
+// following StrPair::GetStr: newline normalization and, if asked, entity
+// processing. Quirks are kept on purpose: an unknown named entity copies the
+// byte the in-place decoder would have left behind and a decoded NUL ends
+// the value.
+void AppendDecoded(std::string_view raw, bool process_entities,
+                   std::string& out) {
+  static constexpr std::pair<std::string_view, char> kEntities[] = {
+      {"quot", '"'}, {"amp", '&'}, {"apos", '\''}, {"lt", '<'}, {"gt", '>'}};
+
+  const size_t base = out.size();
+  size_t p = 0;
+  while (p < raw.size()) {
+    char ch = raw[p];
+    if (ch == '\r') {
+      p += (p + 1 < raw.size() && raw[p + 1] == '\n') ? 2 : 1;
+      out.push_back('\n');
+    } else if (ch == '\n') {
+      p += (p + 1 < raw.size() && raw[p + 1] == '\r') ? 2 : 1;
+      out.push_back('\n');
+    } else if (process_entities && ch == '&') {
+      if (p + 1 < raw.size() && raw[p + 1] == '#') {
+        size_t next = p + 1;
+        unsigned long ucs = 0;
+        switch (ReadCharacterRef(raw, p, next, ucs)) {
+          case ECharRef::Invalid:
+            out.push_back(ch);
+            ++p;
+            break;
+          case ECharRef::Skip:
+            p = next;
+            break;
+          case ECharRef::Decoded:
+            if (ucs == 0) {
+              return;
+            }
+            AppendUtf8(ucs, out);
+            p = next;
+            break;
+        }
+        continue;
+      }
+      bool found = false;
+      for (const auto& [pattern, value] : kEntities) {
+        if (raw.compare(p + 1, pattern.size(), pattern) == 0 &&
+            p + pattern.size() + 1 < raw.size() &&
+            raw[p + pattern.size() + 1] == ';') {
+          out.push_back(value);
+          p += pattern.size() + 2;
+          found = true;
+          break;
+        }
+      }
+      if (!found) {
+        out.push_back(raw[out.size() - base]);
+        ++p;
+      }
+    } else {
+      out.push_back(ch);
+      ++p;
+    }
+  }
+}
+
+void AssignDecoded(std::string_view raw, std::string& out) {
+  out.clear();
+  AppendDecoded(raw, /*process_entities =*/true, out);
+}
+
+std::string GetFullText(const tinyxml2::XMLElement* element) {
+  if (const tinyxml2::XMLText* textNode = element->ToText()) {
+    return textNode->Value();
+  }
+  std::string text;
+  const tinyxml2::XMLNode* node = element->FirstChild();
+  while (node) {
+    if (const tinyxml2::XMLElement* elementNode = node->ToElement()) {
+      text += GetFullText(elementNode);
+    } else if (const tinyxml2::XMLText* textNode = node->ToText()) {
+      text += textNode->Value();
+    }
+    node = node->NextSibling();
+  }
+  return text;
+}
+
+}  // namespace
+
+namespace tgnews {
+
+bool HtmlExtractor::Extract(std::string_view html, ParsedDoc& doc) {
+  Reset();
+
+  // tinyxml2 gets a C string, so anything after a NUL is ignored.
+  html = html.substr(0, html.find('\0'));
+  const char* p = html.data();
+  const char* const end = p + html.size();
+
+  p = SkipWhiteSpace(p, end);
+  if (StartsWith(p, end, "\xEF\xBB\xBF")) {
+    p += 3;
+  }
+  if (p == end) {
+    Fail();
+  }
+
+  while (!stopped_) {
+    const char* start = p;
+    p = SkipWhiteSpace(p, end);
+    if (p == end) {
+      if (!stack_.empty()) {
+        Fail();
+      }
+      break;
+    }
+    if (*p != '<') {
+      const char* text_end =
+          static_cast<const char*>(std::memchr(p, '<', end - p));
+      if (!text_end) {
+        Fail();
+      }
+      OnText(std::string_view(start, text_end - start), /*cdata =*/false,
+             doc);
+      p = text_end;
+    } else if (StartsWith(p, end, "<?")) {
+      p = SkipPast(p + 2, end, "?>");
+      // Declarations are only allowed at the very top of the document.
+      if (!p || !stack_.empty() || top_level_non_declaration_) {
+        Fail();
+      }
+    } else if (StartsWith(p, end, "<!--")) {
+      p = SkipPast(p + 4, end, "-->");
+      if (!p) {
+        Fail();
+      }
+      OnNode();
+    } else if (StartsWith(p, end, "<![CDATA[")) {
+      const char* text_start = p + 9;
+      p = SkipPast(text_start, end, "]]>");
+      if (!p) {
+        Fail();
+      }
+      OnText(std::string_view(text_start, p - 3 - text_start),
+             /*cdata =*/true, doc);
+    } else if (StartsWith(p, end, "<!")) {
+      p = SkipPast(p + 2, end, ">");
+      if (!p) {
+        Fail();
+      }
+      OnNode();
+    } else {
+      p = ParseTag(p + 1, end, doc);
+    }
+  }
+
+  if (!has_html_) {
+    throw std::runtime_error("Parser error: no html tag");
+  }
+  if (!has_head_) {
+    throw std::runtime_error("Parser error: no head");
+  }
+  if (!has_meta_) {
+    throw std::runtime_error("Parser error: no meta");
+  }
+  for (auto raw : published_times_) {
+    AssignDecoded(raw, scratch_);
+    doc.FetchTime = DateToTimestamp(scratch_);
+  }
+  if (!has_body_) {
+    throw std::runtime_error("Parser error: no body");
+  }
+  if (!has_article_) {
+    throw std::runtime_error("Parser error: no article");
+  }
+  if (!has_address_) {
+    return false;
+  }
+  if (pub_time_.data()) {
+    AssignDecoded(pub_time_, scratch_);
+    doc.PubTime = DateToTimestamp(scratch_);
+  }
+  return true;
+}
+
+void HtmlExtractor::Reset() {
+  stack_.clear();
+  attributes_.clear();
+  published_times_.clear();
+  pub_time_ = {};
+  top_level_non_declaration_ = false;
+  stopped_ = false;
+  in_paragraph_ = false;
+  has_html_ = false;
+  has_head_ = false;
+  has_meta_ = false;
+  has_body_ = false;
+  has_article_ = false;
+  has_address_ = false;
+  has_time_ = false;
+  has_address_link_ = false;
+}
+
+const char* HtmlExtractor::ParseTag(const char* p, const char* end,
+                                    ParsedDoc& doc) {
+  p = SkipWhiteSpace(p, end);
+  bool closing = false;
+  if (p != end && *p == '/') {
+    closing = true;
+    ++p;
+  }
+  std::string_view name = ParseName(p, end);
+  if (name.empty()) {
+    Fail();
+  }
+
+  attributes_.clear();
+  bool self_closed = false;
+  while (true) {
+    p = SkipWhiteSpace(p, end);
+    if (p == end) {
+      Fail();
+    }
+    if (IsNameStartChar(*p)) {
+      std::string_view attribute_name = ParseName(p, end);
+      p = SkipWhiteSpace(p, end);
+      if (p == end || *p != '=') {
+        Fail();
+      }
+      p = SkipWhiteSpace(p + 1, end);
+      if (p == end || (*p != '"' && *p != '\'')) {
+        Fail();
+      }
+      const char* value_start = p + 1;
+      const char* value_end = static_cast<const char*>(
+          std::memchr(value_start, *p, end - value_start));
+      if (!value_end || FindAttribute(attribute_name).data()) {
+        Fail();
+      }
+      attributes_.push_back(
+          {attribute_name,
+           std::string_view(value_start, value_end - value_start)});
+      p = value_end + 1;
+    } else if (*p == '>') {
+      ++p;
+      break;
+    } else if (*p == '/' && p + 1 != end && p[1] == '>') {
+      // tinyxml2 treats "</name/>" as a sealed element, not a closing tag.
+      p += 2;
+      self_closed = true;
+      closing = false;
+      break;
+    } else {
+      Fail();
+    }
+  }
+
+  if (closing) {
+    if (stack_.empty()) {
+      // A stray closing tag ends parsing of the document without an error.
+      stopped_ = true;
+      return p;
+    }
+    if (stack_.back().name != name) {
+      Fail();
+    }
+    OnClose(doc);
+    return p;
+  }
+
+  OnNode();
+  // The document node counts as a level of its own.
+  if (!self_closed && stack_.size() + 2 >= kMaxElementDepth) {
+    Fail();
+  }
+  OnOpen(name, doc);
+  if (self_closed) {
+    OnClose(doc);
+  }
+  return p;
+}
+
+void HtmlExtractor::OnNode() {
+  if (stack_.empty()) {
+    top_level_non_declaration_ = true;
+    return;
+  }
+  // Comments are children too: GetText() of an element starting with one is
+  // null.
+  stack_.back().first_child_seen = true;
+}
+
+void HtmlExtractor::OnText(std::string_view raw, bool cdata, ParsedDoc& doc) {
+  if (!stack_.empty() && stack_.back().role == ERole::AuthorLink &&
+      !stack_.back().first_child_seen) {
+    doc.Author.clear();
+    AppendDecoded(raw, !cdata, doc.Author);
+  }
+  OnNode();
+  if (in_paragraph_) {
+    AppendDecoded(raw, !cdata, doc.Text);
+  }
+}
+
+void HtmlExtractor::OnOpen(std::string_view name, ParsedDoc& doc) {
+  ERole parent = stack_.empty() ? ERole::Other : stack_.back().role;
+  ERole role = ERole::Other;
+  if (stack_.empty()) {
+    if (name == "html" && !has_html_) {
+      has_html_ = true;
+      role = ERole::Html;
+    }
+  } else if (parent == ERole::Html) {
+    if (name == "head" && !has_head_) {
+      has_head_ = true;
+      role = ERole::Head;
+    } else if (name == "body" && !has_body_) {
+      has_body_ = true;
+      role = ERole::Body;
+    }
+  } else if (parent == ERole::Head && name == "meta") {
+    has_meta_ = true;
+    std::string_view property = FindAttribute("property");
+    std::string_view content = FindAttribute("content");
+    if (property.data() && content.data()) {
+      AssignDecoded(property, scratch_);
+      if (scratch_ == "og:title") {
+        AssignDecoded(content, doc.Title);
+      } else if (scratch_ == "og:url") {
+        AssignDecoded(content, doc.Url);
+      } else if (scratch_ == "og:site_name") {
+        AssignDecoded(content, scratch_);
+        doc.SiteId = GlobalStringPool().Intern(scratch_);
+      } else if (scratch_ == "og:description") {
+        AssignDecoded(content, doc.Description);
+      } else if (scratch_ == "article:published_time") {
+        published_times_.push_back(content);
+      }
+    }
+  } else if (parent == ERole::Body && name == "article" && !has_article_) {
+    has_article_ = true;
+    role = ERole::Article;
+  } else if (parent == ERole::Article) {
+    if (name == "p") {
+      role = ERole::Paragraph;
+      in_paragraph_ = true;
+    } else if (name == "address" && !has_address_) {
+      has_address_ = true;
+      role = ERole::Address;
+    }
+  } else if (parent == ERole::Address) {
+    if (name == "time" && !has_time_) {
+      has_time_ = true;
+      pub_time_ = FindAttribute("datetime");
+    } else if (name == "a" && !has_address_link_) {
+      has_address_link_ = true;
+      std::string_view rel = FindAttribute("rel");
+      if (rel.data()) {
+        AssignDecoded(rel, scratch_);
+        if (scratch_ == "author") {
+          role = ERole::AuthorLink;
+        }
+      }
+    }
+  }
+  stack_.push_back({name, role});
+}
+
+void HtmlExtractor::OnClose(ParsedDoc& doc) {
+  if (stack_.back().role == ERole::Paragraph) {
+    doc.Text += "\n";
+    in_paragraph_ = false;
+  }
+  stack_.pop_back();
+}
+
+std::string_view HtmlExtractor::FindAttribute(std::string_view name) const {
+  for (const auto& attribute : attributes_) {
+    if (attribute.name == name) {
+      return attribute.value;
+    }
+  }
+  return {};
+}
+
+bool ExtractWithDom(const std::string& html, ParsedDoc& doc) {
+  tinyxml2::XMLDocument originalDoc;
+  originalDoc.Parse(html.data());
+  const tinyxml2::XMLElement* htmlElement =
+      originalDoc.FirstChildElement("html");
+  if (!htmlElement) {
+    throw std::runtime_error("Parser error: no html tag");
+  }
+  const tinyxml2::XMLElement* headElement =
+      htmlElement->FirstChildElement("head");
+  if (!headElement) {
+    throw std::runtime_error("Parser error: no head");
+  }
+  const tinyxml2::XMLElement* metaElement =
+      headElement->FirstChildElement("meta");
+  if (!metaElement) {
+    throw std::runtime_error("Parser error: no meta");
+  }
+  while (metaElement != 0) {
+    const char* property = metaElement->Attribute("property");
+    const char* content = metaElement->Attribute("content");
+    if (content == nullptr || property == nullptr) {
+      metaElement = metaElement->NextSiblingElement("meta");
+      continue;
+    }
+    if (std::strcmp(property, "og:title") == 0) {
+      doc.Title = content;
+    }
+    if (std::strcmp(property, "og:url") == 0) {
+      doc.Url = content;
+    }
+    if (std::strcmp(property, "og:site_name") == 0) {
+      doc.SiteId = GlobalStringPool().Intern(content);
+    }
+    if (std::strcmp(property, "og:description") == 0) {
+      doc.Description = content;
+    }
+    if (std::strcmp(property, "article:published_time") == 0) {
+      doc.FetchTime = DateToTimestamp(content);
+    }
+    metaElement = metaElement->NextSiblingElement("meta");
+  }
+  const tinyxml2::XMLElement* bodyElement =
+      htmlElement->FirstChildElement("body");
+  if (!bodyElement) {
+    throw std::runtime_error("Parser error: no body");
+  }
+  const tinyxml2::XMLElement* articleElement =
+      bodyElement->FirstChildElement("article");
+  if (!articleElement) {
+    throw std::runtime_error("Parser error: no article");
+  }
+  const tinyxml2::XMLElement* pElement = articleElement->FirstChildElement("p");
+  while (pElement) {
+    doc.Text += GetFullText(pElement) + "\n";
+    pElement = pElement->NextSiblingElement("p");
+  }
+  const tinyxml2::XMLElement* addressElement =
+      articleElement->FirstChildElement("address");
+  if (!addressElement) {
+    return false;
+  }
+  const tinyxml2::XMLElement* timeElement =
+      addressElement->FirstChildElement("time");
+  if (timeElement && timeElement->Attribute("datetime")) {
+    doc.PubTime = DateToTimestamp(timeElement->Attribute("datetime"));
+  }
+  const tinyxml2::XMLElement* aElement = addressElement->FirstChildElement("a");
+  if (aElement && aElement->Attribute("rel") &&
+      std::string(aElement->Attribute("rel")) == "author") {
+    const char* author = aElement->GetText();
+    doc.Author = author ? author : "";
+  }
+  return true;
+}
+
+}  // namespace tgnews
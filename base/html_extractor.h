@@ -0,0 +1,85 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace tgnews {
+
+class ParsedDoc;
+
+// Single pass extractor of the article fields from raw html.
+//
+// Selects the same elements as the tinyxml2 walk it replaces: og:* meta of
+// <head>, <p> children of <article>, <time datetime> and rel=author link of
+// <address>. Well-formedness rules, entities and whitespace handling follow
+// tinyxml2, so the output is byte-identical. No DOM is built: values are
+// decoded straight into the document fields and scratch buffers are reused
+// between calls, so keep one extractor per thread.
+class HtmlExtractor {
+ public:
+  // Returns false if the article has no <address> block.
+  // Throws std::runtime_error on malformed html or missing elements.
+  bool Extract(std::string_view html, ParsedDoc& doc);
+
+ private:
+  enum class ERole {
+    Other = 0,
+    Html,
+    Head,
+    Body,
+    Article,
+    Paragraph,
+    Address,
+    AuthorLink
+  };
+
+  struct Frame {
+    std::string_view name;
+    ERole role = ERole::Other;
+    bool first_child_seen = false;
+  };
+
+  struct Attribute {
+    std::string_view name;
+    std::string_view value;
+  };
+
+  void Reset();
+
+  const char* ParseTag(const char* p, const char* end, ParsedDoc& doc);
+
+  void OnNode();
+
+  void OnText(std::string_view raw, bool cdata, ParsedDoc& doc);
+
+  void OnOpen(std::string_view name, ParsedDoc& doc);
+
+  void OnClose(ParsedDoc& doc);
+
+  std::string_view FindAttribute(std::string_view name) const;
+
+  std::vector<Frame> stack_;
+  std::vector<Attribute> attributes_;
+  std::vector<std::string_view> published_times_;
+  std::string_view pub_time_;
+  std::string scratch_;
+  bool top_level_non_declaration_ = false;
+  bool stopped_ = false;
+  bool in_paragraph_ = false;
+  bool has_html_ = false;
+  bool has_head_ = false;
+  bool has_meta_ = false;
+  bool has_body_ = false;
+  bool has_article_ = false;
+  bool has_address_ = false;
+  bool has_time_ = false;
+  bool has_address_link_ = false;
+};
+
+// tinyxml2 DOM walk the extractor replaced. Same contract as
+// HtmlExtractor::Extract, kept as the reference for parity checks and
+// benchmarks.
+bool ExtractWithDom(const std::string& html, ParsedDoc& doc);
+
+}  // namespace tgnews
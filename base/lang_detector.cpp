@@ -0,0 +1,234 @@
+#include "base/lang_detector.h"
+
+#include <algorithm>
+
+#include "base/fasttext_classifier.h"
+
+namespace tgnews {
+
+namespace {
+
+// The title and the beginning of the text.
+constexpr size_t kSampleBytes = 512;
+// Fewer letters are left to the model.
+constexpr uint32_t kMinLetters = 40;
+// English needs this many plain latin words, at least one in
+// kEnglishWordRatio of them from kEnglishWords.
+constexpr uint32_t kMinWords = 8;
+constexpr uint32_t kEnglishWordRatio = 8;
+// Russian needs this many letters per punctuation mark or other symbol.
+// Markup, commands and rules of tildes push the model below the 0.6 of the
+// tg rule on Russian text, plain prose does not.
+constexpr uint32_t kRussianLettersPerSymbol = 8;
+
+// Frequent English words that are rare in other languages written in latin
+// letters, unlike "a", "in" or "to".
+constexpr std::string_view kEnglishWords[] = {
+    "the",  "of",    "and",   "for",   "that", "with", "from",  "was",
+    "were", "are",   "has",   "have",  "had",  "said", "his",   "this",
+    "will", "after", "they",  "who",   "not",  "but",  "its",   "been",
+    "their", "which", "would", "about", "than", "into",
+};
+
+constexpr size_t kMaxEnglishWordLength = 5;
+
+// Letters of a sample by script, with the few letters telling the Cyrillic
+// alphabets apart counted on their own.
+class ScriptHistogram {
+ public:
+  void Add(std::string_view text) {
+    size_t pos = 0;
+    while (pos < text.size()) {
+      AddCodePoint(NextCodePoint(text, pos));
+    }
+    EndWord();
+  }
+
+  ELang Decide() const {
+    uint32_t letters = latin_ + latin_extended_ + cyrillic_ + tajik_ +
+                       tajik_shared_ + other_cyrillic_ + other_;
+    if (letters < kMinLetters || other_ > 0) {
+      return LangUndefined;
+    }
+    // Most letters in one alphabet, names in another are fine.
+    auto dominates = [letters](uint32_t count) {
+      return count * 5 >= letters * 4;
+    };
+    if (other_cyrillic_ == 0) {
+      // Only Russian has ы and none of the letters of the other alphabets.
+      if (tajik_ == 0 && tajik_shared_ == 0 && yery_ > 0 &&
+          dominates(cyrillic_) &&
+          symbols_ * kRussianLettersPerSymbol <= letters) {
+        return LangRu;
+      }
+      // ӣ and ҷ are Tajik only.
+      if (tajik_ >= 2 && dominates(cyrillic_ + tajik_ + tajik_shared_)) {
+        return LangTg;
+      }
+    }
+    // Accents of a few borrowed names, not of a language using them.
+    if (latin_extended_ * 50 <= letters && dominates(latin_) &&
+        words_ >= kMinWords && english_words_ * kEnglishWordRatio >= words_) {
+      return LangEn;
+    }
+    return LangUndefined;
+  }
+
+ private:
+  // Next code point of a UTF-8 string, 0 for a malformed or cut off one.
+  static char32_t NextCodePoint(std::string_view text, size_t& pos) {
+    unsigned char lead = text[pos++];
+    if (lead < 0x80) {
+      return lead;
+    }
+    size_t length = lead >= 0xF0 ? 3 : lead >= 0xE0 ? 2 : lead >= 0xC0 ? 1 : 0;
+    if (length == 0) {
+      return 0;
+    }
+    char32_t code = lead & (0x3F >> length);
+    for (; length > 0; length--) {
+      if (pos == text.size() || (text[pos] & 0xC0) != 0x80) {
+        return 0;
+      }
+      code = (code << 6) | (text[pos++] & 0x3F);
+    }
+    return code;
+  }
+
+  void AddCodePoint(char32_t c) {
+    if ((c | 0x20) >= 'a' && (c | 0x20) <= 'z') {
+      latin_++;
+      if (word_length_ < kMaxEnglishWordLength) {
+        word_[word_length_] = c | 0x20;
+      }
+      word_length_++;
+      return;
+    }
+    if (c < 0xC0 || c == 0xD7 || c == 0xF7) {
+      // Digits, punctuation and spaces.
+      symbols_ += c > ' ' && (c < '0' || c > '9') && c != 0xA0;
+      EndWord();
+      return;
+    }
+    if (c < 0x250 || (c >= 0x300 && c < 0x370) ||
+        (c >= 0x1E00 && c < 0x1F00)) {
+      latin_extended_++;
+    } else if ((c >= 0x410 && c < 0x450) || c == 0x401 || c == 0x451) {
+      cyrillic_++;
+      yery_ += c == 0x42B || c == 0x44B;
+    } else if (c == 0x4E2 || c == 0x4E3 || c == 0x4B6 || c == 0x4B7) {
+      tajik_++;
+    } else if (c == 0x492 || c == 0x493 || c == 0x49A || c == 0x49B ||
+               c == 0x4B2 || c == 0x4B3 || c == 0x4EE || c == 0x4EF) {
+      tajik_shared_++;
+    } else if (c >= 0x400 && c < 0x530) {
+      other_cyrillic_++;
+    } else if ((c >= 0x370 && c < 0x400) || (c >= 0x530 && c < 0x1E00) ||
+               (c >= 0x1F00 && c < 0x2000) || (c >= 0x3040 && c < 0xA000) ||
+               (c >= 0xAC00 && c < 0xD7B0)) {
+      other_++;
+    } else {
+      symbols_ += c >= 0x2010;
+      EndWord();
+      return;
+    }
+    plain_word_ = false;
+  }
+
+  void EndWord() {
+    if (word_length_ > 0 && plain_word_) {
+      words_++;
+      if (word_length_ <= kMaxEnglishWordLength) {
+        std::string_view word(word_, word_length_);
+        english_words_ += std::find(std::begin(kEnglishWords),
+                                    std::end(kEnglishWords),
+                                    word) != std::end(kEnglishWords);
+      }
+    }
+    word_length_ = 0;
+    plain_word_ = true;
+  }
+
+  uint32_t latin_ = 0;
+  // Latin letters with diacritics.
+  uint32_t latin_extended_ = 0;
+  // The Russian alphabet, and ы among them.
+  uint32_t cyrillic_ = 0;
+  uint32_t yery_ = 0;
+  uint32_t tajik_ = 0;
+  // ғ, қ, ҳ and ӯ, shared with Uzbek and Kazakh.
+  uint32_t tajik_shared_ = 0;
+  uint32_t other_cyrillic_ = 0;
+  // Letters of other scripts.
+  uint32_t other_ = 0;
+  // Punctuation and other symbols, not letters, digits or spaces.
+  uint32_t symbols_ = 0;
+
+  // Words of latin letters only.
+  uint32_t words_ = 0;
+  uint32_t english_words_ = 0;
+  char word_[kMaxEnglishWordLength];
+  size_t word_length_ = 0;
+  bool plain_word_ = true;
+};
+
+}  // namespace
+
+CascadeLangDetector::CascadeLangDetector(const FastTextClassifier* classifier)
+    : classifier_(classifier) {}
+
+ELang CascadeLangDetector::Detect(
+    const std::vector<std::string_view>& pieces) const {
+  switch (DetectByScript(pieces)) {
+    case LangRu:
+      script_ru_.fetch_add(1, std::memory_order_relaxed);
+      return LangRu;
+    case LangEn:
+      script_en_.fetch_add(1, std::memory_order_relaxed);
+      return LangEn;
+    case LangTg:
+      script_tg_.fetch_add(1, std::memory_order_relaxed);
+      return LangTg;
+    default:
+      fasttext_.fetch_add(1, std::memory_order_relaxed);
+      return DetectByModel(pieces);
+  }
+}
+
+ELang CascadeLangDetector::DetectByScript(
+    const std::vector<std::string_view>& pieces) {
+  ScriptHistogram histogram;
+  size_t budget = kSampleBytes;
+  for (auto piece : pieces) {
+    if (budget == 0) {
+      break;
+    }
+    piece = piece.substr(0, budget);
+    budget -= piece.size();
+    histogram.Add(piece);
+  }
+  return histogram.Decide();
+}
+
+ELang CascadeLangDetector::DetectByModel(
+    const std::vector<std::string_view>& pieces) const {
+  auto prediction = classifier_->Predict(pieces, 0.4);
+  if (!prediction) {
+    return LangUndefined;
+  }
+  if (prediction->label == LangRu && prediction->probability < 0.6) {
+    return LangTg;
+  }
+  return static_cast<ELang>(prediction->label);
+}
+
+CascadeLangDetector::Stats CascadeLangDetector::GetStats() const {
+  Stats stats;
+  stats.script_ru = script_ru_.load(std::memory_order_relaxed);
+  stats.script_en = script_en_.load(std::memory_order_relaxed);
+  stats.script_tg = script_tg_.load(std::memory_order_relaxed);
+  stats.fasttext = fasttext_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+}  // namespace tgnews
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "base/parsed_document.h"
+
+namespace tgnews {
+
+class FastTextClassifier;
+
+// Language of a document, cheapest evidence first. The letters of the first
+// few hundred bytes settle most documents: Russian, English or Tajik text
+// is told apart by its alphabet alone. Russian is only settled as plain
+// prose, which the model is sure about, so the tg rule of DetectByModel
+// would not have applied. Anything else goes to the fastText model: short
+// or mixed samples, Russian among symbols and other languages using the
+// same scripts.
+class CascadeLangDetector {
+ public:
+  // Documents decided by each tier since construction.
+  struct Stats {
+    uint64_t script_ru = 0;
+    uint64_t script_en = 0;
+    uint64_t script_tg = 0;
+    uint64_t fasttext = 0;
+  };
+
+  explicit CascadeLangDetector(const FastTextClassifier* classifier);
+
+  // Pieces of text as they would be joined by spaces.
+  ELang Detect(const std::vector<std::string_view>& pieces) const;
+
+  // The script tier alone, LangUndefined when it is not sure.
+  static ELang DetectByScript(const std::vector<std::string_view>& pieces);
+
+  // The model alone. Russian it is unsure about is taken for Tajik, which
+  // the model mostly confuses with it.
+  ELang DetectByModel(const std::vector<std::string_view>& pieces) const;
+
+  Stats GetStats() const;
+
+ private:
+  const FastTextClassifier* classifier_;
+  mutable std::atomic<uint64_t> script_ru_ = 0;
+  mutable std::atomic<uint64_t> script_en_ = 0;
+  mutable std::atomic<uint64_t> script_tg_ = 0;
+  mutable std::atomic<uint64_t> fasttext_ = 0;
+};
+
+}  // namespace tgnews
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+
+namespace tgnews {
+
+// Bounded map dropping the least recently used entries first. Thread safe:
+// entries are spread over shards with a lock each, so threads rarely wait
+// for each other.
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class ShardedLruCache {
+ public:
+  explicit ShardedLruCache(size_t capacity)
+      : shard_capacity_(std::max<size_t>(1, capacity / kShardCount)) {}
+
+  std::optional<Value> Find(const Key& key) {
+    auto& shard = GetShard(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
+      misses_.fetch_add(1, std::memory_order_relaxed);
+      return std::nullopt;
+    }
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+    return it->second->second;
+  }
+
+  void Insert(const Key& key, Value value) {
+    auto& shard = GetShard(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+      it->second->second = std::move(value);
+      shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+      return;
+    }
+    shard.entries.emplace_front(key, std::move(value));
+    shard.index.emplace(key, shard.entries.begin());
+    if (shard.entries.size() > shard_capacity_) {
+      shard.index.erase(shard.entries.back().first);
+      shard.entries.pop_back();
+    }
+  }
+
+  size_t Size() const {
+    size_t size = 0;
+    for (const auto& shard : shards_) {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      size += shard.entries.size();
+    }
+    return size;
+  }
+
+  uint64_t Hits() const { return hits_.load(std::memory_order_relaxed); }
+
+  uint64_t Misses() const { return misses_.load(std::memory_order_relaxed); }
+
+ private:
+  static constexpr size_t kShardCount = 16;
+
+  struct Shard {
+    mutable std::mutex mutex;
+    // Most recently used first.
+    std::list<std::pair<Key, Value>> entries;
+    std::unordered_map<Key, typename decltype(entries)::iterator, Hash> index;
+  };
+
+  Shard& GetShard(const Key& key) {
+    return shards_[Hash()(key) % kShardCount];
+  }
+
+  const size_t shard_capacity_;
+  std::array<Shard, kShardCount> shards_;
+  std::atomic<uint64_t> hits_ = 0;
+  std::atomic<uint64_t> misses_ = 0;
+};
+
+}  // namespace tgnews
@@ -0,0 +1,157 @@
+#include "base/model_bundle.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+#include <cstring>
+#include <fstream>
+
+#include "base/base.h"
+#include "fmt/format.h"
+
+namespace tgnews {
+
+namespace {
+
+constexpr uint32_t kMagic = 0x424e4754;  // "TGNB"
+constexpr uint32_t kVersion = 1;
+constexpr size_t kHeaderSize = 4 * sizeof(uint32_t);
+constexpr size_t kNameSize = 48;
+constexpr size_t kEntrySize = kNameSize + 2 * sizeof(uint64_t);
+
+size_t Align(size_t offset) {
+  return (offset + ModelBundle::kAlignment - 1) / ModelBundle::kAlignment *
+         ModelBundle::kAlignment;
+}
+
+template <typename T>
+T Read(const char* data) {
+  T value;
+  std::memcpy(&value, data, sizeof(T));
+  return value;
+}
+
+template <typename T>
+void Append(std::string& out, T value) {
+  out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+}  // namespace
+
+ModelBundle::ModelBundle(const std::string& path) : path_(path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  VERIFY(fd >= 0, fmt::format("unable to open model bundle: {}", path));
+  size_ = boost::filesystem::file_size(path);
+  if (size_ > 0) {
+    data_ = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  ::close(fd);
+  VERIFY(data_ != MAP_FAILED,
+         fmt::format("unable to map model bundle: {}", path));
+
+  try {
+    ReadSections();
+  } catch (...) {
+    // No destructor runs for a constructor that throws.
+    if (size_ > 0) {
+      ::munmap(data_, size_);
+    }
+    throw;
+  }
+}
+
+ModelBundle::~ModelBundle() {
+  if (size_ > 0) {
+    ::munmap(data_, size_);
+  }
+}
+
+void ModelBundle::ReadSections() {
+  const char* data = static_cast<const char*>(data_);
+  VERIFY(size_ >= kHeaderSize && Read<uint32_t>(data) == kMagic,
+         fmt::format("not a model bundle: {}", path_));
+  VERIFY(Read<uint32_t>(data + 4) == kVersion,
+         fmt::format("unsupported model bundle version: {}", path_));
+  const size_t count = Read<uint32_t>(data + 8);
+  VERIFY(kHeaderSize + count * kEntrySize <= size_,
+         fmt::format("truncated model bundle: {}", path_));
+  for (size_t i = 0; i < count; i++) {
+    const char* entry = data + kHeaderSize + i * kEntrySize;
+    const uint64_t offset = Read<uint64_t>(entry + kNameSize);
+    const uint64_t size = Read<uint64_t>(entry + kNameSize + sizeof(uint64_t));
+    VERIFY(offset <= size_ && size <= size_ - offset,
+           fmt::format("truncated model bundle: {}", path_));
+    sections_.push_back({std::string_view(entry, strnlen(entry, kNameSize)),
+                         std::string_view(data + offset, size)});
+  }
+}
+
+bool ModelBundle::Has(std::string_view name) const {
+  for (const auto& section : sections_) {
+    if (section.name == name) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::string_view ModelBundle::Get(std::string_view name) const {
+  for (const auto& section : sections_) {
+    if (section.name == name) {
+      return section.data;
+    }
+  }
+  throw std::runtime_error(
+      fmt::format("no section {} in model bundle {}", name, path_));
+}
+
+void ModelBundle::VerifyArray(std::string_view name, size_t size,
+                              size_t value_size) {
+  VERIFY(size % value_size == 0,
+         fmt::format("section {} is not an array of {} byte values", name,
+                     value_size));
+}
+
+void ModelBundle::Writer::Add(std::string name, std::string data) {
+  VERIFY(name.size() < kNameSize,
+         fmt::format("section name is too long: {}", name));
+  sections_.emplace_back(std::move(name), std::move(data));
+}
+
+void ModelBundle::Writer::Write(const std::string& path) const {
+  std::string header;
+  Append<uint32_t>(header, kMagic);
+  Append<uint32_t>(header, kVersion);
+  Append<uint32_t>(header, sections_.size());
+  Append<uint32_t>(header, 0);
+  size_t offset = Align(kHeaderSize + sections_.size() * kEntrySize);
+  for (const auto& [name, data] : sections_) {
+    std::string padded = name;
+    padded.resize(kNameSize, '\0');
+    header += padded;
+    Append<uint64_t>(header, offset);
+    Append<uint64_t>(header, data.size());
+    offset = Align(offset + data.size());
+  }
+
+  const std::string temporary = path + ".tmp";
+  {
+    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+    VERIFY(out.is_open(), fmt::format("unable to write {}", temporary));
+    const std::string padding(kAlignment, '\0');
+    out.write(header.data(), header.size());
+    size_t written = header.size();
+    for (const auto& [name, data] : sections_) {
+      out.write(padding.data(), Align(written) - written);
+      out.write(data.data(), data.size());
+      written = Align(written) + data.size();
+    }
+    out.flush();
+    VERIFY(out.good(), fmt::format("unable to write {}", temporary));
+  }
+  boost::filesystem::rename(temporary, path);
+}
+
+}  // namespace tgnews
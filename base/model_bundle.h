@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace tgnews {
+
+// Named binary sections packed into one file and read in place from a
+// read-only shared mapping, so loading is bound by page faults and several
+// processes on one host share the pages.
+//
+// Header: u32 magic, u32 version, u32 section count, u32 reserved. Then an
+// entry per section: name padded with zeros to 48 bytes, u64 offset, u64
+// size. Every section starts at a multiple of kAlignment.
+class ModelBundle {
+ public:
+  static constexpr size_t kAlignment = 64;
+
+  // Throws if the file is not a bundle.
+  explicit ModelBundle(const std::string& path);
+  ~ModelBundle();
+
+  ModelBundle(const ModelBundle&) = delete;
+  ModelBundle& operator=(const ModelBundle&) = delete;
+
+  bool Has(std::string_view name) const;
+
+  // Throws if there is no such section.
+  std::string_view Get(std::string_view name) const;
+
+  // Sections of plain values, the size has to be a multiple of T's.
+  template <typename T>
+  const T* GetArray(std::string_view name, size_t& count) const {
+    auto data = Get(name);
+    VerifyArray(name, data.size(), sizeof(T));
+    count = data.size() / sizeof(T);
+    return reinterpret_cast<const T*>(data.data());
+  }
+
+  class Writer {
+   public:
+    void Add(std::string name, std::string data);
+
+    template <typename T>
+    void AddArray(std::string name, const T* values, size_t count) {
+      Add(std::move(name),
+          std::string(reinterpret_cast<const char*>(values),
+                      count * sizeof(T)));
+    }
+
+    // Writes a temporary file renamed into place, a reader never sees a
+    // torn bundle.
+    void Write(const std::string& path) const;
+
+   private:
+    std::vector<std::pair<std::string, std::string>> sections_;
+  };
+
+ private:
+  struct Section {
+    std::string_view name;
+    std::string_view data;
+  };
+
+  void ReadSections();
+
+  static void VerifyArray(std::string_view name, size_t size,
+                          size_t value_size);
+
+  std::string path_;
+  void* data_ = nullptr;
+  size_t size_ = 0;
+  std::vector<Section> sections_;
+};
+
+}  // namespace tgnews
@@ -0,0 +1,74 @@
+#include "base/model_registry.h"
+
+#include <chrono>
+
+#include "base/base.h"
+#include "fmt/format.h"
+#include "glog/logging.h"
+
+namespace tgnews {
+
+ModelRegistry::ModelRegistry(Loader loader) : loader_(std::move(loader)) {
+  current_ = Load();
+  version_ = current_->Version;
+}
+
+ModelRegistry::~ModelRegistry() {
+  std::thread loading_thread;
+  {
+    // Joined unlocked, the reload takes the lock to swap the models in.
+    std::lock_guard<std::mutex> lock(mutex_);
+    loading_thread = std::move(loading_thread_);
+  }
+  if (loading_thread.joinable()) {
+    loading_thread.join();
+  }
+}
+
+std::shared_ptr<const Context> ModelRegistry::Get() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return current_;
+}
+
+bool ModelRegistry::Reload(Callback done) {
+  if (reloading_.exchange(true)) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  // The previous reload is over, callback included, and its thread no
+  // longer takes the lock: it is about to exit if it did not.
+  if (loading_thread_.joinable()) {
+    loading_thread_.join();
+  }
+  loading_thread_ = std::thread([this, done = std::move(done)] {
+    std::shared_ptr<const Context> context;
+    try {
+      context = Load();
+      std::lock_guard<std::mutex> lock(mutex_);
+      current_ = context;
+      version_ = context->Version;
+    } catch (std::exception& e) {
+      LOG(ERROR) << "unable to reload models: " << e.what();
+      failed_reloads_++;
+    }
+    if (done) {
+      done(std::move(context));
+    }
+    reloading_ = false;
+  });
+  return true;
+}
+
+std::unique_ptr<Context> ModelRegistry::Load() {
+  auto begin = std::chrono::steady_clock::now();
+  auto context = loader_();
+  VERIFY(context, "model loader returned nothing");
+  context->Version = version_.load() + 1;
+  LOG(INFO) << fmt::format(
+      "models version {} loaded in {:.1f}s", context->Version,
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - begin)
+          .count());
+  return context;
+}
+
+}  // namespace tgnews
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "base/context.h"
+
+namespace tgnews {
+
+// Versioned sets of models. Work takes the current set and keeps it for as
+// long as it runs, so a reload never changes the models under it: the next
+// set is loaded on a thread of its own and replaces the current one at
+// once, the old one is freed with its last user.
+class ModelRegistry {
+ public:
+  using Loader = std::function<std::unique_ptr<Context>()>;
+  // Called on the loading thread with the set that became current, or with
+  // null if loading failed and the current set stays.
+  using Callback = std::function<void(std::shared_ptr<const Context>)>;
+
+  // Loads version 1 right away.
+  explicit ModelRegistry(Loader loader);
+
+  // Waits for a reload in progress.
+  ~ModelRegistry();
+
+  ModelRegistry(const ModelRegistry&) = delete;
+  ModelRegistry& operator=(const ModelRegistry&) = delete;
+
+  std::shared_ptr<const Context> Get() const;
+
+  uint32_t GetVersion() const { return version_.load(); }
+
+  // Starts loading the next version. False if a reload is running already,
+  // which it is until its callback returns.
+  bool Reload(Callback done = {});
+
+  bool IsReloading() const { return reloading_.load(); }
+
+  uint64_t FailedReloads() const { return failed_reloads_.load(); }
+
+ private:
+  std::unique_ptr<Context> Load();
+
+  const Loader loader_;
+  mutable std::mutex mutex_;
+  std::shared_ptr<const Context> current_;
+  std::atomic<uint32_t> version_ = 0;
+  std::atomic<bool> reloading_ = false;
+  std::atomic<uint64_t> failed_reloads_ = 0;
+  // Guarded by mutex_.
+  std::thread loading_thread_;
+};
+
+}  // namespace tgnews
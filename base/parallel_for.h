@@ -0,0 +1,64 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <experimental/executor>
+#include <experimental/thread_pool>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace tgnews {
+
+// Runs task(i) for every i below count on the calling thread and on pool
+// threads. Helpers which start late find nothing left and return, so this
+// never waits for a pool thread busy with the caller itself.
+template <typename Task>
+void ParallelFor(std::experimental::thread_pool* pool, size_t count,
+                 const Task& task) {
+  struct State {
+    std::atomic<size_t> next = 0;
+    size_t remaining = 0;
+    std::mutex mutex;
+    std::condition_variable finished;
+    std::exception_ptr error;
+  };
+  auto state = std::make_shared<State>();
+  state->remaining = count;
+
+  auto work = [state, count, &task] {
+    for (size_t i; (i = state->next.fetch_add(1)) < count;) {
+      std::exception_ptr error;
+      try {
+        task(i);
+      } catch (...) {
+        error = std::current_exception();
+      }
+      std::lock_guard<std::mutex> lock(state->mutex);
+      if (error && !state->error) {
+        state->error = error;
+      }
+      if (--state->remaining == 0) {
+        state->finished.notify_all();
+      }
+    }
+  };
+  if (pool) {
+    size_t helpers =
+        std::min<size_t>(count, std::thread::hardware_concurrency());
+    for (size_t i = 1; i < helpers; i++) {
+      std::experimental::post(*pool, work);
+    }
+  }
+  work();
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->finished.wait(lock, [&] { return state->remaining == 0; });
+  if (state->error) {
+    std::rethrow_exception(state->error);
+  }
+}
+
+}  // namespace tgnews
@@ -1,15 +1,21 @@
 #include "parsed_document.h"
 
-#include <third_party/tinyxml2/tinyxml2.h>
 #include <glog/logging.h>
 
-#include <boost/algorithm/string/join.hpp>
 #include <ctime>
 #include <regex>
 #include <stdexcept>
 #include <sstream>
 
-#include "run_fasttext.h"
+#include "document_record.h"
+#include "embedder.h"
+#include "embedding_cache.h"
+#include "html_extractor.h"
+#include "fasttext_classifier.h"
+#include "lang_detector.h"
+#include "simhash.h"
+#include "text_stream.h"
+#include "util.h"
 
 static uint64_t DateToTimestampFuckedup(const std::string& date) {
   std::regex ex(
@@ -37,290 +43,283 @@ static uint64_t DateToTimestampFuckedup(const std::string& date) {
   return timestamp > 0 ? timestamp : 0;
 }
 
-static uint64_t DateToTimestamp(const std::string& date) {
-  std::stringstream ss(date);
-  char sep;
-  std::tm t = {};
-  ss >> t.tm_year;
-  t.tm_year -= 1900;
-  ss >> sep;
-  if (sep != '-') {
-    throw std::runtime_error("wrong date format");
-  }
-  ss >> t.tm_mon;
-  t.tm_mon -= 1;
-  ss >> sep;
-  if (sep != '-') {
-    throw std::runtime_error("wrong date format");
-  }
-  ss >> t.tm_mday;
-  ss >> sep;
-  if (sep != 'T') {
-    throw std::runtime_error("wrong date format");
-  }
-  ss >> t.tm_hour;
-  ss >> sep;
-  if (sep != ':') {
-    throw std::runtime_error("wrong date format");
+namespace tgnews {
+
+ELang LangFromCode(std::string_view code) {
+  if (code.empty()) {
+    return LangUndefined;
   }
-  ss >> t.tm_min;
-  ss >> sep;
-  if (sep != ':') {
-    throw std::runtime_error("wrong date format");
+  if (code == "ru") {
+    return LangRu;
   }
-  ss >> t.tm_sec;
-  char p;
-  ss >> p;
-  if (p != '+' && p != '-') {
-    throw std::runtime_error("wrong date format");
+  if (code == "en") {
+    return LangEn;
   }
-  int h_z, h_m;
-  ss >> h_z >> sep >> h_m;
-  time_t timestamp = timegm(&t);
-  uint64_t zone_ts = h_z * 60 * 60 + h_m * 60;
-  if (p == '+') {
-    timestamp = timestamp - zone_ts;
-  } else if (p == '-') {
-    timestamp = timestamp + zone_ts;
+  if (code == "tg") {
+    return LangTg;
   }
-  return timestamp > 0 ? timestamp : 0;
+  return LangOther;
 }
 
-static std::string GetFullText(const tinyxml2::XMLElement* element) {
-  if (const tinyxml2::XMLText* textNode = element->ToText()) {
-    return textNode->Value();
+ENewsCategory CategoryFromName(std::string_view name) {
+  if (name == "not_news") {
+    return NC_NOT_NEWS;
   }
-  std::string text;
-  const tinyxml2::XMLNode* node = element->FirstChild();
-  while (node) {
-    if (const tinyxml2::XMLElement* elementNode = node->ToElement()) {
-      text += GetFullText(elementNode);
-    } else if (const tinyxml2::XMLText* textNode = node->ToText()) {
-      text += textNode->Value();
+  for (size_t i = 0; i < CategoryNames.size(); i++) {
+    if (name == CategoryNames[i]) {
+      return static_cast<ENewsCategory>(i);
     }
-    node = node->NextSibling();
   }
-  return text;
+  return NC_UNDEFINED;
 }
 
-static void ParseLinksFromText(const tinyxml2::XMLElement* element,
-                               std::vector<std::string>& links) {
-  const tinyxml2::XMLNode* node = element->FirstChild();
-  while (node) {
-    if (const tinyxml2::XMLElement* nodeElement = node->ToElement()) {
-      if (std::strcmp(nodeElement->Value(), "a") == 0 &&
-          nodeElement->Attribute("href")) {
-        links.push_back(nodeElement->Attribute("href"));
-      }
-      ParseLinksFromText(nodeElement, links);
-    }
-    node = node->NextSibling();
+std::string_view LangCode(ELang lang) {
+  switch (lang) {
+    case LangRu:
+      return "ru";
+    case LangEn:
+      return "en";
+    case LangTg:
+      return "tg";
+    case LangOther:
+      return "other";
+    default:
+      return "";
   }
 }
 
-namespace tgnews {
-
-ParsedDoc::ParsedDoc(Context* context, const std::string& name, std::string content,
-                     uint64_t max_age, EState state)
-    : Data(std::move(content)), MaxAge(max_age), State(state) {
+ParsedDoc::ParsedDoc(const Context* context, const std::string& name, std::string_view content,
+                     uint64_t max_age)
+    : MaxAge(max_age) {
   FileName = name;
 
-  tinyxml2::XMLDocument originalDoc;
-  originalDoc.Parse(Data.data());
-  const tinyxml2::XMLElement* htmlElement =
-      originalDoc.FirstChildElement("html");
-  if (!htmlElement) {
-    throw std::runtime_error("Parser error: no html tag");
-  }
-  const tinyxml2::XMLElement* headElement =
-      htmlElement->FirstChildElement("head");
-  if (!headElement) {
-    throw std::runtime_error("Parser error: no head");
-  }
-  const tinyxml2::XMLElement* metaElement =
-      headElement->FirstChildElement("meta");
-  if (!metaElement) {
-    throw std::runtime_error("Parser error: no meta");
-  }
-  while (metaElement != 0) {
-    const char* property = metaElement->Attribute("property");
-    const char* content = metaElement->Attribute("content");
-    if (content == nullptr || property == nullptr) {
-      metaElement = metaElement->NextSiblingElement("meta");
-      continue;
-    }
-    if (std::strcmp(property, "og:title") == 0) {
-      Title = content;
-    }
-    if (std::strcmp(property, "og:url") == 0) {
-      Url = content;
-    }
-    if (std::strcmp(property, "og:site_name") == 0) {
-      SiteName = content;
-    }
-    if (std::strcmp(property, "og:description") == 0) {
-      Description = content;
-    }
-    if (std::strcmp(property, "article:published_time") == 0) {
-      FetchTime = DateToTimestamp(content);
-    }
-    metaElement = metaElement->NextSiblingElement("meta");
-  }
-  const tinyxml2::XMLElement* bodyElement =
-      htmlElement->FirstChildElement("body");
-  if (!bodyElement) {
-    throw std::runtime_error("Parser error: no body");
-  }
-  const tinyxml2::XMLElement* articleElement =
-      bodyElement->FirstChildElement("article");
-  if (!articleElement) {
-    throw std::runtime_error("Parser error: no article");
-  }
-  const tinyxml2::XMLElement* pElement = articleElement->FirstChildElement("p");
-  {
-    size_t wordCount = 0;
-    while (pElement) {
-      Text += GetFullText(pElement) + "\n";
-      pElement = pElement->NextSiblingElement("p");
-    }
-  }
-  const tinyxml2::XMLElement* addressElement =
-      articleElement->FirstChildElement("address");
-  if (!addressElement) {
+  thread_local HtmlExtractor extractor;
+  Extracted = extractor.Extract(content, *this);
+  HostId = GlobalStringPool().Intern(GetHost(Url));
+  if (!Extracted) {
     return;
   }
-  const tinyxml2::XMLElement* timeElement =
-      addressElement->FirstChildElement("time");
-  if (timeElement && timeElement->Attribute("datetime")) {
-    PubTime = DateToTimestamp(timeElement->Attribute("datetime"));
-  }
-  const tinyxml2::XMLElement* aElement = addressElement->FirstChildElement("a");
-  if (aElement && aElement->Attribute("rel") &&
-      std::string(aElement->Attribute("rel")) == "author") {
-    Author = aElement->GetText();
-  }
-  ParseLang(context->LangDetect.get());
-  Tokenize(*context);
-  DetectCategory(*context);
-  CalcWeight(*context);
+  Annotate(*context);
 }
 
-ParsedDoc::ParsedDoc(const nlohmann::json& value) : State(EState::Added) {
+ParsedDoc::ParsedDoc(const nlohmann::json& value) {
 #define GET(s) value.at(#s).get_to(s);
   GET(Title);
   GET(Url);
-  GET(SiteName);
   GET(Description);
   GET(Text);
   GET(FileName);
   GET(FetchTime);
   GET(MaxAge);
-  GET(Lang);
   GET(GoodTitle);
   GET(GoodText);
   GET(Category);
   GET(Weight);
 #undef GET
-  State = EState::Added;
+  SiteId = GlobalStringPool().Intern(value.at("SiteName").get<std::string>());
+  HostId = GlobalStringPool().Intern(GetHost(Url));
+  Lang = LangFromCode(value.at("Lang").get<std::string>());
+  // Older builds left pages the extractor gave up on without a language.
+  Extracted = Lang != LangUndefined;
+  CalcFingerprint();
+}
+
+ParsedDoc::ParsedDoc(const DocumentRecordView& record, bool cold_fields)
+    : FetchTime(record.FetchTime),
+      MaxAge(record.MaxAge),
+      PubTime(record.PubTime),
+      Weight(record.Weight),
+      SiteId(GlobalStringPool().Intern(record.SiteName)),
+      HostId(GlobalStringPool().Intern(record.HostName)),
+      Lang(record.Lang),
+      Category(record.Category),
+      Extracted(record.Extracted),
+      HasColdFields(cold_fields),
+      ContentHash(record.ContentHash),
+      Fingerprint(record.Fingerprint),
+      Vector(record.GetVector()),
+      FileName(record.FileName),
+      Title(record.Title) {
+  if (record.Fingerprint == 0) {
+    // Older records have none, the tokens are still there.
+    Fingerprint = TextFingerprint(record.GoodTitle, record.GoodText);
+  }
+  if (cold_fields) {
+    Url = record.Url;
+    Description = record.Description;
+    Text = record.Text;
+    Author = record.Author;
+    GoodTitle = record.GoodTitle;
+    GoodText = record.GoodText;
+  }
 }
+
 nlohmann::json ParsedDoc::Serialize() const {
   nlohmann::json res;
 #define ADD(s) res[#s] = s;
   ADD(Title);
   ADD(Url);
-  ADD(SiteName);
   ADD(Description);
   ADD(FetchTime);
   ADD(FileName);
   ADD(Text);
   ADD(MaxAge);
-  ADD(Lang);
   ADD(GoodTitle);
   ADD(GoodText);
   ADD(Category);
   ADD(Weight);
 #undef ADD
+  res["SiteName"] = std::string(GetSiteName());
+  res["Lang"] = std::string(LangCode(Lang));
   return res;
 }
 
-void ParsedDoc::ParseLang(const fasttext::FastText* model) {
-  if (Lang.size()) {
-    // already parsed - skip
+size_t ParsedDoc::ResidentBytes() const {
+  const size_t inlineCapacity = std::string().capacity();
+  size_t bytes = sizeof(*this);
+  for (const std::string* s : {&FileName, &Title, &Url, &Description, &Text,
+                               &Author, &GoodTitle, &GoodText}) {
+    if (s->capacity() > inlineCapacity) {
+      bytes += s->capacity() + 1;
+    }
+  }
+  return bytes;
+}
+
+void ParsedDoc::DropColdFields() {
+  for (std::string* s :
+       {&Url, &Description, &Text, &Author, &GoodTitle, &GoodText}) {
+    std::string().swap(*s);
+  }
+  HasColdFields = false;
+}
+
+size_t ParsedDoc::ColdBytes() const {
+  return Url.size() + Description.size() + Text.size() + Author.size() +
+         GoodTitle.size() + GoodText.size();
+}
+
+void ParsedDoc::Annotate(const tgnews::Context& context, bool batched) {
+  ModelVersion = context.Version;
+  if (!Extracted) {
     return;
   }
-  std::string sample(Title + " " + Description + " " + Text.substr(0, 100));
-  auto pair = RunFasttext(model, sample, 0.4);
-  if (!pair) {
-    Lang = "";
+  ParseLang(*context.LangDetector);
+  Tokenize(context);
+  CalcFingerprint();
+  CalcWeight(context);
+  if (batched) {
     return;
   }
-  const std::string& label = pair->first;
-  double probability = pair->second;
-  if ((label == "ru") && probability < 0.6) {
-    Lang = std::string("tg");
-  } else {
-    Lang = label;
+  // Categorization and the embedding read the same views of the tokens.
+  std::vector<std::string_view> tokens;
+  GetTokens(tokens);
+  DetectCategory(context, tokens);
+  CalcEmbedding(context, tokens);
+}
+
+void ParsedDoc::ResetAnnotation() {
+  Lang = LangUndefined;
+  Category = NC_UNDEFINED;
+  Weight = -1.f;
+  Vector = {};
+  ModelVersion = 0;
+}
+
+void ParsedDoc::ParseLang(const CascadeLangDetector& detector) {
+  if (Lang != LangUndefined) {
+    // already parsed - skip
+    return;
   }
+  Lang = detector.Detect(
+      {Title, Description, std::string_view(Text).substr(0, 100)});
 }
 
-static std::string Preprocess(const std::string& text,
-                              const onmt::Tokenizer& tokenizer) {
+static void Preprocess(const std::string& text,
+                       const onmt::Tokenizer& tokenizer, std::string& result) {
   std::vector<std::string> tokens;
   tokenizer.tokenize(text, tokens);
-  return boost::join(tokens, " ");
+  size_t size = tokens.size();
+  for (const auto& token : tokens) {
+    size += token.size();
+  }
+  result.clear();
+  result.reserve(size);
+  for (const auto& token : tokens) {
+    if (!result.empty()) {
+      result += ' ';
+    }
+    result += token;
+  }
 }
 
 void ParsedDoc::Tokenize(const tgnews::Context& context) {
   if (GoodTitle.size() > 0 && GoodText.size()) {
     return; // already calced
   }
-  GoodTitle = Preprocess(Title, context.Tokenizer);
-  GoodText = Preprocess(Text, context.Tokenizer);
+  Preprocess(Title, context.Tokenizer, GoodTitle);
+  Preprocess(Text, context.Tokenizer, GoodText);
 }
 
-void ParsedDoc::DetectCategory(const tgnews::Context& context) {
+void ParsedDoc::GetTokens(std::vector<std::string_view>& tokens) const {
+  tokens.clear();
+  SplitTokens(GoodTitle, tokens);
+  SplitTokens(GoodText, tokens);
+}
+
+void ParsedDoc::CalcFingerprint() {
+  Fingerprint = TextFingerprint(GoodTitle, GoodText);
+}
+
+void ParsedDoc::DetectCategory(const tgnews::Context& context,
+                               const std::vector<std::string_view>& tokens) {
   if (Category != NC_UNDEFINED) {
     return; //allready calced
   }
-  if (!GoodTitle.size() || !GoodText.size() || !Lang.size()) {
+  if (!GoodTitle.size() || !GoodText.size()) {
     Category = NC_UNDEFINED;
     return;
   }
-  if (Lang != "ru" & Lang != "en") {
+  if (Lang != LangRu && Lang != LangEn) {
     Category = NC_UNDEFINED;
     return;
   }
-  std::string sample(GoodTitle + " " + GoodText);
-  const fasttext::FastText* model =
-      Lang == "ru" ? context.RuCatModel.get() : context.EnCatModel.get();
-  auto pair = RunFasttext(model, sample, 0.0);
-  if (!pair) {
-    Category = NC_UNDEFINED;
-    return;
-  }
-  const std::string& label = pair->first;
-  if (label == "any") {
-    Category = NC_ANY;
-  } else if (label == "society") {
-    Category = NC_SOCIETY;
-  } else if (label == "economy") {
-    Category = NC_ECONOMY;
-  } else if (label == "technology") {
-    Category = NC_TECHNOLOGY;
-  } else if (label == "sports") {
-    Category = NC_SPORTS;
-  } else if (label == "entertainment") {
-    Category = NC_ENTERTAINMENT;
-  } else if (label == "science") {
-    Category = NC_SCIENCE;
-  } else if (label == "other") {
-    Category = NC_OTHER;
-  } else if (label == "not_news") {
-    Category = NC_NOT_NEWS;
-  } else {
-    Category = NC_UNDEFINED;
+  const FastTextClassifier& classifier = Lang == LangRu
+                                            ? *context.RuCategoryClassifier
+                                            : *context.EnCategoryClassifier;
+  auto prediction = classifier.Predict(tokens, 0.0);
+  Category = prediction ? static_cast<ENewsCategory>(prediction->label)
+                        : NC_UNDEFINED;
+}
+
+void ParsedDoc::DetectCategories(const tgnews::Context& context,
+                                 const std::vector<ParsedDoc*>& documents) {
+  for (ELang lang : {LangRu, LangEn}) {
+    std::vector<ParsedDoc*> batch;
+    for (ParsedDoc* document : documents) {
+      if (document->Lang == lang && document->Category == NC_UNDEFINED &&
+          document->GoodTitle.size() && document->GoodText.size()) {
+        batch.push_back(document);
+      }
+    }
+    if (batch.empty()) {
+      continue;
+    }
+    std::vector<std::vector<std::string_view>> tokens(batch.size());
+    for (size_t i = 0; i < batch.size(); i++) {
+      batch[i]->GetTokens(tokens[i]);
+    }
+    const FastTextClassifier& classifier = lang == LangRu
+                                              ? *context.RuCategoryClassifier
+                                              : *context.EnCategoryClassifier;
+    std::vector<std::optional<FastTextClassifier::Prediction>> predictions;
+    classifier.Predict(tokens, 0.0, predictions);
+    for (size_t i = 0; i < batch.size(); i++) {
+      batch[i]->Category =
+          predictions[i] ? static_cast<ENewsCategory>(predictions[i]->label)
+                         : NC_UNDEFINED;
+    }
   }
-  return;
 }
 
 void ParsedDoc::CalcWeight(const tgnews::Context& context) {
@@ -330,4 +329,62 @@ void ParsedDoc::CalcWeight(const tgnews::Context& context) {
   Weight = context.Ratings.ScoreUrl(Url);
 }
 
+static Embedder GetEmbedder(const tgnews::Context& context, ELang lang) {
+  return lang == LangRu
+             ? Embedder(*context.RuWords, context.RuMatrix, context.RuBias)
+             : Embedder(*context.EnWords, context.EnMatrix, context.EnBias);
+}
+
+void ParsedDoc::CalcEmbedding(const tgnews::Context& context,
+                              const std::vector<std::string_view>& tokens) {
+  if (Lang != LangRu && Lang != LangEn) {
+    return;
+  }
+  // New versions differing in markup only and verbatim copies keep the
+  // tokens.
+  const uint64_t key = EmbeddingCache::GetKey(Lang, GoodTitle, GoodText);
+  if (context.Embeddings) {
+    if (auto cached = context.Embeddings->Find(key)) {
+      Vector = *cached;
+      return;
+    }
+  }
+  Vector = GetEmbedder(context, Lang).GetEmbedding(tokens);
+  if (context.Embeddings) {
+    context.Embeddings->Insert(key, Vector);
+  }
+}
+
+void ParsedDoc::CalcEmbeddings(const tgnews::Context& context,
+                               const std::vector<ParsedDoc*>& documents) {
+  std::vector<ParsedDoc*> ruDocuments;
+  std::vector<ParsedDoc*> enDocuments;
+  for (ParsedDoc* document : documents) {
+    if (document->Lang != LangRu && document->Lang != LangEn) {
+      continue;
+    }
+    if (context.Embeddings) {
+      const uint64_t key = EmbeddingCache::GetKey(
+          document->Lang, document->GoodTitle, document->GoodText);
+      if (auto cached = context.Embeddings->Find(key)) {
+        document->Vector = *cached;
+        continue;
+      }
+    }
+    (document->Lang == LangRu ? ruDocuments : enDocuments).push_back(document);
+  }
+  GetEmbedder(context, LangRu).SetEmbeddings(ruDocuments);
+  GetEmbedder(context, LangEn).SetEmbeddings(enDocuments);
+  if (context.Embeddings) {
+    for (const auto* batch : {&ruDocuments, &enDocuments}) {
+      for (const ParsedDoc* document : *batch) {
+        context.Embeddings->Insert(
+            EmbeddingCache::GetKey(document->Lang, document->GoodTitle,
+                                   document->GoodText),
+            document->Vector);
+      }
+    }
+  }
+}
+
 }  // namespace tgnews
@@ -1,22 +1,39 @@
 #pragma once 
 #include "base/context.h"
+#include "base/string_pool.h"
 
 #include "third_party/fastText/src/fasttext.h"
 #include "third_party/nlohmann_json/single_include/nlohmann/json.hpp"
 #include "glog/logging.h"
+#include <array>
+#include <limits>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
-#include <limits>
 
 namespace tgnews {
 
-enum ELang {
+enum ELang : uint8_t {
   LangRu = 0,
   LangEn = 1,
-  LangCount = 2
+  LangCount = 2,
+
+  // Detected languages we neither answer for nor cluster.
+  LangTg = 3,
+  LangOther,
+  LangUndefined
 };
 
-enum ENewsCategory {
+// Codes other than ru, en and tg all map to LangOther, the detected code is
+// not kept.
+ELang LangFromCode(std::string_view code);
+// "other" for LangOther: the "Lang" of ParsedDoc::Serialize, and so of
+// GET /_documents, no longer carries codes like "de" or "uk", and
+// ParsedDoc(json) reads those of older dumps back as LangOther.
+std::string_view LangCode(ELang lang);
+
+enum ENewsCategory : int8_t {
     NC_NOT_NEWS = -2,
     NC_UNDEFINED = -1,
     NC_ANY = 0,
@@ -30,8 +47,17 @@ enum ENewsCategory {
 
     NC_COUNT
 };
+struct DocumentRecordView;
+class CascadeLangDetector;
+
+// Names of the categorization model labels, not_news included.
+ENewsCategory CategoryFromName(std::string_view name);
+
 const std::vector<std::string> CategoryNames = {"any", "society", "economy", "technology", "sports", "entertainment", "science", "other"};
 
+constexpr size_t EmbeddingSize = 50;
+using Embedding = std::array<float, EmbeddingSize>;
+
 class ParsedDoc {
  public:
   enum class EState {
@@ -41,13 +67,37 @@ class ParsedDoc {
   };
 
  public:
-  ParsedDoc(Context* context, const std::string& name, std::string content, uint64_t max_age, EState state);
+  ParsedDoc() = default;
+  // The raw html is only needed for extraction and is not kept.
+  ParsedDoc(const Context* context, const std::string& name, std::string_view content, uint64_t max_age);
   ParsedDoc(const nlohmann::json& value);
+  // Records carry the derived fields as well, no Annotate is needed.
+  explicit ParsedDoc(const DocumentRecordView& record, bool cold_fields = true);
   
-  void ParseLang(const fasttext::FastText* model);
+  // Fills everything derived from the content, nothing for documents which
+  // are not Extracted. Documents are shared as immutable handles afterwards,
+  // so this has to run before publishing.
+  // Bulk loads skip categorization and the embedding and batch them with
+  // DetectCategories and CalcEmbeddings.
+  void Annotate(const Context& context, bool batched = false);
+  // Forgets what the models derived, for Annotate with another set of them.
+  // The tokens and the fingerprint stay.
+  void ResetAnnotation();
+  void ParseLang(const CascadeLangDetector& detector);
   void Tokenize(const Context& context);
-  void DetectCategory(const Context& context);
+  void CalcFingerprint();
+  // Whitespace separated tokens of GoodTitle and then GoodText, views into
+  // them.
+  void GetTokens(std::vector<std::string_view>& tokens) const;
+  void DetectCategory(const Context& context,
+                      const std::vector<std::string_view>& tokens);
+  static void DetectCategories(const Context& context,
+                               const std::vector<ParsedDoc*>& documents);
   void CalcWeight(const Context& context);
+  void CalcEmbedding(const Context& context,
+                     const std::vector<std::string_view>& tokens);
+  static void CalcEmbeddings(const Context& context,
+                             const std::vector<ParsedDoc*>& documents);
   bool IsNews() const {
     return Category != NC_NOT_NEWS && Category != NC_UNDEFINED;
   }
@@ -57,30 +107,67 @@ class ParsedDoc {
     return FetchTime + MaxAge;
   }
 
-  nlohmann::json Serialize() const;
+  std::string_view GetSiteName() const {
+    return GlobalStringPool().Get(SiteId);
+  }
+  std::string_view GetHostName() const {
+    return GlobalStringPool().Get(HostId);
+  }
 
-  std::string Data;
+  nlohmann::json Serialize() const;
 
-  EState State = EState::Added;
+  // Memory held by the document itself, interned strings excluded.
+  size_t ResidentBytes() const;
 
-  std::string Url;
-  std::string SiteName;
-  std::string Description;
-  std::string Text;
-  std::string Author;
+  // Cold fields are only needed to annotate and to show the document. They
+  // can be dropped once it is serialized, FileManager::LoadDocument reads
+  // them back from the log.
+  void DropColdFields();
+  // Bytes of text in the cold fields.
+  size_t ColdBytes() const;
 
-  uint64_t PubTime = 0;
+  // Fields read on every rebuild.
   uint64_t FetchTime = 0;
   uint64_t MaxAge = 0;
+  uint64_t PubTime = 0;
+  float Weight = -1.f;
+  uint32_t SiteId = 0;
+  uint32_t HostId = 0;
+  ELang Lang = LangUndefined;
+  ENewsCategory Category = NC_UNDEFINED;
+  // False for pages without an <address>. They are stored but never
+  // annotated, so they stay out of every answer.
+  bool Extracted = true;
+  bool HasColdFields = true;
+  // Context::Version of the models of the annotation, 0 if not known.
+  uint32_t ModelVersion = 0;
+  // HashBytes of the html the document was parsed from, 0 if unknown.
+  uint64_t ContentHash = 0;
+  // TextFingerprint of GoodTitle and GoodText, groups near-duplicates.
+  uint64_t Fingerprint = 0;
+  Embedding Vector = {};
 
+  // Fields read on ingest and for the answers only.
+  std::string FileName;
   std::string Title;
+  // Cold fields.
+  std::string Url;
+  std::string Description;
+  std::string Text;
+  std::string Author;
   std::string GoodTitle;
   std::string GoodText;
+};
+
+using ParsedDocPtr = std::shared_ptr<const ParsedDoc>;
+
+struct DocumentChange {
+  ParsedDoc::EState State = ParsedDoc::EState::Added;
   std::string FileName;
-  std::string Lang;
-  ENewsCategory Category = NC_UNDEFINED;
-  fasttext::Vector Vector = fasttext::Vector(50);
-  float Weight = -1.f;
+  // Null for removals.
+  ParsedDocPtr Document;
+  // Position in the change stream, 0 outside of it.
+  uint64_t Sequence = 0;
 };
 
 }
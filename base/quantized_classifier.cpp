@@ -0,0 +1,516 @@
+#include "base/quantized_classifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+#include "base/base.h"
+#include "base/cpu_features.h"
+
+namespace tgnews {
+
+namespace {
+
+constexpr int32_t kFastTextMagic = 793712314;
+constexpr int32_t kFastTextVersion = 12;
+// fastText's enums, as stored in the model.
+constexpr int32_t kLossHierarchicalSoftmax = 1;
+constexpr int32_t kLossSoftmax = 3;
+constexpr int32_t kModelSupervised = 3;
+// Codes are bytes.
+constexpr int32_t kCentroids = 256;
+// One AVX2 register of int8 values.
+constexpr int32_t kPadding = 32;
+// Products of int16 activations and int8 weights summed over wider rows
+// could overflow int32.
+constexpr int32_t kMaxDim = 512;
+
+template <typename T>
+T Read(std::istream& in) {
+  T value;
+  in.read(reinterpret_cast<char*>(&value), sizeof(T));
+  VERIFY(in, "fastText model is truncated");
+  return value;
+}
+
+template <typename T>
+void ReadArray(std::istream& in, std::vector<T>& values, int64_t count) {
+  VERIFY(count >= 0, "fastText model has a negative size");
+  values.resize(count);
+  in.read(reinterpret_cast<char*>(values.data()), count * sizeof(T));
+  VERIFY(in, "fastText model is truncated");
+}
+
+struct ProductQuantizer {
+  int32_t dim = 0;
+  int32_t subquantizers = 0;
+  int32_t sub_dim = 0;
+  int32_t last_sub_dim = 0;
+  std::vector<float> centroids;
+};
+
+ProductQuantizer ReadProductQuantizer(std::istream& in) {
+  ProductQuantizer quantizer;
+  quantizer.dim = Read<int32_t>(in);
+  quantizer.subquantizers = Read<int32_t>(in);
+  quantizer.sub_dim = Read<int32_t>(in);
+  quantizer.last_sub_dim = Read<int32_t>(in);
+  VERIFY(quantizer.subquantizers > 0 && quantizer.sub_dim > 0 &&
+             quantizer.last_sub_dim > 0 &&
+             (quantizer.subquantizers - 1) * quantizer.sub_dim +
+                     quantizer.last_sub_dim ==
+                 quantizer.dim,
+         "fastText model has an invalid product quantizer");
+  ReadArray(in, quantizer.centroids, int64_t(quantizer.dim) * kCentroids);
+  return quantizer;
+}
+
+struct QuantMatrix {
+  int64_t rows = 0;
+  int64_t cols = 0;
+  std::vector<uint8_t> codes;
+  ProductQuantizer quantizer;
+  std::vector<uint8_t> norm_codes;
+  ProductQuantizer norm_quantizer;
+};
+
+QuantMatrix ReadQuantMatrix(std::istream& in) {
+  QuantMatrix matrix;
+  const bool quantized_norms = Read<bool>(in);
+  matrix.rows = Read<int64_t>(in);
+  matrix.cols = Read<int64_t>(in);
+  ReadArray(in, matrix.codes, Read<int32_t>(in));
+  matrix.quantizer = ReadProductQuantizer(in);
+  VERIFY(matrix.quantizer.dim == matrix.cols &&
+             int64_t(matrix.codes.size()) ==
+                 matrix.rows * matrix.quantizer.subquantizers,
+         "fastText model has an invalid quantized matrix");
+  if (quantized_norms) {
+    ReadArray(in, matrix.norm_codes, matrix.rows);
+    matrix.norm_quantizer = ReadProductQuantizer(in);
+    VERIFY(matrix.norm_quantizer.dim == 1,
+           "fastText model has invalid quantized norms");
+  }
+  return matrix;
+}
+
+// Adds the row with the codes times alpha to out, the same sums as
+// fastText's ProductQuantizer::addcode. Centroids of a subquantizer are
+// stored one after another, the last one may be shorter.
+void AddQuantRow(const uint8_t* codes, const float* centroids,
+                 int32_t subquantizers, int32_t sub_dim, int32_t last_sub_dim,
+                 float alpha, float* out) {
+  for (int32_t m = 0; m + 1 < subquantizers; m++) {
+    const float* centroid = centroids + (m * kCentroids + codes[m]) * sub_dim;
+    float* values = out + m * sub_dim;
+    for (int32_t i = 0; i < sub_dim; i++) {
+      values[i] += alpha * centroid[i];
+    }
+  }
+  const int32_t last = subquantizers - 1;
+  const float* centroid = centroids + last * kCentroids * sub_dim +
+                          codes[last] * last_sub_dim;
+  float* values = out + last * sub_dim;
+  for (int32_t i = 0; i < last_sub_dim; i++) {
+    values[i] += alpha * centroid[i];
+  }
+}
+
+void SkipArgs(std::istream& in, int32_t& loss, int32_t& model) {
+  Read<int32_t>(in);  // dim
+  Read<int32_t>(in);  // ws
+  Read<int32_t>(in);  // epoch
+  Read<int32_t>(in);  // minCount
+  Read<int32_t>(in);  // neg
+  Read<int32_t>(in);  // wordNgrams
+  loss = Read<int32_t>(in);
+  model = Read<int32_t>(in);
+  Read<int32_t>(in);  // bucket
+  Read<int32_t>(in);  // minn
+  Read<int32_t>(in);  // maxn
+  Read<int32_t>(in);  // lrUpdateRate
+  Read<double>(in);   // t
+}
+
+// Word ids come from fastText's own dictionary, only the label count is
+// needed here.
+int32_t SkipDictionary(std::istream& in) {
+  const int32_t size = Read<int32_t>(in);
+  Read<int32_t>(in);  // nwords
+  const int32_t labels = Read<int32_t>(in);
+  Read<int64_t>(in);  // ntokens
+  const int64_t pruned_size = Read<int64_t>(in);
+  for (int32_t i = 0; i < size; i++) {
+    in.ignore(std::numeric_limits<std::streamsize>::max(), '\0');
+    Read<int64_t>(in);  // count
+    Read<int8_t>(in);   // type
+  }
+  // Pairs of int32 ids, -1 if the model is not pruned.
+  in.ignore(std::max<int64_t>(0, pruned_size) * 2 * sizeof(int32_t));
+  VERIFY(in, "fastText model is truncated");
+  return labels;
+}
+
+// Dot products of every weight row with the activations of `count` texts,
+// text-major into dots. A row is read once for the whole batch.
+using DotKernel = void (*)(const int8_t* weights, int32_t rows, int32_t dim,
+                           const int16_t* activations, size_t count,
+                           int32_t* dots);
+
+void DotScalar(const int8_t* weights, int32_t rows, int32_t dim,
+               const int16_t* activations, size_t count, int32_t* dots) {
+  for (int32_t r = 0; r < rows; r++) {
+    const int8_t* row = weights + r * dim;
+    for (size_t t = 0; t < count; t++) {
+      const int16_t* text = activations + t * dim;
+      int32_t dot = 0;
+      for (int32_t i = 0; i < dim; i++) {
+        dot += int32_t(row[i]) * text[i];
+      }
+      dots[t * rows + r] = dot;
+    }
+  }
+}
+
+#ifdef TGNEWS_X86_KERNELS
+
+__attribute__((target("avx2"))) int32_t HorizontalSum(__m256i values) {
+  __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(values),
+                              _mm256_extracti128_si256(values, 1));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(sum);
+}
+
+// AddQuantRow for fastText's default of two values per subquantizer: the
+// centroid pairs of four subquantizers are gathered as doubles, which only
+// moves their bits, and added to eight values at once. The same multiply
+// and add as the scalar loop, so the sums are the same to the bit.
+__attribute__((target("avx2"))) void AddQuantRowAvx2(
+    const uint8_t* codes, const float* centroids, int32_t subquantizers,
+    int32_t sub_dim, int32_t last_sub_dim, float alpha, float* out) {
+  if (sub_dim != 2) {
+    AddQuantRow(codes, centroids, subquantizers, sub_dim, last_sub_dim, alpha,
+                out);
+    return;
+  }
+  const double* pairs = reinterpret_cast<const double*>(centroids);
+  const __m256 factor = _mm256_set1_ps(alpha);
+  const __m128i offsets = _mm_setr_epi32(0, kCentroids, 2 * kCentroids,
+                                         3 * kCentroids);
+  const int32_t full = subquantizers - 1;
+  int32_t m = 0;
+  for (; m + 4 <= full; m += 4) {
+    uint32_t packed;
+    std::memcpy(&packed, codes + m, sizeof(packed));
+    __m128i index = _mm_add_epi32(
+        _mm_cvtepu8_epi32(_mm_cvtsi32_si128(packed)),
+        _mm_add_epi32(offsets, _mm_set1_epi32(m * kCentroids)));
+    __m256 values = _mm256_castpd_ps(_mm256_i32gather_pd(pairs, index, 8));
+    __m256 sum = _mm256_add_ps(_mm256_loadu_ps(out + 2 * m),
+                               _mm256_mul_ps(factor, values));
+    _mm256_storeu_ps(out + 2 * m, sum);
+  }
+  for (; m < full; m++) {
+    const float* centroid = centroids + (m * kCentroids + codes[m]) * 2;
+    out[2 * m] += alpha * centroid[0];
+    out[2 * m + 1] += alpha * centroid[1];
+  }
+  const float* centroid = centroids + full * kCentroids * 2 +
+                          codes[full] * last_sub_dim;
+  for (int32_t i = 0; i < last_sub_dim; i++) {
+    out[2 * full + i] += alpha * centroid[i];
+  }
+}
+
+// Weights are widened to int16 to meet the activations.
+__attribute__((target("avx2"))) void DotAvx2(const int8_t* weights,
+                                             int32_t rows, int32_t dim,
+                                             const int16_t* activations,
+                                             size_t count, int32_t* dots) {
+  for (int32_t r = 0; r < rows; r++) {
+    const int8_t* row = weights + r * dim;
+    for (size_t t = 0; t < count; t++) {
+      const int16_t* text = activations + t * dim;
+      __m256i acc = _mm256_setzero_si256();
+      for (int32_t i = 0; i < dim; i += 16) {
+        __m256i a =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + i));
+        __m256i w = _mm256_cvtepi8_epi16(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i)));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(a, w));
+      }
+      dots[t * rows + r] = HorizontalSum(acc);
+    }
+  }
+}
+
+// vpdpwssd does the multiply and both adds of the AVX2 loop at once.
+__attribute__((target("avx2,avx512vnni,avx512vl"))) void DotVnni(
+    const int8_t* weights, int32_t rows, int32_t dim,
+    const int16_t* activations, size_t count, int32_t* dots) {
+  for (int32_t r = 0; r < rows; r++) {
+    const int8_t* row = weights + r * dim;
+    for (size_t t = 0; t < count; t++) {
+      const int16_t* text = activations + t * dim;
+      __m256i acc = _mm256_setzero_si256();
+      for (int32_t i = 0; i < dim; i += 16) {
+        __m256i a =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + i));
+        __m256i w = _mm256_cvtepi8_epi16(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i)));
+        acc = _mm256_dpwssd_epi32(acc, a, w);
+      }
+      dots[t * rows + r] = HorizontalSum(acc);
+    }
+  }
+}
+
+#endif
+
+using RowKernel = void (*)(const uint8_t* codes, const float* centroids,
+                           int32_t subquantizers, int32_t sub_dim,
+                           int32_t last_sub_dim, float alpha, float* out);
+
+RowKernel GetRowKernel(Int8Kernel kernel) {
+#ifdef TGNEWS_X86_KERNELS
+  if (kernel != Int8Kernel::Scalar) {
+    return AddQuantRowAvx2;
+  }
+#endif
+  return AddQuantRow;
+}
+
+DotKernel GetDotKernel(Int8Kernel kernel) {
+#ifdef TGNEWS_X86_KERNELS
+  switch (kernel) {
+    case Int8Kernel::Vnni:
+      return DotVnni;
+    case Int8Kernel::Avx2:
+      return DotAvx2;
+    case Int8Kernel::Scalar:
+      break;
+  }
+#endif
+  return DotScalar;
+}
+
+}  // namespace
+
+Int8Kernel DetectInt8Kernel() {
+  if (HasCpuFeature(CpuFeature::Avx512Vnni) &&
+      HasCpuFeature(CpuFeature::Avx512Vl)) {
+    return Int8Kernel::Vnni;
+  }
+  if (HasCpuFeature(CpuFeature::Avx2)) {
+    return Int8Kernel::Avx2;
+  }
+  return Int8Kernel::Scalar;
+}
+
+const char* GetInt8KernelName(Int8Kernel kernel) {
+  switch (kernel) {
+    case Int8Kernel::Scalar:
+      return "scalar";
+    case Int8Kernel::Avx2:
+      return "avx2";
+    case Int8Kernel::Vnni:
+      return "vnni";
+  }
+  return "";
+}
+
+std::unique_ptr<QuantizedClassifier> QuantizedClassifier::Load(
+    const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  VERIFY(in, "unable to open fastText model");
+  return Load(in);
+}
+
+std::unique_ptr<QuantizedClassifier> QuantizedClassifier::Load(
+    std::istream& in) {
+  VERIFY(Read<int32_t>(in) == kFastTextMagic, "not a fastText model");
+  VERIFY(Read<int32_t>(in) <= kFastTextVersion,
+         "fastText model version is not supported");
+  int32_t loss = 0;
+  int32_t model = 0;
+  SkipArgs(in, loss, model);
+  if (model != kModelSupervised || loss == kLossHierarchicalSoftmax) {
+    return nullptr;
+  }
+  const int32_t labels = SkipDictionary(in);
+  if (!Read<bool>(in)) {
+    return nullptr;
+  }
+
+  std::unique_ptr<QuantizedClassifier> classifier(new QuantizedClassifier());
+  QuantMatrix input = ReadQuantMatrix(in);
+  classifier->dim_ = input.cols;
+  classifier->padded_dim_ = (input.cols + kPadding - 1) / kPadding * kPadding;
+  if (classifier->padded_dim_ > kMaxDim) {
+    return nullptr;
+  }
+  classifier->labels_ = labels;
+  classifier->softmax_ = loss == kLossSoftmax;
+  classifier->rows_ = input.rows;
+  classifier->subquantizers_ = input.quantizer.subquantizers;
+  classifier->sub_dim_ = input.quantizer.sub_dim;
+  classifier->last_sub_dim_ = input.quantizer.last_sub_dim;
+  classifier->centroids_ = std::move(input.quantizer.centroids);
+  classifier->codes_ = std::move(input.codes);
+  classifier->norm_codes_ = std::move(input.norm_codes);
+  classifier->norm_centroids_ = std::move(input.norm_quantizer.centroids);
+
+  // The output layer in floats, labels x dim.
+  std::vector<float> output;
+  int64_t output_rows = 0;
+  int64_t output_cols = 0;
+  if (Read<bool>(in)) {
+    QuantMatrix matrix = ReadQuantMatrix(in);
+    output_rows = matrix.rows;
+    output_cols = matrix.cols;
+    output.assign(output_rows * output_cols, 0.f);
+    for (int64_t r = 0; r < output_rows; r++) {
+      float norm = matrix.norm_codes.empty()
+                       ? 1.f
+                       : matrix.norm_quantizer.centroids[matrix.norm_codes[r]];
+      const auto& quantizer = matrix.quantizer;
+      AddQuantRow(&matrix.codes[r * quantizer.subquantizers],
+                  quantizer.centroids.data(), quantizer.subquantizers,
+                  quantizer.sub_dim, quantizer.last_sub_dim, norm,
+                  &output[r * output_cols]);
+    }
+  } else {
+    output_rows = Read<int64_t>(in);
+    output_cols = Read<int64_t>(in);
+    ReadArray(in, output, output_rows * output_cols);
+  }
+  VERIFY(output_rows == labels && output_cols == classifier->dim_,
+         "fastText model has an output layer of a wrong size");
+
+  const int32_t padded_dim = classifier->padded_dim_;
+  classifier->weights_.assign(labels * padded_dim, 0);
+  classifier->scales_.assign(labels, 0.f);
+  for (int32_t r = 0; r < labels; r++) {
+    const float* row = &output[r * output_cols];
+    float max = 0.f;
+    for (int32_t i = 0; i < output_cols; i++) {
+      max = std::max(max, std::abs(row[i]));
+    }
+    if (max == 0.f) {
+      continue;
+    }
+    const float scale = max / 127.f;
+    classifier->scales_[r] = scale;
+    for (int32_t i = 0; i < output_cols; i++) {
+      classifier->weights_[r * padded_dim + i] =
+          static_cast<int8_t>(std::lrint(row[i] / scale));
+    }
+  }
+  return classifier;
+}
+
+std::optional<QuantizedClassifier::Prediction> QuantizedClassifier::Predict(
+    const std::vector<int32_t>& words, float threshold,
+    Int8Kernel kernel) const {
+  std::optional<Prediction> prediction;
+  Predict(&words, 1, threshold, &prediction, kernel);
+  return prediction;
+}
+
+void QuantizedClassifier::Predict(
+    const std::vector<std::vector<int32_t>>& texts, float threshold,
+    std::vector<std::optional<Prediction>>& predictions,
+    Int8Kernel kernel) const {
+  predictions.assign(texts.size(), std::nullopt);
+  Predict(texts.data(), texts.size(), threshold, predictions.data(), kernel);
+}
+
+void QuantizedClassifier::Predict(const std::vector<int32_t>* texts,
+                                  size_t count, float threshold,
+                                  std::optional<Prediction>* predictions,
+                                  Int8Kernel kernel) const {
+  if (count == 0 || labels_ == 0) {
+    return;
+  }
+  struct Scratch {
+    std::vector<float> hidden;
+    std::vector<int16_t> activations;
+    std::vector<float> scales;
+    std::vector<int32_t> dots;
+  };
+  thread_local Scratch scratch;
+
+  // Texts without words get zero activations and are skipped below.
+  const RowKernel add_row = GetRowKernel(kernel);
+  scratch.activations.assign(count * padded_dim_, 0);
+  scratch.scales.assign(count, 0.f);
+  for (size_t t = 0; t < count; t++) {
+    const auto& words = texts[t];
+    if (words.empty()) {
+      continue;
+    }
+    scratch.hidden.assign(dim_, 0.f);
+    for (int32_t id : words) {
+      VERIFY(id >= 0 && id < rows_, "word id is out of the input matrix");
+      const float norm =
+          norm_codes_.empty() ? 1.f : norm_centroids_[norm_codes_[id]];
+      add_row(&codes_[int64_t(id) * subquantizers_], centroids_.data(),
+              subquantizers_, sub_dim_, last_sub_dim_, norm,
+              scratch.hidden.data());
+    }
+    const float inverse_count = 1.0 / words.size();
+    float max = 0.f;
+    for (float& value : scratch.hidden) {
+      value *= inverse_count;
+      max = std::max(max, std::abs(value));
+    }
+    if (max == 0.f) {
+      continue;
+    }
+    const float scale = max / 32767.f;
+    scratch.scales[t] = scale;
+    int16_t* activations = &scratch.activations[t * padded_dim_];
+    for (int32_t i = 0; i < dim_; i++) {
+      activations[i] =
+          static_cast<int16_t>(std::lrint(scratch.hidden[i] / scale));
+    }
+  }
+  scratch.dots.resize(count * labels_);
+  GetDotKernel(kernel)(weights_.data(), labels_, padded_dim_,
+                       scratch.activations.data(), count, scratch.dots.data());
+
+  for (size_t t = 0; t < count; t++) {
+    if (texts[t].empty()) {
+      continue;
+    }
+    const int32_t* dots = &scratch.dots[t * labels_];
+    const float scale = scratch.scales[t];
+    auto logit = [&](int32_t label) {
+      return dots[label] * scales_[label] * scale;
+    };
+    int32_t best = 0;
+    for (int32_t label = 1; label < labels_; label++) {
+      if (logit(label) > logit(best)) {
+        best = label;
+      }
+    }
+    float probability = 0.f;
+    if (softmax_) {
+      float sum = 0.f;
+      for (int32_t label = 0; label < labels_; label++) {
+        sum += std::exp(logit(label) - logit(best));
+      }
+      probability = 1.f / sum;
+    } else {
+      probability = 1.f / (1.f + std::exp(-logit(best)));
+    }
+    if (probability >= threshold) {
+      predictions[t] = Prediction{best, probability};
+    }
+  }
+}
+
+}  // namespace tgnews
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace tgnews {
+
+enum class Int8Kernel {
+  Scalar,
+  Avx2,
+  // AVX-512 VNNI on 256-bit registers.
+  Vnni,
+};
+
+// VNNI where the CPU has it, then AVX2, then scalar.
+Int8Kernel DetectInt8Kernel();
+
+const char* GetInt8KernelName(Int8Kernel kernel);
+
+// Inference of a product quantized supervised fastText model (.ftz), from
+// the word ids of Dictionary::getLine to the top label.
+//
+// The hidden vector is the average of the input rows decoded from their
+// codes, as in fastText, four subquantizers at a time with AVX2. The output
+// layer is decoded once at load and kept as int8 rows with a scale each,
+// padded to 32 values. Only the output layer is rounded that coarsely: the
+// hidden vector is scaled to int16 per prediction, so scoring all labels is
+// a few integer dot products while the scores move by well under a percent
+// of the largest one. The top label only changes on near ties.
+class QuantizedClassifier {
+ public:
+  struct Prediction {
+    int32_t label;
+    float probability;
+  };
+
+  // Nullptr for models it does not handle: not quantized, not supervised,
+  // with hierarchical softmax or over 512 dimensions. Throws on a malformed
+  // model.
+  static std::unique_ptr<QuantizedClassifier> Load(const std::string& path);
+  static std::unique_ptr<QuantizedClassifier> Load(std::istream& in);
+
+  int32_t GetLabelCount() const { return labels_; }
+
+  // Top label, the same as FastText::predict with k = 1 short of rounding.
+  // Nothing without words or when no label reaches the threshold.
+  std::optional<Prediction> Predict(
+      const std::vector<int32_t>& words, float threshold,
+      Int8Kernel kernel = DetectInt8Kernel()) const;
+
+  // The same for many texts: every output row is read once for all of them.
+  void Predict(const std::vector<std::vector<int32_t>>& texts,
+               float threshold,
+               std::vector<std::optional<Prediction>>& predictions,
+               Int8Kernel kernel = DetectInt8Kernel()) const;
+
+ private:
+  QuantizedClassifier() = default;
+
+  void Predict(const std::vector<int32_t>* texts, size_t count,
+               float threshold, std::optional<Prediction>* predictions,
+               Int8Kernel kernel) const;
+
+  int32_t dim_ = 0;
+  int32_t padded_dim_ = 0;
+  int32_t labels_ = 0;
+  // Softmax over the labels, or a sigmoid per label otherwise.
+  bool softmax_ = true;
+
+  // Input rows as product quantizer codes.
+  int64_t rows_ = 0;
+  int32_t subquantizers_ = 0;
+  int32_t sub_dim_ = 0;
+  int32_t last_sub_dim_ = 0;
+  std::vector<float> centroids_;
+  std::vector<uint8_t> codes_;
+  // Row norms quantized separately, empty if they were not.
+  std::vector<uint8_t> norm_codes_;
+  std::vector<float> norm_centroids_;
+
+  // Output rows, labels_ x padded_dim_, and their scales.
+  std::vector<int8_t> weights_;
+  std::vector<float> scales_;
+};
+
+}  // namespace tgnews
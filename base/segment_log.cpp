@@ -0,0 +1,721 @@
+#include "base/segment_log.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <boost/crc.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/range/iterator_range.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <tuple>
+
+#include "base/base.h"
+#include "base/parallel_for.h"
+#include "fmt/format.h"
+#include "glog/logging.h"
+
+namespace tgnews {
+
+namespace {
+
+constexpr size_t kHeaderSize = 2 * sizeof(uint32_t);
+constexpr size_t kPayloadHeaderSize =
+    sizeof(uint8_t) + sizeof(uint64_t) + sizeof(uint32_t);
+constexpr std::string_view kSegmentExtension = ".log";
+constexpr std::string_view kCompactedExtension = ".compact";
+constexpr std::string_view kTemporaryExtension = ".tmp";
+// Live records handed out by one replay task.
+constexpr size_t kReplayChunk = 256;
+
+uint32_t Checksum(const char* data, size_t size) {
+  boost::crc_32_type crc;
+  crc.process_bytes(data, size);
+  return crc.checksum();
+}
+
+template <typename T>
+void AppendValue(std::string& out, T value) {
+  out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+T ReadValue(const char* data) {
+  T value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+void WriteAll(int fd, std::string_view data, const std::string& path) {
+  while (!data.empty()) {
+    ssize_t written = ::write(fd, data.data(), data.size());
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    VERIFY(written >= 0, fmt::format("unable to write {}: {}", path,
+                                     std::strerror(errno)));
+    data.remove_prefix(written);
+  }
+}
+
+void SyncFile(int fd, const std::string& path) {
+  VERIFY(::fdatasync(fd) == 0,
+         fmt::format("unable to sync {}: {}", path, std::strerror(errno)));
+}
+
+// Read only mapping of a whole segment.
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    VERIFY(fd >= 0, fmt::format("unable to open segment: {}", path));
+    size_ = boost::filesystem::file_size(path);
+    if (size_ > 0) {
+      data_ = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    ::close(fd);
+    VERIFY(data_ != MAP_FAILED,
+           fmt::format("unable to map segment: {}", path));
+    if (size_ > 0) {
+      ::madvise(data_, size_, MADV_SEQUENTIAL);
+    }
+  }
+
+  ~MappedFile() {
+    if (size_ > 0) {
+      ::munmap(data_, size_);
+    }
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  std::string_view Data() const {
+    return std::string_view(static_cast<const char*>(data_), size_);
+  }
+
+ private:
+  void* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// Makes creates, renames and unlinks inside the directory durable.
+void SyncDirectory(const std::string& dir) {
+  int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+  VERIFY(fd >= 0, fmt::format("unable to open directory: {}", dir));
+  ::fsync(fd);
+  ::close(fd);
+}
+
+}  // namespace
+
+SegmentLog::SegmentLog(std::string dir, Options options)
+    : dir_(std::move(dir)), options_(options) {
+  VERIFY(options_.segment_size > kHeaderSize + kPayloadHeaderSize,
+         "segment size is too small");
+  boost::filesystem::path path = dir_;
+  if (!boost::filesystem::exists(path)) {
+    VERIFY(boost::filesystem::create_directories(path),
+           fmt::format("unable to create directory for the log: {}", dir_));
+  }
+  Recover();
+}
+
+SegmentLog::~SegmentLog() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+  }
+  pending_cv_.notify_all();
+  if (writer_.joinable()) {
+    writer_.join();
+  }
+  if (active_fd_ >= 0) {
+    if (options_.sync_every_batches > 0 && !failed_) {
+      try {
+        SyncFile(active_fd_, SegmentPath(active_id_));
+      } catch (std::exception& e) {
+        LOG(ERROR) << e.what();
+      }
+    }
+    ::close(active_fd_);
+  }
+}
+
+std::string SegmentLog::SegmentPath(uint64_t id) const {
+  return fmt::format("{}/{:020}{}", dir_, id, kSegmentExtension);
+}
+
+std::string SegmentLog::CompactedPath(uint64_t id) const {
+  return fmt::format("{}/{:020}{}", dir_, id, kCompactedExtension);
+}
+
+void SegmentLog::Recover() {
+  std::vector<uint64_t> compacted;
+  for (const auto& entry : boost::make_iterator_range(
+           boost::filesystem::directory_iterator(dir_), {})) {
+    const auto& path = entry.path();
+    auto extension = path.extension().string();
+    uint64_t id = 0;
+    try {
+      id = std::stoull(path.stem().string());
+    } catch (...) {
+      continue;
+    }
+    if (extension == kTemporaryExtension) {
+      // Compaction died before committing, the sources are intact.
+      boost::filesystem::remove(path);
+    } else if (extension == kCompactedExtension) {
+      compacted.push_back(id);
+    } else if (extension == kSegmentExtension) {
+      segments_[id];
+    }
+  }
+
+  // A committed compaction replaces every segment up to its id.
+  for (uint64_t id : compacted) {
+    for (auto it = segments_.begin();
+         it != segments_.end() && it->first <= id;) {
+      boost::filesystem::remove(SegmentPath(it->first));
+      it = segments_.erase(it);
+    }
+    boost::filesystem::rename(CompactedPath(id), SegmentPath(id));
+    segments_[id];
+  }
+  if (!compacted.empty()) {
+    SyncDirectory(dir_);
+  }
+}
+
+std::string SegmentLog::Encode(ERecordType type, std::string_view name,
+                               uint64_t expiration_time,
+                               std::string_view value) {
+  std::string payload;
+  payload.reserve(kPayloadHeaderSize + name.size() + value.size());
+  AppendValue(payload, static_cast<uint8_t>(type));
+  AppendValue(payload, expiration_time);
+  AppendValue(payload, static_cast<uint32_t>(name.size()));
+  payload.append(name);
+  payload.append(value);
+
+  std::string record;
+  record.reserve(kHeaderSize + payload.size());
+  AppendValue(record, static_cast<uint32_t>(payload.size()));
+  AppendValue(record, Checksum(payload.data(), payload.size()));
+  record.append(payload);
+  return record;
+}
+
+bool SegmentLog::Decode(std::string_view data, uint64_t offset,
+                        Record& record) {
+  if (data.size() - offset < kHeaderSize) {
+    return false;
+  }
+  const char* header = data.data() + offset;
+  auto size = ReadValue<uint32_t>(header);
+  auto checksum = ReadValue<uint32_t>(header + sizeof(uint32_t));
+  if (size < kPayloadHeaderSize ||
+      data.size() - offset - kHeaderSize < size) {
+    return false;
+  }
+  const char* payload = header + kHeaderSize;
+  if (Checksum(payload, size) != checksum) {
+    return false;
+  }
+
+  auto type = static_cast<ERecordType>(ReadValue<uint8_t>(payload));
+  auto name_size =
+      ReadValue<uint32_t>(payload + sizeof(uint8_t) + sizeof(uint64_t));
+  if ((type != ERecordType::Put && type != ERecordType::Delete &&
+       type != ERecordType::Touch) ||
+      name_size > size - kPayloadHeaderSize) {
+    return false;
+  }
+  record.type = type;
+  record.expiration_time = ReadValue<uint64_t>(payload + sizeof(uint8_t));
+  record.name = std::string_view(payload + kPayloadHeaderSize, name_size);
+  record.value =
+      std::string_view(payload + kPayloadHeaderSize + name_size,
+                       size - kPayloadHeaderSize - name_size);
+  record.size = kHeaderSize + size;
+  return true;
+}
+
+void SegmentLog::Replay(const ReplayHandler& handler,
+                        std::experimental::thread_pool* pool) {
+  VERIFY(!replayed_, "segment log is replayed already");
+
+  // The first pass checks segments in parallel and then applies their
+  // records to the index in log order, the second one hands out the puts the
+  // index points to.
+  struct Scanned {
+    std::vector<std::pair<ERecordType, Location>> records;
+    std::vector<std::string> names;
+    uint64_t valid_size = 0;
+    uint64_t size = 0;
+  };
+  std::vector<uint64_t> ids;
+  for (const auto& [id, stats] : segments_) {
+    ids.push_back(id);
+  }
+  std::vector<Scanned> scanned(ids.size());
+  ParallelFor(pool, ids.size(), [&](size_t index) {
+    MappedFile file(SegmentPath(ids[index]));
+    auto data = file.Data();
+    auto& result = scanned[index];
+    uint64_t offset = 0;
+    Record record;
+    while (offset < data.size() && Decode(data, offset, record)) {
+      result.records.emplace_back(
+          record.type,
+          Location{ids[index], offset, record.size, record.expiration_time});
+      result.names.emplace_back(record.name);
+      offset += record.size;
+    }
+    result.valid_size = offset;
+    result.size = data.size();
+  });
+
+  for (size_t index = 0; index < ids.size(); index++) {
+    auto id = ids[index];
+    auto& result = scanned[index];
+    for (size_t i = 0; i < result.records.size(); i++) {
+      const auto& [type, location] = result.records[i];
+      segments_[id].bytes += location.size;
+      ApplyToIndex(type, result.names[i], location);
+    }
+    if (result.valid_size < result.size) {
+      bool last = index + 1 == ids.size();
+      LOG(ERROR) << fmt::format(
+          "{} bytes of broken records at {} of segment {}{}",
+          result.size - result.valid_size, result.valid_size, SegmentPath(id),
+          last ? ", truncating the torn tail" : "");
+      if (last) {
+        VERIFY(::truncate(SegmentPath(id).c_str(), result.valid_size) == 0,
+               fmt::format("unable to truncate segment: {}", SegmentPath(id)));
+      }
+    }
+  }
+  scanned.clear();
+
+  std::vector<Location> live;
+  live.reserve(index_.size());
+  std::map<uint64_t, std::unique_ptr<MappedFile>> files;
+  for (const auto& [name, location] : index_) {
+    live.push_back(location);
+    auto& file = files[location.segment];
+    if (!file) {
+      file = std::make_unique<MappedFile>(SegmentPath(location.segment));
+    }
+  }
+  std::sort(live.begin(), live.end(), [](const auto& lhs, const auto& rhs) {
+    return std::tie(lhs.segment, lhs.offset) <
+           std::tie(rhs.segment, rhs.offset);
+  });
+  const size_t chunks = (live.size() + kReplayChunk - 1) / kReplayChunk;
+  ParallelFor(pool, chunks, [&](size_t chunk) {
+    size_t end = std::min(live.size(), (chunk + 1) * kReplayChunk);
+    for (size_t i = chunk * kReplayChunk; i < end; i++) {
+      Record record;
+      auto data = files.at(live[i].segment)->Data();
+      VERIFY(Decode(data, live[i].offset, record),
+             "segment changed during replay");
+      handler(record.name, live[i].expiration_time, record.value);
+    }
+  });
+
+  // Compaction only touches segments older than the active one, so it is
+  // safe to keep appending to the last segment.
+  OpenSegment(segments_.empty() ? 1 : segments_.rbegin()->first);
+
+  replayed_ = true;
+  writer_ = std::thread([this] { WriterLoop(); });
+}
+
+void SegmentLog::OpenSegment(uint64_t id) {
+  auto path = SegmentPath(id);
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+  VERIFY(fd >= 0, fmt::format("unable to open segment: {}", path));
+  SyncDirectory(dir_);
+  active_fd_ = fd;
+  active_size_ = boost::filesystem::file_size(path);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  segments_[id];
+  active_id_ = id;
+}
+
+void SegmentLog::Put(std::string_view name, uint64_t expiration_time,
+                     std::string_view value, Callback done) {
+  Append({ERecordType::Put, std::string(name), expiration_time,
+          Encode(ERecordType::Put, name, expiration_time, value),
+          std::move(done)});
+}
+
+void SegmentLog::Touch(std::string_view name, uint64_t expiration_time,
+                       Callback done) {
+  Append({ERecordType::Touch, std::string(name), expiration_time,
+          Encode(ERecordType::Touch, name, expiration_time, {}),
+          std::move(done)});
+}
+
+void SegmentLog::Delete(std::string_view name, Callback done) {
+  Append({ERecordType::Delete, std::string(name), 0,
+          Encode(ERecordType::Delete, name, 0, {}), std::move(done)});
+}
+
+void SegmentLog::Append(Pending pending) {
+  VERIFY(pending.data.size() <= options_.segment_size,
+         fmt::format("record for {} does not fit into a segment",
+                     pending.name));
+  std::exception_ptr failed;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    VERIFY(replayed_, "segment log has to be replayed before appending");
+    VERIFY(!stopped_, "segment log is stopped");
+    failed = failed_;
+    if (!failed) {
+      pending_.push_back(std::move(pending));
+    }
+  }
+  if (failed) {
+    if (pending.done) {
+      pending.done(failed);
+    }
+    return;
+  }
+  pending_cv_.notify_one();
+}
+
+void SegmentLog::WriterLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    pending_cv_.wait(lock, [this] { return stopped_ || !pending_.empty(); });
+    if (pending_.empty()) {
+      return;
+    }
+    if (options_.group_commit_window.count() > 0 && !stopped_) {
+      pending_cv_.wait_for(lock, options_.group_commit_window,
+                           [this] { return stopped_; });
+    }
+    writing_.swap(pending_);
+
+    lock.unlock();
+    WriteBatch();
+    lock.lock();
+  }
+}
+
+void SegmentLog::WriteBatch() {
+  // Only the writer changes writing_, reading it needs no lock.
+  auto& batch = writing_;
+  std::vector<Location> locations;
+  locations.reserve(batch.size());
+  std::string buffer;
+
+  auto flush = [&] {
+    WriteAll(active_fd_, buffer, SegmentPath(active_id_));
+    buffer.clear();
+  };
+
+  std::exception_ptr error;
+  try {
+    for (const auto& pending : batch) {
+      if (active_size_ > 0 &&
+          active_size_ + pending.data.size() > options_.segment_size) {
+        flush();
+        if (options_.sync_every_batches > 0) {
+          SyncFile(active_fd_, SegmentPath(active_id_));
+        }
+        ::close(active_fd_);
+        active_fd_ = -1;
+        OpenSegment(active_id_ + 1);
+      }
+      locations.push_back({active_id_, active_size_,
+                           static_cast<uint32_t>(pending.data.size()),
+                           pending.expiration_time});
+      buffer.append(pending.data);
+      active_size_ += pending.data.size();
+    }
+    flush();
+
+    if (options_.sync_every_batches > 0 &&
+        ++batches_since_sync_ >= options_.sync_every_batches) {
+      SyncFile(active_fd_, SegmentPath(active_id_));
+      batches_since_sync_ = 0;
+    }
+  } catch (...) {
+    // A part of the batch may be on disk, anything appended after it could
+    // be lost behind a torn record on replay. The log stops taking writes
+    // and the server keeps answering from memory.
+    error = std::current_exception();
+  }
+
+  std::vector<Pending> finished;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (error) {
+      failed_ = error;
+      // Queued before the failure showed up, these never reach the disk.
+      for (auto& pending : pending_) {
+        batch.push_back(std::move(pending));
+      }
+      pending_.clear();
+    } else {
+      for (size_t i = 0; i < batch.size(); i++) {
+        segments_[locations[i].segment].bytes += locations[i].size;
+        ApplyToIndex(batch[i].type, batch[i].name, locations[i]);
+      }
+    }
+    // Get() reads the index from here on.
+    finished.swap(batch);
+  }
+  if (error) {
+    LOG(ERROR) << "segment log failed, " << finished.size()
+               << " records are not written";
+  }
+
+  for (auto& pending : finished) {
+    if (pending.done) {
+      pending.done(error);
+    }
+  }
+}
+
+void SegmentLog::ApplyToIndex(ERecordType type, const std::string& name,
+                              const Location& location) {
+  auto it = index_.find(name);
+  if (type == ERecordType::Touch) {
+    // The touch itself is garbage right away, compaction rewrites the put.
+    if (it != index_.end()) {
+      it->second.expiration_time = location.expiration_time;
+    }
+    return;
+  }
+  if (it != index_.end()) {
+    MarkDead(it->second);
+  }
+  if (type == ERecordType::Delete) {
+    if (it != index_.end()) {
+      index_.erase(it);
+    }
+    return;
+  }
+  if (it == index_.end()) {
+    it = index_.emplace(name, location).first;
+  }
+  it->second = location;
+  segments_[location.segment].live_bytes += location.size;
+}
+
+void SegmentLog::MarkDead(const Location& location) {
+  auto it = segments_.find(location.segment);
+  if (it != segments_.end()) {
+    it->second.live_bytes -= location.size;
+  }
+}
+
+bool SegmentLog::NeedsCompaction() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!replayed_ || compacting_) {
+    return false;
+  }
+  uint64_t bytes = 0;
+  uint64_t live_bytes = 0;
+  for (const auto& [id, stats] : segments_) {
+    if (id >= active_id_) {
+      break;
+    }
+    bytes += stats.bytes;
+    live_bytes += stats.live_bytes;
+  }
+  return bytes > 0 &&
+         bytes - live_bytes >= options_.compaction_garbage_ratio * bytes;
+}
+
+bool SegmentLog::Compact(uint64_t now) {
+  std::vector<uint64_t> sealed;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!replayed_ || compacting_) {
+      return false;
+    }
+    for (const auto& [id, stats] : segments_) {
+      if (id < active_id_) {
+        sealed.push_back(id);
+      }
+    }
+    if (sealed.empty()) {
+      return false;
+    }
+    compacting_ = true;
+  }
+  const uint64_t target = sealed.back();
+
+  // Sealed segments are immutable, only the index moves under our feet. A
+  // record overwritten after it was copied is simply not relinked below.
+  struct Moved {
+    std::string name;
+    Location from;
+    Location to;
+  };
+  std::vector<Moved> moved;
+  std::vector<std::pair<std::string, Location>> expired;
+  std::string output;
+  for (uint64_t id : sealed) {
+    MappedFile file(SegmentPath(id));
+    auto data = file.Data();
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t offset = 0;
+    Record record;
+    while (offset < data.size() && Decode(data, offset, record)) {
+      Location from{id, offset, record.size};
+      offset += record.size;
+      if (record.type != ERecordType::Put) {
+        continue;
+      }
+      std::string name(record.name);
+      auto it = index_.find(name);
+      if (it == index_.end() || !(it->second == from)) {
+        continue;
+      }
+      auto expiration_time = it->second.expiration_time;
+      if (expiration_time <= now) {
+        expired.emplace_back(std::move(name), from);
+        continue;
+      }
+      moved.push_back({std::move(name), from,
+                       {target, output.size(), record.size}});
+      if (expiration_time == record.expiration_time) {
+        output.append(data.substr(from.offset, record.size));
+      } else {
+        // Touched since, the put takes over the new expiration time.
+        output.append(Encode(ERecordType::Put, record.name, expiration_time,
+                             record.value));
+      }
+    }
+  }
+
+  auto temporary_path =
+      fmt::format("{}{}", CompactedPath(target), kTemporaryExtension);
+  int fd = ::open(temporary_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  try {
+    VERIFY(fd >= 0, fmt::format("unable to open {}", temporary_path));
+    WriteAll(fd, output, temporary_path);
+    SyncFile(fd, temporary_path);
+  } catch (...) {
+    // Nothing is committed yet, the sources stay as they are.
+    if (fd >= 0) {
+      ::close(fd);
+    }
+    boost::system::error_code ignored;
+    boost::filesystem::remove(temporary_path, ignored);
+    std::lock_guard<std::mutex> lock(mutex_);
+    compacting_ = false;
+    throw;
+  }
+  ::close(fd);
+  // Committed from here on, Recover() finishes the rest after a crash.
+  boost::filesystem::rename(temporary_path, CompactedPath(target));
+  SyncDirectory(dir_);
+
+  std::unique_lock<std::shared_mutex> files_lock(files_mutex_);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (uint64_t id : sealed) {
+      segments_.erase(id);
+    }
+    auto& stats = segments_[target];
+    stats.bytes = output.size();
+    for (const auto& [name, from, to] : moved) {
+      auto it = index_.find(name);
+      if (it != index_.end() && it->second == from) {
+        // Keeps the expiration time of a touch which came after the copy.
+        it->second.segment = to.segment;
+        it->second.offset = to.offset;
+        stats.live_bytes += to.size;
+      }
+    }
+    for (const auto& [name, from] : expired) {
+      auto it = index_.find(name);
+      if (it != index_.end() && it->second == from) {
+        index_.erase(it);
+      }
+    }
+  }
+
+  for (uint64_t id : sealed) {
+    boost::filesystem::remove(SegmentPath(id));
+  }
+  boost::filesystem::rename(CompactedPath(target), SegmentPath(target));
+  SyncDirectory(dir_);
+  files_lock.unlock();
+
+  LOG(INFO) << fmt::format(
+      "compacted {} segments up to {}: {} live records, {} expired, {} bytes",
+      sealed.size(), target, moved.size(), expired.size(), output.size());
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  compacting_ = false;
+  return true;
+}
+
+std::optional<std::string> SegmentLog::Get(std::string_view name) const {
+  std::shared_lock<std::shared_mutex> files_lock(files_mutex_);
+  Location location;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Queued records are newer than the index, the latest one wins.
+    for (const auto* queue : {&pending_, &writing_}) {
+      for (auto it = queue->rbegin(); it != queue->rend(); ++it) {
+        if (it->name != name || it->type == ERecordType::Touch) {
+          continue;
+        }
+        if (it->type == ERecordType::Delete) {
+          return std::nullopt;
+        }
+        Record record;
+        VERIFY(Decode(it->data, 0, record), "queued record is broken");
+        return std::string(record.value);
+      }
+    }
+    auto it = index_.find(std::string(name));
+    if (it == index_.end()) {
+      return std::nullopt;
+    }
+    location = it->second;
+  }
+
+  auto path = SegmentPath(location.segment);
+  int fd = ::open(path.c_str(), O_RDONLY);
+  VERIFY(fd >= 0, fmt::format("unable to open segment: {}", path));
+  std::string data(location.size, '\0');
+  size_t done = 0;
+  while (done < data.size()) {
+    ssize_t read = ::pread(fd, data.data() + done, data.size() - done,
+                           location.offset + done);
+    if (read < 0 && errno == EINTR) {
+      continue;
+    }
+    if (read <= 0) {
+      break;
+    }
+    done += read;
+  }
+  ::close(fd);
+
+  Record record;
+  VERIFY(done == data.size() && Decode(data, 0, record) &&
+             record.name == name,
+         fmt::format("broken record of {} in {}", name, path));
+  return std::string(record.value);
+}
+
+size_t SegmentLog::LiveRecords() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return index_.size();
+}
+
+}  // namespace tgnews
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <experimental/thread_pool>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace tgnews {
+
+// Append-only log of put/delete records keyed by name, split into segment
+// files <id>.log inside one directory.
+//
+// Record: u32 payload size, u32 crc32 of payload, payload. Payload: u8 type,
+// u64 expiration time, u32 name size, name, value. A torn record at the end
+// of the last segment is cut off on open. A touch record only moves the
+// expiration time of the live put.
+//
+// Appends are queued and written by a single writer thread: everything queued
+// while it was busy goes out with one write() and at most one fdatasync()
+// (group commit). The completion callback runs on the writer thread after the
+// batch is written and, depending on Options, synced. If a write or sync
+// fails, the callbacks of the batch get the error and so do those of every
+// later append: nothing past a failed write is acknowledged.
+//
+// Compact() rewrites all sealed segments into one, dropping overwritten,
+// deleted and expired records. It commits by renaming <last id>.compact,
+// which is finished on the next open if the process dies halfway.
+class SegmentLog {
+ public:
+  struct Options {
+    size_t segment_size = 64 << 20;
+    // The writer waits this long for more records before writing a batch.
+    std::chrono::microseconds group_commit_window{0};
+    // fdatasync every n-th batch, 0 never syncs.
+    size_t sync_every_batches = 1;
+    // Compact when this share of the sealed segments is garbage.
+    double compaction_garbage_ratio = 0.5;
+  };
+
+  // Gets null once the record is durable, the write error otherwise.
+  using Callback = std::function<void(std::exception_ptr error)>;
+  using ReplayHandler = std::function<void(
+      std::string_view name, uint64_t expiration_time, std::string_view value)>;
+
+  SegmentLog(std::string dir, Options options);
+
+  ~SegmentLog();
+
+  // Calls handler for the latest put of every name which was not deleted
+  // afterwards. Has to be called once before anything is appended. Segments
+  // are mapped, the value is valid during the call only.
+  //
+  // With a pool, segments are checked and the handler is called from pool
+  // threads as well as the calling one, so it has to be thread safe.
+  void Replay(const ReplayHandler& handler,
+              std::experimental::thread_pool* pool = nullptr);
+
+  void Put(std::string_view name, uint64_t expiration_time,
+           std::string_view value, Callback done = {});
+
+  // Does nothing if there is no live put of the name.
+  void Touch(std::string_view name, uint64_t expiration_time,
+             Callback done = {});
+
+  void Delete(std::string_view name, Callback done = {});
+
+  // Reads the value of the live put of `name` back from its segment, or
+  // from the queue if it is not written yet: a Get() right after a Put()
+  // sees the new value. Thread safe, blocks for the duration of one pread().
+  std::optional<std::string> Get(std::string_view name) const;
+
+  bool NeedsCompaction() const;
+
+  // Drops records expired at `now` as well. Returns false if there was
+  // nothing to compact or another compaction is running.
+  bool Compact(uint64_t now);
+
+  size_t LiveRecords() const;
+
+ private:
+  enum class ERecordType : uint8_t { Put = 1, Delete = 2, Touch = 3 };
+
+  struct Location {
+    uint64_t segment = 0;
+    uint64_t offset = 0;
+    uint32_t size = 0;
+    // Of the record for puts in the index, moved by touches.
+    uint64_t expiration_time = 0;
+
+    bool operator==(const Location& other) const {
+      return segment == other.segment && offset == other.offset;
+    }
+  };
+
+  struct SegmentStats {
+    uint64_t bytes = 0;
+    uint64_t live_bytes = 0;
+  };
+
+  struct Record {
+    ERecordType type;
+    uint64_t expiration_time;
+    std::string_view name;
+    std::string_view value;
+    uint32_t size;
+  };
+
+  struct Pending {
+    ERecordType type;
+    std::string name;
+    uint64_t expiration_time;
+    std::string data;
+    Callback done;
+  };
+
+  static std::string Encode(ERecordType type, std::string_view name,
+                            uint64_t expiration_time, std::string_view value);
+
+  // Parses the record at `offset`, returns false on a torn or corrupt one.
+  static bool Decode(std::string_view data, uint64_t offset, Record& record);
+
+  std::string SegmentPath(uint64_t id) const;
+
+  std::string CompactedPath(uint64_t id) const;
+
+  void Recover();
+
+  void OpenSegment(uint64_t id);
+
+  void Append(Pending pending);
+
+  void WriterLoop();
+
+  void WriteBatch();
+
+  // Make sure to hold mutex_.
+  void ApplyToIndex(ERecordType type, const std::string& name,
+                    const Location& location);
+
+  // Make sure to hold mutex_.
+  void MarkDead(const Location& location);
+
+  const std::string dir_;
+  const Options options_;
+
+  mutable std::mutex mutex_;
+  // Held exclusively by Compact() while the index points at segment files
+  // which are being renamed, Get() reads under the shared side.
+  mutable std::shared_mutex files_mutex_;
+  std::condition_variable pending_cv_;
+  std::vector<Pending> pending_;
+  // The batch the writer took from pending_, left for Get() until the index
+  // points at its records.
+  std::vector<Pending> writing_;
+  bool stopped_ = false;
+  bool replayed_ = false;
+  // Set by the writer on the first failed write or sync.
+  std::exception_ptr failed_;
+  bool compacting_ = false;
+
+  std::unordered_map<std::string, Location> index_;
+  std::map<uint64_t, SegmentStats> segments_;
+
+  // Owned by the writer thread once it started.
+  int active_fd_ = -1;
+  uint64_t active_id_ = 0;
+  uint64_t active_size_ = 0;
+  size_t batches_since_sync_ = 0;
+
+  std::thread writer_;
+};
+
+}  // namespace tgnews
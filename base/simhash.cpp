@@ -0,0 +1,118 @@
+#include "base/simhash.h"
+
+#include <unordered_map>
+
+#include "base/base.h"
+#include "base/hash.h"
+
+namespace tgnews {
+
+uint64_t TextFingerprint(std::string_view title, std::string_view text) {
+  int votes[64] = {};
+  size_t features = 0;
+  auto vote = [&](uint64_t hash) {
+    for (int bit = 0; bit < 64; bit++) {
+      votes[bit] += (hash >> bit & 1) ? 1 : -1;
+    }
+    features++;
+  };
+
+  std::string_view previous;
+  for (std::string_view part : {title, text}) {
+    while (!part.empty()) {
+      size_t end = part.find(' ');
+      auto token = part.substr(0, end);
+      part.remove_prefix(end == std::string_view::npos ? part.size() : end + 1);
+      if (token.empty()) {
+        continue;
+      }
+      if (!previous.empty()) {
+        vote(HashBytes(token, HashBytes(previous)));
+      }
+      previous = token;
+    }
+  }
+  // A single token has no bigrams.
+  if (features == 0 && !previous.empty()) {
+    vote(HashBytes(previous));
+  }
+
+  uint64_t fingerprint = 0;
+  for (int bit = 0; bit < 64; bit++) {
+    if (votes[bit] > 0) {
+      fingerprint |= uint64_t(1) << bit;
+    }
+  }
+  return fingerprint;
+}
+
+uint64_t FingerprintBand(uint64_t fingerprint, int index, int max_distance) {
+  const int bands = max_distance + 1;
+  const int width = 64 / bands;
+  int shift = index * width;
+  int bits = index + 1 == bands ? 64 - shift : width;
+  return bits == 64 ? fingerprint
+                    : fingerprint >> shift & ((uint64_t(1) << bits) - 1);
+}
+
+std::vector<size_t> GroupNearDuplicates(
+    const std::vector<uint64_t>& fingerprints, int max_distance) {
+  VERIFY(max_distance >= 0 && max_distance < 16,
+         "near-duplicate distance is out of range");
+  const int bands = max_distance + 1;
+
+  std::vector<size_t> parents(fingerprints.size());
+  auto find = [&](size_t i) {
+    while (parents[i] != i) {
+      parents[i] = parents[parents[i]];
+      i = parents[i];
+    }
+    return i;
+  };
+  auto unite = [&](size_t l, size_t r) { parents[find(l)] = find(r); };
+
+  // Equal fingerprints are joined right away, only the first one goes into
+  // the bands.
+  std::unordered_map<uint64_t, size_t> first;
+  std::vector<std::unordered_map<uint64_t, std::vector<size_t>>> buckets(
+      bands);
+  for (size_t i = 0; i < fingerprints.size(); ++i) {
+    const uint64_t fingerprint = fingerprints[i];
+    parents[i] = i;
+    if (fingerprint == 0) {
+      continue;
+    }
+    auto [it, inserted] = first.emplace(fingerprint, i);
+    if (!inserted) {
+      unite(i, it->second);
+      continue;
+    }
+    for (int index = 0; index < bands; ++index) {
+      auto& bucket =
+          buckets[index][FingerprintBand(fingerprint, index, max_distance)];
+      for (size_t other : bucket) {
+        if (find(i) != find(other) &&
+            FingerprintDistance(fingerprint, fingerprints[other]) <=
+                max_distance) {
+          unite(i, other);
+        }
+      }
+      bucket.push_back(i);
+    }
+  }
+
+  // Groups are named by their first position.
+  const size_t none = fingerprints.size();
+  std::vector<size_t> leaders(fingerprints.size(), none);
+  std::vector<size_t> groups(fingerprints.size());
+  for (size_t i = 0; i < fingerprints.size(); ++i) {
+    size_t root = find(i);
+    if (leaders[root] == none) {
+      leaders[root] = i;
+    }
+    groups[i] = leaders[root];
+  }
+  return groups;
+}
+
+}  // namespace tgnews
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace tgnews {
+
+// Near-duplicates differ in at most this many fingerprint bits. Syndicated
+// copies of one article with another header or footer stay within it.
+constexpr int kNearDuplicateBits = 3;
+
+// 64-bit SimHash (Charikar) of the word bigrams of the space separated
+// tokens of the title and the text: every bit is the majority vote of that
+// bit over the bigram hashes, so similar texts get fingerprints a few bits
+// apart. 0 for a text without tokens. Persisted, must not change between
+// builds.
+uint64_t TextFingerprint(std::string_view title, std::string_view text);
+
+inline int FingerprintDistance(uint64_t lhs, uint64_t rhs) {
+  return __builtin_popcountll(lhs ^ rhs);
+}
+
+// Band `index` out of max_distance + 1 equal cuts of the fingerprint.
+// Fingerprints at most max_distance bits apart have at least one equal band.
+uint64_t FingerprintBand(uint64_t fingerprint, int index,
+                         int max_distance = kNearDuplicateBits);
+
+// Groups the fingerprints transitively: two within `max_distance` bits
+// share a group, and so do chains of them. Every one gets the position of
+// the first fingerprint of its group. Zero fingerprints are left alone.
+//
+// Candidates are found by LSH banding, fingerprints are cut into
+// max_distance + 1 bands and only ones with an equal band are compared.
+// Fingerprints differing in at most max_distance bits share a band, so no
+// pair is missed while a batch of distinct texts is grouped in about linear
+// time.
+std::vector<size_t> GroupNearDuplicates(
+    const std::vector<uint64_t>& fingerprints,
+    int max_distance = kNearDuplicateBits);
+
+}  // namespace tgnews
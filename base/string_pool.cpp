@@ -0,0 +1,65 @@
+#include "base/string_pool.h"
+
+#include <mutex>
+
+#include "base/base.h"
+#include "fmt/format.h"
+
+namespace tgnews {
+
+StringPool::StringPool() { Intern({}); }
+
+uint32_t StringPool::Intern(std::string_view value) {
+  {
+    std::shared_lock lock(mutex_);
+    auto it = id_by_string_.find(value);
+    if (it != id_by_string_.end()) {
+      return it->second;
+    }
+  }
+
+  std::unique_lock lock(mutex_);
+  auto it = id_by_string_.find(value);
+  if (it != id_by_string_.end()) {
+    return it->second;
+  }
+  auto id = static_cast<uint32_t>(strings_.size());
+  const auto& stored = strings_.emplace_back(value);
+  id_by_string_.emplace(stored, id);
+  return id;
+}
+
+std::string_view StringPool::Get(uint32_t id) const {
+  std::shared_lock lock(mutex_);
+  VERIFY(id < strings_.size(), fmt::format("unknown string id: {}", id));
+  return strings_[id];
+}
+
+size_t StringPool::Size() const {
+  std::shared_lock lock(mutex_);
+  return strings_.size();
+}
+
+size_t StringPool::ResidentBytes() const {
+  std::shared_lock lock(mutex_);
+  // Node based map: key, value and a next pointer per entry, plus buckets.
+  size_t bytes = sizeof(*this) +
+                 id_by_string_.size() *
+                     (sizeof(std::pair<std::string_view, uint32_t>) +
+                      sizeof(void*)) +
+                 id_by_string_.bucket_count() * sizeof(void*);
+  for (const auto& value : strings_) {
+    bytes += sizeof(value);
+    if (value.capacity() > std::string().capacity()) {
+      bytes += value.capacity() + 1;
+    }
+  }
+  return bytes;
+}
+
+StringPool& GlobalStringPool() {
+  static StringPool pool;
+  return pool;
+}
+
+}  // namespace tgnews
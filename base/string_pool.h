@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace tgnews {
+
+// Append-only set of strings repeated across many documents, like site names
+// and hosts. Ids are dense and never reused, id 0 is the empty string. Views
+// returned by Get stay valid for the lifetime of the pool.
+class StringPool {
+ public:
+  StringPool();
+
+  uint32_t Intern(std::string_view value);
+
+  std::string_view Get(uint32_t id) const;
+
+  size_t Size() const;
+
+  size_t ResidentBytes() const;
+
+ private:
+  mutable std::shared_mutex mutex_;
+  std::deque<std::string> strings_;
+  std::unordered_map<std::string_view, uint32_t> id_by_string_;
+};
+
+StringPool& GlobalStringPool();
+
+}  // namespace tgnews
@@ -0,0 +1,45 @@
+#include "base/text_stream.h"
+
+#include <algorithm>
+
+namespace tgnews {
+
+JoinedTextBuf::int_type JoinedTextBuf::underflow() {
+  while (next_ + 1 < 2 * pieces_.size()) {
+    const size_t item = next_++;
+    if (item % 2 == 1) {
+      setg(&space_, &space_, &space_ + 1);
+      return traits_type::to_int_type(space_);
+    }
+    std::string_view piece = pieces_[item / 2];
+    if (piece.empty()) {
+      continue;
+    }
+    if (piece.find('\n') != std::string_view::npos) {
+      scratch_.assign(piece);
+      std::replace(scratch_.begin(), scratch_.end(), '\n', ' ');
+      piece = scratch_;
+    }
+    // Never written through, nothing is put back into the pieces.
+    char* begin = const_cast<char*>(piece.data());
+    setg(begin, begin, begin + piece.size());
+    return traits_type::to_int_type(*begin);
+  }
+  return traits_type::eof();
+}
+
+void SplitTokens(std::string_view text,
+                 std::vector<std::string_view>& tokens) {
+  constexpr std::string_view kSpaces = " \t\n\v\f\r";
+  size_t begin = text.find_first_not_of(kSpaces);
+  while (begin != std::string_view::npos) {
+    size_t end = text.find_first_of(kSpaces, begin);
+    if (end == std::string_view::npos) {
+      end = text.size();
+    }
+    tokens.push_back(text.substr(begin, end - begin));
+    begin = text.find_first_not_of(kSpaces, end);
+  }
+}
+
+}  // namespace tgnews
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace tgnews {
+
+// Reads pieces of text as if they were joined by single spaces, with line
+// breaks read as spaces too. The pieces are read in place, only the ones
+// with line breaks are copied. They have to outlive the buffer.
+class JoinedTextBuf : public std::streambuf {
+ public:
+  explicit JoinedTextBuf(const std::vector<std::string_view>& pieces)
+      : pieces_(pieces) {}
+
+ protected:
+  int_type underflow() override;
+
+ private:
+  const std::vector<std::string_view>& pieces_;
+  // Pieces and the separators between them, one after another.
+  size_t next_ = 0;
+  char space_ = ' ';
+  std::string scratch_;
+};
+
+// Appends the whitespace separated tokens of the text, views into it.
+void SplitTokens(std::string_view text, std::vector<std::string_view>& tokens);
+
+}  // namespace tgnews
@@ -0,0 +1,212 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "base/base.h"
+
+namespace tgnews {
+
+// Hierarchical timing wheel over second resolution timestamps.
+//
+// Eight levels of 256 slots cover the whole uint64_t range, so there is no
+// overflow list. A deadline sits on the level of the highest byte in which it
+// differs from the current time and moves down when the wheel reaches its
+// slot. Insert and Cancel are O(1). Advance jumps straight to the next
+// occupied slot using per level bitmaps, so large gaps between timestamps
+// cost nothing.
+//
+// Not thread safe: keep a wheel per strand.
+template <typename T>
+class TimingWheel {
+ public:
+  using Handle = uint32_t;
+  static constexpr Handle kInvalidHandle = std::numeric_limits<Handle>::max();
+
+  explicit TimingWheel(uint64_t now = 0) : current_(now) { heads_.fill(kNil); }
+
+  uint64_t Now() const { return current_; }
+
+  size_t Size() const { return size_; }
+
+  // Deadlines which are not in the future expire on the next Advance.
+  Handle Insert(uint64_t deadline, T value) {
+    Handle handle = Allocate();
+    Node& node = nodes_[handle];
+    node.deadline = deadline;
+    node.value = std::move(value);
+    Link(handle);
+    ++size_;
+    return handle;
+  }
+
+  void Cancel(Handle handle) {
+    VERIFY(handle < nodes_.size() && nodes_[handle].slot != kFree,
+           "cancel of unknown timer");
+    Unlink(handle);
+    Release(handle);
+    --size_;
+  }
+
+  // Moves the wheel to `now` and calls on_expired(value) for every deadline
+  // not later than `now`. The timer is already gone when the callback runs.
+  template <typename OnExpired>
+  void Advance(uint64_t now, OnExpired&& on_expired) {
+    ExpireSlot(kDueSlot, on_expired);
+    while (current_ < now) {
+      size_t level = 0;
+      int slot = -1;
+      for (; level < kLevels; ++level) {
+        slot = NextOccupied(level, Group(current_, level) + 1);
+        if (slot >= 0) {
+          break;
+        }
+      }
+      if (slot < 0) {
+        current_ = now;
+        return;
+      }
+
+      uint64_t block = level + 1 < kLevels
+                           ? current_ >> (kBits * (level + 1))
+                                           << (kBits * (level + 1))
+                           : 0;
+      uint64_t next = block | (static_cast<uint64_t>(slot) << (kBits * level));
+      if (next > now) {
+        // Nothing is due before `now` and no occupied slot is crossed.
+        current_ = now;
+        return;
+      }
+      current_ = next;
+
+      // Everything in the slot is due now (level 0) or moves to a lower level.
+      size_t index = level * kSlots + slot;
+      Handle handle = heads_[index];
+      heads_[index] = kNil;
+      ClearOccupied(level, slot);
+      while (handle != kNil) {
+        Handle next_handle = nodes_[handle].next;
+        Link(handle);
+        handle = next_handle;
+      }
+      ExpireSlot(kDueSlot, on_expired);
+    }
+  }
+
+ private:
+  static constexpr size_t kBits = 8;
+  static constexpr size_t kSlots = 1 << kBits;
+  static constexpr size_t kLevels = 64 / kBits;
+  static constexpr size_t kDueSlot = kLevels * kSlots;
+  static constexpr uint32_t kNil = kInvalidHandle;
+  static constexpr uint32_t kFree = kDueSlot + 1;
+
+  struct Node {
+    uint64_t deadline = 0;
+    T value = {};
+    Handle prev = kNil;
+    Handle next = kNil;
+    uint32_t slot = kFree;
+  };
+
+  static size_t Group(uint64_t time, size_t level) {
+    return (time >> (kBits * level)) & (kSlots - 1);
+  }
+
+  Handle Allocate() {
+    if (free_ != kNil) {
+      Handle handle = free_;
+      free_ = nodes_[handle].next;
+      return handle;
+    }
+    nodes_.emplace_back();
+    return static_cast<Handle>(nodes_.size() - 1);
+  }
+
+  void Release(Handle handle) {
+    Node& node = nodes_[handle];
+    node.value = {};
+    node.slot = kFree;
+    node.prev = kNil;
+    node.next = free_;
+    free_ = handle;
+  }
+
+  void Link(Handle handle) {
+    Node& node = nodes_[handle];
+    size_t index = kDueSlot;
+    if (node.deadline > current_) {
+      size_t level = (63 - __builtin_clzll(node.deadline ^ current_)) / kBits;
+      size_t slot = Group(node.deadline, level);
+      index = level * kSlots + slot;
+      SetOccupied(level, slot);
+    }
+    node.slot = index;
+    node.prev = kNil;
+    node.next = heads_[index];
+    if (node.next != kNil) {
+      nodes_[node.next].prev = handle;
+    }
+    heads_[index] = handle;
+  }
+
+  void Unlink(Handle handle) {
+    Node& node = nodes_[handle];
+    if (node.prev != kNil) {
+      nodes_[node.prev].next = node.next;
+    } else {
+      heads_[node.slot] = node.next;
+      if (node.next == kNil && node.slot != kDueSlot) {
+        ClearOccupied(node.slot / kSlots, node.slot % kSlots);
+      }
+    }
+    if (node.next != kNil) {
+      nodes_[node.next].prev = node.prev;
+    }
+  }
+
+  template <typename OnExpired>
+  void ExpireSlot(size_t index, OnExpired& on_expired) {
+    while (heads_[index] != kNil) {
+      Handle handle = heads_[index];
+      heads_[index] = nodes_[handle].next;
+      T value = std::move(nodes_[handle].value);
+      Release(handle);
+      --size_;
+      on_expired(std::move(value));
+    }
+  }
+
+  void SetOccupied(size_t level, size_t slot) {
+    occupied_[level][slot / 64] |= uint64_t(1) << (slot % 64);
+  }
+
+  void ClearOccupied(size_t level, size_t slot) {
+    occupied_[level][slot / 64] &= ~(uint64_t(1) << (slot % 64));
+  }
+
+  // First occupied slot of the level at or after `from`, -1 if none.
+  int NextOccupied(size_t level, size_t from) const {
+    for (size_t word = from / 64; word < kSlots / 64; ++word) {
+      uint64_t bits = occupied_[level][word];
+      if (word == from / 64) {
+        bits &= ~uint64_t(0) << (from % 64);
+      }
+      if (bits) {
+        return word * 64 + __builtin_ctzll(bits);
+      }
+    }
+    return -1;
+  }
+
+  uint64_t current_;
+  size_t size_ = 0;
+  std::vector<Node> nodes_;
+  Handle free_ = kNil;
+  std::array<Handle, kDueSlot + 1> heads_;
+  std::array<std::array<uint64_t, kSlots / 64>, kLevels> occupied_ = {};
+};
+
+}  // namespace tgnews
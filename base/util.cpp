@@ -23,11 +23,11 @@ std::string GetHost(const std::string& url) {
 }
 
 
-std::vector<ParsedDoc> MakeDocumentsFromDir(const std::string& dir, int nDocs, Context* context) {
+std::vector<ParsedDocPtr> MakeDocumentsFromDir(const std::string& dir, int nDocs, const Context* context) {
   boost::filesystem::path dirPath(dir);
   boost::filesystem::recursive_directory_iterator start(dirPath);
   boost::filesystem::recursive_directory_iterator end;
-  std::vector<ParsedDoc> documents;
+  std::vector<ParsedDocPtr> documents;
 
   for (auto it = start; it != end; it++) {
     if (boost::filesystem::is_directory(it->path())) {
@@ -37,7 +37,7 @@ std::vector<ParsedDoc> MakeDocumentsFromDir(const std::string& dir, int nDocs, C
     if (path.substr(path.length() - 5) == ".html") {
       std::ifstream file(path);
       std::string content(std::istreambuf_iterator<char>(file), {});
-      documents.emplace_back(ParsedDoc(context, it->path().filename().string(), std::move(content), 1000000000, ParsedDoc::EState::Added));
+      documents.push_back(std::make_shared<const ParsedDoc>(context, it->path().filename().string(), std::move(content), 1000000000));
     }
     if (nDocs != -1 && documents.size() == static_cast<size_t>(nDocs)) {
       break;
@@ -7,6 +7,6 @@ namespace tgnews {
 
 std::string GetHost(const std::string& url);
 
-std::vector<ParsedDoc> MakeDocumentsFromDir(const std::string& dir, int nDocs, Context* context);
+std::vector<ParsedDocPtr> MakeDocumentsFromDir(const std::string& dir, int nDocs, const Context* context);
 
 }
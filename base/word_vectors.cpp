@@ -0,0 +1,95 @@
+#include "base/word_vectors.h"
+
+#include <algorithm>
+
+#include "base/base.h"
+
+namespace tgnews {
+
+namespace {
+
+// Shorter vectors are noise, the embedder skips them.
+constexpr float kMinNorm = 0.0001f;
+
+}  // namespace
+
+WordVectors::WordVectors(const fasttext::FastText* model, size_t table_words,
+                         size_t oov_capacity)
+    : model_(model),
+      dictionary_(model->getDictionary()),
+      dimension_(model->getDimension()),
+      rows_(std::min<size_t>(table_words, dictionary_->nwords())) {
+  table_storage_.resize(rows_ * dimension_);
+  known_storage_.resize(rows_);
+  for (size_t id = 0; id < rows_; id++) {
+    auto vector = Compute(dictionary_->getWord(id));
+    if (!vector.empty()) {
+      std::copy(vector.begin(), vector.end(),
+                table_storage_.begin() + id * dimension_);
+      known_storage_[id] = 1;
+    }
+  }
+  table_ = table_storage_.data();
+  known_ = known_storage_.data();
+  MakeOovCache(oov_capacity);
+}
+
+WordVectors::WordVectors(const fasttext::FastText* model, const float* table,
+                         const uint8_t* known, size_t rows,
+                         size_t oov_capacity)
+    : model_(model),
+      dictionary_(model->getDictionary()),
+      dimension_(model->getDimension()),
+      rows_(rows),
+      table_(table),
+      known_(known) {
+  VERIFY(rows_ <= static_cast<size_t>(dictionary_->nwords()),
+         "word vectors table is larger than the dictionary");
+  MakeOovCache(oov_capacity);
+}
+
+void WordVectors::MakeOovCache(size_t capacity) {
+  if (capacity > 0) {
+    oov_ = std::make_unique<ShardedLruCache<std::string, std::vector<float>>>(
+        capacity);
+  }
+}
+
+bool WordVectors::GetVector(const std::string& word,
+                            fasttext::Vector& vector) const {
+  const int32_t id = dictionary_->getId(word);
+  if (id >= 0 && static_cast<size_t>(id) < rows_) {
+    if (!known_[id]) {
+      return false;
+    }
+    std::copy_n(table_ + id * dimension_, dimension_, vector.data());
+    return true;
+  }
+  std::vector<float> computed;
+  if (!oov_) {
+    computed = Compute(word);
+  } else if (auto cached = oov_->Find(word)) {
+    computed = std::move(*cached);
+  } else {
+    computed = Compute(word);
+    oov_->Insert(word, computed);
+  }
+  if (computed.empty()) {
+    return false;
+  }
+  std::copy(computed.begin(), computed.end(), vector.data());
+  return true;
+}
+
+std::vector<float> WordVectors::Compute(const std::string& word) const {
+  fasttext::Vector vector(dimension_);
+  model_->getWordVector(vector, word);
+  float norm = vector.norm();
+  if (norm < kMinNorm) {
+    return {};
+  }
+  vector.mul(1.0f / norm);
+  return std::vector<float>(vector.data(), vector.data() + dimension_);
+}
+
+}  // namespace tgnews
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base/lru_cache.h"
+
+#include "third_party/fastText/src/fasttext.h"
+
+namespace tgnews {
+
+// Normalized word vectors of a fastText model. Summing the subword rows of
+// a word costs a few dozen ngram hashes, so the vectors of the dictionary
+// words are computed once, and the vectors of other tokens are kept in a
+// bounded cache. Thread safe, shared by the annotating threads.
+class WordVectors {
+ public:
+  static constexpr size_t kDefaultTableWords = 200'000;
+  static constexpr size_t kDefaultOovCapacity = 1 << 16;
+
+  // Tables the `table_words` most frequent dictionary words, zero sizes
+  // turn the table or the cache off.
+  explicit WordVectors(const fasttext::FastText* model,
+                       size_t table_words = kDefaultTableWords,
+                       size_t oov_capacity = kDefaultOovCapacity);
+
+  // A table built before for the same model, read in place: `rows` vectors
+  // and a flag per row, nonzero for words with a vector. Both have to
+  // outlive this.
+  WordVectors(const fasttext::FastText* model, const float* table,
+              const uint8_t* known, size_t rows,
+              size_t oov_capacity = kDefaultOovCapacity);
+
+  size_t GetDimension() const { return dimension_; }
+
+  size_t GetTableRows() const { return rows_; }
+  const float* GetTable() const { return table_; }
+  const uint8_t* GetKnown() const { return known_; }
+
+  // Same as fastText's word vector divided by its norm. False for words
+  // without a vector, like the ones made of unknown ngrams only.
+  bool GetVector(const std::string& word, fasttext::Vector& vector) const;
+
+ private:
+  // Empty for words without a vector.
+  std::vector<float> Compute(const std::string& word) const;
+
+  void MakeOovCache(size_t capacity);
+
+  const fasttext::FastText* model_;
+  std::shared_ptr<const fasttext::Dictionary> dictionary_;
+  size_t dimension_;
+  // Row per dictionary id, in table_storage_ unless built before.
+  size_t rows_ = 0;
+  const float* table_ = nullptr;
+  const uint8_t* known_ = nullptr;
+  std::vector<float> table_storage_;
+  std::vector<uint8_t> known_storage_;
+  mutable std::unique_ptr<ShardedLruCache<std::string, std::vector<float>>>
+      oov_;
+};
+
+}  // namespace tgnews
@@ -2,6 +2,7 @@
 #include "server/server.h"
 
 #include "base/context.h"
+#include "base/model_registry.h"
 #include "base/util.h"
 
 #include "solver/response_builder.h"
@@ -9,10 +10,17 @@
 #include "gflags/gflags.h"
 #include "glog/logging.h"
 
+#include <chrono>
 #include <iostream>
+#include <thread>
 
 DEFINE_string(modelsPath, "models", " subj");
 DEFINE_int32(docsCount, -1, "how much docs to read, -1 to read all");
+DEFINE_int32(serverThreads, 4, "worker threads of the server pool");
+DEFINE_int32(logGroupCommitMicros, 200, "how long the document log gathers records into one write");
+DEFINE_bool(serveSnapshotWhileRestoring, false, "answer /threads from the responses of the previous run until documents are restored");
+DEFINE_int32(logSyncEveryBatches, 1, "fdatasync the document log every n-th write, 0 to never sync");
+DEFINE_int32(coldFieldsBudgetMb, 256, "megabytes of document text kept in memory, the rest is read from the document log on demand");
 
 int main(int argc, char** argv) {
   gflags::ParseCommandLineFlags(&argc, &argv, false);
@@ -23,33 +31,56 @@ int main(int argc, char** argv) {
   google::InitGoogleLogging(argv[0]);
 
   std::string mode = argv[1];
-  std::vector<std::string> modes = {"server", "languages", "news", "categories", "threads"};
+  std::vector<std::string> modes = {"server", "convert", "bundle", "languages", "news", "categories", "threads"};
   if (std::find(modes.begin(), modes.end(), mode) == modes.end()) {
     LOG(FATAL) << fmt::format("unknown mode: {}", mode);
   }
 
   LOG(INFO) << fmt::format("Running mode - {}", mode);
 
-  tgnews::Context context(FLAGS_modelsPath, nullptr);
+  // POST /_admin/reload_models loads the models again from the same path.
+  tgnews::ModelRegistry models([] { return std::make_unique<tgnews::Context>(FLAGS_modelsPath, nullptr); });
 
   LOG(INFO) << "context loaded";
 
-  tgnews::ResponseBuilder responseBuilder(&context);
+  if (mode == "bundle") {
+    // Later runs map the bundle instead of reading the models.
+    models.Get()->SaveBundle(FLAGS_modelsPath, FLAGS_modelsPath + "/" + tgnews::Context::BundleFileName);
+    return 0;
+  }
+
+  std::experimental::thread_pool pool(FLAGS_serverThreads);
+  tgnews::ResponseBuilder responseBuilder(&pool);
 
   LOG(INFO) << "response builder created";
 
   if (mode == "server") {
     int port = std::stoi(argv[2]);
     LOG(INFO) << fmt::format("prepare to run on port: {}", port);
-    std::experimental::thread_pool pool(4);
-    auto file_manager = std::make_unique<tgnews::FileManager>(pool, &context);
-    tgnews::Server server(port, std::move(file_manager), pool, &responseBuilder);
+    tgnews::SegmentLog::Options log_options;
+    log_options.group_commit_window = std::chrono::microseconds(FLAGS_logGroupCommitMicros);
+    log_options.sync_every_batches = FLAGS_logSyncEveryBatches;
+    auto file_manager = std::make_unique<tgnews::FileManager>(
+        pool, &models, "content", tgnews::FileManager::kDefaultShardCount, log_options,
+        static_cast<uint64_t>(FLAGS_coldFieldsBudgetMb) << 20);
+    tgnews::Server server(port, std::move(file_manager), pool, &responseBuilder,
+                          FLAGS_serveSnapshotWhileRestoring);
     server.Run();
     return 0;
   }
 
+  if (mode == "convert") {
+    // Rewrites json documents of older builds in the content dir as binary
+    // records, the same happens on server start otherwise.
+    tgnews::FileManager file_manager(pool, &models, argv[2]);
+    while (!file_manager.FinishedRestoringFromDisk()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    return 0;
+  }
+
   std::string content_dir = argv[2];
-  auto docs = tgnews::MakeDocumentsFromDir(content_dir, FLAGS_docsCount, &context);
+  auto docs = tgnews::MakeDocumentsFromDir(content_dir, FLAGS_docsCount, models.Get().get());
   LOG(INFO) << fmt::format("Docs size - {}", docs.size());
   if (mode == "languages") {
     std::cout << responseBuilder.AddDocuments(docs).LangAns.dump(4);
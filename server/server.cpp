@@ -6,6 +6,7 @@
 #include <regex>
 
 #include "base/base.h"
+#include "base/lang_detector.h"
 #include "glog/logging.h"
 
 static std::string RESPONSES_CACHE_DUMP = "response_cache.dump";
@@ -110,16 +111,26 @@ auto OnFailCallback(std::shared_ptr<HttpServer::Response> response,
 
 Server::Server(uint32_t port, std::unique_ptr<FileManager> file_manager,
                std::experimental::thread_pool& pool,
-               ResponseBuilder* response_builder)
+               ResponseBuilder* response_builder,
+               bool serve_snapshot_while_restoring)
     : port_(port),
       file_manager_(std::move(file_manager)),
       responses_cache_strand_(pool.get_executor()),
       response_builder_(response_builder),
+      serve_snapshot_while_restoring_(serve_snapshot_while_restoring),
       pool_(pool) {
   server_.config.port = port;
 
   SetupHandlers();
-  UpdateResponseCache();
+  if (serve_snapshot_while_restoring_) {
+    LoadResponseCacheSnapshot();
+  }
+  if (response_builder_) {
+    responses_cursor_ =
+        file_manager_->GetChangeStream().OpenCursor("responses");
+  }
+  std::experimental::post(responses_cache_strand_,
+                          [this] { UpdateResponseCache(); });
 }
 
 Server::~Server() { Stop(); }
@@ -222,7 +233,8 @@ void Server::SetupHandlers() {
         auto stats_handler = std::make_shared<StatsHandler>(stats_);
 
         try {
-          if (!file_manager_->FinishedRestoringFromDisk()) {
+          if (!file_manager_->FinishedRestoringFromDisk() &&
+              !serve_snapshot_while_restoring_) {
             response->write(
                 SimpleWeb::StatusCode::server_error_service_unavailable);
             LOG(INFO) << "response: service is unavailable";
@@ -260,8 +272,6 @@ void Server::SetupHandlers() {
         auto stats_handler = std::make_shared<StatsHandler>(stats_);
 
         try {
-          //file_manager_->RemoveOutdatedFiles();
-
           GetAllDocuments()
               .then([=](auto&& value) {
                 SimpleWeb::CaseInsensitiveMultimap headers;
@@ -277,6 +287,57 @@ void Server::SetupHandlers() {
         }
       };
 
+  server_.resource["^/_documents/(.+)$"]["GET"] =
+      [this](std::shared_ptr<HttpServer::Response> response,
+             std::shared_ptr<HttpServer::Request> request) {
+        auto stats_handler = std::make_shared<StatsHandler>(stats_);
+
+        try {
+          auto filename = request->path_match[1].str();
+          LOG(INFO) << "received document request: " << filename;
+          file_manager_->LoadDocument(std::move(filename))
+              .then([=](ParsedDocPtr document) {
+                if (!document) {
+                  response->write(
+                      SimpleWeb::StatusCode::client_error_not_found);
+                } else {
+                  SimpleWeb::CaseInsensitiveMultimap headers;
+                  headers.emplace("Content-type", "application/json");
+                  response->write(document->Serialize().dump(), headers);
+                }
+                stats_handler->OnSuccess();
+              })
+              .fail(OnFailCallback(response, stats_handler));
+        } catch (std::exception& e) {
+          OnFailCallback(response, stats_handler)(std::current_exception());
+        }
+      };
+
+  server_.resource["^/_stats$"]["GET"] =
+      [this](std::shared_ptr<HttpServer::Response> response,
+             std::shared_ptr<HttpServer::Request> request) {
+        SimpleWeb::CaseInsensitiveMultimap headers;
+        headers.emplace("Content-type", "application/json");
+        response->write(GetStats().dump(), headers);
+      };
+
+  server_.resource["^/_admin/reload_models$"]["POST"] =
+      [this](std::shared_ptr<HttpServer::Response> response,
+             std::shared_ptr<HttpServer::Request> request) {
+        // Answered right away, GET /_stats follows the reload.
+        bool started = file_manager_->ReloadModels();
+        nlohmann::json value;
+        value["reloading"] = started;
+        if (const auto* models = file_manager_->GetModels()) {
+          value["version"] = models->GetVersion();
+        }
+        SimpleWeb::CaseInsensitiveMultimap headers;
+        headers.emplace("Content-type", "application/json");
+        response->write(started ? SimpleWeb::StatusCode::success_accepted
+                                : SimpleWeb::StatusCode::client_error_conflict,
+                        value.dump(), headers);
+      };
+
   server_.default_resource["GET"] =
       [this](std::shared_ptr<HttpServer::Response> response,
              std::shared_ptr<HttpServer::Request> request) {
@@ -287,11 +348,11 @@ void Server::SetupHandlers() {
 
 cti::continuable<nlohmann::json> Server::GetAllDocuments() {
   return file_manager_->GetDocuments().then(
-      [](std::vector<ParsedDoc> documents) {
+      [](std::vector<ParsedDocPtr> documents) {
         nlohmann::json value;
         nlohmann::json articles = nlohmann::json::array();
         for (const auto& document : documents) {
-          articles.push_back(document.FileName);
+          articles.push_back(document->FileName);
         }
         value["articles"] = std::move(articles);
         LOG(INFO) << "GetDocumentThreads: " << value;
@@ -310,6 +371,99 @@ std::optional<nlohmann::json> Server::GetDocumentThreads(uint64_t period,
                                   period);
 }
 
+nlohmann::json Server::GetStats() const {
+  auto progress = file_manager_->GetRestoreProgress();
+  nlohmann::json restore;
+  restore["finished"] = progress.finished;
+  restore["documents"] = progress.documents;
+  restore["bytes"] = progress.bytes;
+  restore["seconds"] = progress.seconds;
+  if (progress.seconds > 0) {
+    restore["documents_per_second"] = progress.documents / progress.seconds;
+    restore["megabytes_per_second"] =
+        progress.bytes / progress.seconds / (1 << 20);
+  }
+
+  nlohmann::json value;
+  value["restore"] = std::move(restore);
+  value["serving_snapshot"] =
+      serve_snapshot_while_restoring_ && !progress.finished;
+  value["dedup_hits"] = file_manager_->DedupHits();
+
+  if (const auto* models = file_manager_->GetModels()) {
+    auto context = models->Get();
+    auto rescore = file_manager_->GetRescoreProgress();
+    nlohmann::json model_set;
+    model_set["version"] = context->Version;
+    model_set["reloading"] = models->IsReloading();
+    model_set["failed_reloads"] = models->FailedReloads();
+    model_set["rescoring_version"] = rescore.version;
+    model_set["rescored_documents"] = rescore.documents;
+    value["models"] = std::move(model_set);
+
+    // Counted since the current models were loaded.
+    auto langs = context->LangDetector->GetStats();
+    nlohmann::json lang_detection;
+    lang_detection["script_ru"] = langs.script_ru;
+    lang_detection["script_en"] = langs.script_en;
+    lang_detection["script_tg"] = langs.script_tg;
+    lang_detection["fasttext"] = langs.fasttext;
+    value["lang_detection"] = std::move(lang_detection);
+  }
+
+  auto usage = file_manager_->GetMemoryUsage();
+  nlohmann::json memory;
+  memory["documents"] = usage.documents;
+  memory["resident_bytes"] = usage.resident_bytes;
+  memory["cold_bytes"] = usage.cold_bytes;
+  memory["cold_fields_budget"] = usage.cold_fields_budget;
+  if (usage.documents > 0) {
+    memory["bytes_per_document"] =
+        static_cast<double>(usage.resident_bytes) / usage.documents;
+  }
+  value["memory"] = std::move(memory);
+
+  const auto& stream = file_manager_->GetChangeStream();
+  nlohmann::json changes;
+  changes["next_sequence"] = stream.NextSequence();
+  changes["rebuilds"] = responses_rebuilds_.load();
+  changes["cursors"] = nlohmann::json::array();
+  for (const auto& cursor : stream.GetCursors()) {
+    changes["cursors"].push_back({{"name", cursor.name},
+                                  {"position", cursor.position},
+                                  {"lag", cursor.lag}});
+  }
+  value["change_stream"] = std::move(changes);
+  return value;
+}
+
+void Server::LoadResponseCacheSnapshot() {
+  if (!boost::filesystem::exists(RESPONSES_CACHE_DUMP)) {
+    return;
+  }
+  try {
+    auto responses =
+        std::make_unique<CalculatedResponses>(RESPONSES_CACHE_DUMP);
+    std::unique_lock lock(responses_cache_mutex_);
+    responses_cache_ = std::move(responses);
+  } catch (std::exception& e) {
+    LOG(ERROR) << "unable to load responses snapshot: " << e.what();
+    return;
+  }
+  LOG(INFO) << "responses snapshot loaded: " << RESPONSES_CACHE_DUMP;
+}
+
+void Server::DumpResponseCacheSnapshot(CalculatedResponses& responses) {
+  // Renamed into place, so a crash never leaves a torn snapshot.
+  auto path = RESPONSES_CACHE_DUMP + ".tmp";
+  try {
+    responses.dump(path);
+    boost::filesystem::rename(path, RESPONSES_CACHE_DUMP);
+  } catch (std::exception& e) {
+    LOG(ERROR) << "unable to dump responses snapshot: " << e.what();
+  }
+}
+
 void Server::UpdateResponseCache() {
   if (!response_builder_) {
     return;
@@ -321,37 +475,82 @@ void Server::UpdateResponseCache() {
                                       [this]() { UpdateResponseCache(); });
   };
 
-  file_manager_->FetchChangeLog()
-      .then([this, repeat = std::move(repeat)](auto change_log) {
-        if (change_log.empty()) {
+  // The documents are incomplete until restored.
+  if (!file_manager_->FinishedRestoringFromDisk()) {
+    repeat();
+    return;
+  }
+
+  auto batch = file_manager_->GetChangeStream().Read(responses_cursor_);
+  if (batch.lost) {
+    LOG(INFO) << "change stream dropped unread changes, rebuilding responses";
+    responses_rebuilds_++;
+    file_manager_->GetDocuments()
+        .then([this, repeat, next = batch.next](auto documents) {
+          std::experimental::post(
+              responses_cache_strand_,
+              [this, repeat, next, documents = std::move(documents)] {
+                BuildResponseCache(next, [&] {
+                  return response_builder_->Rebuild(documents);
+                });
+                // Re-armed once the rebuild is over, so the next tick reads
+                // after the committed cursor and never starts another one.
+                repeat();
+              });
+        })
+        .fail([repeat](std::exception_ptr ptr) {
+          OnFailCallback()(ptr);
           repeat();
-          return;
-        }
-        std::experimental::post(
-            responses_cache_strand_, [this, repeat = std::move(repeat),
-                                      change_log = std::move(change_log)] {
-              LOG(INFO) << "change log size: " << change_log.size();
+        });
+    return;
+  }
 
+  if (batch.changes.empty()) {
+    repeat();
+    return;
+  }
+  LOG(INFO) << "change log size: " << batch.changes.size();
+  // The stream names the documents, the shards tell what they are now.
+  auto next = batch.next;
+  file_manager_->GetChanges(std::move(batch.changes))
+      .then([this, repeat, next](auto changes) {
+        std::experimental::post(
+            responses_cache_strand_,
+            [this, repeat, next, changes = std::move(changes)] {
+              BuildResponseCache(next, [&] {
+                return response_builder_->AddDocuments(changes);
+              });
               repeat();
-
-              std::unique_ptr<CalculatedResponses> responses_cache;
-              try {
-                responses_cache = std::make_unique<CalculatedResponses>(
-                    response_builder_->AddDocuments(std::move(change_log)));
-              } catch (std::exception& e) {
-                LOG(ERROR) << "AddDocuments exception caught: " << e.what();
-                return;
-              }
-
-              LOG(INFO) << "add documents finished";
-
-              {
-                std::unique_lock lock(responses_cache_mutex_);
-                responses_cache_ = std::move(responses_cache);
-              }
             });
       })
-      .fail(OnFailCallback());
+      .fail([repeat](std::exception_ptr ptr) {
+        OnFailCallback()(ptr);
+        repeat();
+      });
+}
+
+template <typename Build>
+void Server::BuildResponseCache(uint64_t next, Build build) {
+  std::unique_ptr<CalculatedResponses> responses_cache;
+  try {
+    responses_cache = std::make_unique<CalculatedResponses>(build());
+  } catch (std::exception& e) {
+    // The cursor stays, the same changes are read on the next tick.
+    LOG(ERROR) << "AddDocuments exception caught: " << e.what();
+    return;
+  }
+  file_manager_->GetChangeStream().Commit(responses_cursor_, next);
+
+  LOG(INFO) << "add documents finished";
+
+  if (serve_snapshot_while_restoring_) {
+    DumpResponseCacheSnapshot(*responses_cache);
+  }
+
+  {
+    std::unique_lock lock(responses_cache_mutex_);
+    responses_cache_ = std::move(responses_cache);
+  }
 }
 
 }  // namespace tgnews
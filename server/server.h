@@ -18,7 +18,8 @@ class Server {
  public:
   Server(uint32_t port, std::unique_ptr<FileManager> file_manager,
          std::experimental::thread_pool& pool,
-         ResponseBuilder* response_builder = nullptr);
+         ResponseBuilder* response_builder = nullptr,
+         bool serve_snapshot_while_restoring = false);
 
   ~Server();
 
@@ -37,8 +38,20 @@ class Server {
                                                    std::string lang_code,
                                                    std::string category);
 
+  nlohmann::json GetStats() const;
+
+  // Make sure to call it from responses_cache_strand_. Applies the changes
+  // after the responses cursor and commits them once the responses are
+  // built.
   void UpdateResponseCache();
 
+  template <typename Build>
+  void BuildResponseCache(uint64_t next, Build build);
+
+  void LoadResponseCacheSnapshot();
+
+  void DumpResponseCacheSnapshot(CalculatedResponses& responses);
+
  private:
   uint32_t port_;
   std::unique_ptr<FileManager> file_manager_;
@@ -48,8 +61,15 @@ class Server {
   std::experimental::strand<std::experimental::thread_pool::executor_type>
       responses_cache_strand_;
   ResponseBuilder* const response_builder_;
+  ChangeStream::CursorId responses_cursor_ = 0;
+  // Times the responses were built from all the documents because the
+  // cursor fell out of the change stream.
+  std::atomic<uint64_t> responses_rebuilds_ = 0;
   std::unique_ptr<CalculatedResponses> responses_cache_;
   std::shared_mutex responses_cache_mutex_;
+  // Answers /threads from the responses persisted by the previous run until
+  // the documents are restored.
+  const bool serve_snapshot_while_restoring_;
 
   std::experimental::thread_pool& pool_;
 };
@@ -1,89 +1,88 @@
 #include "cluster.h"
+#include "distance.h"
+#include "distance_kernel.h"
+
+#include "base/parallel_for.h"
+#include "base/simhash.h"
+
+#include <algorithm>
 
 namespace {
   using namespace tgnews;
 
-  void FillDistanceMatrix(const Eigen::MatrixXf& points, Eigen::MatrixXf& distances) {
-    distances = -((points * points.transpose()).array() + 1.0f) / 2.0f + 1.0f;
-    distances += distances.Identity(distances.rows(), distances.cols());
-  }
+  class DisjointSets {
+  public:
+    explicit DisjointSets(size_t size) : Parents(size) {
+      for (size_t i = 0; i < size; ++i) {
+        Parents[i] = i;
+      }
+    }
 
-  std::vector<size_t> RunClusteringImpl(Eigen::MatrixXf& points, float DistanceThreshold) {
-    size_t docSize = points.rows();
-    Eigen::MatrixXf distances(points.rows(), points.rows());
-    FillDistanceMatrix(points, distances);
-    const float INF_DISTANCE = 1.0f;
-
-    // Prepare 3 arrays
-    std::vector<size_t> labels(docSize);
-    for (size_t i = 0; i < docSize; i++) {
-        labels[i] = i;
-    }
-    std::vector<size_t> nn(docSize);
-    std::vector<float> nnDistances(docSize);
-    for (size_t i = 0; i < docSize; i++) {
-        Eigen::Index minJ;
-        nnDistances[i] = distances.row(i).minCoeff(&minJ);
-        nn[i] = minJ;
-    }
-
-    // Main linking loop
-    size_t level = 0;
-    while (level + 1 < docSize) {
-      // Calculate minimal distance
-      auto minDistanceIt = std::min_element(nnDistances.begin(), nnDistances.end());
-      size_t minI = std::distance(nnDistances.begin(), minDistanceIt);
-      size_t minJ = nn[minI];
-      float minDistance = *minDistanceIt;
-      if (minDistance > DistanceThreshold) {
-        break;
+    size_t Find(size_t i) {
+      while (Parents[i] != i) {
+        Parents[i] = Parents[Parents[i]];
+        i = Parents[i];
       }
+      return i;
+    }
 
-      // Link minJ to minI
-      for (size_t i = 0; i < docSize; i++) {
-        if (labels[i] == minJ) {
-          labels[i] = minI;
-        }
+    void Union(size_t l, size_t r) {
+      l = Find(l);
+      r = Find(r);
+      if (l != r) {
+        Parents[std::max(l, r)] = std::min(l, r);
       }
+    }
+
+  private:
+    std::vector<size_t> Parents;
+  };
+
+  // Same linkage as LinkWithinThreshold without comparing every pair: edges below the
+  // threshold come from the k nearest neighbours of every document, so
+  // memory is O(n * k).
+  std::vector<size_t> RunApproximateClustering(const std::vector<ParsedDocPtr>& docs, float threshold, const ClusteringOptions& options) {
+    std::vector<Embedding> points(docs.size());
+    for (size_t i = 0; i < docs.size(); ++i) {
+      points[i] = Normalize(docs[i]->Vector);
+    }
+    HnswIndex index(points, options.Ann);
+    index.Build(options.Pool);
 
-      // Update distance matrix and nearest neighbors
-      nnDistances[minI] = INF_DISTANCE;
-      for (size_t k = 0; k < static_cast<size_t>(distances.rows()); k++) {
-        if (k == minI || k == minJ) {
-          continue;
+    std::vector<std::vector<uint32_t>> edges(docs.size());
+    ParallelFor(options.Pool, docs.size(), [&](size_t i) {
+      for (const auto& [distance, j] : index.Search(points[i], options.Ann.Neighbours + 1, options.Ann.EfSearch)) {
+        if (distance > threshold) {
+          break;
         }
-        float newDistance = std::min(distances(minJ, k), distances(minI, k));
-        distances(minI, k) = newDistance;
-        distances(k, minI) = newDistance;
-        if (newDistance < nnDistances[minI]) {
-          nnDistances[minI] = newDistance;
-          nn[minI] = k;
+        if (j != i) {
+          edges[i].push_back(j);
         }
       }
+    });
 
-      // Remove minJ row and column from distance matrix
-      nnDistances[minJ] = INF_DISTANCE;
-      for (size_t i = 0; i < static_cast<size_t>(distances.rows()); i++) {
-        distances(minJ, i) = INF_DISTANCE;
-        distances(i, minJ) = INF_DISTANCE;
+    DisjointSets sets(docs.size());
+    for (size_t i = 0; i < docs.size(); ++i) {
+      for (uint32_t j : edges[i]) {
+        sets.Union(i, j);
       }
-      level += 1;
     }
-
+    std::vector<size_t> labels(docs.size());
+    for (size_t i = 0; i < docs.size(); ++i) {
+      labels[i] = sets.Find(i);
+    }
     return labels;
   }
 
-  std::vector<size_t> GetLabels(std::vector<ParsedDoc>& docs, float threshold) {
-    const size_t docSize = docs.size();;
-    const size_t embSize = 50; // sorry, mario
-    Eigen::MatrixXf points(docSize, embSize);
-    for (size_t i = 0; i < docSize; ++i) {
-        fasttext::Vector embedding = docs[i].Vector;
-        Eigen::Map<Eigen::VectorXf, Eigen::Unaligned> eigenVector(embedding.data(), embedding.size());
-        points.row(i) = eigenVector / eigenVector.norm();
-    }
-    
-    return RunClusteringImpl(points, threshold);
+  std::vector<size_t> LinkDocuments(const std::vector<ParsedDocPtr>& docs, float threshold, const ClusteringOptions& options) {
+    if (options.Exact) {
+      std::vector<Embedding> points(docs.size());
+      for (size_t i = 0; i < docs.size(); ++i) {
+        points[i] = Normalize(docs[i]->Vector);
+      }
+      return LinkWithinThreshold(points, threshold, options.Pool);
+    }
+    return RunApproximateClustering(docs, threshold, options);
   }
 
 }
@@ -91,17 +90,59 @@ namespace {
 
 namespace tgnews {
 
-  std::vector<Cluster> RunClustering(std::vector<ParsedDoc>& docs) {
-    std::vector<ParsedDoc> ruDocs, enDocs;
-    for (auto& doc : docs) {
-      if (doc.Lang.size() && doc.Lang == "ru" && doc.IsNews()) {
+  std::vector<size_t> GetClusterLabels(const std::vector<ParsedDocPtr>& docs, float threshold, const ClusteringOptions& options) {
+    if (!options.CollapseNearDuplicates) {
+      return LinkDocuments(docs, threshold, options);
+    }
+    std::vector<uint64_t> fingerprints(docs.size());
+    for (size_t i = 0; i < docs.size(); ++i) {
+      fingerprints[i] = docs[i]->Fingerprint;
+    }
+    auto groups = GroupNearDuplicates(fingerprints);
+
+    // A group ends up in one cluster. Only its first document is linked,
+    // the others join its cluster: copies of one text embed next to each
+    // other, looking up their neighbours again would find the same ones.
+    std::vector<ParsedDocPtr> linked;
+    std::vector<size_t> linkedPositions;
+    std::vector<size_t> linkedIndex(docs.size());
+    for (size_t i = 0; i < docs.size(); ++i) {
+      if (groups[i] == i) {
+        linkedIndex[i] = linked.size();
+        linked.push_back(docs[i]);
+        linkedPositions.push_back(i);
+      }
+    }
+    if (linked.size() == docs.size()) {
+      return LinkDocuments(docs, threshold, options);
+    }
+    auto linkedLabels = LinkDocuments(linked, threshold, options);
+    // Labels stay positions of cluster members.
+    std::vector<size_t> labels(docs.size());
+    for (size_t i = 0; i < docs.size(); ++i) {
+      labels[i] = linkedPositions[linkedLabels[linkedIndex[groups[i]]]];
+    }
+    return labels;
+  }
+
+  std::vector<Cluster> RunClustering(const std::vector<ParsedDocPtr>& docs, const ClusteringOptions& options) {
+    std::vector<ParsedDocPtr> ruDocs, enDocs;
+    for (const auto& doc : docs) {
+      if (doc->Lang == LangRu && doc->IsNews()) {
         ruDocs.push_back(doc);
-      } else if (doc.Lang.size() && doc.Lang == "en" && doc.IsNews()) {
+      } else if (doc->Lang == LangEn && doc->IsNews()) {
         enDocs.push_back(doc);
       }
     }
-    auto ruLabels = GetLabels(ruDocs, 0.013f);
-    auto enLabels = GetLabels(enDocs, 0.02f);
+    // Languages are linked apart, at the same time.
+    std::vector<size_t> ruLabels, enLabels;
+    ParallelFor(options.Pool, LangCount, [&](size_t lang) {
+      if (lang == LangRu) {
+        ruLabels = GetClusterLabels(ruDocs, RuDistanceThreshold, options);
+      } else {
+        enLabels = GetClusterLabels(enDocs, EnDistanceThreshold, options);
+      }
+    });
     std::vector<Cluster> ruCluster(ruDocs.size()), enCluster(enDocs.size());
     for (size_t idx = 0; idx < ruDocs.size(); ++idx) {
       ruCluster[ruLabels[idx]].AddDocument(ruDocs[idx]);
@@ -113,13 +154,13 @@ namespace tgnews {
     for (auto& c : ruCluster) {
       if (c.Size() > 0) {
         c.Init();
-        result.push_back(c);
+        result.push_back(std::move(c));
       }
     }
     for (auto& c : enCluster) {
       if (c.Size() > 0) {
         c.Init();
-        result.push_back(c);
+        result.push_back(std::move(c));
       }
     }
     for (auto& c : result) {
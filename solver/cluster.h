@@ -1,31 +1,35 @@
 #pragma once
 
 #include "base/parsed_document.h"
+#include "hnsw_index.h"
+
+#include <experimental/thread_pool>
 
 namespace tgnews {
 
+  // Single linkage stops at these distances, see RunClustering.
+  constexpr float RuDistanceThreshold = 0.013f;
+  constexpr float EnDistanceThreshold = 0.02f;
+
   class Cluster {
   public:
-    void AddDocument(const ParsedDoc& doc) {
-      Docs.push_back(doc);
-      Time = std::max(Time, doc.FetchTime);
+    void AddDocument(ParsedDocPtr doc) {
+      Time = std::max(Time, doc->FetchTime);
+      Docs.push_back(std::move(doc));
     }
     std::string GetTitle() const {
-      return Docs[0].Title;
+      return Docs[0]->Title;
     }
     std::string GetLang() const {
-      return Docs[0].Lang.size() ? Docs[0].Lang : "en";
+      return std::string(LangCode(GetEnumLang()));
     }
     ELang GetEnumLang() const {
-      if (!Docs[0].Lang.size()) {
-        return LangEn;
-      }
-      return Docs[0].Lang == "ru" ? LangRu : LangEn;
+      return Docs[0]->Lang == LangRu ? LangRu : LangEn;
     }
     size_t Size() const {
       return Docs.size();
     }
-    const std::vector<ParsedDoc>& GetDocs() const {
+    const std::vector<ParsedDocPtr>& GetDocs() const {
       return Docs;
     }
 
@@ -33,7 +37,7 @@ namespace tgnews {
       if (!Init_) {
         std::vector<size_t> categoryCount(NC_COUNT);
         for (const auto& doc : Docs) {
-          ENewsCategory docCategory = doc.Category;
+          ENewsCategory docCategory = doc->Category;
           assert(docCategory != NC_UNDEFINED && docCategory != NC_NOT_NEWS);
           categoryCount[static_cast<size_t>(docCategory)] += 1;
         }
@@ -43,13 +47,13 @@ namespace tgnews {
       return Category_;
     }
     void Sort() {
-      sort(Docs.begin(), Docs.end(), [](const auto& l, const auto& r) {return l.Weight > r.Weight;});
+      sort(Docs.begin(), Docs.end(), [](const auto& l, const auto& r) {return l->Weight > r->Weight;});
     }
     float Weight() const {
       if (!Init_) {
         float sum = 0.f;
         for (const auto& d : Docs) {
-          sum += d.Weight;
+          sum += d->Weight;
         }
         return sum * sqrt(Docs.size() + 1);;
       }
@@ -64,13 +68,33 @@ namespace tgnews {
       Init_ = true;
     }
   private:
-    uint64_t Time;
-    bool Init_;
-    float Weight_;
-    ENewsCategory Category_;
-    std::vector<ParsedDoc> Docs;
+    uint64_t Time = 0;
+    bool Init_ = false;
+    float Weight_ = 0.f;
+    ENewsCategory Category_ = NC_UNDEFINED;
+    std::vector<ParsedDocPtr> Docs;
   };
 
-  std::vector<Cluster> RunClustering(std::vector<ParsedDoc>& docs);
+  struct ClusteringOptions {
+    // Compares every pair, see LinkWithinThreshold: quadratic time, kept to
+    // evaluate the approximate mode.
+    bool Exact = false;
+    // Otherwise documents are linked to their neighbours below the threshold
+    // found through an HNSW index.
+    HnswOptions Ann;
+    // Near-duplicates by text fingerprint (syndicated copies), and chains
+    // of them, land in one cluster even if their embeddings happen to be
+    // further apart than the threshold. Only the first copy is linked, the
+    // others follow it.
+    bool CollapseNearDuplicates = true;
+    // Builds the index or compares the pairs on pool threads too.
+    std::experimental::thread_pool* Pool = nullptr;
+  };
+
+  // Single linkage of the documents at `threshold`: documents with equal
+  // labels share a cluster.
+  std::vector<size_t> GetClusterLabels(const std::vector<ParsedDocPtr>& docs, float threshold, const ClusteringOptions& options = {});
+
+  std::vector<Cluster> RunClustering(const std::vector<ParsedDocPtr>& docs, const ClusteringOptions& options = {});
 
 }
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "base/parsed_document.h"
+
+#include <cmath>
+
+namespace tgnews {
+
+  inline Embedding Normalize(const Embedding& vector) {
+    float norm = 0.f;
+    for (float value : vector) {
+      norm += value * value;
+    }
+    norm = std::sqrt(norm);
+    Embedding point;
+    for (size_t i = 0; i < EmbeddingSize; ++i) {
+      point[i] = vector[i] / norm;
+    }
+    return point;
+  }
+
+  // Cosine distance scaled to [0, 1] between normalized points, the one
+  // the clustering thresholds are set for.
+  inline float Distance(const Embedding& l, const Embedding& r) {
+    float dot = 0.f;
+    for (size_t i = 0; i < EmbeddingSize; ++i) {
+      dot += l[i] * r[i];
+    }
+    return -(dot + 1.0f) / 2.0f + 1.0f;
+  }
+
+}
@@ -0,0 +1,262 @@
+#include "distance_kernel.h"
+
+#include "base/cpu_features.h"
+#include "base/parallel_for.h"
+
+#include <atomic>
+#include <cstdint>
+
+namespace tgnews {
+
+namespace {
+
+// Columns compared at once, one AVX-512 register or two AVX2 ones.
+constexpr size_t kPanelWidth = 16;
+// Rows compared at once, enough independent multiply-add chains to hide
+// their latency. The accumulators have to fit in registers.
+constexpr size_t kRowGroup = 8;
+// Rows per task, small enough to stay in L1 with a panel.
+constexpr size_t kTileRows = 128;
+
+static_assert(kTileRows % kPanelWidth == 0 && kTileRows % kRowGroup == 0);
+
+// Sets masks[r] bit c if the dot product of row r and panel column c is at
+// least minDot. Rows are row major, the panel is dimension major, so every
+// dimension is one multiply-add of a broadcast row value and a column vector
+// and no horizontal sums are needed.
+using MicroKernel = void (*)(const float* rows, const float* panel,
+                             float minDot, uint16_t* masks);
+
+void MicroKernelScalar(const float* rows, const float* panel, float minDot,
+                       uint16_t* masks) {
+  float dots[kRowGroup][kPanelWidth] = {};
+  for (size_t d = 0; d < EmbeddingSize; ++d) {
+    const float* column = panel + d * kPanelWidth;
+    for (size_t r = 0; r < kRowGroup; ++r) {
+      float value = rows[r * EmbeddingSize + d];
+      for (size_t c = 0; c < kPanelWidth; ++c) {
+        dots[r][c] += value * column[c];
+      }
+    }
+  }
+  for (size_t r = 0; r < kRowGroup; ++r) {
+    uint16_t mask = 0;
+    for (size_t c = 0; c < kPanelWidth; ++c) {
+      if (dots[r][c] >= minDot) {
+        mask |= 1u << c;
+      }
+    }
+    masks[r] = mask;
+  }
+}
+
+#ifdef TGNEWS_X86_KERNELS
+
+// Eight rows of accumulators would not fit in the 16 registers, so the
+// group is done in halves.
+__attribute__((target("avx2,fma"))) void MicroKernelAvx2(const float* rows,
+                                                          const float* panel,
+                                                          float minDot,
+                                                          uint16_t* masks) {
+  constexpr size_t kHalf = kRowGroup / 2;
+  const __m256 bound = _mm256_set1_ps(minDot);
+  for (size_t first = 0; first < kRowGroup; first += kHalf) {
+    __m256 dots[kHalf][2];
+    for (size_t r = 0; r < kHalf; ++r) {
+      dots[r][0] = _mm256_setzero_ps();
+      dots[r][1] = _mm256_setzero_ps();
+    }
+    const float* half = rows + first * EmbeddingSize;
+    for (size_t d = 0; d < EmbeddingSize; ++d) {
+      __m256 low = _mm256_loadu_ps(panel + d * kPanelWidth);
+      __m256 high = _mm256_loadu_ps(panel + d * kPanelWidth + 8);
+#pragma GCC unroll 4
+      for (size_t r = 0; r < kHalf; ++r) {
+        __m256 value = _mm256_broadcast_ss(half + r * EmbeddingSize + d);
+        dots[r][0] = _mm256_fmadd_ps(value, low, dots[r][0]);
+        dots[r][1] = _mm256_fmadd_ps(value, high, dots[r][1]);
+      }
+    }
+    for (size_t r = 0; r < kHalf; ++r) {
+      int low =
+          _mm256_movemask_ps(_mm256_cmp_ps(dots[r][0], bound, _CMP_GE_OQ));
+      int high =
+          _mm256_movemask_ps(_mm256_cmp_ps(dots[r][1], bound, _CMP_GE_OQ));
+      masks[first + r] = static_cast<uint16_t>(low | (high << 8));
+    }
+  }
+}
+
+__attribute__((target("avx512f"))) void MicroKernelAvx512(const float* rows,
+                                                           const float* panel,
+                                                           float minDot,
+                                                           uint16_t* masks) {
+  __m512 dots[kRowGroup];
+  for (size_t r = 0; r < kRowGroup; ++r) {
+    dots[r] = _mm512_setzero_ps();
+  }
+  for (size_t d = 0; d < EmbeddingSize; ++d) {
+    __m512 column = _mm512_loadu_ps(panel + d * kPanelWidth);
+#pragma GCC unroll 8
+    for (size_t r = 0; r < kRowGroup; ++r) {
+      __m512 value = _mm512_set1_ps(rows[r * EmbeddingSize + d]);
+      dots[r] = _mm512_fmadd_ps(value, column, dots[r]);
+    }
+  }
+  __m512 bound = _mm512_set1_ps(minDot);
+  for (size_t r = 0; r < kRowGroup; ++r) {
+    masks[r] = _mm512_cmp_ps_mask(dots[r], bound, _CMP_GE_OQ);
+  }
+}
+
+#endif
+
+MicroKernel GetMicroKernel(DistanceKernel kernel) {
+#ifdef TGNEWS_X86_KERNELS
+  switch (kernel) {
+    case DistanceKernel::Avx512:
+      return MicroKernelAvx512;
+    case DistanceKernel::Avx2:
+      return MicroKernelAvx2;
+    case DistanceKernel::Scalar:
+      break;
+  }
+#endif
+  return MicroKernelScalar;
+}
+
+// Disjoint sets joined from several threads without locks. A root is only
+// ever linked under a smaller one, by a compare-and-swap which fails if it
+// stopped being a root meanwhile, so parents never form a cycle.
+class ConcurrentDisjointSets {
+ public:
+  explicit ConcurrentDisjointSets(size_t size) : Parents(size) {
+    for (size_t i = 0; i < size; ++i) {
+      Parents[i].store(i, std::memory_order_relaxed);
+    }
+  }
+
+  size_t Find(size_t i) {
+    for (;;) {
+      size_t parent = Parents[i].load(std::memory_order_acquire);
+      if (parent == i) {
+        return i;
+      }
+      size_t grandparent = Parents[parent].load(std::memory_order_acquire);
+      // Path halving, losing the race to another thread is harmless.
+      if (grandparent != parent) {
+        Parents[i].compare_exchange_weak(parent, grandparent,
+                                         std::memory_order_release,
+                                         std::memory_order_relaxed);
+      }
+      i = grandparent;
+    }
+  }
+
+  void Union(size_t l, size_t r) {
+    for (;;) {
+      l = Find(l);
+      r = Find(r);
+      if (l == r) {
+        return;
+      }
+      if (l < r) {
+        std::swap(l, r);
+      }
+      size_t expected = l;
+      if (Parents[l].compare_exchange_strong(expected, r,
+                                             std::memory_order_acq_rel)) {
+        return;
+      }
+    }
+  }
+
+ private:
+  std::vector<std::atomic<size_t>> Parents;
+};
+
+}  // namespace
+
+DistanceKernel DetectDistanceKernel() {
+  if (HasCpuFeature(CpuFeature::Avx512F)) {
+    return DistanceKernel::Avx512;
+  }
+  if (HasCpuFeature(CpuFeature::Avx2) && HasCpuFeature(CpuFeature::Fma)) {
+    return DistanceKernel::Avx2;
+  }
+  return DistanceKernel::Scalar;
+}
+
+const char* GetDistanceKernelName(DistanceKernel kernel) {
+  switch (kernel) {
+    case DistanceKernel::Scalar:
+      return "scalar";
+    case DistanceKernel::Avx2:
+      return "avx2";
+    case DistanceKernel::Avx512:
+      return "avx512";
+  }
+  return "unknown";
+}
+
+std::vector<size_t> LinkWithinThreshold(const std::vector<Embedding>& points,
+                                        float threshold,
+                                        std::experimental::thread_pool* pool,
+                                        DistanceKernel kernel) {
+  const size_t count = points.size();
+  if (count == 0) {
+    return {};
+  }
+  // Distance (1 - dot) / 2 is within the threshold iff the dot is at least:
+  const float minDot = 1.f - 2.f * threshold;
+  const MicroKernel microKernel = GetMicroKernel(kernel);
+
+  // Zero padding never matches, and padded positions are skipped anyway.
+  const size_t tiles = (count + kTileRows - 1) / kTileRows;
+  const size_t panels = (count + kPanelWidth - 1) / kPanelWidth;
+  std::vector<float> rows(tiles * kTileRows * EmbeddingSize);
+  std::vector<float> columns(panels * EmbeddingSize * kPanelWidth);
+  for (size_t i = 0; i < count; ++i) {
+    float* panel =
+        columns.data() + i / kPanelWidth * EmbeddingSize * kPanelWidth;
+    for (size_t d = 0; d < EmbeddingSize; ++d) {
+      rows[i * EmbeddingSize + d] = points[i][d];
+      panel[d * kPanelWidth + i % kPanelWidth] = points[i][d];
+    }
+  }
+
+  ConcurrentDisjointSets sets(count);
+  // Tile t compares its rows with the columns from its own diagonal block
+  // on, so every pair is seen at least once. Early tiles have the most work
+  // and are taken first.
+  ParallelFor(pool, tiles, [&](size_t tile) {
+    const size_t firstRow = tile * kTileRows;
+    const size_t lastRow = std::min(firstRow + kTileRows, count);
+    uint16_t masks[kRowGroup];
+    for (size_t panel = firstRow / kPanelWidth; panel < panels; ++panel) {
+      const float* panelData =
+          columns.data() + panel * EmbeddingSize * kPanelWidth;
+      for (size_t row = firstRow; row < lastRow; row += kRowGroup) {
+        microKernel(rows.data() + row * EmbeddingSize, panelData, minDot,
+                    masks);
+        for (size_t r = 0; r < kRowGroup; ++r) {
+          for (uint32_t mask = masks[r]; mask != 0; mask &= mask - 1) {
+            size_t i = row + r;
+            size_t j = panel * kPanelWidth + __builtin_ctz(mask);
+            if (i < count && j < count && i != j) {
+              sets.Union(i, j);
+            }
+          }
+        }
+      }
+    }
+  });
+
+  std::vector<size_t> labels(count);
+  for (size_t i = 0; i < count; ++i) {
+    labels[i] = sets.Find(i);
+  }
+  return labels;
+}
+
+}  // namespace tgnews
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "base/parsed_document.h"
+
+#include <experimental/thread_pool>
+#include <vector>
+
+namespace tgnews {
+
+enum class DistanceKernel {
+  Scalar,
+  Avx2,
+  Avx512,
+};
+
+// The widest kernel the CPU running us supports.
+DistanceKernel DetectDistanceKernel();
+
+const char* GetDistanceKernelName(DistanceKernel kernel);
+
+// Exact single linkage of normalized points at `threshold`: points with
+// equal labels are connected by a chain of pairs within it. Labels are the
+// smallest position in the cluster.
+//
+// Every pair is compared, but no distance matrix is kept: the points are cut
+// into tiles of rows and columns compared on the calling thread and on pool
+// threads, and close pairs are joined in shared disjoint sets right away. So
+// memory is O(n) and time O(n^2 / threads).
+std::vector<size_t> LinkWithinThreshold(
+    const std::vector<Embedding>& points, float threshold,
+    std::experimental::thread_pool* pool = nullptr,
+    DistanceKernel kernel = DetectDistanceKernel());
+
+}  // namespace tgnews
@@ -0,0 +1,234 @@
+#include "hnsw_index.h"
+#include "distance.h"
+
+#include "base/base.h"
+#include "base/parallel_for.h"
+
+#include <algorithm>
+#include <cmath>
+#include <queue>
+#include <random>
+
+namespace {
+
+// Marks nodes seen by the current search of this thread. Bumping the epoch
+// clears it without touching the memory.
+class VisitedSet {
+ public:
+  void Reset(size_t size) {
+    if (Marks.size() < size) {
+      Marks.assign(size, 0);
+      Epoch = 0;
+    }
+    if (++Epoch == 0) {
+      std::fill(Marks.begin(), Marks.end(), 0);
+      Epoch = 1;
+    }
+  }
+
+  // Returns false if already visited.
+  bool Visit(uint32_t id) {
+    if (Marks[id] == Epoch) {
+      return false;
+    }
+    Marks[id] = Epoch;
+    return true;
+  }
+
+ private:
+  std::vector<uint32_t> Marks;
+  uint32_t Epoch = 0;
+};
+
+}  // namespace
+
+namespace tgnews {
+
+HnswIndex::HnswIndex(const std::vector<Embedding>& points,
+                     const HnswOptions& options)
+    : Points(points), Options(options) {
+  VERIFY(Options.M > 1, "hnsw needs at least two links per node");
+  Nodes.reserve(Points.size());
+  Grow();
+}
+
+void HnswIndex::Grow() {
+  // Levels are drawn per id, so the graph doesn't depend on insert order.
+  const double levelMultiplier = 1.0 / std::log(static_cast<double>(Options.M));
+  for (size_t id = Nodes.size(); id < Points.size(); ++id) {
+    std::mt19937_64 random(id);
+    double uniform = 1.0 - std::generate_canonical<double, 53>(random);
+    auto& node = Nodes.emplace_back();
+    node.Level = static_cast<int>(-std::log(uniform) * levelMultiplier);
+    node.Links.resize(node.Level + 1);
+    Locks.emplace_back();
+  }
+}
+
+void HnswIndex::Build(std::experimental::thread_pool* pool) {
+  ParallelFor(pool, Nodes.size(), [this](size_t id) { Insert(id); });
+}
+
+float HnswIndex::DistanceTo(const Embedding& query, uint32_t id) const {
+  return Distance(query, Points[id]);
+}
+
+void HnswIndex::Insert(uint32_t id) {
+  const auto& point = Points[id];
+  const int level = Nodes[id].Level;
+
+  std::unique_lock<std::mutex> entryLock(EntryLock);
+  if (EntryPoint < 0) {
+    EntryPoint = id;
+    MaxLevel = level;
+    return;
+  }
+  uint32_t entry = EntryPoint;
+  const int maxLevel = MaxLevel;
+  // A node reaching above the graph becomes the entry, nobody may start
+  // from it before it's linked.
+  if (level <= maxLevel) {
+    entryLock.unlock();
+  }
+
+  for (int l = maxLevel; l > level; --l) {
+    entry = GreedyClosest(point, entry, l, true);
+  }
+  for (int l = std::min(level, maxLevel); l >= 0; --l) {
+    auto candidates = SearchLayer(point, entry, Options.EfConstruction, l, true);
+    auto neighbours = SelectNeighbours(candidates, Options.M);
+    {
+      std::lock_guard<std::mutex> lock(Locks[id]);
+      Nodes[id].Links[l] = neighbours;
+    }
+    for (uint32_t neighbour : neighbours) {
+      std::lock_guard<std::mutex> lock(Locks[neighbour]);
+      auto& links = Nodes[neighbour].Links[l];
+      if (links.size() < MaxLinks(l)) {
+        links.push_back(id);
+        continue;
+      }
+      // Full: choose again among the old links and the new node.
+      const auto& base = Points[neighbour];
+      std::vector<Candidate> linked = {{Distance(base, point), id}};
+      for (uint32_t link : links) {
+        linked.push_back({DistanceTo(base, link), link});
+      }
+      std::sort(linked.begin(), linked.end());
+      links = SelectNeighbours(linked, MaxLinks(l));
+    }
+    entry = candidates.front().second;
+  }
+
+  if (level > maxLevel) {
+    EntryPoint = id;
+    MaxLevel = level;
+  }
+}
+
+uint32_t HnswIndex::GreedyClosest(const Embedding& query, uint32_t entry,
+                                  int level, bool locked) const {
+  float best = DistanceTo(query, entry);
+  for (bool moved = true; moved;) {
+    moved = false;
+    VisitLinks(entry, level, locked, [&](uint32_t link) {
+      float distance = DistanceTo(query, link);
+      if (distance < best) {
+        best = distance;
+        entry = link;
+        moved = true;
+      }
+    });
+  }
+  return entry;
+}
+
+std::vector<HnswIndex::Candidate> HnswIndex::SearchLayer(
+    const Embedding& query, uint32_t entry, size_t ef, int level,
+    bool locked) const {
+  thread_local VisitedSet visited;
+  visited.Reset(Nodes.size());
+
+  // Closest first to expand, farthest first to drop.
+  std::priority_queue<Candidate, std::vector<Candidate>, std::greater<>>
+      candidates;
+  std::priority_queue<Candidate> results;
+  float distance = DistanceTo(query, entry);
+  visited.Visit(entry);
+  candidates.push({distance, entry});
+  results.push({distance, entry});
+  while (!candidates.empty()) {
+    auto [current, id] = candidates.top();
+    if (current > results.top().first && results.size() >= ef) {
+      break;
+    }
+    candidates.pop();
+    VisitLinks(id, level, locked, [&](uint32_t link) {
+      if (!visited.Visit(link)) {
+        return;
+      }
+      float distance = DistanceTo(query, link);
+      if (results.size() < ef || distance < results.top().first) {
+        candidates.push({distance, link});
+        results.push({distance, link});
+        if (results.size() > ef) {
+          results.pop();
+        }
+      }
+    });
+  }
+
+  std::vector<Candidate> closest(results.size());
+  for (size_t i = closest.size(); i-- > 0; results.pop()) {
+    closest[i] = results.top();
+  }
+  return closest;
+}
+
+std::vector<uint32_t> HnswIndex::SelectNeighbours(
+    const std::vector<Candidate>& candidates, size_t count) const {
+  std::vector<uint32_t> selected;
+  for (const auto& [distance, id] : candidates) {
+    if (selected.size() == count) {
+      break;
+    }
+    bool diverse = std::all_of(
+        selected.begin(), selected.end(), [&, distance = distance](uint32_t other) {
+          return DistanceTo(Points[id], other) > distance;
+        });
+    if (diverse) {
+      selected.push_back(id);
+    }
+  }
+  return selected;
+}
+
+std::vector<std::pair<float, uint32_t>> HnswIndex::Search(
+    const Embedding& query, size_t k, size_t ef) const {
+  if (EntryPoint < 0) {
+    return {};
+  }
+  uint32_t entry = EntryPoint;
+  for (int l = MaxLevel; l > 0; --l) {
+    entry = GreedyClosest(query, entry, l, false);
+  }
+  auto closest = SearchLayer(query, entry, std::max(ef, k), 0, false);
+  if (closest.size() > k) {
+    closest.resize(k);
+  }
+  return closest;
+}
+
+size_t HnswIndex::MemoryBytes() const {
+  size_t bytes = Nodes.capacity() * sizeof(Node) +
+                 Locks.size() * sizeof(std::mutex);
+  for (const auto& node : Nodes) {
+    bytes += node.Links.capacity() * sizeof(node.Links[0]);
+    for (const auto& links : node.Links) {
+      bytes += links.capacity() * sizeof(uint32_t);
+    }
+  }
+  return bytes;
+}
+
+}  // namespace tgnews
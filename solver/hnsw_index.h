@@ -0,0 +1,110 @@
+#pragma once
+
+#include "base/parsed_document.h"
+
+#include <deque>
+#include <experimental/thread_pool>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace tgnews {
+
+struct HnswOptions {
+  // Links per node on the upper layers, twice as many on the bottom one.
+  size_t M = 16;
+  // Candidates kept while linking a new node.
+  size_t EfConstruction = 100;
+  // Candidates kept while searching, the recall knob: more is slower and
+  // misses fewer neighbours.
+  size_t EfSearch = 64;
+  // Neighbours looked up per document when clustering.
+  size_t Neighbours = 16;
+};
+
+// Hierarchical navigable small world graph over normalized embeddings
+// (Malkov, Yashunin). Every node keeps at most 2M links on the bottom layer,
+// so memory is O(n * M) and a search visits O(log n) nodes per layer.
+//
+// Inserts may run concurrently: neighbour lists are guarded per node. Search
+// expects all inserts to be done. Points appended later are indexed after
+// Grow, so the index can follow a growing set.
+class HnswIndex {
+ public:
+  // The points have to be normalized and outlive the index. Ids are
+  // positions in `points`.
+  HnswIndex(const std::vector<Embedding>& points, const HnswOptions& options);
+
+  // Makes room for the points appended since, each to be inserted once.
+  // Not while inserts or searches run.
+  void Grow();
+
+  // Every id once.
+  void Insert(uint32_t id);
+
+  // Inserts all points, on pool threads as well if there is a pool.
+  void Build(std::experimental::thread_pool* pool = nullptr);
+
+  // Up to k points closest to the query as (distance, id), closest first.
+  std::vector<std::pair<float, uint32_t>> Search(const Embedding& query,
+                                                 size_t k, size_t ef) const;
+
+  size_t MemoryBytes() const;
+
+ private:
+  using Candidate = std::pair<float, uint32_t>;
+
+  struct Node {
+    int Level = 0;
+    std::vector<std::vector<uint32_t>> Links;
+  };
+
+  float DistanceTo(const Embedding& query, uint32_t id) const;
+
+  // Calls visit(link) for the links of the node. While inserting, they are
+  // copied under the node lock first.
+  template <typename Visit>
+  void VisitLinks(uint32_t id, int level, bool locked, Visit visit) const {
+    if (!locked) {
+      for (uint32_t link : Nodes[id].Links[level]) {
+        visit(link);
+      }
+      return;
+    }
+    std::vector<uint32_t> links;
+    {
+      std::lock_guard<std::mutex> lock(Locks[id]);
+      links = Nodes[id].Links[level];
+    }
+    for (uint32_t link : links) {
+      visit(link);
+    }
+  }
+
+  uint32_t GreedyClosest(const Embedding& query, uint32_t entry, int level,
+                         bool locked) const;
+
+  // The ef closest nodes reachable from the entry, closest first.
+  std::vector<Candidate> SearchLayer(const Embedding& query, uint32_t entry,
+                                     size_t ef, int level, bool locked) const;
+
+  // Keeps up to `count` candidates closer to the base than to any kept one,
+  // so links go in different directions instead of into one dense clump.
+  std::vector<uint32_t> SelectNeighbours(
+      const std::vector<Candidate>& candidates, size_t count) const;
+
+  size_t MaxLinks(int level) const {
+    return level == 0 ? 2 * Options.M : Options.M;
+  }
+
+  const std::vector<Embedding>& Points;
+  const HnswOptions Options;
+  std::vector<Node> Nodes;
+  // Not a vector: mutexes don't move when it grows.
+  mutable std::deque<std::mutex> Locks;
+  std::mutex EntryLock;
+  int64_t EntryPoint = -1;
+  int MaxLevel = -1;
+};
+
+}  // namespace tgnews
@@ -0,0 +1,384 @@
+#include "incremental_clustering.h"
+#include "distance.h"
+
+#include "base/parallel_for.h"
+#include "base/simhash.h"
+
+#include <algorithm>
+#include <iterator>
+#include <unordered_set>
+
+namespace tgnews {
+
+IncrementalClustering::IncrementalClustering(const HnswOptions& ann)
+    : Ann(ann) {
+  Partitions[LangRu].Threshold = RuDistanceThreshold;
+  Partitions[LangEn].Threshold = EnDistanceThreshold;
+  Clear();
+}
+
+bool IncrementalClustering::IsClustered(const ParsedDoc& doc) {
+  return (doc.Lang == LangRu || doc.Lang == LangEn) && doc.IsNews();
+}
+
+void IncrementalClustering::Update(ParsedDocPtr doc) {
+  Operations operations;
+  Route(doc->FileName, doc, operations);
+  Run(operations, nullptr);
+}
+
+void IncrementalClustering::Remove(const std::string& fileName) {
+  Operations operations;
+  Route(fileName, nullptr, operations);
+  Run(operations, nullptr);
+}
+
+void IncrementalClustering::Apply(const std::vector<DocumentChange>& changes,
+                                  std::experimental::thread_pool* pool) {
+  Operations operations;
+  for (const auto& change : changes) {
+    Route(change.FileName,
+          change.State == ParsedDoc::EState::Removed ? nullptr
+                                                     : change.Document,
+          operations);
+  }
+  Run(operations, pool);
+}
+
+void IncrementalClustering::Route(const std::string& fileName,
+                                  ParsedDocPtr doc, Operations& operations) {
+  const bool clustered = doc && IsClustered(*doc);
+  auto it = LangByName.find(fileName);
+  if (it != LangByName.end() && (!clustered || it->second != doc->Lang)) {
+    operations[it->second].push_back({fileName, nullptr});
+    LangByName.erase(it);
+  }
+  if (clustered) {
+    LangByName[fileName] = doc->Lang;
+    operations[doc->Lang].push_back({fileName, std::move(doc)});
+  }
+}
+
+void IncrementalClustering::Run(Operations& operations,
+                                std::experimental::thread_pool* pool) {
+  ParallelFor(pool, LangCount, [&](size_t lang) {
+    auto& partition = Partitions[lang];
+    for (auto& operation : operations[lang]) {
+      if (operation.Doc) {
+        Update(partition, std::move(operation.Doc));
+      } else {
+        Remove(partition, operation.FileName);
+      }
+    }
+  });
+}
+
+void IncrementalClustering::Update(Partition& partition, ParsedDocPtr doc) {
+  auto it = partition.SlotByName.find(doc->FileName);
+  if (it != partition.SlotByName.end()) {
+    auto& node = partition.Nodes[it->second];
+    // Only the expiration moved, the links stay.
+    if (doc->Vector == node.Doc->Vector &&
+        doc->Fingerprint == node.Doc->Fingerprint) {
+      node.Doc = std::move(doc);
+      return;
+    }
+    Erase(partition, it->second);
+    partition.SlotByName.erase(it);
+  }
+  Add(partition, std::move(doc));
+}
+
+void IncrementalClustering::Remove(Partition& partition,
+                                   const std::string& fileName) {
+  auto it = partition.SlotByName.find(fileName);
+  if (it != partition.SlotByName.end()) {
+    Erase(partition, it->second);
+    partition.SlotByName.erase(it);
+  }
+}
+
+void IncrementalClustering::Clear() {
+  for (auto& partition : Partitions) {
+    partition.Nodes.clear();
+    partition.FreeSlots.clear();
+    partition.Clusters.clear();
+    partition.NextClusterId = 0;
+    partition.SlotByName.clear();
+    ResetPoints(partition);
+    for (auto& band : partition.Bands) {
+      band.clear();
+    }
+  }
+  LangByName.clear();
+}
+
+void IncrementalClustering::ResetPoints(Partition& partition) const {
+  partition.Points = std::make_unique<PointIndex>(Ann);
+}
+
+void IncrementalClustering::Load(const std::vector<ParsedDocPtr>& docs,
+                                 std::experimental::thread_pool* pool) {
+  Clear();
+  // Added in order like updates, so the index and the links come out the
+  // same as for the documents coming in one by one.
+  Operations operations;
+  for (const auto& doc : docs) {
+    Route(doc->FileName, doc, operations);
+  }
+  Run(operations, pool);
+}
+
+void IncrementalClustering::Add(Partition& partition, ParsedDocPtr doc) {
+  size_t slot;
+  if (!partition.FreeSlots.empty()) {
+    slot = partition.FreeSlots.back();
+    partition.FreeSlots.pop_back();
+  } else {
+    slot = partition.Nodes.size();
+    partition.Nodes.emplace_back();
+  }
+  partition.SlotByName[doc->FileName] = slot;
+
+  auto& points = *partition.Points;
+  Node node;
+  node.Point = points.Points.size();
+  points.Points.push_back(Normalize(doc->Vector));
+  points.Slots.push_back(slot);
+  points.Index.Grow();
+  points.Index.Insert(node.Point);
+  node.Doc = std::move(doc);
+  partition.Nodes[slot] = std::move(node);
+
+  auto links = FindLinks(partition, slot);
+  const uint64_t fingerprint = partition.Nodes[slot].Doc->Fingerprint;
+  if (fingerprint != 0) {
+    for (size_t band = 0; band < partition.Bands.size(); ++band) {
+      partition.Bands[band][FingerprintBand(fingerprint, band)].push_back(
+          slot);
+    }
+  }
+  std::unordered_set<size_t> linked;
+  for (size_t other : links) {
+    partition.Nodes[other].Links.push_back(slot);
+    linked.insert(partition.Nodes[other].ClusterId);
+  }
+  partition.Nodes[slot].Links = std::move(links);
+
+  if (linked.empty()) {
+    partition.Nodes[slot].ClusterId = partition.NextClusterId++;
+    partition.Clusters[partition.Nodes[slot].ClusterId].push_back(slot);
+    return;
+  }
+
+  // The largest linked cluster absorbs the others.
+  size_t target = *linked.begin();
+  for (size_t clusterId : linked) {
+    if (partition.Clusters[clusterId].size() >
+        partition.Clusters[target].size()) {
+      target = clusterId;
+    }
+  }
+  auto& members = partition.Clusters[target];
+  for (size_t clusterId : linked) {
+    if (clusterId == target) {
+      continue;
+    }
+    auto it = partition.Clusters.find(clusterId);
+    for (size_t member : it->second) {
+      partition.Nodes[member].ClusterId = target;
+      members.push_back(member);
+    }
+    partition.Clusters.erase(it);
+  }
+  partition.Nodes[slot].ClusterId = target;
+  members.push_back(slot);
+}
+
+std::vector<size_t> IncrementalClustering::FindLinks(
+    const Partition& partition, size_t slot) const {
+  const auto& node = partition.Nodes[slot];
+  const auto& points = *partition.Points;
+  std::vector<size_t> links;
+  // The whole search beam is read: removed points come up too and must not
+  // take the places of live ones.
+  for (const auto& [distance, point] :
+       points.Index.Search(points.Points[node.Point], Ann.EfSearch,
+                           Ann.EfSearch)) {
+    if (distance > partition.Threshold || links.size() == Ann.Neighbours) {
+      break;
+    }
+    const size_t other = points.Slots[point];
+    if (other != kNoSlot && other != slot) {
+      links.push_back(other);
+    }
+  }
+
+  const uint64_t fingerprint = node.Doc->Fingerprint;
+  if (fingerprint == 0) {
+    return links;
+  }
+  std::vector<std::pair<int, size_t>> duplicates;
+  for (size_t band = 0; band < partition.Bands.size(); ++band) {
+    auto it = partition.Bands[band].find(FingerprintBand(fingerprint, band));
+    if (it == partition.Bands[band].end()) {
+      continue;
+    }
+    for (size_t other : it->second) {
+      int bits = FingerprintDistance(
+          fingerprint, partition.Nodes[other].Doc->Fingerprint);
+      if (other != slot && bits <= kNearDuplicateBits) {
+        duplicates.push_back({bits, other});
+      }
+    }
+  }
+  // Found once per shared band.
+  std::sort(duplicates.begin(), duplicates.end());
+  duplicates.erase(std::unique(duplicates.begin(), duplicates.end()),
+                   duplicates.end());
+  if (duplicates.size() > Ann.Neighbours) {
+    duplicates.resize(Ann.Neighbours);
+  }
+  for (const auto& [bits, other] : duplicates) {
+    if (std::find(links.begin(), links.end(), other) == links.end()) {
+      links.push_back(other);
+    }
+  }
+  return links;
+}
+
+void IncrementalClustering::Erase(Partition& partition, size_t slot) {
+  auto node = std::move(partition.Nodes[slot]);
+  partition.Nodes[slot] = Node();
+  partition.FreeSlots.push_back(slot);
+
+  const uint64_t fingerprint = node.Doc->Fingerprint;
+  if (fingerprint != 0) {
+    for (size_t band = 0; band < partition.Bands.size(); ++band) {
+      auto it = partition.Bands[band].find(FingerprintBand(fingerprint, band));
+      auto& slots = it->second;
+      slots.erase(std::find(slots.begin(), slots.end(), slot));
+      if (slots.empty()) {
+        partition.Bands[band].erase(it);
+      }
+    }
+  }
+  for (size_t other : node.Links) {
+    auto& links = partition.Nodes[other].Links;
+    links.erase(std::find(links.begin(), links.end(), slot));
+  }
+
+  auto& points = *partition.Points;
+  points.Slots[node.Point] = kNoSlot;
+  if (++points.Removed * 2 > points.Points.size()) {
+    CompactPoints(partition);
+  }
+
+  auto it = partition.Clusters.find(node.ClusterId);
+  auto& members = it->second;
+  members.erase(std::find(members.begin(), members.end(), slot));
+  if (members.empty()) {
+    partition.Clusters.erase(it);
+  } else if (node.Links.size() > 1) {
+    // With a single neighbour the rest holds together without the node.
+    Split(partition, node.ClusterId, node.Links);
+  }
+}
+
+void IncrementalClustering::CompactPoints(Partition& partition) const {
+  auto old = std::move(partition.Points);
+  ResetPoints(partition);
+  auto& points = *partition.Points;
+  for (size_t slot : old->Slots) {
+    if (slot != kNoSlot) {
+      auto& node = partition.Nodes[slot];
+      points.Points.push_back(old->Points[node.Point]);
+      points.Slots.push_back(slot);
+      node.Point = points.Points.size() - 1;
+    }
+  }
+  points.Index.Grow();
+  points.Index.Build();
+}
+
+void IncrementalClustering::Split(Partition& partition, size_t clusterId,
+                                  const std::vector<size_t>& neighbours) {
+  std::unordered_set<size_t> visited;
+  // Members reached from the start, breadth first. Stops early once all of
+  // `pending` is reached.
+  auto walk = [&](size_t start, std::unordered_set<size_t>* pending) {
+    std::vector<size_t> component = {start};
+    visited.insert(start);
+    for (size_t next = 0; next < component.size(); ++next) {
+      if (pending && pending->empty()) {
+        break;
+      }
+      for (size_t link : partition.Nodes[component[next]].Links) {
+        if (visited.insert(link).second) {
+          component.push_back(link);
+          if (pending) {
+            pending->erase(link);
+          }
+        }
+      }
+    }
+    return component;
+  };
+
+  // Usually the neighbours still reach each other close by and nothing
+  // else is walked.
+  std::unordered_set<size_t> pending(neighbours.begin() + 1,
+                                     neighbours.end());
+  walk(neighbours.front(), &pending);
+  if (pending.empty()) {
+    return;
+  }
+  // The component of the first neighbour was walked whole, it keeps the
+  // id. The others move to new clusters.
+  for (size_t start : neighbours) {
+    if (visited.count(start)) {
+      continue;
+    }
+    size_t id = partition.NextClusterId++;
+    auto component = walk(start, nullptr);
+    for (size_t member : component) {
+      partition.Nodes[member].ClusterId = id;
+    }
+    partition.Clusters[id] = std::move(component);
+  }
+  auto& members = partition.Clusters[clusterId];
+  members.erase(std::remove_if(members.begin(), members.end(),
+                               [&](size_t member) {
+                                 return partition.Nodes[member].ClusterId !=
+                                        clusterId;
+                               }),
+                members.end());
+}
+
+std::vector<Cluster> IncrementalClustering::GetClusters(
+    std::experimental::thread_pool* pool) const {
+  std::array<std::vector<Cluster>, LangCount> byLang;
+  ParallelFor(pool, LangCount, [&](size_t lang) {
+    const auto& partition = Partitions[lang];
+    auto& clusters = byLang[lang];
+    clusters.reserve(partition.Clusters.size());
+    for (const auto& [clusterId, members] : partition.Clusters) {
+      clusters.emplace_back();
+      for (size_t member : members) {
+        clusters.back().AddDocument(partition.Nodes[member].Doc);
+      }
+      clusters.back().Init();
+      clusters.back().Sort();
+    }
+  });
+  std::vector<Cluster> result;
+  for (auto& clusters : byLang) {
+    std::move(clusters.begin(), clusters.end(), std::back_inserter(result));
+  }
+  std::sort(result.begin(), result.end(), [](const auto& l, const auto& r) {
+    return l.GetTime() > r.GetTime();
+  });
+  return result;
+}
+
+}  // namespace tgnews
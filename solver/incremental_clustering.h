@@ -0,0 +1,146 @@
+#pragma once
+
+#include "base/parsed_document.h"
+#include "base/simhash.h"
+#include "cluster.h"
+#include "hnsw_index.h"
+
+#include <array>
+#include <limits>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace tgnews {
+
+// Keeps the clustering of RunClustering up to date under document changes.
+//
+// Single linkage with a distance threshold puts two documents into one
+// cluster iff they are connected by a chain of linked pairs, so the
+// clusters are the connected components of the links. Every language keeps
+// its documents in an HNSW index as RunClustering's approximate mode does:
+// a new document is looked up there and linked to its nearest neighbours
+// within the threshold, and through the fingerprint bands to its
+// near-duplicates, merging their clusters. Links are kept both ways, so a
+// removal walks from the neighbours of the removed document only until
+// they reach each other, and splits its cluster if they don't. Other
+// clusters are not touched. Load adds the documents the same way, the
+// clusters don't depend on whether they came in at once or one by one.
+//
+// Languages are clustered apart, so every language keeps its own partition
+// and a batch of changes is applied to the partitions in parallel. Not
+// thread safe otherwise.
+class IncrementalClustering {
+ public:
+  explicit IncrementalClustering(const HnswOptions& ann = {});
+
+  // Adds the document or replaces the stored one of the same name. Only ru
+  // and en news are clustered, others just drop the stored one.
+  void Update(ParsedDocPtr doc);
+
+  void Remove(const std::string& fileName);
+
+  // Same as Update or Remove for every change in order, the partitions on
+  // pool threads too.
+  void Apply(const std::vector<DocumentChange>& changes,
+             std::experimental::thread_pool* pool = nullptr);
+
+  // Replaces the stored documents, as many Update calls would, the
+  // partitions on pool threads.
+  void Load(const std::vector<ParsedDocPtr>& docs,
+            std::experimental::thread_pool* pool = nullptr);
+
+  void Clear();
+
+  // Clusters of the stored documents in the order of RunClustering.
+  std::vector<Cluster> GetClusters(
+      std::experimental::thread_pool* pool = nullptr) const;
+
+  size_t Size() const { return LangByName.size(); }
+
+ private:
+  static constexpr size_t kNoSlot = std::numeric_limits<size_t>::max();
+
+  struct Node {
+    ParsedDocPtr Doc;
+    size_t ClusterId = 0;
+    // Position in PointIndex::Points.
+    uint32_t Point = 0;
+    // Slots of the linked documents, links go both ways.
+    std::vector<size_t> Links;
+  };
+
+  // Points of the partition in an HNSW index. Removed points stay in the
+  // graph, searches still pass through them, until there are more of them
+  // than live ones and the index is built again. Allocated apart, the index
+  // refers to the points.
+  struct PointIndex {
+    explicit PointIndex(const HnswOptions& options) : Index(Points, options) {}
+
+    std::vector<Embedding> Points;
+    // Slot of every point, kNoSlot once removed.
+    std::vector<size_t> Slots;
+    size_t Removed = 0;
+    HnswIndex Index;
+  };
+
+  struct Partition {
+    float Threshold = 0.f;
+    // Slots of removed documents are null and reused.
+    std::vector<Node> Nodes;
+    std::vector<size_t> FreeSlots;
+    std::unordered_map<size_t, std::vector<size_t>> Clusters;
+    size_t NextClusterId = 0;
+    std::unordered_map<std::string, size_t> SlotByName;
+    std::unique_ptr<PointIndex> Points;
+    // Slots of fingerprinted documents by every band of the fingerprint.
+    std::array<std::unordered_map<uint64_t, std::vector<size_t>>,
+               kNearDuplicateBits + 1>
+        Bands;
+  };
+
+  // A change routed to one partition, a removal if there is no document.
+  struct Operation {
+    std::string FileName;
+    ParsedDocPtr Doc;
+  };
+
+  using Operations = std::array<std::vector<Operation>, LangCount>;
+
+  static bool IsClustered(const ParsedDoc& doc);
+
+  // Queues the change for the partitions the document leaves and enters.
+  void Route(const std::string& fileName, ParsedDocPtr doc,
+             Operations& operations);
+
+  void Run(Operations& operations, std::experimental::thread_pool* pool);
+
+  void Update(Partition& partition, ParsedDocPtr doc);
+
+  void Remove(Partition& partition, const std::string& fileName);
+
+  void Add(Partition& partition, ParsedDocPtr doc);
+
+  // The nearest documents within the threshold, up to Ann.Neighbours of
+  // them, and as many closest near-duplicates (both fingerprinted).
+  std::vector<size_t> FindLinks(const Partition& partition, size_t slot) const;
+
+  void Erase(Partition& partition, size_t slot);
+
+  // Splits the cluster the neighbours of a removed document belonged to if
+  // they no longer reach each other.
+  void Split(Partition& partition, size_t clusterId,
+             const std::vector<size_t>& neighbours);
+
+  void ResetPoints(Partition& partition) const;
+
+  // Builds the index of the live points again.
+  void CompactPoints(Partition& partition) const;
+
+  const HnswOptions Ann;
+  std::array<Partition, LangCount> Partitions;
+  std::unordered_map<std::string, ELang> LangByName;
+};
+
+}  // namespace tgnews
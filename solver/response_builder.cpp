@@ -5,23 +5,23 @@
 #include <string>
 #include <vector>
 
-#include "embedder.h"
-
 #include <glog/logging.h>
 
+#include "base/parallel_for.h"
+
 namespace {
 
 using namespace tgnews;
 
-nlohmann::json CalcLangAns(const std::vector<tgnews::ParsedDoc>& docs) {
+nlohmann::json CalcLangAns(const std::vector<tgnews::ParsedDocPtr>& docs) {
   nlohmann::json result = nlohmann::json::array();
-  for (const auto& lang : {"en", "ru"}) {
+  for (const auto lang : {LangEn, LangRu}) {
     nlohmann::json lang_obj;
-    lang_obj["lang_code"] = lang;
+    lang_obj["lang_code"] = std::string(LangCode(lang));
     nlohmann::json articles = nlohmann::json::array();
     for (const auto& doc : docs) {
-      if (doc.Lang == lang) {
-        articles.push_back(doc.FileName);
+      if (doc->Lang == lang) {
+        articles.push_back(doc->FileName);
       }
     }
     lang_obj["articles"] = articles;
@@ -30,11 +30,11 @@ nlohmann::json CalcLangAns(const std::vector<tgnews::ParsedDoc>& docs) {
   return result;
 }
 
-nlohmann::json CalcNewsAns(const std::vector<tgnews::ParsedDoc>& docs) {
+nlohmann::json CalcNewsAns(const std::vector<tgnews::ParsedDocPtr>& docs) {
   nlohmann::json articles = nlohmann::json::array();
   for (const auto& doc : docs) {
-    if (doc.IsNews()) {
-      articles.push_back(doc.FileName);
+    if (doc->IsNews()) {
+      articles.push_back(doc->FileName);
     }
   }
   nlohmann::json result;
@@ -42,47 +42,47 @@ nlohmann::json CalcNewsAns(const std::vector<tgnews::ParsedDoc>& docs) {
   return result;
 }
 
-nlohmann::json CalcCategoryAns(const std::vector<tgnews::ParsedDoc>& docs) {
+nlohmann::json CalcCategoryAns(const std::vector<tgnews::ParsedDocPtr>& docs) {
   nlohmann::json society = nlohmann::json::array();
   for (const auto& doc : docs) {
-    if (doc.Category == ENewsCategory::NC_SOCIETY) {
-      society.push_back(doc.FileName);
+    if (doc->Category == ENewsCategory::NC_SOCIETY) {
+      society.push_back(doc->FileName);
     }
   }
   nlohmann::json economy = nlohmann::json::array();
   for (const auto& doc : docs) {
-    if (doc.Category == ENewsCategory::NC_ECONOMY) {
-      economy.push_back(doc.FileName);
+    if (doc->Category == ENewsCategory::NC_ECONOMY) {
+      economy.push_back(doc->FileName);
     }
   }
   nlohmann::json technology = nlohmann::json::array();
   for (const auto& doc : docs) {
-    if (doc.Category == ENewsCategory::NC_TECHNOLOGY) {
-      technology.push_back(doc.FileName);
+    if (doc->Category == ENewsCategory::NC_TECHNOLOGY) {
+      technology.push_back(doc->FileName);
     }
   }
   nlohmann::json sports = nlohmann::json::array();
   for (const auto& doc : docs) {
-    if (doc.Category == ENewsCategory::NC_SPORTS) {
-      sports.push_back(doc.FileName);
+    if (doc->Category == ENewsCategory::NC_SPORTS) {
+      sports.push_back(doc->FileName);
     }
   }
   nlohmann::json entertainment = nlohmann::json::array();
   for (const auto& doc : docs) {
-    if (doc.Category == ENewsCategory::NC_ENTERTAINMENT) {
-      entertainment.push_back(doc.FileName);
+    if (doc->Category == ENewsCategory::NC_ENTERTAINMENT) {
+      entertainment.push_back(doc->FileName);
     }
   }
   nlohmann::json science = nlohmann::json::array();
   for (const auto& doc : docs) {
-    if (doc.Category == ENewsCategory::NC_SCIENCE) {
-      science.push_back(doc.FileName);
+    if (doc->Category == ENewsCategory::NC_SCIENCE) {
+      science.push_back(doc->FileName);
     }
   }
   nlohmann::json other = nlohmann::json::array();
   for (const auto& doc : docs) {
-    if (doc.Category == ENewsCategory::NC_OTHER) {
-      other.push_back(doc.FileName);
+    if (doc->Category == ENewsCategory::NC_OTHER) {
+      other.push_back(doc->FileName);
     }
   }
   nlohmann::json result = nlohmann::json::array();
@@ -118,7 +118,7 @@ nlohmann::json CalcThreadsAns(const std::vector<Cluster>& clusters) {
     thread["title"] = c.GetTitle();
     nlohmann::json articles = nlohmann::json::array();
     for (const auto& d : c.GetDocs()) {
-      articles.push_back(d.FileName);
+      articles.push_back(d->FileName);
     }
     thread["articles"] = std::move(articles);
     threads.push_back(thread);
@@ -126,6 +126,51 @@ nlohmann::json CalcThreadsAns(const std::vector<Cluster>& clusters) {
   return threads;
 }
 
+// Threads of the language in every category for the period, heaviest
+// first. Clusters updated within the period weigh twice as much.
+void CalcPeriodAns(
+    const std::vector<Cluster>& clustering, uint64_t now, size_t durIdx,
+    ELang lang,
+    std::array<std::array<nlohmann::json, LangCount>, NC_COUNT>& answers) {
+  const int64_t duration = Discretization[durIdx];
+  using WeightWithIdx = std::pair<float, size_t>;
+  std::array<std::vector<WeightWithIdx>, ENewsCategory::NC_COUNT> weights;
+  for (size_t clusterIdx = 0; clusterIdx < clustering.size(); ++clusterIdx) {
+    const auto& c = clustering[clusterIdx];
+    if (c.GetTime() + 3 * duration < now) {
+      continue;  // cause clusters sorted (by freshness)
+    }
+    if (c.GetEnumLang() != lang) {
+      continue;
+    }
+    size_t catIdx = static_cast<size_t>(c.GetCategory());
+    float clusterWeight = c.Weight();
+    if (c.GetTime() + duration >= now) {
+      clusterWeight *= 2;
+    }
+    weights[catIdx].push_back({clusterWeight, clusterIdx});
+    weights[static_cast<size_t>(NC_ANY)].push_back({clusterWeight, clusterIdx});
+  }
+  for (size_t catIdx = 0; catIdx < NC_COUNT; catIdx++) {
+    auto& vec = weights[catIdx];
+    std::sort(vec.begin(), vec.end(), std::greater<WeightWithIdx>());
+    nlohmann::json threads = nlohmann::json::array();
+    for (const auto& it : vec) {
+      nlohmann::json thread;
+      thread["title"] = clustering[it.second].GetTitle();
+      thread["category"] = CategoryNames.at(static_cast<size_t>(clustering[it.second].GetCategory()));
+      nlohmann::json articles = nlohmann::json::array();
+      for (const auto& d : clustering[it.second].GetDocs()) {
+        articles.push_back(d->FileName);
+      }
+      thread["articles"] = std::move(articles);
+      threads.push_back(thread);
+    }
+    nlohmann::json ans = { {"threads",  threads} };
+    answers[catIdx][lang] = std::move(ans);
+  }
+}
+
 }  // namespace
 
 namespace tgnews {
@@ -161,65 +206,41 @@ void CalculatedResponses::dump(const std::string& path) {
 }
 
 CalculatedResponses::CalculatedResponses(
-    const std::vector<tgnews::ParsedDoc>& docs,
-    const std::vector<Cluster>& clustering) {
-  LangAns = CalcLangAns(docs);
-  NewsAns = CalcNewsAns(docs);
-  CategoryAns = CalcCategoryAns(docs);
-  ThreadsAns = CalcThreadsAns(clustering);
-  uint64_t now = 0;
-  if (clustering.size()) {
-    now = std::max_element(clustering.begin(), clustering.end(),
-                           [](const auto& l, const auto& r) {
-                             return l.GetTime() < r.GetTime();
-                           })
-              ->GetTime();
-  size_t durIdx = 0;
-  for (const auto& duration : Discretization) {
-    using WeightWithIdx = std::pair<float, size_t>;
-    std::array<std::array<std::vector<WeightWithIdx>, ELang::LangCount>,
-               ENewsCategory::NC_COUNT>
-        weights;
-    for (size_t clusterIdx = 0; clusterIdx < clustering.size(); ++clusterIdx) {
-      const auto& c = clustering[clusterIdx];
-      if (c.GetTime() + 3 * duration < now) {
-        continue;  // cause clusters sorted (by freshness)
-      }
-      size_t catIdx = static_cast<size_t>(c.GetCategory());
-      size_t langIdx = static_cast<size_t>(c.GetEnumLang());
-      float clusterWeight = c.Weight();
-      if (c.GetTime() + duration >= now) {
-        clusterWeight *= 2;
-      }
-      weights[catIdx][langIdx].push_back({clusterWeight, clusterIdx});
-      weights[static_cast<size_t>(NC_ANY)][langIdx].push_back(
-          {clusterWeight, clusterIdx});
-    }
-    for (size_t catIdx = 0; catIdx < NC_COUNT; catIdx++) {
-      for (size_t langIdx = 0; langIdx < LangCount; ++langIdx) {
-        auto& vec = weights[catIdx][langIdx];
-        std::sort(vec.begin(), vec.end(), std::greater<WeightWithIdx>());
-        nlohmann::json threads = nlohmann::json::array();
-        for (const auto& it : vec) {
-          nlohmann::json thread;
-          thread["title"] = clustering[it.second].GetTitle();
-          thread["category"] = CategoryNames.at(static_cast<size_t>(clustering[it.second].GetCategory()));
-          nlohmann::json articles = nlohmann::json::array();
-          for (const auto& d : clustering[it.second].GetDocs()) {
-            articles.push_back(d.FileName);
-          }
-          thread["articles"] = std::move(articles);
-          threads.push_back(thread);
-        }
-        nlohmann::json ans = { {"threads",  threads} };
-        Answers[durIdx][catIdx][langIdx] = std::move(ans);
-      }
-    }
-    ++durIdx;
+    const std::vector<tgnews::ParsedDocPtr>& docs,
+    const std::vector<Cluster>& clustering,
+    std::experimental::thread_pool* pool) {
+  if (clustering.empty()) {
+    std::cerr << "empty clustering somehow";
   }
-  } else {
-    std::cerr << "empty clustering somehow"; 
+  uint64_t now = 0;
+  for (const auto& c : clustering) {
+    now = std::max(now, c.GetTime());
   }
+  // Answers of different kinds, and of different languages and periods, do
+  // not depend on each other.
+  constexpr size_t plainAnswers = 4;
+  const size_t periodAnswers =
+      clustering.empty() ? 0 : DiscretizationSize * LangCount;
+  ParallelFor(pool, plainAnswers + periodAnswers, [&](size_t task) {
+    switch (task) {
+      case 0:
+        LangAns = CalcLangAns(docs);
+        return;
+      case 1:
+        NewsAns = CalcNewsAns(docs);
+        return;
+      case 2:
+        CategoryAns = CalcCategoryAns(docs);
+        return;
+      case 3:
+        ThreadsAns = CalcThreadsAns(clustering);
+        return;
+    }
+    size_t durIdx = (task - plainAnswers) / LangCount;
+    size_t langIdx = (task - plainAnswers) % LangCount;
+    CalcPeriodAns(clustering, now, durIdx, static_cast<ELang>(langIdx),
+                  Answers[durIdx]);
+  });
 }
 
 nlohmann::json CalculatedResponses::GetAns(const std::string& lang,
@@ -256,62 +277,53 @@ nlohmann::json CalculatedResponses::GetAns(const std::string& lang,
 }
 
 
-ResponseBuilder::ResponseBuilder(tgnews::Context* context)
-    : Context(context) {}
+ResponseBuilder::ResponseBuilder(std::experimental::thread_pool* pool) {
+  Options.Pool = pool;
+}
 
-CalculatedResponses ResponseBuilder::AddDocuments(std::vector<ParsedDoc> docs) {
-  LOG(INFO) << docs.size() << " - docs size";
-  for (auto&& doc : docs) {
-    if (doc.State == ParsedDoc::EState::Added) {
-      Docs.push_back(std::move(doc));
-    } else if (doc.State == ParsedDoc::EState::Removed) {
-      size_t idx = std::distance(Docs.begin(), std::find_if(Docs.begin(), Docs.end(), [doc](const auto& d) { return d.FileName == doc.FileName;}));
-      if (idx != Docs.size()) {
-        std::swap(Docs[idx], Docs[Docs.size() - 1]);
-        Docs.pop_back();
+CalculatedResponses ResponseBuilder::AddDocuments(
+    const std::vector<DocumentChange>& changes) {
+  LOG(INFO) << changes.size() << " - changes size";
+  std::chrono::steady_clock::time_point begin =
+      std::chrono::steady_clock::now();
+  // Starting from nothing, everything is clustered at once below.
+  const bool fromScratch = Docs.empty();
+  for (const auto& change : changes) {
+    // A batch may be applied twice after a failure or on top of a full
+    // rebuild, so added documents replace the known ones.
+    if (change.State == ParsedDoc::EState::Removed) {
+      Docs.erase(change.FileName);
+    } else {
+      Docs[change.FileName] = change.Document;
+    }
+  }
+  std::vector<DocumentChange> expired;
+  auto it = std::max_element(Docs.begin(), Docs.end(), [](const auto& l, const auto& r) { return l.second->FetchTime < r.second->FetchTime; });
+  if (it != Docs.end()) {
+    uint64_t now = it->second->FetchTime;
+    for (auto doc = Docs.begin(); doc != Docs.end();) {
+      if (doc->second->ExpirationTime() < now) {
+        expired.push_back({ParsedDoc::EState::Removed, doc->first});
+        doc = Docs.erase(doc);
+      } else {
+        ++doc;
       }
-    } else if (doc.State == ParsedDoc::EState::Changed) {
-      size_t idx = std::distance(Docs.begin(), std::find_if(Docs.begin(), Docs.end(), [doc](const auto& d) { return d.FileName == doc.FileName;}));
-      Docs[idx] = doc;
     }
   }
-  auto it = std::max_element(Docs.begin(), Docs.end(), [](const auto& l, const auto& r) { return l.FetchTime < r.FetchTime; });
-  if (it != Docs.end()) { 
-    uint64_t now = it->FetchTime;
-    Docs.erase(std::remove_if(Docs.begin(), Docs.end(), [now](const auto& d) { return d.ExpirationTime() < now; }), Docs.end());
+  std::vector<tgnews::ParsedDocPtr> docs;
+  docs.reserve(Docs.size());
+  for (const auto& [name, doc] : Docs) {
+    docs.push_back(doc);
   }
-  {
-    std::chrono::steady_clock::time_point begin =
-        std::chrono::steady_clock::now();
-    for (auto& doc : Docs) {
-      doc.ParseLang(Context->LangDetect.get());
-      doc.Tokenize(*Context);
-      doc.DetectCategory(*Context);
-      doc.CalcWeight(*Context);
-    }
-    std::chrono::steady_clock::time_point end =
-        std::chrono::steady_clock::now();
-    LOG(INFO) << "Time difference categorization = "
-              << std::chrono::duration_cast<std::chrono::milliseconds>(end -
-                                                                       begin)
-                     .count()
-              << "[milli]";
+  // Every stage below runs the languages in parallel.
+  if (fromScratch) {
+    Clustering.Load(docs, Options.Pool);
+  } else {
+    Clustering.Apply(changes, Options.Pool);
+    Clustering.Apply(expired, Options.Pool);
   }
-  auto ruEmbedder =
-      Embedder(Context->RuCatModel.get(), Context->RuMatrix, Context->RuBias);
-  auto enEmbedder =
-      Embedder(Context->EnCatModel.get(), Context->EnMatrix, Context->EnBias);
   {
-    std::chrono::steady_clock::time_point begin =
-        std::chrono::steady_clock::now();
-    for (auto& doc : Docs) {
-      if (doc.Lang.size() && doc.Lang == "ru") {
-        doc.Vector = ruEmbedder.GetEmbedding(doc);
-      } else if (doc.Lang.size() && doc.Lang == "en") {
-        doc.Vector = enEmbedder.GetEmbedding(doc);
-      }
-    }
-    std::vector<Cluster> clustering = RunClustering(Docs);
+    std::vector<Cluster> clustering = Clustering.GetClusters(Options.Pool);
     std::chrono::steady_clock::time_point end =
         std::chrono::steady_clock::now();
     LOG(INFO) << "Time difference clustering = "
@@ -319,8 +331,25 @@ CalculatedResponses ResponseBuilder::AddDocuments(std::vector<ParsedDoc> docs) {
                                                                        begin)
                      .count()
               << "[milli]";
-    return {Docs, clustering};
+    return {docs, clustering, Options.Pool};
+  }
+}
+
+CalculatedResponses ResponseBuilder::AddDocuments(
+    const std::vector<ParsedDocPtr>& docs) {
+  std::vector<DocumentChange> changes;
+  changes.reserve(docs.size());
+  for (const auto& doc : docs) {
+    changes.push_back({ParsedDoc::EState::Added, doc->FileName, doc});
   }
+  return AddDocuments(changes);
+}
+
+CalculatedResponses ResponseBuilder::Rebuild(
+    const std::vector<ParsedDocPtr>& docs) {
+  Docs.clear();
+  Clustering.Clear();
+  return AddDocuments(docs);
 }
 
 }  // namespace tgnews
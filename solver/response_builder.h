@@ -1,6 +1,7 @@
 #pragma once
 #include "base/parsed_document.h"
 #include "cluster.h"
+#include "incremental_clustering.h"
 
 #include "base/context.h"
 
@@ -14,7 +15,8 @@ constexpr size_t DiscretizationSize = 12;
 class CalculatedResponses {
  public:
   CalculatedResponses(const std::string& path);
-  CalculatedResponses(const std::vector<tgnews::ParsedDoc>& docs, const std::vector<Cluster>& clustering);
+  // Builds the answers on pool threads too.
+  CalculatedResponses(const std::vector<tgnews::ParsedDocPtr>& docs, const std::vector<Cluster>& clustering, std::experimental::thread_pool* pool = nullptr);
   nlohmann::json GetAns(const std::string& lang = {}, const std::string& category = {}, const uint64_t period = 0);
  public:
   void dump(const std::string& path);
@@ -28,12 +30,19 @@ class CalculatedResponses {
 
 class ResponseBuilder {
  public:
-  ResponseBuilder(tgnews::Context* context);
-  CalculatedResponses AddDocuments(std::vector<ParsedDoc> docs);
+  // The pool runs the languages in parallel and speeds up clustering from
+  // scratch, done on the first batch and on rebuilds.
+  explicit ResponseBuilder(std::experimental::thread_pool* pool = nullptr);
+  CalculatedResponses AddDocuments(const std::vector<DocumentChange>& changes);
+  CalculatedResponses AddDocuments(const std::vector<ParsedDocPtr>& docs);
+  // Forgets the documents added before.
+  CalculatedResponses Rebuild(const std::vector<ParsedDocPtr>& docs);
 
  private:
-  std::vector<tgnews::ParsedDoc> Docs;
-  tgnews::Context* Context;
+  std::unordered_map<std::string, tgnews::ParsedDocPtr> Docs;
+  // Follows Docs change by change instead of clustering all of them again.
+  IncrementalClustering Clustering;
+  ClusteringOptions Options;
 };
 
 }
@@ -0,0 +1,132 @@
+#include <iostream>
+
+#include "base/context.h"
+#include "base/embedder.h"
+#include "base/fasttext_classifier.h"
+#include "base/parsed_document.h"
+#include "base/quantized_classifier.h"
+#include "base/text_stream.h"
+#include "fmt/format.h"
+#include "test/benchmark/benchmark.h"
+
+namespace tgnews {
+
+namespace {
+
+void MeasureLang(std::string_view lang, const std::vector<ParsedDoc>& docs,
+                 const fasttext::FastText& model,
+                 const std::string& model_file) {
+  std::cout << fmt::format("{}: {} documents", lang, docs.size())
+            << std::endl;
+  if (docs.empty()) {
+    return;
+  }
+  auto head = QuantizedClassifier::Load(model_file);
+  if (!head) {
+    std::cout << "the model is not supported by the int8 head" << std::endl;
+    return;
+  }
+  std::vector<std::vector<std::string_view>> texts(docs.size());
+  for (size_t i = 0; i < docs.size(); i++) {
+    docs[i].GetTokens(texts[i]);
+  }
+  auto label_id = [](std::string_view name) { return CategoryFromName(name); };
+  FastTextClassifier reference(&model, label_id);
+  FastTextClassifier quantized(&model, label_id,
+                               QuantizedClassifier::Load(model_file));
+
+  std::vector<int> expected(texts.size());
+  std::vector<int> labels(texts.size());
+  for (auto [name, classifier, output] :
+       {std::make_tuple("fasttext", &reference, &expected),
+        std::make_tuple("int8", &quantized, &labels)}) {
+    Stopwatch stopwatch;
+    for (int i = 0; i < FLAGS_iterations; i++) {
+      for (size_t j = 0; j < texts.size(); j++) {
+        auto prediction = classifier->Predict(texts[j], 0.f);
+        (*output)[j] = prediction ? prediction->label : NC_UNDEFINED;
+      }
+    }
+    double seconds = stopwatch.ElapsedSeconds();
+    std::cout << fmt::format("{:>10}: {:.0f} docs/s", name,
+                             texts.size() * FLAGS_iterations / seconds)
+              << std::endl;
+  }
+  {
+    // Batches of the size documents are annotated in on restore.
+    std::vector<std::optional<FastTextClassifier::Prediction>> predictions;
+    Stopwatch stopwatch;
+    for (int i = 0; i < FLAGS_iterations; i++) {
+      for (size_t begin = 0; begin < texts.size();
+           begin += Embedder::BatchSize) {
+        size_t end = std::min(texts.size(), begin + Embedder::BatchSize);
+        quantized.Predict({texts.begin() + begin, texts.begin() + end}, 0.f,
+                          predictions);
+      }
+    }
+    double seconds = stopwatch.ElapsedSeconds();
+    std::cout << fmt::format("{:>10}: {:.0f} docs/s", "batched",
+                             texts.size() * FLAGS_iterations / seconds)
+              << std::endl;
+  }
+  size_t same = 0;
+  for (size_t i = 0; i < texts.size(); i++) {
+    same += expected[i] == labels[i];
+  }
+  std::cout << fmt::format("same top label: {} of {} ({:.2f}%)", same,
+                           texts.size(), 100.0 * same / texts.size())
+            << std::endl;
+
+  // The head alone, words already read.
+  std::vector<std::vector<int32_t>> words(texts.size());
+  std::vector<int32_t> unused;
+  for (size_t i = 0; i < texts.size(); i++) {
+    JoinedTextBuf buffer(texts[i]);
+    std::istream stream(&buffer);
+    model.getDictionary()->getLine(stream, words[i], unused);
+  }
+  for (auto kernel : {Int8Kernel::Scalar, Int8Kernel::Avx2, Int8Kernel::Vnni}) {
+    if (kernel > DetectInt8Kernel()) {
+      continue;
+    }
+    Stopwatch stopwatch;
+    for (int i = 0; i < FLAGS_iterations; i++) {
+      for (const auto& ids : words) {
+        head->Predict(ids, 0.f, kernel);
+      }
+    }
+    double seconds = stopwatch.ElapsedSeconds();
+    std::cout << fmt::format("{:>10}: {:.0f} docs/s without reading words",
+                             GetInt8KernelName(kernel),
+                             words.size() * FLAGS_iterations / seconds)
+              << std::endl;
+  }
+}
+
+}  // namespace
+
+void RunCategoryHeadBenchmark() {
+  Context context(FLAGS_model_path, nullptr);
+  auto files = ReadHtmlFiles(FLAGS_content_path, FLAGS_docs_count);
+
+  std::vector<ParsedDoc> ru_docs;
+  std::vector<ParsedDoc> en_docs;
+  for (const auto& file : files) {
+    try {
+      ParsedDoc doc(&context, file.name, file.content, 0);
+      if (doc.Lang == LangRu) {
+        ru_docs.push_back(std::move(doc));
+      } else if (doc.Lang == LangEn) {
+        en_docs.push_back(std::move(doc));
+      }
+    } catch (const std::exception&) {
+    }
+  }
+
+  MeasureLang("ru", ru_docs, *context.RuCatModel,
+              FLAGS_model_path + "/ru_cat_v2.ftz");
+  MeasureLang("en", en_docs, *context.EnCatModel,
+              FLAGS_model_path + "/en_cat_v2.ftz");
+}
+
+}  // namespace tgnews
@@ -0,0 +1,116 @@
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "fmt/format.h"
+#include "solver/cluster.h"
+#include "solver/incremental_clustering.h"
+#include "test/benchmark/benchmark.h"
+
+DEFINE_int32(clustering_max_docs, 64000,
+             "largest corpus, sizes double from 1000 up to it");
+DEFINE_int32(clustering_exact_max_docs, 16000,
+             "largest corpus clustered by comparing every pair too");
+DEFINE_int32(clustering_batch, 100,
+             "changes between two rebuilds, half of them removals");
+
+namespace tgnews {
+
+namespace {
+
+// Synthetic embeddings: stories of a few documents each plus unrelated
+// ones, the way a day of news clusters.
+class Corpus {
+ public:
+  Corpus() : random_(42) {}
+
+  ParsedDocPtr Next() {
+    std::normal_distribution<float> normal;
+    if (centers_.empty() || random_() % 4 == 0) {
+      Embedding center;
+      for (auto& value : center) {
+        value = normal(random_);
+      }
+      centers_.push_back(center);
+    }
+    auto doc = std::make_shared<ParsedDoc>();
+    doc->FileName = std::to_string(next_name_++);
+    doc->Lang = random_() % 2 ? LangRu : LangEn;
+    doc->Category = NC_SOCIETY;
+    doc->Weight = 1.f;
+    doc->FetchTime = 1588000000 + next_name_;
+    doc->Vector = centers_[random_() % centers_.size()];
+    for (auto& value : doc->Vector) {
+      value += 0.05f * normal(random_);
+    }
+    return doc;
+  }
+
+ private:
+  std::mt19937 random_;
+  std::vector<Embedding> centers_;
+  size_t next_name_ = 0;
+};
+
+}  // namespace
+
+void RunClusteringBenchmark() {
+  const auto max_docs = static_cast<size_t>(FLAGS_clustering_max_docs);
+  for (size_t count = 1000; count <= max_docs; count *= 2) {
+    Corpus corpus;
+    std::vector<ParsedDocPtr> docs;
+    IncrementalClustering clustering;
+    for (size_t i = 0; i < count; i++) {
+      docs.push_back(corpus.Next());
+      clustering.Update(docs.back());
+    }
+
+    const bool exact =
+        count <= static_cast<size_t>(FLAGS_clustering_exact_max_docs);
+    ClusteringOptions exact_options;
+    exact_options.Exact = true;
+    double exact_seconds = 0;
+    double batch_seconds = 0;
+    double incremental_seconds = 0;
+    size_t clusters = 0;
+    for (int iteration = 0; iteration < FLAGS_iterations; iteration++) {
+      std::vector<ParsedDocPtr> added;
+      for (int i = 0; i < FLAGS_clustering_batch / 2; i++) {
+        added.push_back(corpus.Next());
+      }
+
+      Stopwatch incremental;
+      for (size_t i = 0; i < added.size(); i++) {
+        clustering.Remove(docs[i]->FileName);
+        clustering.Update(added[i]);
+      }
+      clusters = clustering.GetClusters().size();
+      incremental_seconds += incremental.ElapsedSeconds();
+
+      docs.erase(docs.begin(), docs.begin() + added.size());
+      docs.insert(docs.end(), added.begin(), added.end());
+      Stopwatch batch;
+      RunClustering(docs);
+      batch_seconds += batch.ElapsedSeconds();
+
+      if (exact) {
+        Stopwatch exact_batch;
+        RunClustering(docs, exact_options);
+        exact_seconds += exact_batch.ElapsedSeconds();
+      }
+    }
+    std::cout << fmt::format(
+                     "{:>6} docs: exact {}, hnsw {:.1f} ms, incremental "
+                     "{:.2f} ms per {} changes, {} clusters",
+                     count,
+                     exact ? fmt::format("{:.1f} ms",
+                                         exact_seconds * 1e3 / FLAGS_iterations)
+                           : std::string("skipped"),
+                     batch_seconds * 1e3 / FLAGS_iterations,
+                     incremental_seconds * 1e3 / FLAGS_iterations,
+                     FLAGS_clustering_batch, clusters)
+              << std::endl;
+  }
+}
+
+}  // namespace tgnews
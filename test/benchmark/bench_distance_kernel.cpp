@@ -0,0 +1,88 @@
+#include <iostream>
+#include <random>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "fmt/format.h"
+#include "solver/cluster.h"
+#include "solver/distance.h"
+#include "solver/distance_kernel.h"
+#include "test/benchmark/benchmark.h"
+
+DEFINE_string(distance_kernel_docs, "10000,50000,100000",
+              "comma separated corpus sizes");
+DEFINE_int32(distance_kernel_threads, 0,
+             "pool threads helping the caller, 0 for one per core");
+
+namespace tgnews {
+
+namespace {
+
+// Stories of about four documents each, as in the clustering benchmark.
+std::vector<Embedding> MakePoints(size_t count) {
+  std::mt19937 random(42);
+  std::normal_distribution<float> normal;
+  std::vector<Embedding> centers;
+  std::vector<Embedding> points(count);
+  for (auto& point : points) {
+    if (centers.empty() || random() % 4 == 0) {
+      Embedding center;
+      for (auto& value : center) {
+        value = normal(random);
+      }
+      centers.push_back(center);
+    }
+    point = centers[random() % centers.size()];
+    for (auto& value : point) {
+      value += 0.05f * normal(random);
+    }
+    point = Normalize(point);
+  }
+  return points;
+}
+
+}  // namespace
+
+void RunDistanceKernelBenchmark() {
+  size_t threads = FLAGS_distance_kernel_threads > 0
+                       ? FLAGS_distance_kernel_threads
+                       : std::thread::hardware_concurrency();
+  std::experimental::thread_pool pool(threads);
+  std::cout << fmt::format("{} threads, best kernel {}", threads,
+                           GetDistanceKernelName(DetectDistanceKernel()))
+            << std::endl;
+
+  std::istringstream sizes(FLAGS_distance_kernel_docs);
+  for (std::string size; std::getline(sizes, size, ',');) {
+    auto points = MakePoints(std::stoul(size));
+    const double pairs = 0.5 * points.size() * points.size();
+    for (auto kernel : {DistanceKernel::Scalar, DistanceKernel::Avx2,
+                        DistanceKernel::Avx512}) {
+      if (kernel > DetectDistanceKernel()) {
+        continue;
+      }
+      double seconds = 0;
+      size_t clusters = 0;
+      for (int iteration = 0; iteration < FLAGS_iterations; iteration++) {
+        Stopwatch stopwatch;
+        auto labels =
+            LinkWithinThreshold(points, RuDistanceThreshold, &pool, kernel);
+        seconds += stopwatch.ElapsedSeconds();
+        clusters = std::set<size_t>(labels.begin(), labels.end()).size();
+      }
+      seconds /= FLAGS_iterations;
+      std::cout << fmt::format(
+                       "{:>7} docs, {:>6}: {:.1f} ms, {:.0f} M pairs/s, {} "
+                       "clusters",
+                       points.size(), GetDistanceKernelName(kernel),
+                       seconds * 1e3, pairs / seconds / 1e6, clusters)
+                << std::endl;
+    }
+  }
+  pool.stop();
+  pool.join();
+}
+
+}  // namespace tgnews
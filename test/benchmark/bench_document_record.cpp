@@ -0,0 +1,70 @@
+#include <iostream>
+
+#include "base/context.h"
+#include "base/document_record.h"
+#include "base/parsed_document.h"
+#include "fmt/format.h"
+#include "test/benchmark/benchmark.h"
+
+DEFINE_int32(restore_docs_count, 1'000'000,
+             "documents a restore is extrapolated to, about a week of news");
+
+namespace tgnews {
+
+namespace {
+
+template <typename Restore>
+void Measure(std::string_view name, const std::vector<std::string>& dumps,
+             Restore&& restore) {
+  size_t bytes = 0;
+  for (const auto& dump : dumps) {
+    bytes += dump.size();
+  }
+  Stopwatch stopwatch;
+  for (int i = 0; i < FLAGS_iterations; i++) {
+    for (const auto& dump : dumps) {
+      restore(dump);
+    }
+  }
+  double seconds = stopwatch.ElapsedSeconds();
+  double rate = static_cast<double>(dumps.size()) * FLAGS_iterations / seconds;
+  std::cout << fmt::format(
+                   "{:>6}: {:.0f} docs/s, {:.0f} bytes/doc, {:.1f} s for {} "
+                   "docs",
+                   name, rate, static_cast<double>(bytes) / dumps.size(),
+                   FLAGS_restore_docs_count / rate, FLAGS_restore_docs_count)
+            << std::endl;
+}
+
+}  // namespace
+
+void RunDocumentRecordBenchmark() {
+  Context context(FLAGS_model_path, nullptr);
+  auto files = ReadHtmlFiles(FLAGS_content_path, FLAGS_docs_count);
+
+  std::vector<std::string> json_dumps;
+  std::vector<std::string> records;
+  for (const auto& file : files) {
+    try {
+      ParsedDoc doc(&context, file.name, file.content, 0);
+      json_dumps.push_back(doc.Serialize().dump());
+      records.push_back(SerializeDocumentRecord(doc));
+    } catch (const std::exception&) {
+    }
+  }
+  std::cout << fmt::format("documents: {}", records.size()) << std::endl;
+  if (records.empty()) {
+    return;
+  }
+
+  // Json dumps lack the embedding and have to go through annotation again.
+  Measure("json", json_dumps, [&](const std::string& dump) {
+    ParsedDoc doc(nlohmann::json::parse(dump));
+    doc.Annotate(context);
+  });
+  Measure("binary", records, [](const std::string& record) {
+    ParsedDoc doc{DocumentRecordView(record)};
+  });
+}
+
+}  // namespace tgnews
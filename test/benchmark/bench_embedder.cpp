@@ -0,0 +1,86 @@
+#include <iostream>
+
+#include "base/context.h"
+#include "base/embedder.h"
+#include "base/parsed_document.h"
+#include "base/word_vectors.h"
+#include "fmt/format.h"
+#include "test/benchmark/benchmark.h"
+
+namespace tgnews {
+
+namespace {
+
+template <typename Embed>
+void Measure(std::string_view name, const std::vector<ParsedDoc>& docs,
+             Embed&& embed) {
+  Stopwatch stopwatch;
+  for (int i = 0; i < FLAGS_iterations; i++) {
+    embed();
+  }
+  double seconds = stopwatch.ElapsedSeconds();
+  std::cout << fmt::format("{:>15}: {:.1f} us/doc", name,
+                           seconds * 1e6 / (docs.size() * FLAGS_iterations))
+            << std::endl;
+}
+
+void MeasureLang(std::string_view lang, std::vector<ParsedDoc>& docs,
+                 const fasttext::FastText& model, const WordVectors& words,
+                 const Eigen::MatrixXf& matrix, const Eigen::VectorXf& bias) {
+  std::cout << fmt::format("{}: {} documents", lang, docs.size())
+            << std::endl;
+  if (docs.empty()) {
+    return;
+  }
+  // Every token goes through the subword ngrams, as before the tables.
+  const WordVectors uncached(&model, 0, 0);
+  std::vector<ParsedDoc*> batch;
+  for (auto& doc : docs) {
+    batch.push_back(&doc);
+  }
+  for (const WordVectors* vectors : {&uncached, &words}) {
+    Embedder embedder(*vectors, matrix, bias);
+    auto suffix = vectors == &words ? "table" : "subwords";
+    Measure(fmt::format("{}/single", suffix), docs, [&] {
+      std::vector<std::string_view> tokens;
+      for (const auto& doc : docs) {
+        doc.GetTokens(tokens);
+        embedder.GetEmbedding(tokens);
+      }
+    });
+    Measure(fmt::format("{}/batch", suffix), docs,
+            [&] { embedder.SetEmbeddings(batch); });
+  }
+}
+
+}  // namespace
+
+void RunEmbedderBenchmark() {
+  Stopwatch loading;
+  Context context(FLAGS_model_path, nullptr);
+  std::cout << fmt::format("context loaded in {:.1f} s",
+                           loading.ElapsedSeconds())
+            << std::endl;
+  auto files = ReadHtmlFiles(FLAGS_content_path, FLAGS_docs_count);
+
+  std::vector<ParsedDoc> ru_docs;
+  std::vector<ParsedDoc> en_docs;
+  for (const auto& file : files) {
+    try {
+      ParsedDoc doc(&context, file.name, file.content, 0);
+      if (doc.Lang == LangRu) {
+        ru_docs.push_back(std::move(doc));
+      } else if (doc.Lang == LangEn) {
+        en_docs.push_back(std::move(doc));
+      }
+    } catch (const std::exception&) {
+    }
+  }
+
+  MeasureLang("ru", ru_docs, *context.RuCatModel, *context.RuWords,
+              context.RuMatrix, context.RuBias);
+  MeasureLang("en", en_docs, *context.EnCatModel, *context.EnWords,
+              context.EnMatrix, context.EnBias);
+}
+
+}  // namespace tgnews
@@ -0,0 +1,98 @@
+#include <iostream>
+
+#include "base/html_extractor.h"
+#include "base/parsed_document.h"
+#include "fmt/format.h"
+#include "test/benchmark/benchmark.h"
+
+namespace tgnews {
+
+namespace {
+
+struct Extracted {
+  bool ok = false;
+  bool has_address = false;
+  ParsedDoc doc;
+};
+
+bool SameFields(const Extracted& lhs, const Extracted& rhs) {
+  if (lhs.ok != rhs.ok) {
+    return false;
+  }
+  if (!lhs.ok) {
+    return true;
+  }
+  return lhs.has_address == rhs.has_address && lhs.doc.Title == rhs.doc.Title &&
+         lhs.doc.Url == rhs.doc.Url && lhs.doc.SiteId == rhs.doc.SiteId &&
+         lhs.doc.Description == rhs.doc.Description &&
+         lhs.doc.Text == rhs.doc.Text && lhs.doc.Author == rhs.doc.Author &&
+         lhs.doc.FetchTime == rhs.doc.FetchTime &&
+         lhs.doc.PubTime == rhs.doc.PubTime;
+}
+
+template <typename Extract>
+Extracted Run(Extract&& extract) {
+  Extracted result;
+  try {
+    result.has_address = extract(result.doc);
+    result.ok = true;
+  } catch (const std::exception&) {
+  }
+  return result;
+}
+
+template <typename Extract>
+void Measure(std::string_view name, const std::vector<HtmlFile>& files,
+             size_t bytes, Extract&& extract) {
+  Stopwatch stopwatch;
+  for (int i = 0; i < FLAGS_iterations; i++) {
+    for (const auto& file : files) {
+      Run([&](ParsedDoc& doc) { return extract(file.content, doc); });
+    }
+  }
+  double seconds = stopwatch.ElapsedSeconds();
+  double docs = static_cast<double>(files.size()) * FLAGS_iterations;
+  std::cout << fmt::format("{:>10}: {:.0f} docs/s, {:.1f} MB/s", name,
+                           docs / seconds,
+                           bytes * FLAGS_iterations / seconds / (1 << 20))
+            << std::endl;
+}
+
+}  // namespace
+
+void RunHtmlExtractorBenchmark() {
+  auto files = ReadHtmlFiles(FLAGS_content_path, FLAGS_docs_count);
+  size_t bytes = 0;
+  for (const auto& file : files) {
+    bytes += file.content.size();
+  }
+  std::cout << fmt::format("documents: {}, total size: {:.1f} MB",
+                           files.size(), bytes / double(1 << 20))
+            << std::endl;
+
+  HtmlExtractor extractor;
+  size_t mismatches = 0;
+  for (const auto& file : files) {
+    auto streaming = Run([&](ParsedDoc& doc) {
+      return extractor.Extract(file.content, doc);
+    });
+    auto dom =
+        Run([&](ParsedDoc& doc) { return ExtractWithDom(file.content, doc); });
+    if (!SameFields(streaming, dom)) {
+      if (mismatches++ < 10) {
+        std::cout << "mismatch: " << file.name << std::endl;
+      }
+    }
+  }
+  std::cout << fmt::format("mismatches: {}", mismatches) << std::endl;
+
+  Measure("tinyxml2", files, bytes, [](const std::string& html, ParsedDoc& doc) {
+    return ExtractWithDom(html, doc);
+  });
+  Measure("streaming", files, bytes,
+          [&](const std::string& html, ParsedDoc& doc) {
+            return extractor.Extract(html, doc);
+          });
+}
+
+}  // namespace tgnews
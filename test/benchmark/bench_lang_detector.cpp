@@ -0,0 +1,89 @@
+#include <iostream>
+#include <map>
+#include <utility>
+
+#include "base/context.h"
+#include "base/fasttext_classifier.h"
+#include "base/lang_detector.h"
+#include "base/parsed_document.h"
+#include "fmt/format.h"
+#include "test/benchmark/benchmark.h"
+
+namespace tgnews {
+
+namespace {
+
+std::string_view LangName(ELang lang) {
+  return lang == LangUndefined ? "undefined" : LangCode(lang);
+}
+
+}  // namespace
+
+void RunLangDetectorBenchmark() {
+  Context context(FLAGS_model_path, nullptr);
+  auto files = ReadHtmlFiles(FLAGS_content_path, FLAGS_docs_count);
+
+  std::vector<ParsedDoc> docs;
+  for (const auto& file : files) {
+    try {
+      docs.emplace_back(&context, file.name, file.content, 0);
+    } catch (const std::exception&) {
+    }
+  }
+  std::cout << fmt::format("{} documents", docs.size()) << std::endl;
+  if (docs.empty()) {
+    return;
+  }
+
+  std::vector<std::vector<std::string_view>> samples;
+  for (const auto& doc : docs) {
+    samples.push_back({doc.Title, doc.Description,
+                       std::string_view(doc.Text).substr(0, 100)});
+  }
+
+  // A pass with fresh counters: where the letters decide and how often
+  // fastText alone says the same, by the language of each.
+  CascadeLangDetector detector(context.LangClassifier.get());
+  std::map<std::pair<ELang, ELang>, size_t> outcomes;
+  size_t same = 0;
+  for (const auto& sample : samples) {
+    ELang expected = detector.DetectByModel(sample);
+    ELang lang = detector.Detect(sample);
+    outcomes[{expected, lang}]++;
+    same += lang == expected;
+  }
+  auto stats = detector.GetStats();
+  std::cout << fmt::format(
+                   "decided by letters: ru {}, en {}, tg {}; by fasttext {} "
+                   "({:.2f}%)",
+                   stats.script_ru, stats.script_en, stats.script_tg,
+                   stats.fasttext, 100.0 * stats.fasttext / samples.size())
+            << std::endl;
+  std::cout << fmt::format("parity with fasttext: {} of {} ({:.2f}%)", same,
+                           samples.size(), 100.0 * same / samples.size())
+            << std::endl;
+  for (const auto& [langs, count] : outcomes) {
+    if (langs.first != langs.second) {
+      std::cout << fmt::format("  fasttext {} -> cascade {}: {}",
+                               LangName(langs.first), LangName(langs.second),
+                               count)
+                << std::endl;
+    }
+  }
+
+  for (bool cascade : {false, true}) {
+    Stopwatch stopwatch;
+    for (int i = 0; i < FLAGS_iterations; i++) {
+      for (const auto& sample : samples) {
+        cascade ? detector.Detect(sample) : detector.DetectByModel(sample);
+      }
+    }
+    double seconds = stopwatch.ElapsedSeconds();
+    std::cout << fmt::format("{:>10}: {:.0f} docs/s",
+                             cascade ? "cascade" : "fasttext",
+                             samples.size() * FLAGS_iterations / seconds)
+              << std::endl;
+  }
+}
+
+}  // namespace tgnews
@@ -0,0 +1,141 @@
+#include <iostream>
+#include <limits>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "base/timing_wheel.h"
+#include "fmt/format.h"
+#include "test/benchmark/benchmark.h"
+
+DEFINE_int32(timers_count, 4000000, "documents to schedule for expiration");
+
+namespace tgnews {
+
+namespace {
+
+// Document stream of the server: fetch times mostly grow, max-age is one of
+// the usual cache policies or arbitrary, a fifth of documents is updated or
+// deleted before it expires.
+struct Operation {
+  uint64_t now;
+  uint64_t deadline;
+  bool cancel_previous;
+};
+
+std::vector<Operation> MakeOperations(size_t count) {
+  std::mt19937_64 mt(42);
+  const std::vector<uint64_t> max_ages = {300, 3600, 86400, 604800, 2592000};
+  std::vector<Operation> operations;
+  operations.reserve(count);
+  uint64_t now = 1588000000;
+  for (size_t i = 0; i < count; i++) {
+    now += mt() % 3 == 0;
+    uint64_t fetch_time = now - mt() % 3600;
+    uint64_t max_age = mt() % 4 == 0 ? mt() % 2592000
+                                     : max_ages[mt() % max_ages.size()];
+    operations.push_back({now, fetch_time + max_age, mt() % 5 == 0});
+  }
+  return operations;
+}
+
+template <typename Scheduler>
+void Measure(std::string_view name, const std::vector<Operation>& operations,
+             Scheduler&& scheduler) {
+  Stopwatch stopwatch;
+  size_t expired = 0;
+  for (size_t i = 0; i < operations.size(); i++) {
+    const auto& operation = operations[i];
+    scheduler.Insert(i, operation.deadline);
+    if (operation.cancel_previous && i > 0) {
+      scheduler.Cancel(i - 1);
+    }
+    // The server ticks once a second.
+    if (i % 1000 == 0) {
+      expired += scheduler.Advance(operation.now);
+    }
+  }
+  expired += scheduler.Advance(operations.back().now + 2592000 + 3600);
+  double seconds = stopwatch.ElapsedSeconds();
+  std::cout << fmt::format("{:>12}: {:.1f} ns/op, expired: {}", name,
+                           seconds * 1e9 / operations.size(), expired)
+            << std::endl;
+}
+
+class WheelScheduler {
+ public:
+  explicit WheelScheduler(size_t count) : handles_(count) {}
+
+  void Insert(size_t id, uint64_t deadline) {
+    handles_[id] = wheel_.Insert(deadline, id);
+  }
+
+  void Cancel(size_t id) {
+    if (handles_[id] != TimingWheel<size_t>::kInvalidHandle) {
+      wheel_.Cancel(handles_[id]);
+      handles_[id] = TimingWheel<size_t>::kInvalidHandle;
+    }
+  }
+
+  size_t Advance(uint64_t now) {
+    size_t expired = 0;
+    wheel_.Advance(now, [&](size_t id) {
+      handles_[id] = TimingWheel<size_t>::kInvalidHandle;
+      expired++;
+    });
+    return expired;
+  }
+
+ private:
+  TimingWheel<size_t> wheel_;
+  std::vector<TimingWheel<size_t>::Handle> handles_;
+};
+
+// What FileManager used before: an ordered set of (deadline, document).
+class SetScheduler {
+ public:
+  explicit SetScheduler(size_t count) : deadlines_(count, kNone) {}
+
+  void Insert(size_t id, uint64_t deadline) {
+    deadlines_[id] = deadline;
+    set_.emplace(deadline, id);
+  }
+
+  void Cancel(size_t id) {
+    if (deadlines_[id] != kNone) {
+      set_.erase({deadlines_[id], id});
+      deadlines_[id] = kNone;
+    }
+  }
+
+  size_t Advance(uint64_t now) {
+    size_t expired = 0;
+    while (!set_.empty() && set_.begin()->first <= now) {
+      deadlines_[set_.begin()->second] = kNone;
+      set_.erase(set_.begin());
+      expired++;
+    }
+    return expired;
+  }
+
+ private:
+  static constexpr uint64_t kNone = std::numeric_limits<uint64_t>::max();
+
+  std::set<std::pair<uint64_t, size_t>> set_;
+  std::vector<uint64_t> deadlines_;
+};
+
+}  // namespace
+
+void RunTimingWheelBenchmark() {
+  size_t count = FLAGS_timers_count;
+  auto operations = MakeOperations(count);
+  std::cout << fmt::format("documents: {}", count) << std::endl;
+
+  for (int i = 0; i < FLAGS_iterations; i++) {
+    Measure("std::set", operations, SetScheduler(count));
+    Measure("timing wheel", operations, WheelScheduler(count));
+  }
+}
+
+}  // namespace tgnews
@@ -0,0 +1,69 @@
+#include "test/benchmark/benchmark.h"
+
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <functional>
+#include <map>
+
+#include "fmt/format.h"
+#include "glog/logging.h"
+
+DEFINE_string(benchmark, "", "benchmark to run, empty to list them");
+DEFINE_string(content_path, "content", "directory with html documents");
+DEFINE_string(model_path, "models", "path to models");
+DEFINE_int32(docs_count, -1, "how much docs to read, -1 to read all");
+DEFINE_int32(iterations, 5, "passes over the data set");
+
+namespace tgnews {
+
+std::vector<HtmlFile> ReadHtmlFiles(const std::string& dir, int count) {
+  std::vector<HtmlFile> files;
+  boost::filesystem::recursive_directory_iterator end;
+  for (boost::filesystem::recursive_directory_iterator it(dir); it != end;
+       ++it) {
+    if (count != -1 && files.size() == static_cast<size_t>(count)) {
+      break;
+    }
+    if (boost::filesystem::is_directory(it->path()) ||
+        it->path().extension() != ".html") {
+      continue;
+    }
+    std::ifstream file(it->path().string());
+    files.push_back({it->path().filename().string(),
+                     std::string(std::istreambuf_iterator<char>(file), {})});
+  }
+  return files;
+}
+
+}  // namespace tgnews
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, false);
+
+  FLAGS_minloglevel = 1;
+  FLAGS_logtostderr = true;
+
+  google::InitGoogleLogging(argv[0]);
+
+  const std::map<std::string, std::function<void()>> benchmarks = {
+      {"html_extractor", tgnews::RunHtmlExtractorBenchmark},
+      {"timing_wheel", tgnews::RunTimingWheelBenchmark},
+      {"document_record", tgnews::RunDocumentRecordBenchmark},
+      {"clustering", tgnews::RunClusteringBenchmark},
+      {"distance_kernel", tgnews::RunDistanceKernelBenchmark},
+      {"embedder", tgnews::RunEmbedderBenchmark},
+      {"category_head", tgnews::RunCategoryHeadBenchmark},
+      {"lang_detector", tgnews::RunLangDetectorBenchmark},
+  };
+
+  auto it = benchmarks.find(FLAGS_benchmark);
+  if (it == benchmarks.end()) {
+    std::cout << "available benchmarks:" << std::endl;
+    for (const auto& [name, _] : benchmarks) {
+      std::cout << "  " << name << std::endl;
+    }
+    return FLAGS_benchmark.empty() ? 0 : 1;
+  }
+  it->second();
+  return 0;
+}
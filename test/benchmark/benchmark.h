@@ -0,0 +1,54 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "gflags/gflags.h"
+
+DECLARE_string(content_path);
+DECLARE_string(model_path);
+DECLARE_int32(docs_count);
+DECLARE_int32(iterations);
+
+namespace tgnews {
+
+struct HtmlFile {
+  std::string name;
+  std::string content;
+};
+
+// Reads up to `count` (-1 for all) html files found under `dir`.
+std::vector<HtmlFile> ReadHtmlFiles(const std::string& dir, int count);
+
+class Stopwatch {
+ public:
+  Stopwatch() : start_(std::chrono::steady_clock::now()) {}
+
+  double ElapsedSeconds() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start_)
+        .count();
+  }
+
+ private:
+  std::chrono::steady_clock::time_point start_;
+};
+
+void RunHtmlExtractorBenchmark();
+
+void RunTimingWheelBenchmark();
+
+void RunDocumentRecordBenchmark();
+
+void RunClusteringBenchmark();
+
+void RunDistanceKernelBenchmark();
+
+void RunEmbedderBenchmark();
+
+void RunCategoryHeadBenchmark();
+
+void RunLangDetectorBenchmark();
+
+}  // namespace tgnews
@@ -1,5 +1,8 @@
 #include "common.h"
 
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "test/common/constants.h"
@@ -95,6 +98,44 @@ std::vector<TestDocument> GenerateDocuments(std::mt19937& mt, size_t count,
   return documents;
 }
 
+std::vector<Embedding> GeneratePoints(std::mt19937& mt, size_t count,
+                                      size_t centers, float spread) {
+  std::normal_distribution<float> normal;
+  std::vector<Embedding> center_points(centers);
+  for (auto& center : center_points) {
+    for (auto& value : center) {
+      value = normal(mt);
+    }
+  }
+  std::vector<Embedding> points(count);
+  for (auto& point : points) {
+    point = center_points[mt() % centers];
+    for (auto& value : point) {
+      value += spread * normal(mt);
+    }
+    point = Normalize(point);
+  }
+  return points;
+}
+
+std::vector<TestDocument> ReadDocumentsFromDir(const std::string& dir,
+                                               std::chrono::seconds max_age) {
+  std::vector<TestDocument> documents;
+  boost::filesystem::recursive_directory_iterator end;
+  for (boost::filesystem::recursive_directory_iterator it(dir); it != end;
+       ++it) {
+    if (boost::filesystem::is_directory(it->path()) ||
+        it->path().extension() != ".html") {
+      continue;
+    }
+    boost::filesystem::ifstream file(it->path());
+    documents.emplace_back(it->path().filename().string(),
+                           std::string(std::istreambuf_iterator<char>(file), {}),
+                           max_age);
+  }
+  return documents;
+}
+
 std::vector<std::string> GetDocumentNames(
     const std::vector<TestDocument>& documents) {
   std::vector<std::string> document_names;
@@ -5,6 +5,7 @@
 
 #include "base/time_helpers.h"
 #include "server/server.h"
+#include "solver/distance.h"
 #include "third_party/simple_web_server/client_http.hpp"
 
 namespace tgnews {
@@ -46,6 +47,15 @@ TestDocument GenerateDocument(std::mt19937& mt,
 std::vector<TestDocument> GenerateDocuments(
     std::mt19937& mt, size_t count, std::chrono::seconds max_age = 1024s);
 
+// Normalized points around `centers` random centers, like embeddings of
+// news stories.
+std::vector<Embedding> GeneratePoints(std::mt19937& mt, size_t count,
+                                      size_t centers, float spread);
+
+// Reads html files under `dir` as they would be sent by a client.
+std::vector<TestDocument> ReadDocumentsFromDir(const std::string& dir,
+                                               std::chrono::seconds max_age);
+
 std::vector<std::string> GetDocumentNames(
     const std::vector<TestDocument>& documents);
 
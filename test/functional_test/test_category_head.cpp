@@ -0,0 +1,86 @@
+#include <boost/filesystem.hpp>
+#include <optional>
+#include <random>
+#include <sstream>
+
+#include "base/quantized_classifier.h"
+#include "gtest/gtest.h"
+#include "third_party/fastText/src/fasttext.h"
+
+using namespace tgnews;
+
+namespace {
+
+constexpr const char* kModelsPath = "models";
+constexpr size_t kTexts = 2000;
+
+// Words of the model's own dictionary, so that most of them are known.
+std::vector<std::string> MakeTexts(const fasttext::Dictionary& dictionary) {
+  std::mt19937 random(17);
+  std::vector<std::string> texts(kTexts);
+  for (auto& text : texts) {
+    const size_t words = 1 + random() % 60;
+    for (size_t i = 0; i < words; i++) {
+      text += dictionary.getWord(random() % dictionary.nwords());
+      text += ' ';
+    }
+  }
+  return texts;
+}
+
+}  // namespace
+
+TEST(CategoryHeadTest, MatchesFastTextTopLabel) {
+  size_t models = 0;
+  for (const char* file : {"ru_cat_v2.ftz", "en_cat_v2.ftz"}) {
+    const std::string path = std::string(kModelsPath) + "/" + file;
+    if (!boost::filesystem::exists(path)) {
+      continue;
+    }
+    models++;
+    fasttext::FastText model;
+    model.loadModel(path);
+    auto head = QuantizedClassifier::Load(path);
+    ASSERT_TRUE(head) << file;
+    auto dictionary = model.getDictionary();
+
+    size_t same = 0;
+    std::vector<std::vector<int32_t>> batch;
+    std::vector<std::optional<QuantizedClassifier::Prediction>> single;
+    for (const auto& text : MakeTexts(*dictionary)) {
+      std::vector<std::pair<fasttext::real, std::string>> expected;
+      std::istringstream line(text);
+      ASSERT_TRUE(model.predictLine(line, expected, 2, 0.f));
+      ASSERT_FALSE(expected.empty());
+
+      std::vector<int32_t> words;
+      std::vector<int32_t> labels;
+      std::istringstream stream(text);
+      dictionary->getLine(stream, words, labels);
+      auto prediction = head->Predict(words, 0.f);
+      ASSERT_TRUE(prediction);
+      batch.push_back(words);
+      single.push_back(prediction);
+      const std::string label = dictionary->getLabel(prediction->label);
+      same += label == expected[0].second;
+      // Only a near tie may go the other way.
+      if (expected.size() == 1 ||
+          expected[0].first - expected[1].first > 0.01) {
+        EXPECT_EQ(label, expected[0].second) << file << ": " << text;
+        EXPECT_NEAR(prediction->probability, expected[0].first, 0.01);
+      }
+    }
+    EXPECT_GE(same, kTexts * 995 / 1000) << file;
+
+    // A batch gets the same answers.
+    std::vector<std::optional<QuantizedClassifier::Prediction>> predictions;
+    head->Predict(batch, 0.f, predictions);
+    ASSERT_EQ(predictions.size(), single.size());
+    for (size_t i = 0; i < single.size(); i++) {
+      ASSERT_TRUE(predictions[i]);
+      EXPECT_EQ(predictions[i]->label, single[i]->label);
+      EXPECT_EQ(predictions[i]->probability, single[i]->probability);
+    }
+  }
+  EXPECT_GT(models, 0u);
+}
@@ -1,5 +1,7 @@
+#include <map>
 #include <random>
 
+#include "base/model_registry.h"
 #include "base/time_helpers.h"
 #include "gtest/gtest.h"
 #include "server/server.h"
@@ -16,11 +18,33 @@ constexpr size_t kPort = 12345;
 constexpr const char* kContentDir = "test_content";
 constexpr const char* kModelsPath = "models";
 
+nlohmann::json GetJson(SimpleWeb::Client<SimpleWeb::HTTP>& client,
+                       const std::string& path) {
+  auto response = client.request("GET", path, /*content =*/"");
+  EXPECT_EQ(response->status_code, "200 OK");
+  return nlohmann::json::parse(response->content.string());
+}
+
+// Answers of GET /_documents/<name> by name.
+std::map<std::string, nlohmann::json> GetDocumentAnswers(
+    SimpleWeb::Client<SimpleWeb::HTTP>& client,
+    const std::vector<TestDocument>& documents) {
+  std::map<std::string, nlohmann::json> answers;
+  for (const auto& document : documents) {
+    answers[document.name] = GetJson(client, "/_documents/" + document.name);
+  }
+  return answers;
+}
+
 }  // namespace
 
 class ServerTest : public Test {
  public:
-  ServerTest() : mt(rd()) {
+  // Only a server with a response builder reads the change stream.
+  explicit ServerTest(
+      size_t change_stream_capacity = ChangeStream::kDefaultCapacity,
+      bool build_responses = false)
+      : mt(rd()) {
     FLAGS_minloglevel = 1;
 
     boost::filesystem::path content_path = kContentDir;
@@ -30,9 +54,18 @@ class ServerTest : public Test {
     }
     LOG_IF(FATAL, !boost::filesystem::create_directory(content_path))
         << "unable to create content dir: " << kContentDir;
-    Context* context = new Context(kModelsPath, nullptr); 
+    models_ = std::make_unique<ModelRegistry>(
+        [] { return std::make_unique<Context>(kModelsPath, nullptr); });
+    if (build_responses) {
+      response_builder_ = std::make_unique<ResponseBuilder>(&pool_);
+    }
     server = std::make_unique<Server>(
-        kPort, std::make_unique<FileManager>(pool_, context, kContentDir), pool_);
+        kPort,
+        std::make_unique<FileManager>(
+            pool_, models_.get(), kContentDir, FileManager::kDefaultShardCount,
+            SegmentLog::Options{}, FileManager::kDefaultColdFieldsBudget,
+            change_stream_capacity),
+        pool_, response_builder_.get());
 
     server_thread_ = std::make_unique<std::thread>([&]() { server->Run(); });
 
@@ -64,6 +97,8 @@ class ServerTest : public Test {
 
  private:
   std::experimental::thread_pool pool_{4};
+  std::unique_ptr<ModelRegistry> models_;
+  std::unique_ptr<ResponseBuilder> response_builder_;
   std::unique_ptr<std::thread> server_thread_;
 
  public:
@@ -160,3 +195,99 @@ TEST_F(ServerTest, TestUpdateDeadline) {
   EXPECT_TRUE(!WaitForExactDocuments(*client, {}));
   EXPECT_TRUE(WaitForExactDocuments(*client, {}));
 }
+
+TEST_F(ServerTest, TestReloadModels) {
+  static constexpr size_t kStoredDocuments = 20;
+  static constexpr size_t kPutDuringRescore = 10;
+
+  auto stored = GenerateDocuments(mt, kStoredDocuments);
+  for (auto& document : stored) {
+    PutRequest(*client, document.name, document.content, document.max_age);
+  }
+  ASSERT_TRUE(WaitForExactDocuments(*client, GetDocumentNames(stored)));
+  auto answers = GetDocumentAnswers(*client, stored);
+
+  auto response = client->request("POST", "/_admin/reload_models", "");
+  ASSERT_EQ(response->status_code, "202 Accepted");
+
+  // Stored while the models load and the stored documents are re-scored.
+  auto added = GenerateDocuments(mt, kPutDuringRescore);
+  for (auto& document : added) {
+    PutRequest(*client, document.name, document.content, document.max_age);
+  }
+  auto added_answers = GetDocumentAnswers(*client, added);
+  answers.insert(added_answers.begin(), added_answers.end());
+
+  bool rescored = false;
+  auto deadline = Deadline(60s);
+  while (!rescored && Now() < deadline) {
+    auto models = GetJson(*client, "/_stats")["models"];
+    rescored = models["version"] == 2 && !models["reloading"] &&
+               models["rescoring_version"] == 0;
+    if (!rescored) {
+      std::this_thread::sleep_for(100ms);
+    }
+  }
+  ASSERT_TRUE(rescored);
+
+  auto all = ConcatDocuments(stored, added);
+  EXPECT_TRUE(WaitForExactDocuments(*client, GetDocumentNames(all)));
+  EXPECT_EQ(GetJson(*client, "/_stats")["memory"]["documents"], all.size());
+  for (const auto& [name, answer] : GetDocumentAnswers(*client, all)) {
+    EXPECT_EQ(answer, answers[name]) << name;
+  }
+}
+
+// A stream shorter than the corpus, so a re-scoring pass which does not wait
+// for the responses would overflow it.
+class SmallChangeStreamTest : public ServerTest {
+ public:
+  static constexpr size_t kChangeStreamCapacity = 16;
+
+  SmallChangeStreamTest()
+      : ServerTest(kChangeStreamCapacity, /*build_responses =*/true) {}
+
+  // Rebuilds of the responses once they caught up with the stream.
+  uint64_t WaitForResponses() {
+    auto deadline = Deadline(60s);
+    while (Now() < deadline) {
+      auto changes = GetJson(*client, "/_stats")["change_stream"];
+      if (changes["cursors"][0]["lag"] == 0) {
+        return changes["rebuilds"];
+      }
+      std::this_thread::sleep_for(100ms);
+    }
+    ADD_FAILURE() << "responses did not catch up";
+    return 0;
+  }
+};
+
+TEST_F(SmallChangeStreamTest, TestReloadModelsWithoutRebuild) {
+  static constexpr size_t kStoredDocuments = kChangeStreamCapacity * 3 / 2;
+
+  auto stored = GenerateDocuments(mt, kStoredDocuments);
+  for (auto& document : stored) {
+    PutRequest(*client, document.name, document.content, document.max_age);
+  }
+  ASSERT_TRUE(WaitForExactDocuments(*client, GetDocumentNames(stored)));
+  // The PUTs alone may overflow the stream.
+  auto rebuilds = WaitForResponses();
+
+  auto response = client->request("POST", "/_admin/reload_models", "");
+  ASSERT_EQ(response->status_code, "202 Accepted");
+
+  // The pass goes at the pace of the responses, a few ticks of them.
+  bool rescored = false;
+  auto deadline = Deadline(60s);
+  while (!rescored && Now() < deadline) {
+    auto models = GetJson(*client, "/_stats")["models"];
+    rescored = models["version"] == 2 &&
+               models["rescored_documents"] == kStoredDocuments &&
+               models["rescoring_version"] == 0;
+    if (!rescored) {
+      std::this_thread::sleep_for(100ms);
+    }
+  }
+  ASSERT_TRUE(rescored);
+  EXPECT_EQ(WaitForResponses(), rebuilds);
+}
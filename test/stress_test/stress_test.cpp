@@ -1,9 +1,14 @@
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
 #include <chrono>
+#include <iostream>
+#include <numeric>
 #include <thread>
 #include <vector>
 
+#include "base/context.h"
+#include "base/model_registry.h"
 #include "base/time_helpers.h"
-#include "base/util.h"
 #include "fmt/format.h"
 #include "gflags/gflags.h"
 #include "glog/logging.h"
@@ -16,18 +21,24 @@ DEFINE_int32(thread_count, 2, "thread count for shooting");
 DEFINE_int32(shooting_time, 60, "time to shoot in seconds");
 DEFINE_bool(log_to_stderr, false, "log to stderr");
 DEFINE_string(content_path, "content", "content path");
-DEFINE_string(model_path, "models", "path to models");
+DEFINE_string(server_threads, "",
+              "comma separated pool sizes, e.g. 1,2,4,8: starts an in-process "
+              "server with each of them in turn, shoots PUTs only and reports "
+              "their rps; shoots at --server_hostname when empty");
+DEFINE_string(model_path, "models", "path to models of the in-process server");
+DEFINE_string(server_content_path, "stress_test_index",
+              "index directory of the in-process server, wiped before a run");
 
 using namespace tgnews;
 
 namespace {
 
 std::vector<TestDocument> GetWorkerDocuments(
-    std::vector<TestDocument>& documents, size_t worker_id,
+    const std::vector<TestDocument>& documents, size_t worker_id,
     size_t thread_count) {
   std::vector<TestDocument> worker_documents;
   for (size_t i = worker_id; i < documents.size(); i += thread_count) {
-    worker_documents.push_back(std::move(documents[i]));
+    worker_documents.push_back(documents[i]);
   }
   return worker_documents;
 }
@@ -36,12 +47,13 @@ std::vector<TestDocument> GetWorkerDocuments(
 
 class Worker {
  public:
-  Worker(std::vector<TestDocument> documents, Stats& stats)
+  Worker(std::vector<TestDocument> documents, Stats& stats, bool put_only)
       : deadline_(Deadline(std::chrono::seconds(FLAGS_shooting_time))),
         documents_(std::move(documents)),
         client_(std::make_unique<SimpleWeb::Client<SimpleWeb::HTTP>>(
             fmt::format("{}:{}", FLAGS_server_hostname, FLAGS_server_port))),
-        stats_(stats) {}
+        stats_(stats),
+        put_only_(put_only) {}
 
   void Run() {
     while (Now() < deadline_) {
@@ -49,12 +61,21 @@ class Worker {
     }
   }
 
+  size_t PutCount() const { return put_count_; }
+
  private:
   void DoIteration() {
-    for (auto document : documents_) {
+    for (const auto& document : documents_) {
+      if (put_only_ && Now() >= deadline_) {
+        return;
+      }
       MakeRequest([&] {
         PutRequest(*client_, document.name, document.content, document.max_age, /*expected_status =*/ "");
       });
+      put_count_++;
+    }
+    if (put_only_) {
+      return;
     }
     MakeRequest([&] {
       GetArticles(*client_, std::chrono::hours(2), "en", "any");
@@ -102,33 +123,24 @@ class Worker {
   std::vector<TestDocument> documents_;
   std::unique_ptr<SimpleWeb::Client<SimpleWeb::HTTP>> client_;
   Stats& stats_;
+  bool put_only_;
+  size_t put_count_ = 0;
 };
 
-int main(int argc, char** argv) {
-  gflags::ParseCommandLineFlags(&argc, &argv, false);
-
-  FLAGS_minloglevel = 0;
-  FLAGS_logtostderr = FLAGS_log_to_stderr;
-
-  google::InitGoogleLogging(argv[0]);
-
-  Context context(FLAGS_model_path, nullptr);
-  std::vector<TestDocument> documents;
-  for (const auto& document : MakeDocumentsFromDir(FLAGS_content_path, -1, &context)) {
-    documents.push_back(TestDocument(document.FileName, document.Data,
-                                     std::chrono::hours(1024)));
-  }
-  LOG(INFO) << "document count: " << documents.size();
-
+// Runs FLAGS_thread_count workers until the shooting time is over and
+// returns the number of PUT requests they made.
+size_t Shoot(const std::vector<TestDocument>& documents, Stats& stats,
+             bool put_only) {
+  std::vector<size_t> put_counts(FLAGS_thread_count);
   std::vector<std::thread> workers;
 
-  Stats stats;
-
   size_t thread_count = FLAGS_thread_count;
   for (size_t worker_id = 0; worker_id < thread_count; worker_id++) {
     auto work = [&](auto id) {
-      Worker worker(GetWorkerDocuments(documents, id, thread_count), stats);
+      Worker worker(GetWorkerDocuments(documents, id, thread_count), stats,
+                    put_only);
       worker.Run();
+      put_counts[id] = worker.PutCount();
     };
     if (worker_id + 1 == thread_count) {
       work(worker_id);
@@ -140,5 +152,62 @@ int main(int argc, char** argv) {
   for (auto& worker : workers) {
     worker.join();
   }
+  return std::accumulate(put_counts.begin(), put_counts.end(), size_t{0});
+}
+
+void CompareServerThreads(const std::vector<TestDocument>& documents) {
+  std::vector<std::string> thread_counts;
+  boost::split(thread_counts, FLAGS_server_threads, boost::is_any_of(","));
+
+  ModelRegistry models(
+      [] { return std::make_unique<Context>(FLAGS_model_path, nullptr); });
+  for (const auto& thread_count : thread_counts) {
+    size_t server_threads = std::stoul(thread_count);
+    boost::filesystem::remove_all(FLAGS_server_content_path);
+
+    std::experimental::thread_pool pool(server_threads);
+    Server server(FLAGS_server_port,
+                  std::make_unique<FileManager>(pool, &models,
+                                                FLAGS_server_content_path),
+                  pool);
+    std::thread server_thread([&server] { server.Run(); });
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+
+    Stats stats;
+    auto start = std::chrono::steady_clock::now();
+    size_t put_count = Shoot(documents, stats, /*put_only =*/true);
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    server.Stop();
+    server_thread.join();
+
+    std::cout << fmt::format("server threads: {} put requests: {} rps: {:.1f}",
+                             server_threads, put_count,
+                             put_count / elapsed.count())
+              << std::endl;
+  }
+  boost::filesystem::remove_all(FLAGS_server_content_path);
+}
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, false);
+
+  FLAGS_minloglevel = 0;
+  FLAGS_logtostderr = FLAGS_log_to_stderr;
+
+  google::InitGoogleLogging(argv[0]);
+
+  auto documents =
+      ReadDocumentsFromDir(FLAGS_content_path, std::chrono::hours(1024));
+  LOG(INFO) << "document count: " << documents.size();
+
+  if (!FLAGS_server_threads.empty()) {
+    CompareServerThreads(documents);
+    return 0;
+  }
+
+  Stats stats;
+  Shoot(documents, stats, /*put_only =*/false);
   return 0;
 }
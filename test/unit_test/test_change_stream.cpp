@@ -0,0 +1,80 @@
+#include "base/change_stream.h"
+
+#include "gtest/gtest.h"
+
+#include <string>
+
+using namespace tgnews;
+
+namespace {
+
+std::vector<std::string> Names(const ChangeStream::Batch& batch) {
+  std::vector<std::string> names;
+  for (const auto& change : batch.changes) {
+    names.push_back(change.FileName);
+  }
+  return names;
+}
+
+}  // namespace
+
+TEST(ChangeStream, NumbersChanges) {
+  ChangeStream stream;
+  EXPECT_EQ(stream.NextSequence(), 1u);
+  EXPECT_EQ(stream.Append(ParsedDoc::EState::Added, "a"), 1u);
+  EXPECT_EQ(stream.Append(ParsedDoc::EState::Removed, "a"), 2u);
+
+  auto batch = stream.ReadFrom(1);
+  ASSERT_EQ(batch.changes.size(), 2u);
+  EXPECT_FALSE(batch.lost);
+  EXPECT_EQ(batch.next, 3u);
+  EXPECT_EQ(batch.changes[0].State, ParsedDoc::EState::Added);
+  EXPECT_EQ(batch.changes[1].State, ParsedDoc::EState::Removed);
+  EXPECT_EQ(batch.changes[1].Sequence, 2u);
+
+  EXPECT_EQ(Names(stream.ReadFrom(2)), std::vector<std::string>({"a"}));
+  EXPECT_TRUE(stream.ReadFrom(3).changes.empty());
+}
+
+TEST(ChangeStream, CursorsAreIndependent) {
+  ChangeStream stream;
+  auto responses = stream.OpenCursor("responses");
+  stream.Append(ParsedDoc::EState::Added, "a");
+  stream.Append(ParsedDoc::EState::Added, "b");
+  auto replication = stream.OpenCursor("replication");
+
+  auto batch = stream.Read(responses, 1);
+  EXPECT_EQ(Names(batch), std::vector<std::string>({"a"}));
+  // Not committed: the same batch is read again.
+  EXPECT_EQ(Names(stream.Read(responses, 1)), Names(batch));
+  stream.Commit(responses, batch.next);
+  EXPECT_EQ(Names(stream.Read(responses)), std::vector<std::string>({"b"}));
+
+  EXPECT_EQ(Names(stream.Read(replication)),
+            std::vector<std::string>({"a", "b"}));
+
+  auto cursors = stream.GetCursors();
+  ASSERT_EQ(cursors.size(), 2u);
+  EXPECT_EQ(cursors[0].name, "responses");
+  EXPECT_EQ(cursors[0].lag, 1u);
+  EXPECT_EQ(cursors[1].lag, 2u);
+}
+
+TEST(ChangeStream, DropsOldChanges) {
+  ChangeStream stream(2);
+  auto cursor = stream.OpenCursor("slow");
+  for (auto name : {"a", "b", "c"}) {
+    stream.Append(ParsedDoc::EState::Added, name);
+  }
+
+  auto batch = stream.Read(cursor);
+  EXPECT_TRUE(batch.lost);
+  EXPECT_TRUE(batch.changes.empty());
+  EXPECT_EQ(batch.next, 4u);
+  EXPECT_EQ(Names(stream.ReadFrom(2)), std::vector<std::string>({"b", "c"}));
+
+  stream.Commit(cursor, batch.next);
+  stream.Append(ParsedDoc::EState::Added, "d");
+  EXPECT_EQ(Names(stream.Read(cursor)), std::vector<std::string>({"d"}));
+  EXPECT_THROW(stream.Commit(cursor, 10), std::runtime_error);
+}
@@ -0,0 +1,85 @@
+#include "solver/cluster.h"
+#include "solver/distance.h"
+#include "solver/distance_kernel.h"
+#include "test/common/common.h"
+
+#include "fmt/format.h"
+#include "gtest/gtest.h"
+
+#include <numeric>
+#include <random>
+#include <set>
+
+using namespace tgnews;
+
+namespace {
+
+// Components of the pairs within the threshold, labelled by their smallest
+// member.
+std::vector<size_t> NaiveLabels(const std::vector<Embedding>& points,
+                                float threshold) {
+  std::vector<size_t> labels(points.size());
+  std::iota(labels.begin(), labels.end(), 0);
+  for (size_t i = 0; i < points.size(); ++i) {
+    for (size_t j = i + 1; j < points.size(); ++j) {
+      if (labels[j] != labels[i] &&
+          Distance(points[i], points[j]) <= threshold) {
+        size_t from = std::max(labels[i], labels[j]);
+        size_t to = std::min(labels[i], labels[j]);
+        for (auto& label : labels) {
+          if (label == from) {
+            label = to;
+          }
+        }
+      }
+    }
+  }
+  return labels;
+}
+
+}  // namespace
+
+TEST(DistanceKernelTest, EveryKernelLinksLikeNaive) {
+  // Not a multiple of the tile sizes, with clusters spanning tiles.
+  std::mt19937 random(7);
+  auto points = GeneratePoints(random, 1001, 150, 0.01f);
+  auto expected = NaiveLabels(points, RuDistanceThreshold);
+  ASSERT_LT(std::set<size_t>(expected.begin(), expected.end()).size(),
+            points.size());
+
+  std::experimental::thread_pool pool(4);
+  for (auto kernel : {DistanceKernel::Scalar, DistanceKernel::Avx2,
+                      DistanceKernel::Avx512}) {
+    if (kernel > DetectDistanceKernel()) {
+      continue;
+    }
+    SCOPED_TRACE(GetDistanceKernelName(kernel));
+    EXPECT_EQ(LinkWithinThreshold(points, RuDistanceThreshold, nullptr,
+                                  kernel),
+              expected);
+    EXPECT_EQ(LinkWithinThreshold(points, RuDistanceThreshold, &pool, kernel),
+              expected);
+  }
+  pool.stop();
+  pool.join();
+}
+
+TEST(DistanceKernelTest, HandlesPartialTiles) {
+  // Fewer points than a row group, a panel and a tile.
+  std::mt19937 random(7);
+  for (size_t count : {0, 1, 2, 7, 15, 127}) {
+    auto points = GeneratePoints(random, count, 3, 0.01f);
+    auto expected = NaiveLabels(points, RuDistanceThreshold);
+    for (auto kernel : {DistanceKernel::Scalar, DistanceKernel::Avx2,
+                        DistanceKernel::Avx512}) {
+      if (kernel > DetectDistanceKernel()) {
+        continue;
+      }
+      SCOPED_TRACE(fmt::format("{} points, {}", count,
+                               GetDistanceKernelName(kernel)));
+      EXPECT_EQ(LinkWithinThreshold(points, RuDistanceThreshold, nullptr,
+                                    kernel),
+                expected);
+    }
+  }
+}
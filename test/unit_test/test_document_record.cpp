@@ -0,0 +1,173 @@
+#include "base/document_record.h"
+#include "base/hash.h"
+#include "base/simhash.h"
+
+#include "gtest/gtest.h"
+
+#include <cstring>
+#include <string>
+
+using namespace tgnews;
+
+namespace {
+
+ParsedDoc MakeDoc() {
+  ParsedDoc doc;
+  doc.FetchTime = 1588000000;
+  doc.MaxAge = 86400;
+  doc.PubTime = 1587990000;
+  doc.Weight = 0.75f;
+  doc.SiteId = GlobalStringPool().Intern("Example News");
+  doc.HostId = GlobalStringPool().Intern("example.com");
+  doc.Lang = LangRu;
+  doc.Category = NC_SCIENCE;
+  doc.ContentHash = HashBytes("<html></html>");
+  doc.Fingerprint = 0x0123456789abcdefull;
+  for (size_t i = 0; i < EmbeddingSize; i++) {
+    doc.Vector[i] = i * 0.5f - 3.f;
+  }
+  doc.FileName = "123.html";
+  doc.Title = "Заголовок";
+  doc.Url = "https://example.com/news/1";
+  doc.Description = "description";
+  doc.Text = std::string(5000, 't');
+  doc.Author = "author";
+  doc.GoodTitle = "заголовок";
+  doc.GoodText = std::string(5000, 'g');
+  return doc;
+}
+
+}  // namespace
+
+TEST(DocumentRecordTest, RoundTrip) {
+  auto doc = MakeDoc();
+  auto record = SerializeDocumentRecord(doc);
+  ASSERT_TRUE(DocumentRecordView::IsDocumentRecord(record));
+  EXPECT_FALSE(DocumentRecordView::IsDocumentRecord(doc.Serialize().dump()));
+
+  DocumentRecordView view(record);
+  EXPECT_EQ(view.Size, record.size());
+  ParsedDoc restored(view);
+  EXPECT_EQ(restored.FetchTime, doc.FetchTime);
+  EXPECT_EQ(restored.MaxAge, doc.MaxAge);
+  EXPECT_EQ(restored.PubTime, doc.PubTime);
+  EXPECT_EQ(restored.Weight, doc.Weight);
+  EXPECT_EQ(restored.SiteId, doc.SiteId);
+  EXPECT_EQ(restored.HostId, doc.HostId);
+  EXPECT_EQ(restored.Lang, doc.Lang);
+  EXPECT_EQ(restored.Category, doc.Category);
+  EXPECT_EQ(restored.ContentHash, doc.ContentHash);
+  EXPECT_EQ(restored.Fingerprint, doc.Fingerprint);
+  EXPECT_EQ(restored.Vector, doc.Vector);
+  EXPECT_EQ(restored.FileName, doc.FileName);
+  EXPECT_EQ(restored.Title, doc.Title);
+  EXPECT_EQ(restored.Url, doc.Url);
+  EXPECT_EQ(restored.Description, doc.Description);
+  EXPECT_EQ(restored.Text, doc.Text);
+  EXPECT_EQ(restored.Author, doc.Author);
+  EXPECT_EQ(restored.GoodTitle, doc.GoodTitle);
+  EXPECT_EQ(restored.GoodText, doc.GoodText);
+}
+
+TEST(DocumentRecordTest, KeepsPagesUnextracted) {
+  auto doc = MakeDoc();
+  EXPECT_TRUE(ParsedDoc(DocumentRecordView(SerializeDocumentRecord(doc)))
+                  .Extracted);
+  doc.Extracted = false;
+  auto record = SerializeDocumentRecord(doc);
+  DocumentRecordView view(record);
+  EXPECT_FALSE(view.Extracted);
+  EXPECT_FALSE(ParsedDoc(view).Extracted);
+}
+
+TEST(DocumentRecordTest, HotFieldsOnly) {
+  auto doc = MakeDoc();
+  auto record = SerializeDocumentRecord(doc);
+  DocumentRecordView view(record);
+  EXPECT_EQ(view.ColdBytes(), doc.ColdBytes());
+
+  ParsedDoc hot(view, false);
+  EXPECT_FALSE(hot.HasColdFields);
+  EXPECT_EQ(hot.ColdBytes(), 0u);
+  EXPECT_EQ(hot.FileName, doc.FileName);
+  EXPECT_EQ(hot.Title, doc.Title);
+  EXPECT_EQ(hot.Vector, doc.Vector);
+  EXPECT_LT(hot.ResidentBytes(), 1024u);
+
+  doc.DropColdFields();
+  EXPECT_TRUE(doc.Text.empty());
+  EXPECT_LT(doc.ResidentBytes(), 1024u);
+  // The record would lose the text.
+  EXPECT_THROW(SerializeDocumentRecord(doc), std::runtime_error);
+}
+
+TEST(DocumentRecordTest, ViewDoesNotCopy) {
+  auto record = SerializeDocumentRecord(MakeDoc());
+  DocumentRecordView view(record);
+  EXPECT_GE(view.Text.data(), record.data());
+  EXPECT_LT(view.Text.data(), record.data() + record.size());
+}
+
+TEST(DocumentRecordTest, RejectsBrokenRecords) {
+  auto record = SerializeDocumentRecord(MakeDoc());
+  for (size_t size : {size_t(3), size_t(16), size_t(300), record.size() - 1}) {
+    EXPECT_THROW(DocumentRecordView(std::string_view(record).substr(0, size)),
+                 std::runtime_error);
+  }
+
+  auto future = record;
+  future[4] = kDocumentRecordVersion + 1;
+  EXPECT_THROW(DocumentRecordView{future}, std::runtime_error);
+
+  // Lang and Category bytes follow the header, three times u64 and a float.
+  const size_t lang_offset = 12 + 3 * sizeof(uint64_t) + sizeof(float);
+  for (int lang : {int(LangCount), int(LangUndefined) + 1, 255}) {
+    auto broken = record;
+    broken[lang_offset] = static_cast<char>(lang);
+    EXPECT_THROW(DocumentRecordView{broken}, std::runtime_error) << lang;
+  }
+  for (int category : {int(NC_NOT_NEWS) - 1, int(NC_COUNT)}) {
+    auto broken = record;
+    broken[lang_offset + 1] = static_cast<char>(category);
+    EXPECT_THROW(DocumentRecordView{broken}, std::runtime_error) << category;
+  }
+  auto other = record;
+  other[lang_offset] = LangOther;
+  other[lang_offset + 1] = static_cast<char>(NC_NOT_NEWS);
+  EXPECT_EQ(DocumentRecordView(other).Lang, LangOther);
+  EXPECT_EQ(DocumentRecordView(other).Category, NC_NOT_NEWS);
+
+  // Records may be laid out back to back.
+  auto two = record + record;
+  EXPECT_EQ(DocumentRecordView(two).Size, record.size());
+}
+
+TEST(DocumentRecordTest, ReadsVersion1) {
+  auto record = SerializeDocumentRecord(MakeDoc());
+  // Version 1 had neither the content hash nor the fingerprint at the end.
+  record.resize(record.size() - 2 * sizeof(uint64_t));
+  uint16_t version = 1;
+  uint32_t size = record.size();
+  std::memcpy(record.data() + 4, &version, sizeof(version));
+  std::memcpy(record.data() + 8, &size, sizeof(size));
+
+  ParsedDoc restored{DocumentRecordView(record)};
+  EXPECT_EQ(restored.ContentHash, 0u);
+  EXPECT_EQ(restored.GoodText, MakeDoc().GoodText);
+  // Computed from the tokens instead.
+  EXPECT_EQ(restored.Fingerprint,
+            TextFingerprint(MakeDoc().GoodTitle, MakeDoc().GoodText));
+}
+
+TEST(DocumentRecordTest, HashIsStable) {
+  // Persisted with every document, a change here breaks deduplication of
+  // documents stored by older builds.
+  EXPECT_EQ(HashBytes("<html><head></head><body>tgnews</body></html>"),
+            0xc4039040864eb793ull);
+  EXPECT_NE(HashBytes("a"), HashBytes("b"));
+  EXPECT_NE(HashBytes(std::string(16, 'a')), HashBytes(std::string(17, 'a')));
+  std::string html(30000, 'h');
+  auto hash = HashBytes(html);
+  html[12345] = 'x';
+  EXPECT_NE(HashBytes(html), hash);
+}
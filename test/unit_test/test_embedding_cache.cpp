@@ -0,0 +1,71 @@
+#include "base/embedding_cache.h"
+
+#include "gtest/gtest.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace tgnews;
+
+namespace {
+
+Embedding MakeEmbedding(float value) {
+  Embedding embedding;
+  embedding.fill(value);
+  return embedding;
+}
+
+}  // namespace
+
+TEST(EmbeddingCacheTest, FindsInsertedEmbeddings) {
+  EmbeddingCache cache;
+  auto key = EmbeddingCache::GetKey(LangRu, "заголовок", "текст");
+  EXPECT_FALSE(cache.Find(key).has_value());
+  cache.Insert(key, MakeEmbedding(1.f));
+  EXPECT_EQ(cache.Find(key), MakeEmbedding(1.f));
+
+  // Another model or other tokens.
+  EXPECT_NE(EmbeddingCache::GetKey(LangEn, "заголовок", "текст"), key);
+  EXPECT_NE(EmbeddingCache::GetKey(LangRu, "заголовок", "текст2"), key);
+  EXPECT_NE(EmbeddingCache::GetKey(LangRu, "заголовок текст", ""), key);
+
+  auto stats = cache.GetStats();
+  EXPECT_EQ(stats.hits, 1u);
+  EXPECT_EQ(stats.misses, 1u);
+  EXPECT_EQ(stats.size, 1u);
+}
+
+TEST(EmbeddingCacheTest, EvictsLeastRecentlyUsed) {
+  // Two entries per shard, keys 0, 16 and 32 share one.
+  EmbeddingCache cache(32);
+  cache.Insert(0, MakeEmbedding(0.f));
+  cache.Insert(16, MakeEmbedding(16.f));
+  EXPECT_TRUE(cache.Find(0).has_value());
+  cache.Insert(32, MakeEmbedding(32.f));
+  EXPECT_FALSE(cache.Find(16).has_value());
+  EXPECT_EQ(cache.Find(0), MakeEmbedding(0.f));
+  EXPECT_EQ(cache.Find(32), MakeEmbedding(32.f));
+  EXPECT_EQ(cache.GetStats().size, 2u);
+}
+
+TEST(EmbeddingCacheTest, IsThreadSafe) {
+  EmbeddingCache cache(1000);
+  std::vector<std::thread> threads;
+  for (int thread = 0; thread < 4; thread++) {
+    threads.emplace_back([&cache] {
+      for (int i = 0; i < 10000; i++) {
+        auto key = EmbeddingCache::GetKey(LangEn, "", std::to_string(i % 2000));
+        if (auto cached = cache.Find(key)) {
+          EXPECT_EQ((*cached)[0], static_cast<float>(i % 2000));
+        } else {
+          cache.Insert(key, MakeEmbedding(i % 2000));
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_LE(cache.GetStats().size, 1000u);
+}
@@ -0,0 +1,123 @@
+#include "base/file_manager.h"
+#include "base/document_record.h"
+#include "base/hash.h"
+
+#include "gtest/gtest.h"
+
+#include <boost/filesystem.hpp>
+#include <future>
+#include <string>
+#include <thread>
+
+using namespace tgnews;
+
+namespace {
+
+class FileManagerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    dir_ = boost::filesystem::temp_directory_path() /
+           boost::filesystem::unique_path("file-manager-%%%%-%%%%");
+    boost::filesystem::create_directory(dir_);
+
+    doc_.FetchTime = std::chrono::duration_cast<std::chrono::seconds>(
+                         std::chrono::system_clock::now().time_since_epoch())
+                         .count();
+    doc_.MaxAge = 86400;
+    doc_.Lang = LangRu;
+    doc_.Category = NC_SCIENCE;
+    doc_.ContentHash = HashBytes("<html></html>");
+    doc_.FileName = "1.html";
+    doc_.Title = "title";
+    doc_.Text = std::string(5000, 't');
+    doc_.GoodTitle = "title";
+    doc_.GoodText = std::string(5000, 'g');
+
+    // Leave the document in the log as a previous run would.
+    SegmentLog log((dir_ / "log").string(), {});
+    log.Replay([](std::string_view, uint64_t, std::string_view) {});
+    std::promise<void> written;
+    log.Put(doc_.FileName, doc_.ExpirationTime(),
+            SerializeDocumentRecord(doc_),
+            [&](std::exception_ptr) { written.set_value(); });
+    written.get_future().wait();
+  }
+
+  void TearDown() override { boost::filesystem::remove_all(dir_); }
+
+  std::unique_ptr<FileManager> Restore(uint64_t cold_fields_budget) {
+    auto manager = std::make_unique<FileManager>(
+        pool_, nullptr, dir_.string(), 2, SegmentLog::Options{},
+        cold_fields_budget);
+    while (!manager->FinishedRestoringFromDisk()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return manager;
+  }
+
+  std::experimental::thread_pool pool_{2};
+  boost::filesystem::path dir_;
+  ParsedDoc doc_;
+};
+
+}  // namespace
+
+TEST_F(FileManagerTest, LoadsDroppedColdFields) {
+  auto manager = Restore(0);
+  EXPECT_EQ(manager->GetMemoryUsage().cold_bytes, 0);
+
+  auto documents = manager->GetDocuments().apply(cti::transforms::wait());
+  ASSERT_EQ(documents.size(), 1);
+  EXPECT_FALSE(documents[0]->HasColdFields);
+  EXPECT_TRUE(documents[0]->Text.empty());
+
+  auto loaded =
+      manager->LoadDocument(doc_.FileName).apply(cti::transforms::wait());
+  ASSERT_TRUE(loaded);
+  EXPECT_TRUE(loaded->HasColdFields);
+  EXPECT_EQ(loaded->Text, doc_.Text);
+  EXPECT_EQ(loaded->GoodText, doc_.GoodText);
+  EXPECT_EQ(loaded->MaxAge, doc_.MaxAge);
+
+  EXPECT_FALSE(manager->LoadDocument("missing").apply(cti::transforms::wait()));
+}
+
+TEST_F(FileManagerTest, KeepsColdFieldsWithinBudget) {
+  auto manager = Restore(FileManager::kDefaultColdFieldsBudget);
+  EXPECT_GT(manager->GetMemoryUsage().cold_bytes, 0);
+
+  auto loaded =
+      manager->LoadDocument(doc_.FileName).apply(cti::transforms::wait());
+  ASSERT_TRUE(loaded);
+  EXPECT_TRUE(loaded->HasColdFields);
+  EXPECT_EQ(loaded->Text, doc_.Text);
+}
+
+TEST_F(FileManagerTest, LooksUpChangedDocuments) {
+  auto manager = Restore(0);
+  auto& stream = manager->GetChangeStream();
+  stream.Append(ParsedDoc::EState::Changed, doc_.FileName);
+  stream.Append(ParsedDoc::EState::Removed, "missing");
+
+  // One change per name, with the document stored now.
+  auto changes = manager->GetChanges(stream.ReadFrom(1).changes)
+                     .apply(cti::transforms::wait());
+  ASSERT_EQ(changes.size(), 2);
+  EXPECT_EQ(changes[0].FileName, doc_.FileName);
+  EXPECT_EQ(changes[0].State, ParsedDoc::EState::Changed);
+  EXPECT_EQ(changes[0].Sequence, 2);
+  ASSERT_TRUE(changes[0].Document);
+  EXPECT_EQ(changes[0].Document->Title, doc_.Title);
+  EXPECT_EQ(changes[1].FileName, "missing");
+  EXPECT_EQ(changes[1].State, ParsedDoc::EState::Removed);
+  EXPECT_FALSE(changes[1].Document);
+
+  // Read late, an addition of a document removed since is a removal.
+  auto events = stream.ReadFrom(1).changes;
+  EXPECT_TRUE(
+      manager->RemoveFile(doc_.FileName).apply(cti::transforms::wait()));
+  changes = manager->GetChanges(events).apply(cti::transforms::wait());
+  ASSERT_EQ(changes.size(), 2);
+  EXPECT_EQ(changes[0].State, ParsedDoc::EState::Removed);
+  EXPECT_FALSE(changes[0].Document);
+}
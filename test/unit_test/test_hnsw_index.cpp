@@ -0,0 +1,91 @@
+#include "solver/cluster.h"
+#include "solver/distance.h"
+#include "solver/hnsw_index.h"
+#include "test/common/common.h"
+
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <random>
+#include <set>
+
+using namespace tgnews;
+
+namespace {
+
+std::vector<Embedding> MakePoints(size_t count, size_t centers,
+                                  float spread) {
+  std::mt19937 random(42);
+  return GeneratePoints(random, count, centers, spread);
+}
+
+}  // namespace
+
+TEST(HnswIndexTest, FindsNearestNeighbours) {
+  const size_t k = 10;
+  auto points = MakePoints(3000, 100, 0.3f);
+  HnswIndex index(points, {});
+  std::experimental::thread_pool pool(4);
+  index.Build(&pool);
+
+  size_t found = 0;
+  const size_t queries = 200;
+  for (size_t q = 0; q < queries; ++q) {
+    std::vector<std::pair<float, uint32_t>> exact;
+    for (size_t i = 0; i < points.size(); ++i) {
+      exact.push_back({Distance(points[q], points[i]), i});
+    }
+    std::partial_sort(exact.begin(), exact.begin() + k, exact.end());
+    std::set<uint32_t> expected;
+    for (size_t i = 0; i < k; ++i) {
+      expected.insert(exact[i].second);
+    }
+    auto result = index.Search(points[q], k, 64);
+    ASSERT_EQ(result.size(), k);
+    EXPECT_TRUE(std::is_sorted(result.begin(), result.end()));
+    for (const auto& [distance, id] : result) {
+      found += expected.count(id);
+    }
+  }
+  EXPECT_GT(static_cast<double>(found) / (queries * k), 0.95);
+  EXPECT_LT(index.MemoryBytes(), points.size() * 512);
+  pool.stop();
+  pool.join();
+}
+
+TEST(HnswIndexTest, ClustersLikeExactLinkage) {
+  auto points = MakePoints(2000, 300, 0.01f);
+  std::vector<ParsedDocPtr> docs;
+  for (size_t i = 0; i < points.size(); ++i) {
+    auto doc = std::make_shared<ParsedDoc>();
+    doc->FileName = std::to_string(i);
+    doc->Vector = points[i];
+    docs.push_back(doc);
+  }
+  ClusteringOptions exact;
+  exact.Exact = true;
+  auto expected = GetClusterLabels(docs, RuDistanceThreshold, exact);
+  auto labels = GetClusterLabels(docs, RuDistanceThreshold);
+
+  // Same partition: labels map one to one.
+  std::map<size_t, size_t> forward, backward;
+  for (size_t i = 0; i < docs.size(); ++i) {
+    EXPECT_EQ(forward.emplace(labels[i], expected[i]).first->second,
+              expected[i]);
+    EXPECT_EQ(backward.emplace(expected[i], labels[i]).first->second,
+              labels[i]);
+  }
+}
+
+TEST(HnswIndexTest, HandlesTinyInputs) {
+  std::vector<Embedding> points;
+  HnswIndex empty(points, {});
+  empty.Build();
+  EXPECT_TRUE(empty.Search(Embedding{}, 5, 10).empty());
+
+  points = MakePoints(3, 1, 0.5f);
+  HnswIndex index(points, {});
+  index.Build();
+  EXPECT_EQ(index.Search(points[0], 5, 10).size(), 3u);
+  EXPECT_EQ(index.Search(points[0], 1, 10)[0].second, 0u);
+}
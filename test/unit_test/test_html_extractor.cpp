@@ -0,0 +1,175 @@
+#include "base/html_extractor.h"
+#include "base/parsed_document.h"
+
+#include "gtest/gtest.h"
+
+#include <optional>
+#include <string>
+#include <vector>
+
+using namespace tgnews;
+
+namespace {
+
+const char* kArticle = R"(<!DOCTYPE html>
+<html>
+  <head>
+    <meta charset="utf-8"/>
+    <meta property="og:url" content="https://example.com/news/1?a=1&amp;b=2"/>
+    <meta property="og:site_name" content="Example &quot;News&quot;"/>
+    <meta property="article:published_time" content="2020-04-30T10:45:08+00:00"/>
+    <meta property="og:title" content="Scientists &amp; &#x4D;ammals &#1055;&#1088;"/>
+    <meta property="og:description" content="Line one&#10;line two"/>
+  </head>
+  <body>
+    <article>
+      <h1>Scientists Discover Mammal</h1>
+      <address>
+        <time datetime="2020-04-30T10:45:08+03:00">30 Apr 2020, 10:45</time>
+        <a rel="author">  Jane Doe </a>
+      </address>
+      <p>Scientists <a href="https://www.nature.com"><i>Nature</i> reported</a>. </p>
+      <p>Spaces <b>between</b> <i>tags</i> are dropped &lt;here&gt;.</p>
+      <blockquote><p>Not a direct child</p></blockquote>
+      <p/>
+      <p><![CDATA[Raw &amp; <text>]]><!-- comment --> tail</p>
+    </article>
+  </body>
+</html>
+)";
+
+struct Result {
+  bool has_address = false;
+  std::optional<std::string> error;
+  ParsedDoc doc;
+};
+
+template <typename Extract>
+Result Run(Extract&& extract) {
+  Result result;
+  try {
+    result.has_address = extract(result.doc);
+  } catch (const std::exception& e) {
+    result.error = e.what();
+  }
+  return result;
+}
+
+void ExpectSameAsDom(const std::string& html) {
+  HtmlExtractor extractor;
+  auto streaming =
+      Run([&](ParsedDoc& doc) { return extractor.Extract(html, doc); });
+  auto dom = Run([&](ParsedDoc& doc) { return ExtractWithDom(html, doc); });
+
+  EXPECT_EQ(streaming.error.has_value(), dom.error.has_value()) << html;
+  if (streaming.error || dom.error) {
+    return;
+  }
+  EXPECT_EQ(streaming.has_address, dom.has_address) << html;
+  EXPECT_EQ(streaming.doc.Title, dom.doc.Title) << html;
+  EXPECT_EQ(streaming.doc.Url, dom.doc.Url) << html;
+  EXPECT_EQ(streaming.doc.SiteId, dom.doc.SiteId) << html;
+  EXPECT_EQ(streaming.doc.Description, dom.doc.Description) << html;
+  EXPECT_EQ(streaming.doc.Text, dom.doc.Text) << html;
+  EXPECT_EQ(streaming.doc.Author, dom.doc.Author) << html;
+  EXPECT_EQ(streaming.doc.FetchTime, dom.doc.FetchTime) << html;
+  EXPECT_EQ(streaming.doc.PubTime, dom.doc.PubTime) << html;
+}
+
+std::string MakeArticle(const std::string& article) {
+  return "<html><head><meta property=\"og:title\" content=\"t\"/></head>"
+         "<body><article>" +
+         article + "</article></body></html>";
+}
+
+}  // namespace
+
+TEST(HtmlExtractorTest, ExtractsArticle) {
+  ParsedDoc doc;
+  HtmlExtractor extractor;
+  EXPECT_TRUE(extractor.Extract(kArticle, doc));
+  EXPECT_EQ(doc.Url, "https://example.com/news/1?a=1&b=2");
+  EXPECT_EQ(doc.GetSiteName(), "Example \"News\"");
+  EXPECT_EQ(doc.Title, "Scientists & Mammals \xD0\x9F\xD1\x80");
+  EXPECT_EQ(doc.Description, "Line one\nline two");
+  EXPECT_EQ(doc.FetchTime, 1588243508);
+  EXPECT_EQ(doc.PubTime, 1588232708);
+  EXPECT_EQ(doc.Author, "  Jane Doe ");
+  EXPECT_EQ(doc.Text,
+            "Scientists Nature reported. \n"
+            "Spaces betweentags are dropped <here>.\n"
+            "\n"
+            "Raw &amp; <text> tail\n");
+}
+
+TEST(HtmlExtractorTest, ReusesExtractor) {
+  HtmlExtractor extractor;
+  ParsedDoc first;
+  ParsedDoc second;
+  extractor.Extract(kArticle, first);
+  extractor.Extract(kArticle, second);
+  EXPECT_EQ(first.Text, second.Text);
+  EXPECT_EQ(first.Title, second.Title);
+}
+
+TEST(HtmlExtractorTest, MissingElements) {
+  HtmlExtractor extractor;
+  ParsedDoc doc;
+  EXPECT_THROW(extractor.Extract("", doc), std::runtime_error);
+  EXPECT_THROW(extractor.Extract("<html><body/></html>", doc),
+               std::runtime_error);
+  EXPECT_THROW(extractor.Extract("<html><head/><body/></html>", doc),
+               std::runtime_error);
+  EXPECT_THROW(extractor.Extract("<html><head><meta/></head></html>", doc),
+               std::runtime_error);
+  EXPECT_FALSE(extractor.Extract(MakeArticle("<p>text</p>"), doc));
+}
+
+TEST(HtmlExtractorTest, MalformedHtml) {
+  HtmlExtractor extractor;
+  ParsedDoc doc;
+  EXPECT_THROW(extractor.Extract(MakeArticle("<p>text</b></p>"), doc),
+               std::runtime_error);
+  EXPECT_THROW(extractor.Extract(MakeArticle("<p>unclosed"), doc),
+               std::runtime_error);
+  EXPECT_THROW(extractor.Extract(MakeArticle("<p a='1' a='2'>x</p>"), doc),
+               std::runtime_error);
+  EXPECT_THROW(extractor.Extract(MakeArticle("<p a=1>x</p>"), doc),
+               std::runtime_error);
+  EXPECT_THROW(extractor.Extract(MakeArticle("<?xml version='1.0'?>"), doc),
+               std::runtime_error);
+  EXPECT_THROW(extractor.Extract(MakeArticle("") + " trailing text", doc),
+               std::runtime_error);
+}
+
+TEST(HtmlExtractorTest, AuthorAfterComment) {
+  HtmlExtractor extractor;
+  ParsedDoc doc;
+  EXPECT_TRUE(extractor.Extract(
+      MakeArticle("<address><a rel=\"author\"><!-- c -->x</a></address>"),
+      doc));
+  EXPECT_EQ(doc.Author, "");
+}
+
+TEST(HtmlExtractorTest, MatchesDom) {
+  ExpectSameAsDom(kArticle);
+  ExpectSameAsDom(MakeArticle("<p>a &amp;&nbsp; b &#x;c &#12x; &#</p>"));
+  ExpectSameAsDom(MakeArticle("<p>line\r\nbreaks\rand\n\rmore</p>"));
+  ExpectSameAsDom(MakeArticle("<p><b>x</b> <i>y</i>\n</p><p>\n  z  </p>"));
+  ExpectSameAsDom(MakeArticle("<address><a rel=\"author\"><b>x</b></a>"
+                              "</address>"));
+  ExpectSameAsDom(MakeArticle("<address><a rel=\"author\"><!-- c -->x</a>"
+                              "</address>"));
+  ExpectSameAsDom(MakeArticle("<address><a rel=\"author\">x<!-- c --></a>"
+                              "</address>"));
+  ExpectSameAsDom(MakeArticle("<address><a href=\"/\">x</a>"
+                              "<a rel=\"author\">y</a></address>"));
+  ExpectSameAsDom(MakeArticle("<address><time>x</time></address><p>y</p>"));
+  ExpectSameAsDom(MakeArticle("<p>x</p></article></body></html></x> tail"));
+  ExpectSameAsDom("\xEF\xBB\xBF<?xml version=\"1.0\"?>" + MakeArticle("<p/>"));
+  ExpectSameAsDom(MakeArticle("<p>x</b></p>"));
+  ExpectSameAsDom(MakeArticle("<div><p>nested</p></div><p>direct</p>"));
+  ExpectSameAsDom("<html><head><meta property=\"article:published_time\" "
+                  "content=\"2020/04/30\"/></head><body><article/></body>"
+                  "</html>");
+}
@@ -0,0 +1,399 @@
+#include "solver/incremental_clustering.h"
+
+#include "gtest/gtest.h"
+
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+
+using namespace tgnews;
+
+namespace {
+
+using Partition = std::set<std::set<std::string>>;
+
+Partition GetPartition(const std::vector<Cluster>& clusters) {
+  Partition partition;
+  for (const auto& cluster : clusters) {
+    std::set<std::string> names;
+    for (const auto& doc : cluster.GetDocs()) {
+      names.insert(doc->FileName);
+    }
+    partition.insert(std::move(names));
+  }
+  return partition;
+}
+
+ParsedDocPtr MakeDoc(const std::string& name, ELang lang,
+                     const Embedding& vector, uint64_t fetchTime = 1000) {
+  auto doc = std::make_shared<ParsedDoc>();
+  doc->FileName = name;
+  doc->Lang = lang;
+  doc->Category = NC_SOCIETY;
+  doc->Weight = 1.f;
+  doc->FetchTime = fetchTime;
+  doc->Vector = vector;
+  return doc;
+}
+
+// Documents around a few topics, far enough from the thresholds that
+// rounding doesn't decide a link. With duplicates, half of them are copies
+// of a few articles, embedded close to the article's topic as copies of one
+// text are: fingerprints up to two bits from the article's, so that copies
+// chain, and every other one with the embedding of an earlier copy.
+class Corpus {
+ public:
+  explicit Corpus(size_t topics, bool duplicates = false)
+      : Random(42), Duplicates(duplicates) {
+    std::normal_distribution<float> normal;
+    for (size_t i = 0; i < topics; ++i) {
+      Embedding center;
+      for (auto& value : center) {
+        value = normal(Random);
+      }
+      Centers.push_back(center);
+      if (Duplicates) {
+        Articles.push_back(NextFingerprint());
+      }
+    }
+  }
+
+  ParsedDocPtr Next(const std::string& name) {
+    std::normal_distribution<float> normal;
+    size_t topic = Random() % Centers.size();
+    const bool copy = Duplicates && Random() % 2 == 0;
+    // Articles are numbered like the topics they are about.
+    const size_t article = copy ? Random() % Articles.size() : 0;
+    if (copy) {
+      topic = article;
+    }
+    auto vector = Centers[topic];
+    float noise = !copy && Random() % 4 == 0 ? 1.f : 0.02f;
+    for (auto& value : vector) {
+      value += noise * normal(Random);
+    }
+    uint64_t fingerprint = 0;
+    if (copy) {
+      fingerprint = Articles[article];
+      for (int bits = Random() % 3; bits > 0; --bits) {
+        fingerprint ^= uint64_t(1) << (Random() % 64);
+      }
+      auto [copy, inserted] = Copies.emplace(article, vector);
+      if (!inserted && Random() % 2 == 0) {
+        vector = copy->second;
+      }
+    } else if (Duplicates) {
+      fingerprint = NextFingerprint();
+    }
+    auto doc = MakeDoc(name, Random() % 3 == 0 ? LangEn : LangRu, vector,
+                       1000 + Random() % 100);
+    std::const_pointer_cast<ParsedDoc>(doc)->Fingerprint = fingerprint;
+    return doc;
+  }
+
+  uint64_t NextFingerprint() {
+    return uint64_t(Random()) << 32 | Random();
+  }
+
+  std::mt19937 Random;
+  const bool Duplicates;
+  std::vector<Embedding> Centers;
+  std::vector<uint64_t> Articles;
+  std::map<size_t, Embedding> Copies;
+};
+
+}  // namespace
+
+TEST(IncrementalClusteringTest, MatchesBatchClustering) {
+  Corpus corpus(30, /*duplicates=*/true);
+  IncrementalClustering clustering;
+  std::map<std::string, ParsedDocPtr> docs;
+  auto check = [&] {
+    std::vector<ParsedDocPtr> all;
+    for (const auto& [name, doc] : docs) {
+      all.push_back(doc);
+    }
+    ClusteringOptions exact;
+    exact.Exact = true;
+    EXPECT_EQ(GetPartition(clustering.GetClusters()),
+              GetPartition(RunClustering(all, exact)));
+  };
+
+  size_t nextName = 0;
+  for (size_t step = 0; step < 20; ++step) {
+    for (size_t i = 0; i < 30; ++i) {
+      auto doc = corpus.Next(std::to_string(nextName++));
+      docs[doc->FileName] = doc;
+      clustering.Update(doc);
+    }
+    for (size_t i = 0; i < 10; ++i) {
+      auto it = std::next(docs.begin(), corpus.Random() % docs.size());
+      if (i % 2 == 0) {
+        clustering.Remove(it->first);
+        docs.erase(it);
+      } else {
+        // Changed content of a known name.
+        auto doc = corpus.Next(it->first);
+        it->second = doc;
+        clustering.Update(doc);
+      }
+    }
+    check();
+  }
+  EXPECT_EQ(clustering.Size(), docs.size());
+}
+
+TEST(IncrementalClusteringTest, LoadsAtOnce) {
+  Corpus corpus(30, /*duplicates=*/true);
+  std::vector<ParsedDocPtr> docs;
+  for (size_t i = 0; i < 500; ++i) {
+    docs.push_back(corpus.Next(std::to_string(i)));
+  }
+  IncrementalClustering loaded;
+  loaded.Load(docs);
+  IncrementalClustering updated;
+  for (const auto& doc : docs) {
+    updated.Update(doc);
+  }
+  EXPECT_EQ(GetPartition(loaded.GetClusters()),
+            GetPartition(updated.GetClusters()));
+
+  // Changes go on from the loaded clusters.
+  for (size_t i = 0; i < 100; ++i) {
+    loaded.Remove(docs[i]->FileName);
+    updated.Remove(docs[i]->FileName);
+    auto doc = corpus.Next(std::to_string(1000 + i));
+    loaded.Update(doc);
+    updated.Update(doc);
+  }
+  EXPECT_EQ(GetPartition(loaded.GetClusters()),
+            GetPartition(updated.GetClusters()));
+}
+
+TEST(IncrementalClusteringTest, LoadsWithTheLinkageOfUpdates) {
+  // Two tight pairs within the threshold of each other: the nearest
+  // neighbour of every document is its twin, the pairs are linked only
+  // when the later one looks up the earlier.
+  Embedding a = {}, a2 = {}, c = {}, c2 = {};
+  a[0] = a2[0] = c[0] = c2[0] = 1.f;
+  a2[1] = 0.01f;
+  c[1] = 0.2f;
+  c2[1] = 0.21f;
+  std::vector<ParsedDocPtr> docs = {
+      MakeDoc("a", LangRu, a), MakeDoc("a2", LangRu, a2),
+      MakeDoc("c", LangRu, c), MakeDoc("c2", LangRu, c2)};
+  HnswOptions ann;
+  ann.Neighbours = 1;
+
+  IncrementalClustering loaded(ann);
+  loaded.Load(docs);
+  IncrementalClustering updated(ann);
+  for (const auto& doc : docs) {
+    updated.Update(doc);
+  }
+  auto expected = Partition({{"a", "a2", "c", "c2"}});
+  EXPECT_EQ(GetPartition(updated.GetClusters()), expected);
+  EXPECT_EQ(GetPartition(loaded.GetClusters()), expected);
+}
+
+TEST(IncrementalClusteringTest, RemovalSplitsChain) {
+  // a - b - c are linked through b only.
+  Embedding a = {}, b = {}, c = {};
+  a[0] = 1.f;
+  b[0] = 1.f;
+  b[1] = 0.2f;
+  c[0] = 1.f;
+  c[1] = 0.4f;
+  IncrementalClustering clustering;
+  for (const auto& [name, vector] : {std::pair{"a", a}, {"b", b}, {"c", c}}) {
+    clustering.Update(MakeDoc(name, LangRu, vector));
+  }
+  EXPECT_EQ(GetPartition(clustering.GetClusters()),
+            Partition({{"a", "b", "c"}}));
+
+  clustering.Remove("b");
+  EXPECT_EQ(GetPartition(clustering.GetClusters()), Partition({{"a"}, {"c"}}));
+
+  clustering.Update(MakeDoc("b", LangRu, b));
+  EXPECT_EQ(GetPartition(clustering.GetClusters()),
+            Partition({{"a", "b", "c"}}));
+}
+
+TEST(IncrementalClusteringTest, RemovalKeepsLinkedNeighbours) {
+  // c links a and b, which are linked on their own too.
+  Embedding a = {}, b = {}, c = {};
+  a[0] = b[0] = c[0] = 1.f;
+  b[1] = 0.2f;
+  c[1] = 0.1f;
+  IncrementalClustering clustering;
+  for (const auto& [name, vector] : {std::pair{"a", a}, {"b", b}, {"c", c}}) {
+    clustering.Update(MakeDoc(name, LangRu, vector));
+  }
+  clustering.Remove("c");
+  EXPECT_EQ(GetPartition(clustering.GetClusters()), Partition({{"a", "b"}}));
+}
+
+TEST(IncrementalClusteringTest, RebuildsIndexOfRemainingDocuments) {
+  Corpus corpus(30, /*duplicates=*/true);
+  IncrementalClustering clustering;
+  std::map<std::string, ParsedDocPtr> docs;
+  size_t nextName = 0;
+  auto add = [&](size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      auto doc = corpus.Next(std::to_string(nextName++));
+      docs[doc->FileName] = doc;
+      clustering.Update(doc);
+    }
+  };
+  add(300);
+  // Most points in the index are removed ones by now, it is built again.
+  while (docs.size() > 50) {
+    auto it = std::next(docs.begin(), corpus.Random() % docs.size());
+    clustering.Remove(it->first);
+    docs.erase(it);
+  }
+  add(100);
+
+  std::vector<ParsedDocPtr> all;
+  for (const auto& [name, doc] : docs) {
+    all.push_back(doc);
+  }
+  ClusteringOptions exact;
+  exact.Exact = true;
+  EXPECT_EQ(GetPartition(clustering.GetClusters()),
+            GetPartition(RunClustering(all, exact)));
+  EXPECT_EQ(clustering.Size(), docs.size());
+}
+
+TEST(IncrementalClusteringTest, SkipsOtherDocuments) {
+  Embedding vector = {};
+  vector[0] = 1.f;
+  IncrementalClustering clustering;
+  clustering.Update(MakeDoc("ru", LangRu, vector));
+  clustering.Update(MakeDoc("en", LangEn, vector));
+  clustering.Update(MakeDoc("tg", LangTg, vector));
+  auto notNews = MakeDoc("not_news", LangRu, vector);
+  std::const_pointer_cast<ParsedDoc>(notNews)->Category = NC_NOT_NEWS;
+  clustering.Update(notNews);
+  // Languages are clustered apart.
+  EXPECT_EQ(GetPartition(clustering.GetClusters()),
+            Partition({{"ru"}, {"en"}}));
+
+  // Became not news.
+  auto changed = MakeDoc("ru", LangRu, vector);
+  std::const_pointer_cast<ParsedDoc>(changed)->Category = NC_NOT_NEWS;
+  clustering.Update(changed);
+  EXPECT_EQ(GetPartition(clustering.GetClusters()), Partition({{"en"}}));
+  EXPECT_EQ(clustering.Size(), 1u);
+}
+
+TEST(IncrementalClusteringTest, LinksChainsOfNearDuplicates) {
+  // b is 4 bits from a, c is 2 bits from both: one article however they
+  // come in.
+  Embedding a = {}, b = {}, c = {};
+  a[0] = 1.f;
+  b[1] = 1.f;
+  c[2] = 1.f;
+  std::vector<ParsedDocPtr> docs = {MakeDoc("a", LangRu, a),
+                                    MakeDoc("b", LangRu, b),
+                                    MakeDoc("c", LangRu, c)};
+  std::const_pointer_cast<ParsedDoc>(docs[0])->Fingerprint = 0xf0f0;
+  std::const_pointer_cast<ParsedDoc>(docs[1])->Fingerprint = 0xf0ff;
+  std::const_pointer_cast<ParsedDoc>(docs[2])->Fingerprint = 0xf0f3;
+
+  IncrementalClustering clustering;
+  for (const auto& doc : docs) {
+    clustering.Update(doc);
+  }
+  auto expected = Partition({{"a", "b", "c"}});
+  EXPECT_EQ(GetPartition(clustering.GetClusters()), expected);
+  ClusteringOptions exact;
+  exact.Exact = true;
+  EXPECT_EQ(GetPartition(RunClustering(docs, exact)), expected);
+  EXPECT_EQ(GetPartition(RunClustering(docs)), expected);
+}
+
+TEST(IncrementalClusteringTest, LinksNearDuplicatesThroughFirstCopy) {
+  // b is a copy of a with an embedding close to d, a's is far from both.
+  Embedding a = {}, b = {}, d = {};
+  a[2] = 1.f;
+  b[0] = d[0] = 1.f;
+  d[1] = 0.2f;
+  std::vector<ParsedDocPtr> docs = {MakeDoc("a", LangRu, a),
+                                    MakeDoc("b", LangRu, b),
+                                    MakeDoc("d", LangRu, d)};
+  std::const_pointer_cast<ParsedDoc>(docs[0])->Fingerprint = 0xf0f0;
+  std::const_pointer_cast<ParsedDoc>(docs[1])->Fingerprint = 0xf0f1;
+
+  // Only a and d are linked, b follows a.
+  auto expected = Partition({{"a", "b"}, {"d"}});
+  ClusteringOptions exact;
+  exact.Exact = true;
+  EXPECT_EQ(GetPartition(RunClustering(docs, exact)), expected);
+  EXPECT_EQ(GetPartition(RunClustering(docs)), expected);
+
+  // Without a the copy is linked on its own.
+  docs.erase(docs.begin());
+  EXPECT_EQ(GetPartition(RunClustering(docs, exact)),
+            Partition({{"b", "d"}}));
+}
+
+TEST(IncrementalClusteringTest, CollapsesNearDuplicates) {
+  // Far apart embeddings of one syndicated article.
+  Embedding a = {}, b = {}, c = {};
+  a[0] = 1.f;
+  b[1] = 1.f;
+  c[2] = 1.f;
+  std::vector<ParsedDocPtr> docs = {MakeDoc("a", LangRu, a),
+                                    MakeDoc("b", LangRu, b),
+                                    MakeDoc("c", LangRu, c)};
+  std::const_pointer_cast<ParsedDoc>(docs[0])->Fingerprint = 0xf0f0;
+  std::const_pointer_cast<ParsedDoc>(docs[1])->Fingerprint = 0xf0f1;
+
+  IncrementalClustering clustering;
+  for (const auto& doc : docs) {
+    clustering.Update(doc);
+  }
+  auto expected = Partition({{"a", "b"}, {"c"}});
+  EXPECT_EQ(GetPartition(clustering.GetClusters()), expected);
+  EXPECT_EQ(GetPartition(RunClustering(docs)), expected);
+
+  ClusteringOptions apart;
+  apart.CollapseNearDuplicates = false;
+  EXPECT_EQ(GetPartition(RunClustering(docs, apart)),
+            Partition({{"a"}, {"b"}, {"c"}}));
+
+  clustering.Remove("a");
+  EXPECT_EQ(GetPartition(clustering.GetClusters()),
+            Partition({{"b"}, {"c"}}));
+}
+
+TEST(IncrementalClusteringTest, AppliesBatchesPerLanguage) {
+  Corpus corpus(30);
+  IncrementalClustering applied;
+  IncrementalClustering updated;
+  std::experimental::thread_pool pool(2);
+  for (size_t step = 0; step < 10; ++step) {
+    std::vector<DocumentChange> changes;
+    for (size_t i = 0; i < 40; ++i) {
+      // Names repeat, so documents change and move between languages.
+      auto doc = corpus.Next(std::to_string(corpus.Random() % 150));
+      bool removed = corpus.Random() % 5 == 0;
+      changes.push_back(
+          {removed ? ParsedDoc::EState::Removed : ParsedDoc::EState::Added,
+           doc->FileName, removed ? nullptr : doc});
+      if (removed) {
+        updated.Remove(doc->FileName);
+      } else {
+        updated.Update(doc);
+      }
+    }
+    applied.Apply(changes, &pool);
+    EXPECT_EQ(GetPartition(applied.GetClusters(&pool)),
+              GetPartition(updated.GetClusters()));
+    EXPECT_EQ(applied.Size(), updated.Size());
+  }
+  pool.stop();
+  pool.join();
+}
@@ -0,0 +1,85 @@
+#include "base/lang_detector.h"
+
+#include "gtest/gtest.h"
+
+#include <string>
+
+using namespace tgnews;
+
+namespace {
+
+ELang DetectByScript(std::string_view text) {
+  return CascadeLangDetector::DetectByScript({text});
+}
+
+}  // namespace
+
+TEST(LangDetectorTest, DetectsRussian) {
+  EXPECT_EQ(DetectByScript("В Москве открылся новый музей современного "
+                           "искусства, его первыми посетителями стали "
+                           "школьники"),
+            LangRu);
+  // A few names in latin letters.
+  EXPECT_EQ(CascadeLangDetector::DetectByScript(
+                {"Apple представила новый iPhone",
+                 "Компания показала смартфоны на презентации в Калифорнии"}),
+            LangRu);
+}
+
+TEST(LangDetectorTest, DetectsEnglish) {
+  EXPECT_EQ(DetectByScript("The company said that its revenue was higher "
+                           "than expected after the launch of the new phone"),
+            LangEn);
+  EXPECT_EQ(DetectByScript("Erdoğan said the talks with the delegation were "
+                           "about trade and that they will continue"),
+            LangEn);
+}
+
+TEST(LangDetectorTest, DetectsTajik) {
+  EXPECT_EQ(DetectByScript("Дар шаҳри Душанбе маҷлиси навбатии ҳукумати "
+                           "Ҷумҳурии Тоҷикистон баргузор гардид"),
+            LangTg);
+}
+
+TEST(LangDetectorTest, LeavesAmbiguousToModel) {
+  // Too short.
+  EXPECT_EQ(DetectByScript("Новости дня"), LangUndefined);
+  EXPECT_EQ(DetectByScript("Breaking news"), LangUndefined);
+  // Ukrainian and Bulgarian, no ы or letters of their own.
+  EXPECT_EQ(DetectByScript("У Києві відкрився новий музей сучасного "
+                           "мистецтва, його першими відвідувачами стали "
+                           "школярі"),
+            LangUndefined);
+  EXPECT_EQ(DetectByScript("В София откриха нов музей на съвременното "
+                           "изкуство, първите посетители бяха ученици"),
+            LangUndefined);
+  // Latin letters, but not English.
+  EXPECT_EQ(DetectByScript("Pemerintah mengumumkan rencana pembangunan "
+                           "jalan baru di kota dan desa yang terpencil"),
+            LangUndefined);
+  EXPECT_EQ(DetectByScript("Le gouvernement a annoncé une nouvelle réforme "
+                           "des retraites qui sera présentée en été"),
+            LangUndefined);
+  // Russian among markup, which the model is unsure about.
+  EXPECT_EQ(DetectByScript("~~~~~~~~~~~~~~~~~~~~ Урок 4.4: СПОСОБ ИСПРАВЛЕНИЯ "
+                           "ОШИБОК ** Наберите :s/было/стало/g для замены"),
+            LangUndefined);
+  // Half and half.
+  EXPECT_EQ(DetectByScript("The company said that its revenue was higher "
+                           "than expected, сообщили в пресс-службе компании "
+                           "в понедельник"),
+            LangUndefined);
+}
+
+TEST(LangDetectorTest, ReadsOnlyTheBeginning) {
+  std::string russian;
+  while (russian.size() < 1000) {
+    russian += "Мы были рады этой новости. ";
+  }
+  EXPECT_EQ(CascadeLangDetector::DetectByScript(
+                {russian, "Дар шаҳри Душанбе маҷлиси ҳукумат"}),
+            LangRu);
+  // Cut in the middle of a letter.
+  EXPECT_EQ(DetectByScript(std::string_view(russian).substr(0, 101)),
+            LangRu);
+}
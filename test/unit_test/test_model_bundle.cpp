@@ -0,0 +1,87 @@
+#include "base/agency.h"
+#include "base/model_bundle.h"
+
+#include "gtest/gtest.h"
+
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace tgnews;
+
+namespace {
+
+class ModelBundleTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    dir_ = boost::filesystem::temp_directory_path() /
+           boost::filesystem::unique_path();
+    boost::filesystem::create_directories(dir_);
+  }
+
+  void TearDown() override { boost::filesystem::remove_all(dir_); }
+
+  std::string GetPath(const std::string& name) const {
+    return (dir_ / name).string();
+  }
+
+  boost::filesystem::path dir_;
+};
+
+}  // namespace
+
+TEST_F(ModelBundleTest, ReadsSectionsInPlace) {
+  std::vector<float> values = {1.f, -2.5f, 3.f};
+  ModelBundle::Writer writer;
+  writer.Add("model.ftz", "odd sized");
+  writer.AddArray("matrix", values.data(), values.size());
+  writer.Add("empty", "");
+  writer.Write(GetPath("models.bundle"));
+
+  ModelBundle bundle(GetPath("models.bundle"));
+  EXPECT_TRUE(bundle.Has("matrix"));
+  EXPECT_FALSE(bundle.Has("matrix.txt"));
+  EXPECT_EQ(bundle.Get("model.ftz"), "odd sized");
+  EXPECT_EQ(bundle.Get("empty"), "");
+  EXPECT_THROW(bundle.Get("missing"), std::runtime_error);
+
+  size_t count = 0;
+  const float* mapped = bundle.GetArray<float>("matrix", count);
+  ASSERT_EQ(count, values.size());
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(mapped) % ModelBundle::kAlignment, 0u);
+  EXPECT_EQ(std::vector<float>(mapped, mapped + count), values);
+  EXPECT_THROW(bundle.GetArray<double>("model.ftz", count),
+               std::runtime_error);
+}
+
+TEST_F(ModelBundleTest, RejectsOtherFiles) {
+  {
+    std::ofstream out(GetPath("garbage"));
+    out << "not a bundle at all";
+  }
+  EXPECT_THROW(ModelBundle(GetPath("garbage")), std::runtime_error);
+  EXPECT_THROW(ModelBundle(GetPath("missing")), std::runtime_error);
+
+  ModelBundle::Writer writer;
+  writer.Add("model", std::string(1000, 'x'));
+  writer.Write(GetPath("models.bundle"));
+  boost::filesystem::resize_file(GetPath("models.bundle"), 500);
+  EXPECT_THROW(ModelBundle(GetPath("models.bundle")), std::runtime_error);
+}
+
+TEST_F(ModelBundleTest, KeepsAgencyRatings) {
+  {
+    std::ofstream out(GetPath("pagerank_rating.txt"));
+    out << "0.5\tlenta.ru\n0.25\tbbc.com\n";
+  }
+  TAgencyRating ratings(GetPath("pagerank_rating.txt"), true);
+  TAgencyRating restored;
+  restored.Deserialize(ratings.Serialize());
+  for (const auto& url : {"https://lenta.ru/news/1", "https://www.bbc.com/a",
+                          "https://example.com/"}) {
+    EXPECT_EQ(restored.ScoreUrl(url), ratings.ScoreUrl(url)) << url;
+  }
+  EXPECT_EQ(restored.ScoreUrl("https://example.com/"), 0.25);
+  EXPECT_THROW(restored.Deserialize("abc"), std::runtime_error);
+}
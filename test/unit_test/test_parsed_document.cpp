@@ -0,0 +1,160 @@
+#include "base/document_record.h"
+#include "base/parsed_document.h"
+#include "base/string_pool.h"
+
+#include "gtest/gtest.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace tgnews;
+
+namespace {
+
+constexpr size_t kDocuments = 1'000'000;
+constexpr size_t kSites = 5'000;
+
+// ParsedDoc as it was before the compaction. fasttext::Vector is a thin
+// wrapper over std::vector<float>.
+struct LegacyParsedDoc {
+  std::string Data;
+  int State = 0;
+  std::string Url;
+  std::string SiteName;
+  std::string Description;
+  std::string Text;
+  std::string Author;
+  uint64_t PubTime = 0;
+  uint64_t FetchTime = 0;
+  uint64_t MaxAge = 0;
+  std::string Title;
+  std::string GoodTitle;
+  std::string GoodText;
+  std::string FileName;
+  std::string Lang;
+  int Category = 0;
+  std::vector<float> Vector = std::vector<float>(EmbeddingSize);
+  float Weight = -1.f;
+
+  size_t ResidentBytes() const {
+    const size_t inlineCapacity = std::string().capacity();
+    size_t bytes = sizeof(*this) + Vector.capacity() * sizeof(float);
+    for (const std::string* s :
+         {&Data, &Url, &SiteName, &Description, &Text, &Author, &Title,
+          &GoodTitle, &GoodText, &FileName, &Lang}) {
+      if (s->capacity() > inlineCapacity) {
+        bytes += s->capacity() + 1;
+      }
+    }
+    return bytes;
+  }
+};
+
+// Sizes close to the median article of the contest data set.
+const std::string kHtml(30000, 'h');
+const std::string kUrl = "https://www.example-news-site.com/world/2020/04/30/"
+                         "scientists-discover-new-species-of-mammal-12345";
+const std::string kSiteName = "Example News Site";
+const std::string kDescription(200, 'd');
+const std::string kText(2500, 't');
+const std::string kTitle(80, 'T');
+const std::string kFileName = "1234567890123456789.html";
+
+std::string SiteName(size_t i) {
+  return kSiteName + " " + std::to_string(i % kSites);
+}
+
+std::string HostName(size_t i) {
+  return "example-news-site-" + std::to_string(i % kSites) + ".com";
+}
+
+LegacyParsedDoc MakeLegacyDoc(size_t i) {
+  LegacyParsedDoc doc;
+  doc.Data = kHtml;
+  doc.Url = kUrl;
+  doc.SiteName = SiteName(i);
+  doc.Description = kDescription;
+  doc.Text = kText;
+  doc.Title = kTitle;
+  doc.GoodTitle = kTitle + kTitle.substr(0, 10);
+  doc.GoodText = kText + kText.substr(0, 250);
+  doc.FileName = kFileName;
+  doc.Lang = "en";
+  return doc;
+}
+
+ParsedDoc MakeDoc(StringPool& pool, size_t i) {
+  ParsedDoc doc;
+  doc.Url = kUrl;
+  doc.SiteId = pool.Intern(SiteName(i));
+  doc.HostId = pool.Intern(HostName(i));
+  doc.Description = kDescription;
+  doc.Text = kText;
+  doc.Title = kTitle;
+  doc.GoodTitle = kTitle + kTitle.substr(0, 10);
+  doc.GoodText = kText + kText.substr(0, 250);
+  doc.FileName = kFileName;
+  doc.Lang = LangEn;
+  return doc;
+}
+
+}  // namespace
+
+TEST(ParsedDocTest, LangCodes) {
+  for (auto lang : {LangRu, LangEn, LangTg, LangOther, LangUndefined}) {
+    EXPECT_EQ(LangFromCode(LangCode(lang)), lang);
+  }
+  EXPECT_EQ(LangFromCode("de"), LangOther);
+  EXPECT_EQ(LangCode(LangOther), "other");
+}
+
+TEST(ParsedDocTest, ReadsOtherLangCodesOfOlderDumps) {
+  ParsedDoc doc;
+  doc.Lang = LangOther;
+  auto value = doc.Serialize();
+  EXPECT_EQ(value.at("Lang"), "other");
+  value["Lang"] = "de";
+  EXPECT_EQ(ParsedDoc(value).Lang, LangOther);
+}
+
+TEST(ParsedDocTest, CategoryNames) {
+  for (size_t i = 0; i < CategoryNames.size(); i++) {
+    EXPECT_EQ(CategoryFromName(CategoryNames[i]), static_cast<int>(i));
+  }
+  EXPECT_EQ(CategoryFromName("not_news"), NC_NOT_NEWS);
+  EXPECT_EQ(CategoryFromName("weather"), NC_UNDEFINED);
+}
+
+TEST(ParsedDocTest, InternsStrings) {
+  StringPool pool;
+  EXPECT_EQ(pool.Intern(""), 0u);
+  auto id = pool.Intern("site");
+  EXPECT_EQ(pool.Intern(std::string("site")), id);
+  EXPECT_NE(pool.Intern("other site"), id);
+  EXPECT_EQ(pool.Get(id), "site");
+  EXPECT_EQ(pool.Size(), 3u);
+}
+
+TEST(ParsedDocTest, ResidentBytes) {
+  // Interned strings are shared, so charge every document its share of a
+  // pool holding all the distinct sites and hosts.
+  StringPool pool;
+  for (size_t i = 0; i < kSites; i++) {
+    MakeDoc(pool, i);
+  }
+  const double poolBytesPerDoc =
+      static_cast<double>(pool.ResidentBytes()) / kDocuments;
+
+  const double legacyBytes = MakeLegacyDoc(0).ResidentBytes();
+  const double compactBytes = MakeDoc(pool, 0).ResidentBytes() + poolBytesPerDoc;
+
+  std::cout << "bytes per resident document: legacy " << legacyBytes
+            << ", compact " << compactBytes << std::endl;
+  std::cout << "resident MiB at " << kDocuments << " documents: legacy "
+            << legacyBytes * kDocuments / (1 << 20) << ", compact "
+            << compactBytes * kDocuments / (1 << 20) << std::endl;
+
+  // The raw html alone is most of the legacy document.
+  EXPECT_LT(compactBytes * 2, legacyBytes);
+}
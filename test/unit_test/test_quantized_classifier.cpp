@@ -0,0 +1,291 @@
+#include "base/quantized_classifier.h"
+
+#include "gtest/gtest.h"
+
+#include <cmath>
+#include <optional>
+#include <random>
+#include <sstream>
+
+using namespace tgnews;
+
+namespace {
+
+constexpr int32_t kDim = 21;
+constexpr int32_t kSubDim = 2;
+constexpr int32_t kSubquantizers = 11;
+constexpr int32_t kRows = 300;
+constexpr int32_t kLabels = 5;
+constexpr int32_t kSoftmax = 3;
+constexpr int32_t kOneVsAll = 4;
+
+// Writes a supervised model the way fastText saves it after quantize, and
+// keeps the decoded matrices for reference.
+class TestModel {
+ public:
+  explicit TestModel(int32_t loss, bool quantized_output = false,
+                     bool quantized_input = true)
+      : input_(kRows * kDim), output_(kLabels * kDim) {
+    Put<int32_t>(793712314);
+    Put<int32_t>(12);
+    for (int32_t value : {kDim, 5, 5, 1, 5, 2, loss, 3, 1000, 0, 0, 100}) {
+      Put(value);
+    }
+    Put<double>(1e-4);
+
+    // Words and labels with made up counts, pruned to no ngrams.
+    Put<int32_t>(3 + kLabels);
+    Put<int32_t>(3);
+    Put<int32_t>(kLabels);
+    Put<int64_t>(100);
+    Put<int64_t>(0);
+    for (int32_t i = 0; i < 3 + kLabels; i++) {
+      std::string word = i < 3 ? "word" + std::to_string(i)
+                               : "__label__" + std::to_string(i - 3);
+      stream_.write(word.c_str(), word.size() + 1);
+      Put<int64_t>(10 - i);
+      Put<int8_t>(i < 3 ? 0 : 1);
+    }
+
+    Put(quantized_input);
+    if (quantized_input) {
+      PutQuantMatrix(kRows, input_);
+    } else {
+      PutDenseMatrix(kRows, input_);
+    }
+    Put(quantized_output);
+    if (quantized_output) {
+      PutQuantMatrix(kLabels, output_);
+    } else {
+      PutDenseMatrix(kLabels, output_);
+    }
+  }
+
+  std::unique_ptr<QuantizedClassifier> Load() {
+    std::istringstream in(stream_.str());
+    return QuantizedClassifier::Load(in);
+  }
+
+  // FastText::predict in doubles, log probabilities aside.
+  std::vector<double> GetLogits(const std::vector<int32_t>& words) const {
+    auto hidden = GetHidden(words);
+    std::vector<double> logits(kLabels);
+    for (int32_t label = 0; label < kLabels; label++) {
+      for (int32_t i = 0; i < kDim; i++) {
+        logits[label] += output_[label * kDim + i] * hidden[i];
+      }
+    }
+    return logits;
+  }
+
+  // Rounding the output layer to int8 moves the logits by about a percent
+  // of this.
+  double GetLogitScale(const std::vector<int32_t>& words) const {
+    auto hidden = GetHidden(words);
+    double hidden_norm = 0;
+    for (double value : hidden) {
+      hidden_norm += value * value;
+    }
+    double max_norm = 0;
+    for (int32_t label = 0; label < kLabels; label++) {
+      double norm = 0;
+      for (int32_t i = 0; i < kDim; i++) {
+        norm += output_[label * kDim + i] * output_[label * kDim + i];
+      }
+      max_norm = std::max(max_norm, norm);
+    }
+    return std::sqrt(hidden_norm * max_norm);
+  }
+
+ private:
+  std::vector<double> GetHidden(const std::vector<int32_t>& words) const {
+    std::vector<double> hidden(kDim);
+    for (int32_t id : words) {
+      for (int32_t i = 0; i < kDim; i++) {
+        hidden[i] += input_[id * kDim + i] / double(words.size());
+      }
+    }
+    return hidden;
+  }
+
+  template <typename T>
+  void Put(T value) {
+    stream_.write(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  void PutCentroids(int32_t dim, int32_t sub_dim, int32_t last_sub_dim,
+                    std::vector<float>& centroids) {
+    Put<int32_t>(dim);
+    Put<int32_t>((dim - last_sub_dim) / sub_dim + 1);
+    Put<int32_t>(sub_dim);
+    Put<int32_t>(last_sub_dim);
+    std::normal_distribution<float> normal;
+    centroids.resize(dim * 256);
+    for (float& value : centroids) {
+      value = normal(random_);
+      Put(value);
+    }
+  }
+
+  void PutQuantMatrix(int32_t rows, std::vector<float>& decoded) {
+    Put(true);
+    Put<int64_t>(rows);
+    Put<int64_t>(kDim);
+    std::vector<uint8_t> codes(rows * kSubquantizers);
+    for (auto& code : codes) {
+      code = random_() % 256;
+    }
+    Put<int32_t>(codes.size());
+    stream_.write(reinterpret_cast<const char*>(codes.data()), codes.size());
+    std::vector<float> centroids;
+    PutCentroids(kDim, kSubDim, 1, centroids);
+
+    std::vector<uint8_t> norm_codes(rows);
+    for (auto& code : norm_codes) {
+      code = random_() % 256;
+    }
+    stream_.write(reinterpret_cast<const char*>(norm_codes.data()), rows);
+    std::vector<float> norms;
+    PutCentroids(1, 1, 1, norms);
+
+    for (int32_t r = 0; r < rows; r++) {
+      for (int32_t m = 0; m < kSubquantizers; m++) {
+        uint8_t code = codes[r * kSubquantizers + m];
+        const float* centroid =
+            m + 1 == kSubquantizers
+                ? &centroids[m * 256 * kSubDim + code]
+                : &centroids[(m * 256 + code) * kSubDim];
+        for (int32_t i = 0; i < kSubDim && m * kSubDim + i < kDim; i++) {
+          decoded[r * kDim + m * kSubDim + i] =
+              norms[norm_codes[r]] * centroid[i];
+        }
+      }
+    }
+  }
+
+  void PutDenseMatrix(int32_t rows, std::vector<float>& values) {
+    Put<int64_t>(rows);
+    Put<int64_t>(kDim);
+    std::normal_distribution<float> normal;
+    for (float& value : values) {
+      value = normal(random_);
+      Put(value);
+    }
+  }
+
+  std::mt19937 random_{7};
+  std::ostringstream stream_;
+  std::vector<float> input_;
+  std::vector<float> output_;
+};
+
+std::vector<std::vector<int32_t>> MakeTexts(size_t count) {
+  std::mt19937 random(11);
+  std::vector<std::vector<int32_t>> texts(count);
+  for (auto& words : texts) {
+    words.resize(1 + random() % 40);
+    for (auto& id : words) {
+      id = random() % kRows;
+    }
+  }
+  return texts;
+}
+
+std::vector<Int8Kernel> GetSupportedKernels() {
+  std::vector<Int8Kernel> kernels = {Int8Kernel::Scalar};
+  if (DetectInt8Kernel() != Int8Kernel::Scalar) {
+    kernels.push_back(Int8Kernel::Avx2);
+  }
+  if (DetectInt8Kernel() == Int8Kernel::Vnni) {
+    kernels.push_back(Int8Kernel::Vnni);
+  }
+  return kernels;
+}
+
+}  // namespace
+
+TEST(QuantizedClassifierTest, MatchesFloatModel) {
+  for (bool quantized_output : {false, true}) {
+    TestModel model(kSoftmax, quantized_output);
+    auto classifier = model.Load();
+    ASSERT_TRUE(classifier);
+    EXPECT_EQ(classifier->GetLabelCount(), kLabels);
+
+    size_t clear = 0;
+    size_t same = 0;
+    for (const auto& words : MakeTexts(2000)) {
+      auto logits = model.GetLogits(words);
+      std::vector<double> sorted = logits;
+      std::sort(sorted.rbegin(), sorted.rend());
+      double sum = 0;
+      for (double logit : logits) {
+        sum += std::exp(logit - sorted[0]);
+      }
+
+      auto expected = classifier->Predict(words, 0.f, Int8Kernel::Scalar);
+      ASSERT_TRUE(expected);
+      for (auto kernel : GetSupportedKernels()) {
+        auto prediction = classifier->Predict(words, 0.f, kernel);
+        ASSERT_TRUE(prediction) << GetInt8KernelName(kernel);
+        EXPECT_EQ(prediction->label, expected->label);
+        EXPECT_EQ(prediction->probability, expected->probability);
+      }
+      EXPECT_NEAR(expected->probability, 1 / sum, 0.02);
+      same += logits[expected->label] == sorted[0];
+      // Rounding only matters on near ties.
+      if (sorted[0] - sorted[1] > 0.02 * model.GetLogitScale(words)) {
+        clear++;
+        EXPECT_EQ(logits[expected->label], sorted[0]);
+      }
+    }
+    EXPECT_GT(clear, 1500u);
+    EXPECT_GT(same, 1985u);
+  }
+}
+
+TEST(QuantizedClassifierTest, AppliesThreshold) {
+  TestModel model(kOneVsAll);
+  auto classifier = model.Load();
+  ASSERT_TRUE(classifier);
+  EXPECT_FALSE(classifier->Predict({}, 0.f));
+
+  std::vector<int32_t> words = {1, 2, 3};
+  auto logits = model.GetLogits(words);
+  double best = *std::max_element(logits.begin(), logits.end());
+  auto prediction = classifier->Predict(words, 0.f);
+  ASSERT_TRUE(prediction);
+  EXPECT_NEAR(prediction->probability, 1 / (1 + std::exp(-best)), 0.05);
+  EXPECT_FALSE(classifier->Predict(words, prediction->probability + 0.01f));
+  EXPECT_THROW(classifier->Predict({kRows}, 0.f), std::runtime_error);
+}
+
+TEST(QuantizedClassifierTest, PredictsBatches) {
+  TestModel model(kSoftmax);
+  auto classifier = model.Load();
+  ASSERT_TRUE(classifier);
+  auto texts = MakeTexts(100);
+  texts[10].clear();
+  for (auto kernel : GetSupportedKernels()) {
+    std::vector<std::optional<QuantizedClassifier::Prediction>> predictions;
+    classifier->Predict(texts, 0.f, predictions, kernel);
+    ASSERT_EQ(predictions.size(), texts.size());
+    for (size_t i = 0; i < texts.size(); i++) {
+      auto expected = classifier->Predict(texts[i], 0.f, kernel);
+      ASSERT_EQ(predictions[i].has_value(), expected.has_value());
+      if (expected) {
+        EXPECT_EQ(predictions[i]->label, expected->label);
+        EXPECT_EQ(predictions[i]->probability, expected->probability);
+      }
+    }
+    EXPECT_FALSE(predictions[10]);
+  }
+}
+
+TEST(QuantizedClassifierTest, SkipsUnsupportedModels) {
+  // Hierarchical softmax and plain matrices are left to fastText.
+  EXPECT_FALSE(TestModel(1).Load());
+  EXPECT_FALSE(TestModel(kSoftmax, false, false).Load());
+
+  std::istringstream garbage("not a model");
+  EXPECT_THROW(QuantizedClassifier::Load(garbage), std::runtime_error);
+}
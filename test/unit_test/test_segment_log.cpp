@@ -0,0 +1,272 @@
+#include "base/segment_log.h"
+
+#include "gtest/gtest.h"
+
+#include <sys/resource.h>
+
+#include <boost/filesystem.hpp>
+#include <csignal>
+#include <boost/range/iterator_range.hpp>
+#include <fstream>
+#include <future>
+#include <map>
+#include <mutex>
+#include <string>
+
+using namespace tgnews;
+
+namespace {
+
+class SegmentLogTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    dir_ = boost::filesystem::temp_directory_path() /
+           boost::filesystem::unique_path("segment-log-%%%%-%%%%");
+    options_.segment_size = 256;
+  }
+
+  void TearDown() override { boost::filesystem::remove_all(dir_); }
+
+  std::map<std::string, std::string> Reopen(
+      std::unique_ptr<SegmentLog>& log) {
+    log.reset();
+    log = std::make_unique<SegmentLog>(dir_.string(), options_);
+    std::map<std::string, std::string> values;
+    log->Replay([&](std::string_view name, uint64_t, std::string_view value) {
+      values.emplace(name, value);
+    });
+    return values;
+  }
+
+  size_t SegmentCount() const {
+    size_t count = 0;
+    for (const auto& entry : boost::make_iterator_range(
+             boost::filesystem::directory_iterator(dir_), {})) {
+      count += entry.path().extension() == ".log";
+    }
+    return count;
+  }
+
+  // Waits for everything queued before it to be written.
+  static void Flush(SegmentLog& log) {
+    std::promise<void> written;
+    log.Delete("flush", [&](std::exception_ptr) { written.set_value(); });
+    written.get_future().wait();
+  }
+
+  boost::filesystem::path dir_;
+  SegmentLog::Options options_;
+};
+
+}  // namespace
+
+TEST_F(SegmentLogTest, ReplaysLatestPuts) {
+  std::unique_ptr<SegmentLog> log;
+  EXPECT_TRUE(Reopen(log).empty());
+
+  log->Put("a", 100, "first");
+  log->Put("b", 100, "second");
+  log->Put("a", 100, "third");
+  log->Put("c", 100, "fourth");
+  log->Delete("b");
+  Flush(*log);
+
+  auto expected = std::map<std::string, std::string>(
+      {{"a", "third"}, {"c", "fourth"}});
+  EXPECT_EQ(Reopen(log), expected);
+  EXPECT_EQ(log->LiveRecords(), 2u);
+}
+
+TEST_F(SegmentLogTest, GetsLiveValues) {
+  std::unique_ptr<SegmentLog> log;
+  Reopen(log);
+  log->Put("a", 1000, "old");
+  log->Put("b", 1000, std::string(200, 'b'));
+  log->Put("a", 1000, "new");
+  log->Put("c", 1000, "deleted");
+  log->Delete("c");
+  Flush(*log);
+
+  EXPECT_EQ(log->Get("a"), "new");
+  EXPECT_EQ(log->Get("b"), std::string(200, 'b'));
+  EXPECT_FALSE(log->Get("c").has_value());
+  EXPECT_FALSE(log->Get("missing").has_value());
+
+  // Still found once compaction moved the records.
+  ASSERT_TRUE(log->Compact(500));
+  EXPECT_EQ(log->Get("a"), "new");
+  EXPECT_EQ(log->Get("b"), std::string(200, 'b'));
+}
+
+TEST_F(SegmentLogTest, GetsQueuedValues) {
+  // Long enough for everything below to be read before it is written.
+  options_.group_commit_window = std::chrono::seconds(2);
+  std::unique_ptr<SegmentLog> log;
+  Reopen(log);
+  log->Put("a", 1000, "old");
+  log->Put("b", 1000, "value");
+  log->Put("a", 1000, "new");
+  log->Touch("a", 2000);
+  log->Delete("b");
+  EXPECT_EQ(log->Get("a"), "new");
+  EXPECT_FALSE(log->Get("b").has_value());
+
+  Flush(*log);
+  log->Put("b", 1000, "again");
+  EXPECT_EQ(log->Get("a"), "new");
+  EXPECT_EQ(log->Get("b"), "again");
+}
+
+TEST_F(SegmentLogTest, TruncatesTornTail) {
+  std::unique_ptr<SegmentLog> log;
+  Reopen(log);
+  log->Put("a", 100, "value");
+  Flush(*log);
+  log.reset();
+
+  // A record cut in the middle of the write.
+  auto last = (dir_ / "00000000000000000001.log").string();
+  auto size = boost::filesystem::file_size(last);
+  {
+    std::ofstream file(last, std::ios::app | std::ios::binary);
+    file << std::string("\x40\0\0\0garbage", 11);
+  }
+  EXPECT_EQ(Reopen(log).size(), 1u);
+  EXPECT_EQ(boost::filesystem::file_size(last), size);
+
+  log->Put("b", 100, "value");
+  Flush(*log);
+  EXPECT_EQ(Reopen(log).size(), 2u);
+}
+
+TEST_F(SegmentLogTest, CompactionDropsGarbage) {
+  std::unique_ptr<SegmentLog> log;
+  Reopen(log);
+  log->Put("expiring", 10, "value");
+  for (int i = 0; i < 100; i++) {
+    log->Put("key" + std::to_string(i % 10), i < 50 ? 10 : 1000,
+             std::to_string(i));
+  }
+  log->Put("deleted", 1000, "value");
+  log->Delete("deleted");
+  Flush(*log);
+  EXPECT_GT(SegmentCount(), 2u);
+  EXPECT_TRUE(log->NeedsCompaction());
+
+  EXPECT_TRUE(log->Compact(500));
+  EXPECT_FALSE(log->NeedsCompaction());
+  EXPECT_EQ(SegmentCount(), 2u);
+
+  auto values = Reopen(log);
+  EXPECT_EQ(values.size(), 10u);
+  for (int i = 0; i < 10; i++) {
+    EXPECT_EQ(values["key" + std::to_string(i)], std::to_string(90 + i));
+  }
+}
+
+TEST_F(SegmentLogTest, FinishesCommittedCompaction) {
+  std::unique_ptr<SegmentLog> log;
+  Reopen(log);
+  log->Put("a", 1000, "old");
+  log->Put("b", 1000, std::string(220, 'b'));
+  log->Put("a", 1000, "new");
+  Flush(*log);
+  log.reset();
+
+  // Died after committing a compaction of the first segment which kept
+  // nothing, and during an uncommitted one.
+  auto first = dir_ / "00000000000000000001";
+  std::ofstream((first.string() + ".compact").c_str());
+  std::ofstream((first.string() + ".compact.tmp").c_str());
+
+  auto expected = std::map<std::string, std::string>(
+      {{"a", "new"}, {"b", std::string(220, 'b')}});
+  auto values = Reopen(log);
+  EXPECT_EQ(values, expected);
+  EXPECT_FALSE(boost::filesystem::exists(first.string() + ".compact"));
+  EXPECT_FALSE(boost::filesystem::exists(first.string() + ".compact.tmp"));
+}
+
+TEST_F(SegmentLogTest, ReplaysOnPool) {
+  options_.segment_size = 4096;
+  std::unique_ptr<SegmentLog> log;
+  Reopen(log);
+  std::map<std::string, std::string> expected;
+  for (int i = 0; i < 5000; i++) {
+    auto name = std::to_string(i % 1500);
+    log->Put(name, 100, std::to_string(i));
+    expected[name] = std::to_string(i);
+  }
+  Flush(*log);
+  log.reset();
+
+  std::experimental::thread_pool pool(4);
+  std::mutex mutex;
+  std::map<std::string, std::string> values;
+  log = std::make_unique<SegmentLog>(dir_.string(), options_);
+  log->Replay(
+      [&](std::string_view name, uint64_t, std::string_view value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        EXPECT_TRUE(values.emplace(name, value).second);
+      },
+      &pool);
+  EXPECT_EQ(values, expected);
+  pool.stop();
+  pool.join();
+}
+
+TEST_F(SegmentLogTest, TouchMovesExpiration) {
+  std::unique_ptr<SegmentLog> log;
+  Reopen(log);
+  log->Put("a", 100, "value");
+  log->Touch("a", 2000);
+  log->Touch("missing", 2000);
+  for (int i = 0; i < 20; i++) {
+    log->Put("filler", 100, std::string(100, 'f'));
+  }
+  Flush(*log);
+  ASSERT_TRUE(log->Compact(500));
+
+  log.reset();
+  log = std::make_unique<SegmentLog>(dir_.string(), options_);
+  std::map<std::string, uint64_t> expirations;
+  log->Replay([&](std::string_view name, uint64_t expiration_time,
+                  std::string_view) {
+    expirations.emplace(name, expiration_time);
+  });
+  EXPECT_EQ(expirations["a"], 2000u);
+  EXPECT_EQ(expirations.count("missing"), 0u);
+}
+
+TEST_F(SegmentLogTest, FailsCallbacksOnWriteErrors) {
+  std::unique_ptr<SegmentLog> log;
+  Reopen(log);
+  log->Put("a", 100, "value");
+  Flush(*log);
+
+  // Writes past the file size limit fail with EFBIG instead of a signal.
+  auto handler = std::signal(SIGXFSZ, SIG_IGN);
+  rlimit old_limit;
+  ASSERT_EQ(::getrlimit(RLIMIT_FSIZE, &old_limit), 0);
+  rlimit limit = old_limit;
+  limit.rlim_cur = 64;
+  ASSERT_EQ(::setrlimit(RLIMIT_FSIZE, &limit), 0);
+  std::promise<std::exception_ptr> failed;
+  log->Put("b", 100, std::string(100, 'b'),
+           [&](std::exception_ptr error) { failed.set_value(error); });
+  auto error = failed.get_future().get();
+  ::setrlimit(RLIMIT_FSIZE, &old_limit);
+  std::signal(SIGXFSZ, handler);
+  EXPECT_TRUE(error);
+
+  // Nothing is written after a failure, reads still work.
+  std::promise<std::exception_ptr> rejected;
+  log->Delete("a",
+              [&](std::exception_ptr error) { rejected.set_value(error); });
+  EXPECT_TRUE(rejected.get_future().get());
+  EXPECT_EQ(log->Get("a"), "value");
+  EXPECT_FALSE(log->Get("b").has_value());
+
+  auto expected = std::map<std::string, std::string>({{"a", "value"}});
+  EXPECT_EQ(Reopen(log), expected);
+}
@@ -0,0 +1,103 @@
+#include "base/simhash.h"
+
+#include "gtest/gtest.h"
+
+#include <random>
+#include <string>
+
+using namespace tgnews;
+
+namespace {
+
+std::vector<std::string> MakeWords(size_t count, uint32_t seed) {
+  std::mt19937 random(seed);
+  std::vector<std::string> words;
+  for (size_t i = 0; i < count; i++) {
+    words.push_back("w" + std::to_string(random() % 5000));
+  }
+  return words;
+}
+
+std::string Join(const std::vector<std::string>& words) {
+  std::string text;
+  for (const auto& word : words) {
+    text += (text.empty() ? "" : " ") + word;
+  }
+  return text;
+}
+
+}  // namespace
+
+TEST(SimHashTest, NearCopiesAreClose) {
+  auto words = MakeWords(300, 1);
+  auto fingerprint = TextFingerprint("title", Join(words));
+
+  // Another footer and a typo.
+  auto copy = words;
+  copy[17] = "typo";
+  copy.push_back("subscribe");
+  copy.push_back("to");
+  copy.push_back("us");
+  auto near = TextFingerprint("title", Join(copy));
+  EXPECT_LE(FingerprintDistance(fingerprint, near), kNearDuplicateBits);
+
+  auto other = TextFingerprint("title", Join(MakeWords(300, 2)));
+  EXPECT_GT(FingerprintDistance(fingerprint, other), 16);
+}
+
+TEST(SimHashTest, IsStable) {
+  // Persisted with every document.
+  EXPECT_EQ(TextFingerprint("", ""), 0u);
+  EXPECT_EQ(TextFingerprint("  ", " "), 0u);
+  EXPECT_NE(TextFingerprint("single", ""), 0u);
+  EXPECT_EQ(TextFingerprint("a b", "c d"), TextFingerprint("a", "b c d"));
+  EXPECT_EQ(TextFingerprint("breaking news", "the quick brown fox"),
+            0x1450631d6af18b2bull);
+  EXPECT_EQ(TextFingerprint("breaking  news", "the quick brown fox "),
+            0x1450631d6af18b2bull);
+}
+
+TEST(SimHashTest, GroupsNearDuplicates) {
+  std::mt19937_64 random(3);
+  std::vector<uint64_t> fingerprints;
+  std::vector<size_t> expected;
+  for (size_t group = 0; group < 500; group++) {
+    uint64_t leader = random();
+    size_t position = fingerprints.size();
+    expected.push_back(position);
+    fingerprints.push_back(leader);
+    // Copies up to three bits away, in any band.
+    for (int bits = 1; bits <= kNearDuplicateBits; bits++) {
+      uint64_t copy = leader;
+      for (int i = 0; i < bits; i++) {
+        copy ^= uint64_t(1) << (random() % 64);
+      }
+      expected.push_back(position);
+      fingerprints.push_back(copy);
+    }
+  }
+  // Unknown text is never grouped.
+  fingerprints.push_back(0);
+  fingerprints.push_back(0);
+
+  auto groups = GroupNearDuplicates(fingerprints);
+  ASSERT_EQ(groups.size(), fingerprints.size());
+  for (size_t i = 0; i < expected.size(); i++) {
+    EXPECT_EQ(groups[i], expected[i]) << i;
+  }
+  EXPECT_EQ(groups[groups.size() - 2], groups.size() - 2);
+  EXPECT_EQ(groups.back(), groups.size() - 1);
+
+  EXPECT_THROW(GroupNearDuplicates(fingerprints, 16), std::runtime_error);
+}
+
+TEST(SimHashTest, GroupsChainsOfNearDuplicates) {
+  // b is 4 bits from a, c is 2 bits from both.
+  const uint64_t a = 0x0123456789abcdefull;
+  const uint64_t b = a ^ 0xf;
+  const uint64_t c = a ^ 0x3;
+  EXPECT_EQ(GroupNearDuplicates({a, b, c}), std::vector<size_t>({0, 0, 0}));
+  EXPECT_EQ(GroupNearDuplicates({b, a, c, b}),
+            std::vector<size_t>({0, 0, 0, 0}));
+  EXPECT_EQ(GroupNearDuplicates({a, b}), std::vector<size_t>({0, 1}));
+}
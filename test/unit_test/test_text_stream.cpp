@@ -0,0 +1,49 @@
+#include "base/text_stream.h"
+
+#include "gtest/gtest.h"
+
+#include <iterator>
+#include <sstream>
+#include <string>
+
+using namespace tgnews;
+
+namespace {
+
+std::string ReadAll(const std::vector<std::string_view>& pieces) {
+  JoinedTextBuf buffer(pieces);
+  std::istream stream(&buffer);
+  return std::string(std::istreambuf_iterator<char>(stream), {});
+}
+
+}  // namespace
+
+TEST(TextStreamTest, JoinsPieces) {
+  std::string text = "line\nbreaks\n";
+  EXPECT_EQ(ReadAll({"title", "", text, "end"}), "title  line breaks  end");
+  EXPECT_EQ(ReadAll({}), "");
+  EXPECT_EQ(ReadAll({""}), "");
+  EXPECT_EQ(ReadAll({"", ""}), " ");
+
+  // Words are read across the pieces the same way as from a joined string.
+  std::vector<std::string_view> pieces = {"a b", "c", "", "d\ne"};
+  JoinedTextBuf buffer(pieces);
+  std::istream stream(&buffer);
+  std::istringstream joined("a b c  d e");
+  std::string word;
+  std::string expected;
+  while (joined >> expected) {
+    ASSERT_TRUE(stream >> word);
+    EXPECT_EQ(word, expected);
+  }
+  EXPECT_FALSE(stream >> word);
+}
+
+TEST(TextStreamTest, SplitsTokens) {
+  std::vector<std::string_view> tokens;
+  SplitTokens("  breaking\tnews \n", tokens);
+  SplitTokens("", tokens);
+  SplitTokens("the quick", tokens);
+  EXPECT_EQ(tokens, (std::vector<std::string_view>{"breaking", "news", "the",
+                                                   "quick"}));
+}
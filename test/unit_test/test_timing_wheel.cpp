@@ -0,0 +1,89 @@
+#include "base/timing_wheel.h"
+
+#include "gtest/gtest.h"
+
+#include <map>
+#include <random>
+#include <set>
+#include <vector>
+
+using namespace tgnews;
+
+TEST(TimingWheelTest, ExpiresInOrderOfTime) {
+  TimingWheel<int> wheel(1000);
+  wheel.Insert(1005, 1);
+  wheel.Insert(1000 + 300, 2);
+  wheel.Insert(1000 + 70000, 3);
+  wheel.Insert(900, 4);
+
+  std::vector<int> expired;
+  auto collect = [&](int value) { expired.push_back(value); };
+
+  wheel.Advance(1004, collect);
+  EXPECT_EQ(expired, std::vector<int>({4}));
+  wheel.Advance(1005, collect);
+  EXPECT_EQ(expired, std::vector<int>({4, 1}));
+  wheel.Advance(1000 + 69999, collect);
+  EXPECT_EQ(expired, std::vector<int>({4, 1, 2}));
+  wheel.Advance(uint64_t(1) << 40, collect);
+  EXPECT_EQ(expired, std::vector<int>({4, 1, 2, 3}));
+  EXPECT_EQ(wheel.Size(), 0u);
+  EXPECT_EQ(wheel.Now(), uint64_t(1) << 40);
+}
+
+TEST(TimingWheelTest, Cancel) {
+  TimingWheel<int> wheel;
+  auto first = wheel.Insert(10, 1);
+  auto second = wheel.Insert(10, 2);
+  wheel.Cancel(first);
+  EXPECT_EQ(wheel.Size(), 1u);
+
+  std::vector<int> expired;
+  wheel.Advance(100, [&](int value) { expired.push_back(value); });
+  EXPECT_EQ(expired, std::vector<int>({2}));
+  EXPECT_THROW(wheel.Cancel(second), std::runtime_error);
+}
+
+TEST(TimingWheelTest, MatchesOrderedSet) {
+  std::mt19937 mt(17);
+  const uint64_t start = 1588000000;
+  const std::vector<uint64_t> max_ages = {0, 1, 300, 3600, 86400, 2592000};
+
+  TimingWheel<int> wheel(start);
+  std::set<std::pair<uint64_t, int>> reference;
+  std::map<int, std::pair<TimingWheel<int>::Handle, uint64_t>> alive;
+
+  uint64_t now = start;
+  for (int id = 0; id < 20000; id++) {
+    uint64_t fetch_time = now - mt() % 600;
+    uint64_t deadline = fetch_time + max_ages[mt() % max_ages.size()] +
+                        mt() % 100;
+    alive[id] = {wheel.Insert(deadline, id), deadline};
+    reference.emplace(deadline, id);
+
+    if (mt() % 5 == 0 && !alive.empty()) {
+      auto it = alive.lower_bound(mt() % (id + 1));
+      if (it != alive.end()) {
+        wheel.Cancel(it->second.first);
+        reference.erase({it->second.second, it->first});
+        alive.erase(it);
+      }
+    }
+
+    if (mt() % 50 == 0) {
+      now += mt() % 20000;
+      std::set<int> expired;
+      wheel.Advance(now, [&](int value) {
+        expired.insert(value);
+        alive.erase(value);
+      });
+      std::set<int> expected;
+      while (!reference.empty() && reference.begin()->first <= now) {
+        expected.insert(reference.begin()->second);
+        reference.erase(reference.begin());
+      }
+      ASSERT_EQ(expired, expected);
+      ASSERT_EQ(wheel.Size(), reference.size());
+    }
+  }
+}